@@ -0,0 +1,102 @@
+#include "AllocationTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> totalAllocations{0};
+std::atomic<uint64_t> totalBytes{0};
+// Plain data, so touching it never allocates
+thread_local uint64_t threadAllocations = 0;
+thread_local uint64_t threadBytes = 0;
+
+void count(size_t size) {
+    threadAllocations++;
+    threadBytes += size;
+    totalAllocations.fetch_add(1, std::memory_order_relaxed);
+    totalBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void* allocate(size_t size) {
+    count(size);
+    return std::malloc(size ? size : 1);
+}
+
+void* allocateAligned(size_t size, size_t alignment) {
+    count(size);
+#ifdef _MSC_VER
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    // aligned_alloc wants a multiple of the alignment
+    size_t rounded = (size + alignment - 1) / alignment * alignment;
+    return std::aligned_alloc(alignment, rounded ? rounded : alignment);
+#endif
+}
+
+void release(void* p) {
+    std::free(p);
+}
+
+void releaseAligned(void* p) {
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* allocateOrThrow(size_t size) {
+    void* p = allocate(size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* allocateAlignedOrThrow(size_t size, size_t alignment) {
+    void* p = allocateAligned(size, alignment);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+}
+
+AllocationCounts allocationCounts() {
+    AllocationCounts c;
+    c.allocations = totalAllocations.load(std::memory_order_relaxed);
+    c.bytes = totalBytes.load(std::memory_order_relaxed);
+    return c;
+}
+
+AllocationCounts threadAllocationCounts() {
+    AllocationCounts c;
+    c.allocations = threadAllocations;
+    c.bytes = threadBytes;
+    return c;
+}
+
+void* operator new(size_t size) { return allocateOrThrow(size); }
+void* operator new[](size_t size) { return allocateOrThrow(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocateAlignedOrThrow(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateAlignedOrThrow(size, (size_t)alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, (size_t)alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, (size_t)alignment);
+}
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { releaseAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { releaseAligned(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { releaseAligned(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { releaseAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { releaseAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { releaseAligned(p); }
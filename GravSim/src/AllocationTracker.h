@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations made through the global operator new, which this
+// module replaces; every std container and make_shared goes through it.
+// Memory taken with malloc directly, by C libraries or the GL driver, is not
+// seen. Each thread keeps its own counts, so a loop can check what it
+// allocated itself without the other threads' traffic, and the process totals
+// are kept alongside in relaxed atomics.
+//
+//   AllocationCounts before = threadAllocationCounts();
+//   ...
+//   AllocationCounts used = threadAllocationCounts() - before;
+
+struct AllocationCounts {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;      // As requested, not counting allocator overhead
+};
+
+inline AllocationCounts operator-(const AllocationCounts& a, const AllocationCounts& b) {
+    AllocationCounts d;
+    d.allocations = a.allocations - b.allocations;
+    d.bytes = a.bytes - b.bytes;
+    return d;
+}
+
+// Since the process started, over all threads
+AllocationCounts allocationCounts();
+// Since the calling thread started
+AllocationCounts threadAllocationCounts();
@@ -0,0 +1,220 @@
+#include "BarnesHut.h"
+
+#include <cmath>
+
+namespace {
+
+int octantOf(const glm::vec3& p, const glm::vec3& center) {
+    return (p.x >= center.x ? 1 : 0) | (p.y >= center.y ? 2 : 0) | (p.z >= center.z ? 4 : 0);
+}
+
+// Pairwise term shared by the tree walk and the reference direct sum.
+// Returns mj * d / (|d| * (|d|^2 + softening)), or zero below the 0.001 cutoff.
+inline glm::vec3 pairField(const glm::vec3& d, float mj, float softening) {
+    float dist2 = glm::dot(d, d);
+    if(dist2 < 1e-6f) return glm::vec3(0.0f);
+    float dist = std::sqrt(dist2);
+    return d * (mj / (dist * (dist2 + softening)));
+}
+
+}
+
+void BarnesHutTree::build(const BodyState& state) {
+    size_t n = state.size();
+    nodes.clear();
+    sortedIndex.resize(n);
+    originalSlot.resize(n);
+    scratch.resize(n);
+    sortedPositions.resize(n);
+    sortedMasses.resize(n);
+    if(n == 0) return;
+
+    // Gather positions once; the build permutes indices into them
+    for(size_t i = 0; i < n; i++) {
+        sortedPositions[i] = state.position(i);
+        sortedIndex[i] = (unsigned int)i;
+    }
+
+    glm::vec3 minP = sortedPositions[0], maxP = sortedPositions[0];
+    for(size_t i = 1; i < n; i++) {
+        minP = glm::min(minP, sortedPositions[i]);
+        maxP = glm::max(maxP, sortedPositions[i]);
+    }
+    glm::vec3 extent = maxP - minP;
+    float halfSize = 0.5f * std::fmax(extent.x, std::fmax(extent.y, extent.z));
+    halfSize = halfSize * 1.0001f + 1e-3f;
+
+    // A balanced tree has roughly 2N/LEAF_SIZE nodes; reserve generously
+    nodes.reserve(n / 2 + 64);
+
+    Node root;
+    root.center = 0.5f * (minP + maxP);
+    root.halfSize = halfSize;
+    root.begin = 0;
+    root.count = (unsigned int)n;
+    root.firstChild = -1;
+    root.mass = 0.0f;
+    root.centerOfMass = glm::vec3(0.0f);
+    nodes.push_back(root);
+
+    BuildContext context = { sortedPositions.data(), state.mass.data() };
+    buildNode(context, 0, 0);
+
+    // Reorder into tree order so leaf walks read contiguous memory
+    gatherBuffer.resize(n);
+    for(size_t k = 0; k < n; k++) {
+        unsigned int src = sortedIndex[k];
+        gatherBuffer[k] = sortedPositions[src];
+        sortedMasses[k] = state.mass[src];
+        originalSlot[src] = (unsigned int)k;
+    }
+    sortedPositions.swap(gatherBuffer);
+}
+
+void BarnesHutTree::buildNode(const BuildContext& context, int nodeIndex, int depth) {
+    Node node = nodes[nodeIndex];
+
+    if(node.count <= LEAF_SIZE || depth >= MAX_DEPTH) {
+        float mass = 0.0f;
+        glm::vec3 weighted(0.0f);
+        for(unsigned int k = node.begin; k < node.begin + node.count; k++) {
+            unsigned int b = sortedIndex[k];
+            mass += context.masses[b];
+            weighted += context.positions[b] * context.masses[b];
+        }
+        nodes[nodeIndex].mass = mass;
+        nodes[nodeIndex].centerOfMass = mass > 0.0f ? weighted / mass : node.center;
+        nodes[nodeIndex].firstChild = -1;
+        return;
+    }
+
+    // Counting sort of this node's range by octant
+    unsigned int counts[8] = {0};
+    for(unsigned int k = node.begin; k < node.begin + node.count; k++) {
+        counts[octantOf(context.positions[sortedIndex[k]], node.center)]++;
+    }
+    unsigned int offsets[8];
+    unsigned int running = node.begin;
+    for(int o = 0; o < 8; o++) {
+        offsets[o] = running;
+        running += counts[o];
+    }
+    unsigned int cursor[8];
+    for(int o = 0; o < 8; o++) cursor[o] = offsets[o];
+    for(unsigned int k = node.begin; k < node.begin + node.count; k++) {
+        unsigned int b = sortedIndex[k];
+        scratch[cursor[octantOf(context.positions[b], node.center)]++] = b;
+    }
+    for(unsigned int k = node.begin; k < node.begin + node.count; k++) {
+        sortedIndex[k] = scratch[k];
+    }
+
+    int firstChild = (int)nodes.size();
+    nodes[nodeIndex].firstChild = firstChild;
+    float childHalf = node.halfSize * 0.5f;
+    for(int o = 0; o < 8; o++) {
+        Node child;
+        child.center = node.center + glm::vec3((o & 1) ? childHalf : -childHalf,
+                                               (o & 2) ? childHalf : -childHalf,
+                                               (o & 4) ? childHalf : -childHalf);
+        child.halfSize = childHalf;
+        child.begin = offsets[o];
+        child.count = counts[o];
+        child.firstChild = -1;
+        child.mass = 0.0f;
+        child.centerOfMass = child.center;
+        nodes.push_back(child);
+    }
+
+    float mass = 0.0f;
+    glm::vec3 weighted(0.0f);
+    for(int o = 0; o < 8; o++) {
+        if(counts[o] == 0) continue;
+        buildNode(context, firstChild + o, depth + 1);
+        const Node& child = nodes[firstChild + o];
+        mass += child.mass;
+        weighted += child.centerOfMass * child.mass;
+    }
+    nodes[nodeIndex].mass = mass;
+    nodes[nodeIndex].centerOfMass = mass > 0.0f ? weighted / mass : node.center;
+}
+
+glm::vec3 BarnesHutTree::computeForce(size_t index, float gravityConstant, float softening, float theta) const {
+    if(nodes.empty()) return glm::vec3(0.0f);
+
+    unsigned int slot = originalSlot[index];
+    glm::vec3 p = sortedPositions[slot];
+    float theta2 = theta * theta;
+
+    int stack[8 * MAX_DEPTH + 8];
+    int top = 0;
+    stack[top++] = 0;
+
+    glm::vec3 field(0.0f);
+    while(top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if(node.count == 0) continue;
+
+        if(node.firstChild < 0) {
+            for(unsigned int k = node.begin; k < node.begin + node.count; k++) {
+                if(k == slot) continue;
+                field += pairField(sortedPositions[k] - p, sortedMasses[k], softening);
+            }
+            continue;
+        }
+
+        // Accept the node as a point mass if it is small enough as seen from p.
+        // A node that contains p itself is always opened.
+        glm::vec3 d = node.centerOfMass - p;
+        float size = 2.0f * node.halfSize;
+        glm::vec3 offset = glm::abs(p - node.center);
+        bool containsP = offset.x <= node.halfSize && offset.y <= node.halfSize && offset.z <= node.halfSize;
+        if(!containsP && size * size < theta2 * glm::dot(d, d)) {
+            field += pairField(d, node.mass, softening);
+            continue;
+        }
+
+        for(int o = 0; o < 8; o++) {
+            if(nodes[node.firstChild + o].count > 0) stack[top++] = node.firstChild + o;
+        }
+    }
+
+    return field * (gravityConstant * sortedMasses[slot]);
+}
+
+size_t BarnesHutTree::memoryBytes() const {
+    return nodes.capacity() * sizeof(Node) +
+           (sortedPositions.capacity() + gatherBuffer.capacity()) * sizeof(glm::vec3) +
+           sortedMasses.capacity() * sizeof(float) +
+           (sortedIndex.capacity() + originalSlot.capacity() + scratch.capacity()) * sizeof(unsigned int);
+}
+
+ForceErrorStats measureForceError(const BarnesHutTree& tree,
+                                  float gravityConstant, float softening, float theta,
+                                  size_t maxSamples) {
+    ForceErrorStats stats;
+    size_t n = tree.bodyCount();
+    if(n < 2 || maxSamples == 0) return stats;
+
+    size_t stride = n > maxSamples ? n / maxSamples : 1;
+    double sumSq = 0.0;
+    for(size_t i = 0; i < n; i += stride) {
+        glm::vec3 pi = tree.builtPosition(i);
+        glm::vec3 field(0.0f);
+        for(size_t j = 0; j < n; j++) {
+            if(i == j) continue;
+            field += pairField(tree.builtPosition(j) - pi, tree.builtMass(j), softening);
+        }
+        glm::vec3 direct = field * (gravityConstant * tree.builtMass(i));
+        float directMag = glm::length(direct);
+        if(directMag <= 0.0f) continue;
+
+        glm::vec3 approx = tree.computeForce(i, gravityConstant, softening, theta);
+        float rel = glm::length(approx - direct) / directMag;
+        sumSq += (double)rel * rel;
+        if(rel > stats.maxRelative) stats.maxRelative = rel;
+        stats.samples++;
+    }
+    if(stats.samples > 0) stats.rmsRelative = (float)std::sqrt(sumSq / stats.samples);
+    return stats;
+}
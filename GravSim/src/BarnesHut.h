@@ -0,0 +1,71 @@
+#pragma once
+
+#include "BodyState.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+
+// Barnes-Hut octree for approximate O(N log N) force evaluation.
+// The tree is rebuilt from scratch every step; bodies are copied into
+// tree order so that leaf walks touch contiguous memory.
+class BarnesHutTree {
+public:
+    void build(const BodyState& state);
+
+    // Force on body `index` (in the caller's original ordering). Uses the same
+    // softened law as the direct sum: G * mi * mj / (r^2 + softening).
+    glm::vec3 computeForce(size_t index, float gravityConstant, float softening, float theta) const;
+
+    // Bodies as they were when the tree was built, in the caller's ordering
+    size_t bodyCount() const { return originalSlot.size(); }
+    glm::vec3 builtPosition(size_t index) const { return sortedPositions[originalSlot[index]]; }
+    float builtMass(size_t index) const { return sortedMasses[originalSlot[index]]; }
+
+    size_t nodeCount() const { return nodes.size(); }
+    size_t memoryBytes() const;
+
+private:
+    struct Node {
+        glm::vec3 centerOfMass;
+        float mass;
+        glm::vec3 center;
+        float halfSize;
+        int firstChild;      // Index of 8 consecutive children, -1 for leaves
+        unsigned int begin;  // Range into the sorted body arrays
+        unsigned int count;
+    };
+
+    static const int MAX_DEPTH = 32;
+    static const unsigned int LEAF_SIZE = 8;
+
+    // Working state for the recursive build, valid only inside build()
+    struct BuildContext {
+        const glm::vec3* positions;
+        const float* masses;
+    };
+
+    void buildNode(const BuildContext& context, int nodeIndex, int depth);
+
+    std::vector<Node> nodes;
+    std::vector<glm::vec3> sortedPositions;
+    std::vector<float> sortedMasses;
+    std::vector<unsigned int> sortedIndex;   // Tree order -> original index
+    std::vector<unsigned int> originalSlot;  // Original index -> tree order
+    std::vector<unsigned int> scratch;
+    std::vector<glm::vec3> gatherBuffer;
+};
+
+// Relative force error of the tree against the direct sum, measured on a
+// strided sample of bodies. The direct sum uses the positions and masses the
+// tree was built from, so bodies that moved since do not count as error.
+struct ForceErrorStats {
+    float rmsRelative = 0.0f;
+    float maxRelative = 0.0f;
+    size_t samples = 0;
+};
+
+ForceErrorStats measureForceError(const BarnesHutTree& tree,
+                                  float gravityConstant, float softening, float theta,
+                                  size_t maxSamples);
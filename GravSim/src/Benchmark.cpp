@@ -0,0 +1,414 @@
+#include "Simulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// gravsim-bench: sweeps body count x force solver x integrator x precision x
+// body ordering x thread count over a seeded Asteroid Field and writes one JSON record per configuration.
+// Every configuration starts from the same initial conditions for a given
+// seed, so two commits can be compared run against run.
+
+namespace {
+
+struct Options {
+    size_t minBodies = 64;
+    size_t maxBodies = 1 << 20;
+    size_t maxDirectBodies = 1 << 16;   // O(N^2) solvers get slow beyond this
+    size_t maxHermiteBodies = 1 << 14;
+    std::vector<unsigned int> threads;
+    std::vector<int> solvers = { SOLVER_DIRECT, SOLVER_BARNES_HUT };
+    std::vector<int> integrators = { INTEGRATOR_EULER, INTEGRATOR_LEAPFROG, INTEGRATOR_YOSHIDA4, INTEGRATOR_HERMITE };
+    std::vector<int> precisions = { PRECISION_FLOAT };
+    std::vector<int> orderings = { ORDERING_NONE };
+    double minSeconds = 0.5;
+    int minSteps = 1;
+    int maxSteps = 1000;
+    int seed = 1;
+    std::string output = "gravsim-bench.json";
+    std::string label;
+};
+
+struct Result {
+    size_t bodies;
+    int solver;
+    int integrator;
+    int precision;
+    int ordering;
+    unsigned int threads;
+    int steps;
+    double seconds;
+    double evaluations;
+    double interactions;     // Pairwise force terms, 0 when the solver doesn't count them
+    size_t memoryBytes;
+    double energyError;      // Negative when not measured
+    double cacheMisses;      // Per step, negative when the counter is unavailable
+    unsigned long long reorders;
+    double speedup;          // Against the single-thread run of the same configuration
+};
+
+const char* solverKeys[] = { "direct", "barnes-hut", "pm" };
+
+const char* integratorKeys[] = { "euler", "leapfrog", "yoshida", "hermite" };
+
+const char* precisionKeys[] = { "float", "mixed", "double" };
+
+const char* orderingKeys[] = { "none", "morton", "hilbert" };
+
+// Cache misses of this process's threads, including pool threads started
+// after construction, from the kernel's perf counters. Unavailable off Linux
+// and where perf_event_paranoid or a container forbids it; stop() then
+// returns -1.
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+#if defined(__linux__)
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter() {
+#if defined(__linux__)
+        if(fd >= 0) close(fd);
+#endif
+    }
+
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+    void start() {
+#if defined(__linux__)
+        if(fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    double stop() {
+#if defined(__linux__)
+        if(fd < 0) return -1.0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if(read(fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) return -1.0;
+        return (double)count;
+#else
+        return -1.0;
+#endif
+    }
+
+private:
+    int fd = -1;
+};
+
+void printUsage(const char* program) {
+    std::printf(
+        "Usage: %s [options]\n"
+        "  --min-bodies N      Smallest body count, swept in powers of 4 (default 64)\n"
+        "  --max-bodies N      Largest body count (default 1048576)\n"
+        "  --max-direct N      Largest body count for direct summation (default 65536)\n"
+        "  --max-hermite N     Largest body count for Hermite (default 16384)\n"
+        "  --threads LIST      Comma-separated thread counts (default 1,2,4,... up to the hardware)\n"
+        "  --solvers LIST      direct,barnes-hut,pm (default direct,barnes-hut)\n"
+        "  --integrators LIST  euler,leapfrog,yoshida,hermite (default all)\n"
+        "  --precisions LIST   float,mixed,double (default float)\n"
+        "  --orderings LIST    none,morton,hilbert body reordering (default none)\n"
+        "  --min-time SECONDS  Minimum timed run per configuration (default 0.5)\n"
+        "  --max-steps N       Step cap per configuration (default 1000)\n"
+        "  --seed N            Initial condition seed (default 1)\n"
+        "  --label TEXT        Free-form label stored in the output, e.g. a commit id\n"
+        "  --output FILE       JSON output path (default gravsim-bench.json)\n",
+        program);
+}
+
+std::vector<std::string> splitList(const char* value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parseKeys(const char* value, const char* const* keys, int keyCount, std::vector<int>& out) {
+    out.clear();
+    for(const std::string& item : splitList(value)) {
+        int found = -1;
+        for(int k = 0; k < keyCount; k++) {
+            if(item == keys[k]) found = k;
+        }
+        if(found < 0) {
+            std::cerr << "Unknown name: " << item << std::endl;
+            return false;
+        }
+        out.push_back(found);
+    }
+    return !out.empty();
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            std::exit(0);
+        }
+        if(i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        if(arg == "--min-bodies") options.minBodies = std::strtoull(value, nullptr, 10);
+        else if(arg == "--max-bodies") options.maxBodies = std::strtoull(value, nullptr, 10);
+        else if(arg == "--max-direct") options.maxDirectBodies = std::strtoull(value, nullptr, 10);
+        else if(arg == "--max-hermite") options.maxHermiteBodies = std::strtoull(value, nullptr, 10);
+        else if(arg == "--min-time") options.minSeconds = std::atof(value);
+        else if(arg == "--max-steps") options.maxSteps = std::atoi(value);
+        else if(arg == "--seed") options.seed = std::atoi(value);
+        else if(arg == "--label") options.label = value;
+        else if(arg == "--output") options.output = value;
+        else if(arg == "--threads") {
+            options.threads.clear();
+            for(const std::string& item : splitList(value)) {
+                int t = std::atoi(item.c_str());
+                if(t < 1) {
+                    std::cerr << "Invalid thread count: " << item << std::endl;
+                    return false;
+                }
+                options.threads.push_back((unsigned int)t);
+            }
+        }
+        else if(arg == "--solvers") {
+            if(!parseKeys(value, solverKeys, SOLVER_COUNT, options.solvers)) return false;
+        }
+        else if(arg == "--integrators") {
+            if(!parseKeys(value, integratorKeys, INTEGRATOR_COUNT, options.integrators)) return false;
+        }
+        else if(arg == "--precisions") {
+            if(!parseKeys(value, precisionKeys, PRECISION_COUNT, options.precisions)) return false;
+        }
+        else if(arg == "--orderings") {
+            if(!parseKeys(value, orderingKeys, ORDERING_COUNT, options.orderings)) return false;
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if(options.threads.empty()) {
+        unsigned int hardware = ThreadPool::hardwareThreads();
+        for(unsigned int t = 1; t < hardware; t *= 2) options.threads.push_back(t);
+        options.threads.push_back(hardware);
+    }
+    std::sort(options.threads.begin(), options.threads.end());
+    options.threads.erase(std::unique(options.threads.begin(), options.threads.end()), options.threads.end());
+
+    if(options.minBodies < 2 || options.maxBodies < options.minBodies || options.maxSteps < 1) {
+        std::cerr << "Invalid body range or step count" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Pairwise force terms per full force evaluation
+double interactionsPerEvaluation(size_t n, int solver, int integrator) {
+    if(integrator == INTEGRATOR_HERMITE) return (double)n * (n - 1);  // Own kernel, no pair symmetry
+    if(solver == SOLVER_DIRECT) return (double)n * (n - 1) / 2.0;     // Each pair once
+    return 0.0;
+}
+
+Result runConfiguration(const Options& options, size_t n, int solver, int integrator, int precision,
+                        int ordering, unsigned int threads) {
+    CacheMissCounter misses; // Before the pool starts, so its threads inherit the counter
+    Simulation sim(threads);
+    sim.params.forceSolver = solver;
+    sim.params.integrator = integrator;
+    sim.params.precision = precision;
+    sim.params.bodyOrdering = ordering;
+    sim.conservationInterval = 0; // Measured once at the end, outside the timed loop
+    sim.initializePreset(3, (int)n, options.seed);
+
+    // The first step builds caches and sizes buffers; keep it out of the timing
+    sim.step(sim.params.timeStep);
+    double startEvaluations = sim.forceEvaluations();
+
+    unsigned long long startReorders = sim.reorderCount;
+    misses.start();
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    double seconds = 0.0;
+    int steps = 0;
+    while(steps < options.maxSteps && (steps < options.minSteps || seconds < options.minSeconds)) {
+        sim.step(sim.params.timeStep);
+        steps++;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    double missCount = misses.stop();
+
+    Result result;
+    result.bodies = n;
+    result.solver = solver;
+    result.integrator = integrator;
+    result.precision = precision;
+    result.ordering = ordering;
+    result.threads = threads;
+    result.steps = steps;
+    result.seconds = seconds;
+    result.evaluations = sim.forceEvaluations() - startEvaluations;
+    result.interactions = result.evaluations * interactionsPerEvaluation(n, solver, integrator);
+    result.memoryBytes = sim.memoryBytes();
+    result.energyError = -1.0;
+    result.cacheMisses = missCount >= 0.0 ? missCount / steps : -1.0;
+    result.reorders = sim.reorderCount - startReorders;
+    result.speedup = 1.0;
+    if(sim.conservation.valid) {
+        sim.measureConservation();
+        result.energyError = sim.conservation.relativeEnergyError;
+    }
+    return result;
+}
+
+size_t peakResidentBytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        return (size_t)usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+std::string escapeJson(const std::string& text) {
+    std::string out;
+    for(char c : text) {
+        if(c == '"' || c == '\\') out += '\\';
+        if((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
+bool writeJson(const Options& options, const std::vector<Result>& results) {
+    FILE* file = std::fopen(options.output.c_str(), "w");
+    if(!file) return false;
+
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"label\": \"%s\",\n", escapeJson(options.label).c_str());
+    std::fprintf(file, "  \"seed\": %d,\n", options.seed);
+    std::fprintf(file, "  \"direct_kernel\": \"%s\",\n", directKernelName());
+    std::fprintf(file, "  \"hardware_threads\": %u,\n", ThreadPool::hardwareThreads());
+#if defined(__VERSION__)
+    std::fprintf(file, "  \"compiler\": \"%s\",\n", escapeJson(__VERSION__).c_str());
+#endif
+#if defined(NDEBUG)
+    std::fprintf(file, "  \"optimized\": true,\n");
+#else
+    std::fprintf(file, "  \"optimized\": false,\n");
+#endif
+    std::fprintf(file, "  \"peak_resident_bytes\": %zu,\n", peakResidentBytes());
+    std::fprintf(file, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        double stepsPerSecond = r.seconds > 0.0 ? r.steps / r.seconds : 0.0;
+        std::fprintf(file, "    {\"bodies\": %zu, \"solver\": \"%s\", \"integrator\": \"%s\", \"precision\": \"%s\", "
+                           "\"ordering\": \"%s\", \"reorders\": %llu, \"threads\": %u, "
+                           "\"steps\": %d, \"seconds\": %.6f, \"steps_per_second\": %.4f, "
+                           "\"force_evaluations\": %.2f, \"ns_per_body_evaluation\": %.4f, ",
+                     r.bodies, solverKeys[r.solver], integratorKeys[r.integrator], precisionKeys[r.precision],
+                     orderingKeys[r.ordering], r.reorders, r.threads,
+                     r.steps, r.seconds, stepsPerSecond, r.evaluations,
+                     r.evaluations > 0.0 ? r.seconds * 1e9 / (r.evaluations * r.bodies) : 0.0);
+        if(r.interactions > 0.0) std::fprintf(file, "\"ns_per_interaction\": %.6f, ", r.seconds * 1e9 / r.interactions);
+        else std::fprintf(file, "\"ns_per_interaction\": null, ");
+        if(r.energyError >= 0.0) std::fprintf(file, "\"energy_error\": %.6e, ", r.energyError);
+        else std::fprintf(file, "\"energy_error\": null, ");
+        if(r.cacheMisses >= 0.0) std::fprintf(file, "\"cache_misses_per_step\": %.1f, ", r.cacheMisses);
+        else std::fprintf(file, "\"cache_misses_per_step\": null, ");
+        std::fprintf(file, "\"memory_bytes\": %zu, \"speedup\": %.4f}%s\n",
+                     r.memoryBytes, r.speedup, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    return std::fclose(file) == 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if(!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    std::printf("%8s  %-10s  %-9s  %-9s  %-8s  %7s  %10s  %12s  %12s  %10s  %8s\n",
+                "bodies", "solver", "integr.", "precision", "ordering", "threads", "steps/s", "ns/interact",
+                "misses/step", "memory MB", "speedup");
+
+    std::vector<Result> results;
+    for(size_t n = options.minBodies; n <= options.maxBodies; n *= 4) {
+        for(int solver : options.solvers) {
+            for(int integrator : options.integrators) {
+                // Hermite ignores the solver setting, so run it once, under "direct"
+                if(integrator == INTEGRATOR_HERMITE && (solver != SOLVER_DIRECT || n > options.maxHermiteBodies)) continue;
+                if(solver == SOLVER_DIRECT && n > options.maxDirectBodies) continue;
+
+                for(int precision : options.precisions) {
+                    for(int ordering : options.orderings) {
+                        double baseline = 0.0;
+                        for(unsigned int threads : options.threads) {
+                            Result r = runConfiguration(options, n, solver, integrator, precision, ordering, threads);
+                            double stepsPerSecond = r.seconds > 0.0 ? r.steps / r.seconds : 0.0;
+                            if(baseline <= 0.0) baseline = stepsPerSecond;
+                            r.speedup = baseline > 0.0 ? stepsPerSecond / baseline : 1.0;
+                            results.push_back(r);
+
+                            std::printf("%8zu  %-10s  %-9s  %-9s  %-8s  %7u  %10.2f  %12.4f  %12.0f  %10.2f  %8.2f\n",
+                                        n, solverKeys[solver], integratorKeys[integrator], precisionKeys[precision],
+                                        orderingKeys[ordering], threads, stepsPerSecond,
+                                        r.interactions > 0.0 ? r.seconds * 1e9 / r.interactions : 0.0,
+                                        r.cacheMisses, r.memoryBytes / (1024.0 * 1024.0), r.speedup);
+                            std::fflush(stdout);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if(!writeJson(options, results)) {
+        std::cerr << "Failed to write " << options.output << std::endl;
+        return -1;
+    }
+    std::printf("Wrote %zu results to %s\n", results.size(), options.output.c_str());
+    return 0;
+}
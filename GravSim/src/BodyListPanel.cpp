@@ -0,0 +1,175 @@
+#include "BodyListPanel.h"
+#include "FrameArena.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+const float TABLE_HEIGHT = 300.0f;
+
+}
+
+// Maps ids to indices in the view, and keeps the rows in order across
+// structure changes
+void BodyListPanel::updateIndex(const BodyListView& view) {
+    size_t n = view.state->size();
+    if(view.structureVersion == indexedVersion && n == indexedCount) return;
+    indexedVersion = view.structureVersion;
+    indexedCount = n;
+
+    unsigned int idEnd = 0;
+    for(size_t i = 0; i < n; i++) idEnd = std::max(idEnd, view.ids[i] + 1);
+    indexOfId.assign(idEnd, -1);
+    for(size_t i = 0; i < n; i++) indexOfId[view.ids[i]] = (int)i;
+    if(stale) return;
+
+    listed.assign(idEnd, 0);
+    size_t kept = 0;
+    for(unsigned int id : rows) {
+        if(id < idEnd && indexOfId[id] >= 0) {
+            rows[kept++] = id;
+            listed[id] = 1;
+        }
+    }
+    rows.resize(kept);
+    for(size_t i = 0; i < n; i++) {
+        if(!listed[view.ids[i]] && passes(view, i)) rows.push_back(view.ids[i]);
+    }
+}
+
+bool BodyListPanel::passes(const BodyListView& view, size_t index) const {
+    if(view.state->mass[index] < minMass) return false;
+    if(!filter.IsActive()) return true;
+    char label[16];
+    std::snprintf(label, sizeof(label), "%u", view.ids[index]);
+    return filter.PassFilter(label);
+}
+
+float BodyListPanel::sortKey(const BodyListView& view, size_t index) const {
+    const BodyState& s = *view.state;
+    switch(sortColumn) {
+        case BODY_COLUMN_MASS: return s.mass[index];
+        case BODY_COLUMN_SPEED: return glm::length(s.velocity(index));
+        case BODY_COLUMN_FORCE: return glm::length(s.force(index));
+        case BODY_COLUMN_DISTANCE: return glm::length(s.position(index) - view.cameraPos);
+    }
+    return (float)view.ids[index];
+}
+
+void BodyListPanel::rebuildRows(const BodyListView& view) {
+    size_t n = view.state->size();
+    keys.resize(n);
+    ArenaScope scope;
+    unsigned int* order = scope.allocate<unsigned int>(n);
+    size_t count = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(!passes(view, i)) continue;
+        keys[i] = sortKey(view, i);
+        order[count++] = (unsigned int)i;
+    }
+    // Ties by id, so equal keys keep a fixed order
+    std::sort(order, order + count, [&](unsigned int a, unsigned int b) {
+        if(keys[a] != keys[b]) return ascending ? keys[a] < keys[b] : keys[a] > keys[b];
+        return view.ids[a] < view.ids[b];
+    });
+    rows.resize(count);
+    for(size_t k = 0; k < count; k++) rows[k] = view.ids[order[k]];
+    stale = false;
+}
+
+void BodyListPanel::draw(const BodyListView& view, int& selectedBody, bool scrollTo, std::vector<BodyEdit>& edits) {
+    updateIndex(view);
+
+    if(filter.Draw("Filter Ids")) stale = true;
+    if(ImGui::InputFloat("Min Mass", &minMass)) stale = true;
+    if(ImGui::Button("Refresh")) stale = true;
+    ImGui::SameLine();
+    ImGui::Text("%zu of %zu bodies listed", rows.size(), view.state->size());
+
+    ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg |
+                            ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_SizingFixedFit;
+    if(ImGui::BeginTable("Bodies", BODY_COLUMN_COUNT, flags, ImVec2(0.0f, TABLE_HEIGHT))) {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("Body", ImGuiTableColumnFlags_DefaultSort, 0.0f, BODY_COLUMN_ID);
+        ImGui::TableSetupColumn("Mass", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, BODY_COLUMN_MASS);
+        ImGui::TableSetupColumn("Speed", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, BODY_COLUMN_SPEED);
+        ImGui::TableSetupColumn("Force", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, BODY_COLUMN_FORCE);
+        ImGui::TableSetupColumn("Distance", 0, 0.0f, BODY_COLUMN_DISTANCE);
+        ImGui::TableHeadersRow();
+
+        ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs();
+        if(specs && specs->SpecsDirty && specs->SpecsCount > 0) {
+            sortColumn = (int)specs->Specs[0].ColumnUserID;
+            ascending = specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+            specs->SpecsDirty = false;
+            stale = true;
+        }
+        if(stale) rebuildRows(view);
+
+        float rowHeight = ImGui::GetTextLineHeight() + 2.0f * ImGui::GetStyle().CellPadding.y;
+        if(scrollTo && selectedBody >= 0) {
+            auto row = std::find(rows.begin(), rows.end(), (unsigned int)selectedBody);
+            if(row != rows.end()) {
+                float y = (row - rows.begin()) * rowHeight;
+                ImGui::SetScrollY(std::max(0.0f, y - 0.5f * TABLE_HEIGHT));
+            }
+        }
+
+        const BodyState& s = *view.state;
+        ImGuiListClipper clipper;
+        clipper.Begin((int)rows.size(), rowHeight);
+        while(clipper.Step()) {
+            for(int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+                unsigned int id = rows[row];
+                int i = indexOfId[id];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                char label[24];
+                std::snprintf(label, sizeof(label), "Body %u", id);
+                if(ImGui::Selectable(label, (int)id == selectedBody, ImGuiSelectableFlags_SpanAllColumns)) {
+                    selectedBody = (int)id;
+                }
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", s.mass[i]);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", glm::length(s.velocity(i)));
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", glm::length(s.force(i)));
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", glm::length(s.position(i) - view.cameraPos));
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    drawEditor(view, selectedBody, edits);
+}
+
+// Edits go out by id and show up in a later snapshot
+void BodyListPanel::drawEditor(const BodyListView& view, int& selectedBody, std::vector<BodyEdit>& edits) {
+    if(selectedBody < 0 || (size_t)selectedBody >= indexOfId.size() || indexOfId[selectedBody] < 0) return;
+    unsigned int id = (unsigned int)selectedBody;
+    int i = indexOfId[id];
+    const BodyState& s = *view.state;
+
+    ImGui::Text("Body %u", id);
+    glm::vec3 position = s.position(i);
+    glm::vec3 velocity = s.velocity(i);
+    ImGui::Text("Position: (%.2f, %.2f, %.2f)", position.x, position.y, position.z);
+    ImGui::Text("Velocity: (%.2f, %.2f, %.2f)", velocity.x, velocity.y, velocity.z);
+    ImGui::Text("Speed: %.2f", glm::length(velocity));
+    ImGui::Text("Force: %.2f", glm::length(s.force(i)));
+
+    BodyEdit edit = { id, 0, s.mass[i], view.radius[i], view.color[i] };
+    if(ImGui::DragFloat("Mass##edit", &edit.mass, 1.0f, 1.0f, 10000.0f)) edit.fields |= EDIT_MASS;
+    if(ImGui::DragFloat("Radius##edit", &edit.radius, 0.1f, 0.5f, 20.0f)) edit.fields |= EDIT_RADIUS;
+    if(ImGui::ColorEdit3("Color##edit", glm::value_ptr(edit.color))) edit.fields |= EDIT_COLOR;
+    if(ImGui::Button("Remove")) {
+        edit.fields |= EDIT_REMOVE;
+        selectedBody = -1;
+    }
+    if(edit.fields) edits.push_back(edit);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "BodyState.h"
+#include "Simulation.h"
+
+#include <imgui.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// The bodies of one published state, as the body list sees them
+struct BodyListView {
+    const BodyState* state;
+    const unsigned int* ids;
+    const float* radius;
+    const glm::vec3* color;
+    unsigned int structureVersion;
+    glm::vec3 cameraPos;
+};
+
+enum BodyListColumn {
+    BODY_COLUMN_ID = 0,
+    BODY_COLUMN_MASS,
+    BODY_COLUMN_SPEED,
+    BODY_COLUMN_FORCE,
+    BODY_COLUMN_DISTANCE,
+    BODY_COLUMN_COUNT
+};
+
+// Body table for the control window, with an editor for the selected body.
+//
+// Rows are body ids in display order. Only the rows in view are submitted,
+// through a list clipper, so the table costs the same for 100 bodies or a
+// million. Sorting and filtering build the row list over all bodies, but
+// only when the sort column or filter changes or Refresh is pressed; when
+// bodies are added, removed or reordered the rows are kept in their order,
+// gone bodies dropped and new ones appended.
+class BodyListPanel {
+public:
+    // selectedBody is a body id or -1, and is changed by clicking a row.
+    // scrollTo brings the selected row into view. Edits are appended to
+    // edits for the caller to post to the physics thread.
+    void draw(const BodyListView& view, int& selectedBody, bool scrollTo, std::vector<BodyEdit>& edits);
+
+private:
+    void updateIndex(const BodyListView& view);
+    void rebuildRows(const BodyListView& view);
+    bool passes(const BodyListView& view, size_t index) const;
+    float sortKey(const BodyListView& view, size_t index) const;
+    void drawEditor(const BodyListView& view, int& selectedBody, std::vector<BodyEdit>& edits);
+
+    std::vector<unsigned int> rows;     // Body ids in display order
+    std::vector<int> indexOfId;         // Index in the view, -1 if gone
+    std::vector<unsigned char> listed;  // By id, scratch for keeping rows across structure changes
+    std::vector<float> keys;            // By index, scratch for sorting
+    unsigned int indexedVersion = ~0u;
+    size_t indexedCount = 0;
+    bool stale = true;
+    int sortColumn = BODY_COLUMN_ID;
+    bool ascending = true;
+    ImGuiTextFilter filter;
+    float minMass = 0.0f;
+};
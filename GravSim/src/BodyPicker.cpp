@@ -0,0 +1,189 @@
+#include "BodyPicker.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+const size_t LEAF_SIZE = 4;
+const size_t BODIES_PER_TASK = 16384; // Subtrees at most this big are refit by one task
+const float LOOSE_FACTOR = 2.0f;  // Rebuild once leaves cover this much more area than after the build
+const int STACK_SIZE = 256;       // Depth is at most 63 key bits plus log2 of the largest run of equal keys
+
+float surfaceArea(const glm::vec3& lo, const glm::vec3& hi) {
+    glm::vec3 e = hi - lo;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+}
+
+void BodyPicker::update(const float* x, const float* y, const float* z, const float* radius, size_t n,
+                        bool rebuild, ThreadPool& pool) {
+    auto start = std::chrono::steady_clock::now();
+    bool built = false;
+    if(rebuild || n != bodyCount || nodes.empty()) {
+        build(x, y, z, n, pool);
+        built = true;
+    }
+    refit(x, y, z, radius, pool);
+
+    // Moving bodies stretch the boxes of leaves built for where they were
+    double area = 0.0;
+    for(uint32_t leaf : leaves) area += surfaceArea(nodes[leaf].lo, nodes[leaf].hi);
+    if(!built && area > builtArea * LOOSE_FACTOR) {
+        build(x, y, z, n, pool);
+        refit(x, y, z, radius, pool);
+        area = 0.0;
+        for(uint32_t leaf : leaves) area += surfaceArea(nodes[leaf].lo, nodes[leaf].hi);
+        built = true;
+    }
+    if(built) builtArea = area;
+    updateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BodyPicker::build(const float* x, const float* y, const float* z, size_t n, ThreadPool& pool) {
+    bodyCount = n;
+    nodes.clear();
+    leaves.clear();
+    subtrees.clear();
+    topNodes.clear();
+    sorter.sort(x, y, z, n, ORDERING_MORTON, pool, bodies);
+    if(n > 0) {
+        nodes.reserve(2 * (n / LEAF_SIZE + 1));
+        buildNode(0, n);
+        if(n <= BODIES_PER_TASK) subtrees.push_back({ 0, (uint32_t)nodes.size() });
+    }
+    rebuilds++;
+}
+
+// Splits [begin, end) where the highest differing key bit flips, or in the
+// middle when every key is the same
+uint32_t BodyPicker::buildNode(size_t begin, size_t end) {
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back(Node());
+    if(end - begin <= LEAF_SIZE) {
+        nodes[index].first = (uint32_t)begin;
+        nodes[index].count = (uint32_t)(end - begin);
+        leaves.push_back(index);
+        return index;
+    }
+
+    const std::vector<uint64_t>& keys = sorter.sortedKeys();
+    uint64_t prefix = keys[begin];
+    uint64_t diff = prefix ^ keys[end - 1];
+    size_t split = begin + (end - begin) / 2;
+    if(diff != 0) {
+        uint64_t top = 1ull << (63 - __builtin_clzll(diff));
+        split = std::partition_point(keys.begin() + begin, keys.begin() + end,
+                                     [&](uint64_t k) { return (k ^ prefix) < top; }) - keys.begin();
+    }
+    // Below the top nodes, each subtree small enough for one task is a
+    // contiguous run of nodes
+    bool top = end - begin > BODIES_PER_TASK;
+    if(top) topNodes.push_back(index);
+    uint32_t leftBegin = (uint32_t)nodes.size();
+    buildNode(begin, split);
+    uint32_t right = (uint32_t)nodes.size();
+    buildNode(split, end);
+    if(top && split - begin <= BODIES_PER_TASK) subtrees.push_back({ leftBegin, right });
+    if(top && end - split <= BODIES_PER_TASK) subtrees.push_back({ right, (uint32_t)nodes.size() });
+    nodes[index].first = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+// Each subtree on its own task, from the back, where children always come
+// after their parent; then the few top nodes above them
+void BodyPicker::refit(const float* x, const float* y, const float* z, const float* radius, ThreadPool& pool) {
+    pool.run(subtrees.size(), [&](size_t t) {
+        for(uint32_t k = subtrees[t].end; k-- > subtrees[t].begin;) {
+            Node& node = nodes[k];
+            if(node.count == 0) {
+                fitToChildren(k);
+                continue;
+            }
+            glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+            for(uint32_t b = node.first; b < node.first + node.count; b++) {
+                unsigned int i = bodies[b];
+                glm::vec3 p(x[i], y[i], z[i]);
+                lo = glm::min(lo, p - radius[i]);
+                hi = glm::max(hi, p + radius[i]);
+            }
+            node.lo = lo;
+            node.hi = hi;
+        }
+    });
+    for(size_t t = topNodes.size(); t-- > 0;) fitToChildren(topNodes[t]);
+}
+
+void BodyPicker::fitToChildren(uint32_t index) {
+    Node& node = nodes[index];
+    const Node& left = nodes[index + 1];
+    const Node& right = nodes[node.first];
+    node.lo = glm::min(left.lo, right.lo);
+    node.hi = glm::max(left.hi, right.hi);
+}
+
+int BodyPicker::pick(const glm::vec3& origin, const glm::vec3& direction, float slope,
+                     const float* x, const float* y, const float* z, const float* radius, size_t n) const {
+    if(nodes.empty() || n != bodyCount) return -1;
+
+    glm::vec3 inverse = glm::vec3(1.0f) / direction;
+    float best = FLT_MAX;
+    int hit = -1;
+    uint32_t stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        uint32_t index = stack[--top];
+        const Node& node = nodes[index];
+
+        // Slab test against the box widened by the slope at its far corner
+        glm::vec3 farCorner = glm::max(glm::abs(node.lo - origin), glm::abs(node.hi - origin));
+        float margin = slope * glm::length(farCorner);
+        glm::vec3 t0 = (node.lo - margin - origin) * inverse;
+        glm::vec3 t1 = (node.hi + margin - origin) * inverse;
+        glm::vec3 tMin = glm::min(t0, t1), tMax = glm::max(t0, t1);
+        float enter = std::fmax(0.0f, std::fmax(tMin.x, std::fmax(tMin.y, tMin.z)));
+        float exit = std::fmin(tMax.x, std::fmin(tMax.y, tMax.z));
+        if(enter > exit || enter >= best) continue;
+
+        if(node.count > 0) {
+            for(uint32_t k = node.first; k < node.first + node.count; k++) {
+                unsigned int i = bodies[k];
+                glm::vec3 c = glm::vec3(x[i], y[i], z[i]) - origin;
+                float along = glm::dot(c, direction);
+                if(along <= 0.0f) continue;
+                float r = radius[i] + slope * along;
+                glm::vec3 perpendicular = c - direction * along; // Not |c|^2 - along^2, which cancels far away
+                float offAxis = glm::dot(perpendicular, perpendicular);
+                if(offAxis > r * r) continue;
+                float t = along - std::sqrt(std::fmax(r * r - offAxis, 0.0f));
+                if(t < best) {
+                    best = t;
+                    hit = (int)i;
+                }
+            }
+            continue;
+        }
+
+        // Nearer child on top of the stack
+        uint32_t left = index + 1, right = node.first;
+        const Node& a = nodes[left];
+        const Node& b = nodes[right];
+        bool leftFirst = glm::dot(a.lo + a.hi - b.lo - b.hi, direction) <= 0.0f;
+        if(top + 2 > STACK_SIZE) break;
+        stack[top++] = leftFirst ? right : left;
+        stack[top++] = leftFirst ? left : right;
+    }
+    return hit;
+}
+
+size_t BodyPicker::memoryBytes() const {
+    return nodes.capacity() * sizeof(Node) + bodies.capacity() * sizeof(unsigned int) +
+           (leaves.capacity() + topNodes.capacity()) * sizeof(uint32_t) +
+           subtrees.capacity() * sizeof(NodeRange) + sorter.memoryBytes();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "SpatialOrder.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Finds the body under the cursor for click selection.
+//
+// Bodies are kept in a bounding volume hierarchy built as an LBVH: they are
+// sorted by Morton key and split at the highest key bit that differs within
+// a range, down to leaves of a few bodies. Nodes are stored depth first, so
+// a node's left child is the next node and only the right child's index is
+// kept. Moved bodies only refit the boxes bottom-up; the tree is rebuilt
+// when bodies are added, removed or reordered, or once the refit boxes have
+// grown too loose to prune well.
+//
+// update() is meant for a thread other than the one handling clicks: a
+// refit runs one subtree per pool task and a rebuild sorts on the pool, so
+// a click only pays for pick(), which is tested against the positions the
+// tree was last fit to.
+class BodyPicker {
+public:
+    // Refits the tree to the given positions. rebuild forces a new tree, as
+    // do a changed body count and loose boxes.
+    void update(const float* x, const float* y, const float* z, const float* radius, size_t n,
+                bool rebuild, ThreadPool& pool);
+
+    // Index of the nearest body hit by the ray, or -1. direction must be
+    // normalized. Each sphere is widened by slope times its distance along the
+    // ray, so small bodies can be hit within a few pixels of their center.
+    int pick(const glm::vec3& origin, const glm::vec3& direction, float slope,
+             const float* x, const float* y, const float* z, const float* radius, size_t n) const;
+
+    size_t nodeCount() const { return nodes.size(); }
+    unsigned long long rebuildCount() const { return rebuilds; }
+    double lastUpdateSeconds() const { return updateSeconds; }
+    size_t memoryBytes() const;
+
+private:
+    struct Node {
+        glm::vec3 lo;
+        uint32_t first;  // Leaves: first slot in bodies; internal nodes: right child
+        glm::vec3 hi;
+        uint32_t count;  // Bodies in a leaf, 0 for internal nodes
+    };
+
+    void build(const float* x, const float* y, const float* z, size_t n, ThreadPool& pool);
+    uint32_t buildNode(size_t begin, size_t end);
+    void refit(const float* x, const float* y, const float* z, const float* radius, ThreadPool& pool);
+    void fitToChildren(uint32_t index);
+
+    struct NodeRange {
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<unsigned int> bodies;  // Body indices in leaf order
+    std::vector<uint32_t> leaves;      // Node index of every leaf
+    std::vector<NodeRange> subtrees;   // Refit tasks, each a whole subtree
+    std::vector<uint32_t> topNodes;    // Internal nodes above the subtrees, in build order
+    SpatialSorter sorter;
+    size_t bodyCount = 0;
+    double builtArea = 0.0;            // Summed leaf surface area just after a build
+    unsigned long long rebuilds = 0;
+    double updateSeconds = 0.0;
+};
@@ -0,0 +1,330 @@
+#include "BodyRenderer.h"
+#include "RenderState.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Spheres are only translated and uniformly scaled, so the mesh normal is
+// already the world-space normal
+const char* bodyVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec4 instanceBody;
+layout (location = 3) in vec3 instanceColor;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec3 ObjectColor;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+void main() {
+    FragPos = aPos * instanceBody.w + instanceBody.xyz;
+    Normal = aNormal;
+    ObjectColor = instanceColor;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+const char* bodyFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec3 ObjectColor;
+
+uniform vec3 lightPos;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+void main() {
+    float ambientStrength = 0.3;
+    vec3 ambient = ambientStrength * vec3(1.0);
+    
+    vec3 norm = normalize(Normal);
+    vec3 lightDir = normalize(lightPos - FragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * vec3(1.0);
+    
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = specularStrength * spec * vec3(1.0);
+    
+    vec3 result = (ambient + diffuse + specular) * ObjectColor;
+    FragColor = vec4(result, 1.0);
+}
+)";
+
+// Bodies below the smallest LOD: a point covering the projected sphere,
+// shaded with the normal of a sphere facing the camera
+const char* spriteVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec4 aBody;
+layout (location = 1) in vec3 aColor;
+
+out vec3 Center;
+out float Radius;
+out vec3 ObjectColor;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+uniform float pixelScale;
+
+void main() {
+    Center = aBody.xyz;
+    Radius = aBody.w;
+    ObjectColor = aColor;
+    gl_Position = projection * view * vec4(Center, 1.0);
+    gl_PointSize = max(2.0 * Radius * pixelScale / gl_Position.w, 1.0);
+}
+)";
+
+const char* spriteFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Center;
+in float Radius;
+in vec3 ObjectColor;
+
+uniform vec3 lightPos;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+void main() {
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+    float d2 = dot(coord, coord);
+    if(d2 > 1.0) discard;
+    vec3 norm = transpose(mat3(view)) * vec3(coord.x, -coord.y, sqrt(1.0 - d2));
+    vec3 FragPos = Center + norm * Radius;
+
+    float ambientStrength = 0.3;
+    vec3 ambient = ambientStrength * vec3(1.0);
+    
+    vec3 lightDir = normalize(lightPos - FragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * vec3(1.0);
+    
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = specularStrength * spec * vec3(1.0);
+    
+    vec3 result = (ambient + diffuse + specular) * ObjectColor;
+    FragColor = vec4(result, 1.0);
+}
+)";
+
+const size_t MIN_INSTANCES = 256;
+const glm::vec3 HIGHLIGHT_COLOR(1.0f, 0.95f, 0.4f); // Selected body
+
+// Points the body (xyz + radius) and color attributes at instance `first`
+// of the interleaved instance stream
+void instanceAttributes(GLuint bodyLocation, size_t first) {
+    size_t stride = 7 * sizeof(float);
+    glVertexAttribPointer(bodyLocation, 4, GL_FLOAT, GL_FALSE, stride, (void*)(first * stride));
+    glVertexAttribPointer(bodyLocation + 1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(first * stride + 4 * sizeof(float)));
+}
+
+}
+
+void BodyRenderer::init(RenderState& renderState, const std::vector<SphereLod>& lods) {
+    static_assert(sizeof(Instance) == 7 * sizeof(float), "instance stream is tightly packed");
+    state = &renderState;
+
+    meshProgram = createShaderProgram(bodyVertexShaderSource, bodyFragmentShaderSource);
+    state->attachCamera(meshProgram);
+    meshLightPosLocation = glGetUniformLocation(meshProgram, "lightPos");
+
+    spriteProgram = createShaderProgram(spriteVertexShaderSource, spriteFragmentShaderSource);
+    state->attachCamera(spriteProgram);
+    spriteLightPosLocation = glGetUniformLocation(spriteProgram, "lightPos");
+    spritePixelScaleLocation = glGetUniformLocation(spriteProgram, "pixelScale");
+
+    // All LOD meshes share one vertex and one index buffer; indices are
+    // rebased so each LOD is just an offset into the index buffer
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    lodMinPixels.clear();
+    lodIndexCount.clear();
+    lodIndexOffset.clear();
+    for(const SphereLod& lod : lods) {
+        unsigned int base = (unsigned int)(vertices.size() / 6);
+        lodMinPixels.push_back(lod.minPixels);
+        lodIndexCount.push_back((GLsizei)lod.indices.size());
+        lodIndexOffset.push_back(indices.size() * sizeof(unsigned int));
+        vertices.insert(vertices.end(), lod.vertices.begin(), lod.vertices.end());
+        for(unsigned int index : lod.indices) indices.push_back(base + index);
+    }
+    buckets.assign(lods.size() + 1, {});
+    drawnCount.assign(lods.size() + 1, 0);
+    bucketFirst.assign(lods.size() + 1, 0);
+
+    glGenVertexArrays(1, &meshVao);
+    glGenVertexArrays(1, &spriteVao);
+    glGenBuffers(1, &meshBuffer);
+    glGenBuffers(1, &indexBuffer);
+    glGenBuffers(1, &instanceBuffer);
+
+    state->bindVertexArray(meshVao);
+    state->bindArrayBuffer(meshBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    instanceCapacity = MIN_INSTANCES;
+    state->bindArrayBuffer(instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Instance), nullptr, GL_STREAM_DRAW);
+    instanceAttributes(2, 0);
+    glVertexAttribDivisor(2, 1);
+    glVertexAttribDivisor(3, 1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+
+    // Sprites read the same stream as plain per-vertex attributes
+    state->bindVertexArray(spriteVao);
+    instanceAttributes(0, 0);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    state->bindVertexArray(0);
+
+    glEnable(GL_PROGRAM_POINT_SIZE);
+}
+
+void BodyRenderer::release() {
+    GLuint buffers[] = { meshBuffer, indexBuffer, instanceBuffer };
+    glDeleteBuffers(3, buffers);
+    GLuint vaos[] = { meshVao, spriteVao };
+    glDeleteVertexArrays(2, vaos);
+    if(meshProgram) glDeleteProgram(meshProgram);
+    if(spriteProgram) glDeleteProgram(spriteProgram);
+    meshBuffer = indexBuffer = instanceBuffer = meshVao = spriteVao = meshProgram = spriteProgram = 0;
+    instanceCapacity = 0;
+    bodyCount = 0;
+}
+
+void BodyRenderer::updatePositions(const float* x, const float* y, const float* z, size_t n) {
+    this->x = x;
+    this->y = y;
+    this->z = z;
+    bodyCount = n;
+}
+
+void BodyRenderer::updateAttributes(const float* radius, const glm::vec3* color, size_t n) {
+    this->radius.assign(radius, radius + n);
+    this->color.assign(color, color + n);
+}
+
+// Sorts the bodies inside the frustum into LOD buckets by projected radius in
+// pixels. Planes come from the rows of projection * view (Gribb/Hartmann) and
+// are normalized so a sphere is outside once its center is more than its
+// radius behind any of them.
+void BodyRenderer::cull(const glm::mat4& view, const glm::mat4& projection, float viewportHeight) {
+    glm::mat4 clip = projection * view;
+    glm::vec4 row[4];
+    for(int i = 0; i < 4; i++) row[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+    glm::vec4 planes[6] = {
+        row[3] + row[0], row[3] - row[0],
+        row[3] + row[1], row[3] - row[1],
+        row[3] + row[2], row[3] - row[2],
+    };
+    for(glm::vec4& p : planes) p = p / glm::length(glm::vec3(p));
+
+    float pixelScale = projection[1][1] * viewportHeight * 0.5f;
+    size_t lodCount = lodMinPixels.size();
+    for(std::vector<Instance>& bucket : buckets) bucket.clear();
+    size_t n = std::min(bodyCount, radius.size());
+    culled = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        float px = x[i], py = y[i], pz = z[i], r = radius[i];
+        bool inside = true;
+        for(const glm::vec4& p : planes) {
+            if(p.x * px + p.y * py + p.z * pz + p.w < -r) { inside = false; break; }
+        }
+        if(!inside) { culled++; continue; }
+
+        // Clip w is the distance along the view direction
+        float w = row[3].x * px + row[3].y * py + row[3].z * pz + row[3].w;
+        float pixels = r * pixelScale / std::max(w, 1e-3f);
+        size_t lod = 0;
+        while(lod < lodCount && pixels < lodMinPixels[lod]) lod++;
+        buckets[lod].push_back({ px, py, pz, r, (int)i == highlighted ? HIGHLIGHT_COLOR : color[i] });
+    }
+}
+
+void BodyRenderer::draw(const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+                        const glm::vec3& lightPos) {
+    cull(view, projection, viewportHeight);
+
+    size_t total = 0;
+    for(size_t b = 0; b < buckets.size(); b++) {
+        drawnCount[b] = buckets[b].size();
+        total += buckets[b].size();
+    }
+    if(total == 0) return;
+
+    // Orphan last frame's stream so the upload never waits on the GPU
+    state->bindArrayBuffer(instanceBuffer);
+    if(total > instanceCapacity) instanceCapacity = std::max(total, instanceCapacity * 2);
+    glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Instance), nullptr, GL_STREAM_DRAW);
+    size_t offset = 0;
+    for(size_t b = 0; b < buckets.size(); b++) {
+        bucketFirst[b] = offset;
+        if(!buckets[b].empty()) {
+            glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(Instance),
+                            buckets[b].size() * sizeof(Instance), buckets[b].data());
+        }
+        offset += buckets[b].size();
+    }
+
+    // Instanced draws have no base instance in GL 3.3, so the instance
+    // attributes are re-pointed at each LOD's range instead
+    size_t lodCount = lodMinPixels.size();
+    state->useProgram(meshProgram);
+    state->setUniform(meshLightPosLocation, lightPos);
+    state->bindVertexArray(meshVao);
+    for(size_t lod = 0; lod < lodCount; lod++) {
+        if(buckets[lod].empty()) continue;
+        instanceAttributes(2, bucketFirst[lod]);
+        glDrawElementsInstanced(GL_TRIANGLES, lodIndexCount[lod], GL_UNSIGNED_INT,
+                                (void*)lodIndexOffset[lod], (GLsizei)buckets[lod].size());
+        state->countDraw();
+    }
+
+    if(!buckets[lodCount].empty()) {
+        state->useProgram(spriteProgram);
+        state->setUniform(spriteLightPosLocation, lightPos);
+        state->setUniform(spritePixelScaleLocation, projection[1][1] * viewportHeight * 0.5f);
+        state->bindVertexArray(spriteVao);
+        glDrawArrays(GL_POINTS, (GLint)bucketFirst[lodCount], (GLsizei)buckets[lodCount].size());
+        state->countDraw();
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class RenderState;
+
+// Unit-sphere mesh (interleaved position + normal) used while a body's
+// projected radius is at least minPixels
+struct SphereLod {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    float minPixels;
+};
+
+// Draws the bodies as lit spheres with per-body level of detail.
+//
+// Each frame the bodies are culled against the view frustum on the CPU and
+// sorted into buckets by projected screen radius: one bucket per sphere LOD,
+// plus one for bodies too small for any mesh, which are drawn as shaded
+// point sprites. Surviving bodies are gathered into one instance stream, so
+// each LOD costs one instanced draw and the sprites one glDrawArrays.
+// Radius and color are kept on the CPU and only refreshed when a new
+// snapshot arrives.
+class BodyRenderer {
+public:
+    // Needs a current GL context. LODs go from most to least detailed.
+    void init(RenderState& renderState, const std::vector<SphereLod>& lods);
+    void release();
+
+    // Positions are read during draw(), so they must stay valid until then
+    void updatePositions(const float* x, const float* y, const float* z, size_t n);
+    void updateAttributes(const float* radius, const glm::vec3* color, size_t n);
+    // Body index drawn in the highlight color, -1 for none
+    void setHighlight(int index) { highlighted = index; }
+
+    // The camera block must hold the same view and projection
+    void draw(const glm::mat4& view, const glm::mat4& projection, float viewportHeight, const glm::vec3& lightPos);
+
+    // Bodies drawn with each LOD in the last frame; the extra last entry is
+    // the point sprites
+    const std::vector<size_t>& lodCounts() const { return drawnCount; }
+    size_t culledCount() const { return culled; }
+
+private:
+    // Per-instance data, gathered after culling
+    struct Instance {
+        float x, y, z, radius;
+        glm::vec3 color;
+    };
+
+    void cull(const glm::mat4& view, const glm::mat4& projection, float viewportHeight);
+
+    RenderState* state = nullptr;
+    GLuint meshProgram = 0;
+    GLuint spriteProgram = 0;
+    GLuint meshVao = 0;
+    GLuint spriteVao = 0;
+    GLuint meshBuffer = 0;
+    GLuint indexBuffer = 0;
+    GLuint instanceBuffer = 0;
+    size_t instanceCapacity = 0;
+
+    std::vector<float> lodMinPixels;
+    std::vector<GLsizei> lodIndexCount;
+    std::vector<size_t> lodIndexOffset;
+
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* z = nullptr;
+    size_t bodyCount = 0;
+    std::vector<float> radius;
+    std::vector<glm::vec3> color;
+    int highlighted = -1;
+
+    std::vector<std::vector<Instance>> buckets; // One per LOD, then sprites
+    std::vector<size_t> bucketFirst;            // First instance of each bucket in the stream
+    std::vector<size_t> drawnCount;
+    size_t culled = 0;
+
+    GLint meshLightPosLocation = -1;
+    GLint spriteLightPosLocation = -1;
+    GLint spritePixelScaleLocation = -1;
+};
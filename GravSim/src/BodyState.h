@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <new>
+
+// Allocator returning 64-byte aligned storage so SIMD kernels start on a cache line
+template<typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    static const std::size_t ALIGNMENT = 64;
+
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT)));
+    }
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t(ALIGNMENT));
+    }
+
+    template<typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+using FloatArray = std::vector<float, AlignedAllocator<float>>;
+
+// Reorders a so that slot k holds what was at order[k]. Gathers into scratch
+// and swaps, so scratch ends up holding the old contents.
+template<typename Array>
+void permuteArray(Array& a, const std::vector<unsigned int>& order, Array& scratch) {
+    scratch.resize(order.size());
+    for(size_t k = 0; k < order.size(); k++) scratch[k] = a[order[k]];
+    a.swap(scratch);
+}
+
+// Hot physics state as structure-of-arrays. Index i refers to the same body
+// in every array and in the cold per-body data kept alongside it.
+struct BodyState {
+    FloatArray x, y, z;
+    FloatArray vx, vy, vz;
+    FloatArray fx, fy, fz;
+    FloatArray mass;
+
+    size_t size() const { return x.size(); }
+
+    void clear() {
+        for(FloatArray* a : arrays()) a->clear();
+    }
+
+    void reserve(size_t n) {
+        for(FloatArray* a : arrays()) a->reserve(n);
+    }
+
+    // New bodies are zeroed, for loaders that fill the arrays in place
+    void resize(size_t n) {
+        for(FloatArray* a : arrays()) a->resize(n);
+    }
+
+    size_t memoryBytes() const { return 10 * x.capacity() * sizeof(float); }
+
+    void push(const glm::vec3& pos, const glm::vec3& vel, float m) {
+        x.push_back(pos.x); y.push_back(pos.y); z.push_back(pos.z);
+        vx.push_back(vel.x); vy.push_back(vel.y); vz.push_back(vel.z);
+        fx.push_back(0.0f); fy.push_back(0.0f); fz.push_back(0.0f);
+        mass.push_back(m);
+    }
+
+    // Drops every body with removed[i] != 0 in one pass, keeping the order
+    // of the rest
+    void compact(const std::vector<unsigned char>& removed) {
+        for(FloatArray* a : arrays()) {
+            size_t kept = 0;
+            for(size_t i = 0; i < a->size(); i++) {
+                if(!removed[i]) (*a)[kept++] = (*a)[i];
+            }
+            a->resize(kept);
+        }
+    }
+
+    // Moves the body at order[k] to slot k for every k
+    void permute(const std::vector<unsigned int>& order, FloatArray& scratch) {
+        for(FloatArray* a : arrays()) permuteArray(*a, order, scratch);
+    }
+
+    glm::vec3 position(size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+    glm::vec3 velocity(size_t i) const { return glm::vec3(vx[i], vy[i], vz[i]); }
+    glm::vec3 force(size_t i) const { return glm::vec3(fx[i], fy[i], fz[i]); }
+
+private:
+    std::array<FloatArray*, 10> arrays() {
+        return { &x, &y, &z, &vx, &vy, &vz, &fx, &fy, &fz, &mass };
+    }
+};
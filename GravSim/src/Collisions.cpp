@@ -0,0 +1,148 @@
+#include "Collisions.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace {
+
+const size_t BODIES_PER_TASK = 1024;
+// Cell coordinates are clamped to 21 bits per axis so a cell packs into one
+// 64-bit key; bodies further out share the outermost cells, which only costs
+// extra distance tests
+const int64_t CELL_LIMIT = (1 << 20) - 2;
+
+int64_t cellCoordinate(float position, float inverseCell) {
+    double c = std::floor((double)position * inverseCell);
+    return (int64_t)std::min(std::max(c, (double)-CELL_LIMIT), (double)CELL_LIMIT);
+}
+
+uint64_t cellKey(int64_t cx, int64_t cy, int64_t cz) {
+    const uint64_t bias = 1 << 20, mask = (1 << 21) - 1;
+    return ((uint64_t)(cx + bias) & mask) << 42 | ((uint64_t)(cy + bias) & mask) << 21 | ((uint64_t)(cz + bias) & mask);
+}
+
+// Linear in z, so a run of cells along z lands in neighbouring buckets
+uint32_t hashCell(int64_t cx, int64_t cy, int64_t cz, uint32_t mask) {
+    return (uint32_t)((uint64_t)cx * 73856093ull + (uint64_t)cy * 19349663ull + (uint64_t)cz) & mask;
+}
+
+}
+
+const char* collisionModeName(int mode) {
+    switch(mode) {
+        case COLLISION_MERGE: return "Merge";
+        case COLLISION_BOUNCE: return "Bounce";
+        case COLLISION_ABSORB: return "Absorb";
+        default: return "None";
+    }
+}
+
+size_t CollisionDetector::memoryBytes() const {
+    size_t bytes = (bucketStart.capacity() + bucketFill.capacity() + bucketOfBody.capacity() + sortedIndex.capacity()) * sizeof(unsigned int) +
+                   (cellOfBody.capacity() + sortedCell.capacity()) * sizeof(uint64_t) +
+                   (sortedX.capacity() + sortedY.capacity() + sortedZ.capacity() + sortedRadius.capacity()) * sizeof(float) +
+                   taskCandidates.capacity() * sizeof(size_t) +
+                   overlaps.capacity() * sizeof(std::pair<unsigned int, unsigned int>);
+    for(const auto& task : taskOverlaps) bytes += task.capacity() * sizeof(std::pair<unsigned int, unsigned int>);
+    return bytes;
+}
+
+void CollisionDetector::detect(const BodyState& state, const FloatArray& radius, ThreadPool& pool) {
+    size_t n = state.size();
+    overlaps.clear();
+    candidates = 0;
+    if(n < 2) return;
+
+    float maxRadius = 0.0f;
+    for(size_t i = 0; i < n; i++) maxRadius = std::max(maxRadius, radius[i]);
+    if(maxRadius <= 0.0f) return;
+    // Cells twice the largest diameter: a body's reach (its radius plus the
+    // largest) then spans at most two cells per axis
+    float inverseCell = 1.0f / (4.0f * maxRadius);
+
+    size_t buckets = 1;
+    while(buckets < 2 * n) buckets <<= 1;
+    uint32_t mask = (uint32_t)(buckets - 1);
+
+    // Counting sort of the bodies by bucket
+    bucketOfBody.resize(n);
+    cellOfBody.resize(n);
+    pool.parallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            int64_t cx = cellCoordinate(state.x[i], inverseCell);
+            int64_t cy = cellCoordinate(state.y[i], inverseCell);
+            int64_t cz = cellCoordinate(state.z[i], inverseCell);
+            cellOfBody[i] = cellKey(cx, cy, cz);
+            bucketOfBody[i] = hashCell(cx, cy, cz, mask);
+        }
+    });
+    bucketStart.assign(buckets + 1, 0);
+    for(size_t i = 0; i < n; i++) bucketStart[bucketOfBody[i] + 1]++;
+    for(size_t b = 0; b < buckets; b++) bucketStart[b + 1] += bucketStart[b];
+    // Positions and radii are copied in bucket order so a bucket's bodies
+    // are read contiguously
+    sortedIndex.resize(n);
+    sortedCell.resize(n);
+    sortedX.resize(n); sortedY.resize(n); sortedZ.resize(n); sortedRadius.resize(n);
+    bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+    for(size_t i = 0; i < n; i++) {
+        unsigned int slot = bucketFill[bucketOfBody[i]]++;
+        sortedIndex[slot] = (unsigned int)i;
+        sortedCell[slot] = cellOfBody[i];
+        sortedX[slot] = state.x[i];
+        sortedY[slot] = state.y[i];
+        sortedZ[slot] = state.z[i];
+        sortedRadius[slot] = radius[i];
+    }
+
+    // Narrow phase in bucket order, which walks runs of cells along z, over
+    // fixed ranges so the pairs found don't depend on scheduling
+    size_t taskCount = (n + BODIES_PER_TASK - 1) / BODIES_PER_TASK;
+    taskOverlaps.resize(taskCount);
+    taskCandidates.assign(taskCount, 0);
+    pool.run(taskCount, [&](size_t task) {
+        std::vector<std::pair<unsigned int, unsigned int>>& found = taskOverlaps[task];
+        found.clear();
+        size_t tested = 0;
+        size_t end = std::min(n, (task + 1) * BODIES_PER_TASK);
+        for(size_t a = task * BODIES_PER_TASK; a < end; a++) {
+            unsigned int i = sortedIndex[a];
+            float xi = sortedX[a], yi = sortedY[a], zi = sortedZ[a], ri = sortedRadius[a];
+            // Only the cells overlapped by the box that any partner must touch
+            float reach = ri + maxRadius;
+            int64_t x0 = cellCoordinate(xi - reach, inverseCell), x1 = cellCoordinate(xi + reach, inverseCell);
+            int64_t y0 = cellCoordinate(yi - reach, inverseCell), y1 = cellCoordinate(yi + reach, inverseCell);
+            int64_t z0 = cellCoordinate(zi - reach, inverseCell), z1 = cellCoordinate(zi + reach, inverseCell);
+
+            for(int64_t cx = x0; cx <= x1; cx++) {
+                for(int64_t cy = y0; cy <= y1; cy++) {
+                    for(int64_t cz = z0; cz <= z1; cz++) {
+                        uint64_t key = cellKey(cx, cy, cz);
+                        uint32_t bucket = hashCell(cx, cy, cz, mask);
+                        // Skipping other cells' bodies drops hash collisions and
+                        // keeps a bucket shared by two cells from being scanned
+                        // twice for the same pair
+                        for(unsigned int s = bucketStart[bucket]; s < bucketStart[bucket + 1]; s++) {
+                            if(sortedCell[s] != key) continue;
+                            float ddx = sortedX[s] - xi, ddy = sortedY[s] - yi, ddz = sortedZ[s] - zi;
+                            float contact = ri + sortedRadius[s];
+                            tested++;
+                            if(ddx * ddx + ddy * ddy + ddz * ddz >= contact * contact) continue;
+                            unsigned int j = sortedIndex[s];
+                            if(j > i) found.emplace_back(i, j);
+                        }
+                    }
+                }
+            }
+        }
+        taskCandidates[task] = tested;
+    });
+
+    for(size_t task = 0; task < taskCount; task++) {
+        overlaps.insert(overlaps.end(), taskOverlaps[task].begin(), taskOverlaps[task].end());
+        candidates += taskCandidates[task];
+    }
+    std::sort(overlaps.begin(), overlaps.end());
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "BodyState.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+enum CollisionMode { COLLISION_NONE = 0, COLLISION_MERGE, COLLISION_BOUNCE, COLLISION_ABSORB, COLLISION_MODE_COUNT };
+
+const char* collisionModeName(int mode);
+
+// Broad and narrow phase for body overlap, rebuilt every step in O(N).
+//
+// Bodies are hashed into a uniform grid of cells twice as wide as the
+// largest diameter. The hash table has a power of two of buckets, at least
+// twice the body count, and is filled with a counting sort. Each body then
+// scans only the cells its reach (own radius plus the largest) overlaps, at
+// most 2 x 2 x 2, skipping entries from other cells that share a bucket, and
+// tests the rest against the radii.
+class CollisionDetector {
+public:
+    // Fills pairs() with every (i, j), i < j, whose spheres overlap, sorted by
+    // i then j so the response is the same for any thread count
+    void detect(const BodyState& state, const FloatArray& radius, ThreadPool& pool);
+
+    const std::vector<std::pair<unsigned int, unsigned int>>& pairs() const { return overlaps; }
+    size_t candidateCount() const { return candidates; }
+    size_t memoryBytes() const;
+
+private:
+    std::vector<unsigned int> bucketStart;
+    std::vector<unsigned int> bucketFill; // Next free slot per bucket while sorting
+    std::vector<unsigned int> bucketOfBody;
+    std::vector<unsigned int> sortedIndex;
+    std::vector<uint64_t> cellOfBody, sortedCell; // Packed cell coordinates
+    FloatArray sortedX, sortedY, sortedZ, sortedRadius;
+    std::vector<std::vector<std::pair<unsigned int, unsigned int>>> taskOverlaps;
+    std::vector<size_t> taskCandidates;
+    std::vector<std::pair<unsigned int, unsigned int>> overlaps;
+    size_t candidates = 0;
+};
@@ -0,0 +1,388 @@
+#include "CsvIO.h"
+#include "Ensemble.h"
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GRAVSIM_HAVE_MMAP 1
+#endif
+
+namespace {
+
+const size_t CHUNK_BYTES = 1 << 20; // Text per parse task
+
+// Powers of ten that are exact doubles
+const double POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const uint64_t INTEGER_POWERS_OF_TEN[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+const bool LITTLE_ENDIAN_HOST = [] {
+    uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}();
+
+bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+bool isDigit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+// Digits that lead an 8-byte word, given the word minus '0' in every byte.
+// A byte is flagged when it is below '0' (its subtraction borrows or wraps)
+// or above '9'; digits carry nothing into later bytes, so the first flag is
+// the first non-digit.
+int leadingDigits(uint64_t values) {
+    uint64_t nonDigit = (values | (values + 0x7676767676767676ull)) & 0x8080808080808080ull;
+#if defined(__GNUC__) || defined(__clang__)
+    return nonDigit ? __builtin_ctzll(nonDigit) / 8 : 8;
+#else
+    int run = 0;
+    while(run < 8 && !(nonDigit >> (8 * run) & 0x80)) run++;
+    return run;
+#endif
+}
+
+// Value of 8 digits, first digit in the lowest byte, with three multiplies
+uint32_t eightDigits(uint64_t values) {
+    const uint64_t mask = 0x000000FF000000FFull;
+    values = values * 10 + (values >> 8);
+    values = ((values & mask) * (100 + (1000000ull << 32)) + ((values >> 16) & mask) * (1 + (10000ull << 32))) >> 32;
+    return (uint32_t)values;
+}
+
+// Appends the digits at p to mantissa, 8 at a time while the text allows,
+// and adds how many there were to count
+const char* readDigits(const char* p, const char* end, uint64_t& mantissa, int& count) {
+    while(LITTLE_ENDIAN_HOST && end - p >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        uint64_t values = word - 0x3030303030303030ull;
+        int run = leadingDigits(values);
+        if(run == 0) return p;
+        // Shifting the digits to the top leaves zeros, leading zeros, below
+        mantissa = mantissa * INTEGER_POWERS_OF_TEN[run] + eightDigits(values << (64 - 8 * run));
+        count += run;
+        p += run;
+        if(run < 8) return p;
+    }
+    for(; p < end && isDigit(*p); p++) {
+        mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        count++;
+    }
+    return p;
+}
+
+// strtof on a copy of the token, since the text isn't null-terminated
+const char* parseFloatSlow(const char* p, const char* end, float& value) {
+    char token[64];
+    size_t length = 0;
+    while(p + length < end && length < sizeof(token) - 1 && !isSeparator(p[length]) && p[length] != '\n') {
+        token[length] = p[length];
+        length++;
+    }
+    token[length] = '\0';
+    char* tokenEnd;
+    value = std::strtof(token, &tokenEnd);
+    return p + (tokenEnd - token);
+}
+
+// Whether rounding a double that is within a few of its ulps of a decimal
+// value to float gives the float nearest that decimal. It can only go wrong
+// next to a point halfway between two floats, where the double may have
+// landed on the other side of, or on, the halfway point. Zero, subnormal
+// and overflowing floats are left to strtof too.
+bool roundsToFloatOnce(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    int exponent = (int)(bits >> 52 & 0x7FF) - 1023;
+    if(exponent < -126 || exponent > 127) return false;
+    // The 29 bits a float drops; halfway is the top one alone
+    const uint64_t half = 1ull << 28;
+    uint64_t dropped = bits & (2 * half - 1);
+    return dropped + 4 < half || dropped > half + 4;
+}
+
+// Decimal numbers with up to 19 digits and an exponent within 22 are scaled
+// in double precision by an exact power of ten, which is off by at most two
+// ulps of the double. Rounding that to float gives what strtof would unless
+// it sits next to a float halfway point; those, longer mantissas, inf, nan
+// and hex go through strtof. Returns the end of the number, or p if none.
+const char* parseFloat(const char* p, const char* end, float& value) {
+    const char* start = p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int digits = 0, fractionDigits = 0;
+    p = readDigits(p, end, mantissa, digits);
+    if(p < end && *p == '.') {
+        p = readDigits(p + 1, end, mantissa, fractionDigits);
+        digits += fractionDigits;
+    }
+    // Leading zeros count too, which only sends a few more numbers to strtof
+    if(digits == 0 || digits > 19) return parseFloatSlow(start, end, value);
+    int exponent = -fractionDigits;
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if(q < end && (*q == '-' || *q == '+')) negativeExponent = *q++ == '-';
+        if(q == end || !isDigit(*q)) return parseFloatSlow(start, end, value);
+        int e = 0;
+        for(; q < end && isDigit(*q); q++) {
+            if(e < 10000) e = e * 10 + (*q - '0');
+        }
+        exponent += negativeExponent ? -e : e;
+        p = q;
+    }
+    if(exponent < -22 || exponent > 22) return parseFloatSlow(start, end, value);
+    double result = (double)mantissa;
+    result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+    if(mantissa != 0 && !roundsToFloatOnce(result)) return parseFloatSlow(start, end, value);
+    value = (float)(negative ? -result : result);
+    return p;
+}
+
+// Parses up to maxValues comma or whitespace separated numbers from one line;
+// returns how many were read, or -1 if the line holds anything else
+int parseNumbers(const char* p, const char* end, float* values, int maxValues) {
+    int count = 0;
+    while(p < end) {
+        while(p < end && isSeparator(*p)) p++;
+        if(p == end) break;
+        if(count == maxValues) return -1;
+        const char* next = parseFloat(p, end, values[count]);
+        if(next == p || (next < end && !isSeparator(*next))) return -1;
+        count++;
+        p = next;
+    }
+    return count;
+}
+
+// Blank lines and comments hold no body
+bool isBodyLine(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p < end && *p != '#';
+}
+
+const char* lineEnd(const char* p, const char* end) {
+    const void* newline = std::memchr(p, '\n', (size_t)(end - p));
+    return newline ? static_cast<const char*>(newline) : end;
+}
+
+// The whole file, mapped where mmap is available
+class FileView {
+public:
+    ~FileView() {
+#if defined(GRAVSIM_HAVE_MMAP)
+        if(mapped) munmap(const_cast<char*>(data), size);
+#endif
+    }
+
+    bool open(const std::string& path) {
+#if defined(GRAVSIM_HAVE_MMAP)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        size = ok ? (size_t)info.st_size : 0;
+        if(ok && size > 0) {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = mapping != MAP_FAILED;
+            if(ok) {
+                data = static_cast<const char*>(mapping);
+                mapped = true;
+                madvise(mapping, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        return ok;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if(!in) return false;
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = contents.data();
+        size = contents.size();
+        return true;
+#endif
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+
+private:
+    bool mapped = false;
+    std::vector<char> contents;
+};
+
+struct ParseChunk {
+    const char* begin;
+    const char* end;
+    size_t lines = 0;      // Newlines in the chunk
+    size_t bodies = 0;
+    size_t firstBody = 0;  // Index of the chunk's first body in the arrays
+    size_t errorLine = 0;  // Line within the chunk, 1-based, 0 if none
+    std::string error;
+};
+
+}
+
+bool loadBodiesCsv(const std::string& path, Simulation& sim, std::string& error) {
+    FileView file;
+    if(!file.open(path)) {
+        error = "cannot open " + path;
+        return false;
+    }
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+
+    // A non-numeric first line is a header
+    size_t firstLine = 1;
+    if(begin < end) {
+        const char* headerEnd = lineEnd(begin, end);
+        float values[12];
+        if(isBodyLine(begin, headerEnd) && parseNumbers(begin, headerEnd, values, 12) < 0) {
+            begin = headerEnd < end ? headerEnd + 1 : end;
+            firstLine = 2;
+        }
+    }
+
+    // Chunks of whole lines, cut after the first newline past each boundary
+    std::vector<ParseChunk> chunks;
+    for(const char* p = begin; p < end;) {
+        const char* cut = p + std::min(CHUNK_BYTES, (size_t)(end - p));
+        if(cut < end) cut = lineEnd(cut, end);
+        if(cut < end) cut++;
+        ParseChunk chunk;
+        chunk.begin = p;
+        chunk.end = cut;
+        chunks.push_back(chunk);
+        p = cut;
+    }
+
+    // Count the bodies in each chunk so every chunk knows where its bodies go
+    ThreadPool& pool = sim.threadPool;
+    pool.run(chunks.size(), [&](size_t c) {
+        ParseChunk& chunk = chunks[c];
+        for(const char* p = chunk.begin; p < chunk.end;) {
+            const char* next = lineEnd(p, chunk.end);
+            if(isBodyLine(p, next)) chunk.bodies++;
+            if(next < chunk.end) chunk.lines++;
+            p = next + 1;
+        }
+    });
+    size_t total = 0;
+    for(ParseChunk& chunk : chunks) {
+        chunk.firstBody = total;
+        total += chunk.bodies;
+    }
+
+    // Parse straight into the new arrays
+    std::vector<GravityBody> bodies(total);
+    BodyState state;
+    state.resize(total);
+    pool.run(chunks.size(), [&](size_t c) {
+        ParseChunk& chunk = chunks[c];
+        size_t i = chunk.firstBody, line = 0;
+        const char* next;
+        for(const char* p = chunk.begin; p < chunk.end; p = next + 1) {
+            line++;
+            next = lineEnd(p, chunk.end);
+            if(!isBodyLine(p, next)) continue;
+
+            float values[12];
+            int count = parseNumbers(p, next, values, 12);
+            if(count != 7 && count != 8 && count != 11 && count != 12) {
+                chunk.errorLine = line;
+                chunk.error = "expected 7, 8, 11 or 12 numbers";
+                return;
+            }
+            // Files written by writeBodiesCsv lead with the body id
+            float* v = values;
+            if(count == 12) {
+                v++;
+                count--;
+            }
+            // Overflowing numbers parse to inf, and "nan" parses at all
+            bool finite = true;
+            for(int k = 0; k < count; k++) finite &= std::isfinite(v[k]);
+            if(!finite) {
+                chunk.errorLine = line;
+                chunk.error = "numbers must be finite";
+                return;
+            }
+            if(!(v[6] > 0.0f)) {
+                chunk.errorLine = line;
+                chunk.error = "mass must be positive";
+                return;
+            }
+
+            state.x[i] = v[0]; state.y[i] = v[1]; state.z[i] = v[2];
+            state.vx[i] = v[3]; state.vy[i] = v[4]; state.vz[i] = v[5];
+            state.mass[i] = v[6];
+            bodies[i].radius = count >= 8 ? v[7] : std::cbrt(v[6]) * 0.5f;
+            bodies[i].color = count == 11 ? glm::vec3(v[8], v[9], v[10]) : glm::vec3(0.8f);
+            i++;
+        }
+    });
+
+    // The first error in the file, with its line number
+    size_t lineNumber = firstLine;
+    for(const ParseChunk& chunk : chunks) {
+        if(chunk.errorLine > 0) {
+            error = path + ":" + std::to_string(lineNumber + chunk.errorLine - 1) + ": " + chunk.error;
+            return false;
+        }
+        lineNumber += chunk.lines;
+    }
+
+    sim.replaceBodies(bodies, state);
+    return true;
+}
+
+bool writeBodiesCsv(const std::string& path, const Simulation& sim) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if(!file) return false;
+
+    const BodyState& s = sim.state;
+    std::fprintf(file, "# step %llu, time %.9g\n", sim.stepCount, sim.simulationTime);
+    std::fprintf(file, "# id,x,y,z,vx,vy,vz,mass,radius,r,g,b\n");
+    for(size_t i = 0; i < s.size(); i++) {
+        const GravityBody& b = sim.bodies[i];
+        std::fprintf(file, "%u,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.4g,%.4g,%.4g\n", b.id,
+                     s.x[i], s.y[i], s.z[i], s.vx[i], s.vy[i], s.vz[i], s.mass[i],
+                     b.radius, b.color.x, b.color.y, b.color.z);
+    }
+    return std::fclose(file) == 0;
+}
+
+bool writeEnsembleCsv(const std::string& path, const EnsembleSet& set, const std::vector<EnsembleResult>& results) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if(!file) return false;
+
+    std::fprintf(file, "# member,outcome,time,steps,body,other_body,energy_error,softening\n");
+    for(size_t m = 0; m < results.size() && m < set.size(); m++) {
+        const EnsembleResult& r = results[m];
+        std::fprintf(file, "%zu,%s,%.9g,%u,%d,%d,%.6e,%.9g\n", m, ensembleOutcomeName(r.outcome), r.time, r.steps,
+                     r.body, r.otherBody, r.energyError, set.softening[m]);
+    }
+    return std::fclose(file) == 0;
+}
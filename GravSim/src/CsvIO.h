@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct Simulation;
+struct EnsembleSet;
+struct EnsembleResult;
+
+// Plain-text body lists, one body per line:
+//   [id, ]x, y, z, vx, vy, vz, mass[, radius[, r, g, b]]
+// The id column is only recognized on full 12-column lines and is ignored.
+// Blank lines, lines starting with '#' and a non-numeric header line are skipped.
+
+// Replaces the simulation's bodies with the ones in the file, parsed in
+// chunks on the simulation's thread pool. On failure the simulation is left
+// untouched and `error` says what went wrong.
+bool loadBodiesCsv(const std::string& path, Simulation& sim, std::string& error);
+
+// Writes the current bodies in the same layout, with the body id in an extra
+// leading column and the step and time in a comment line
+bool writeBodiesCsv(const std::string& path, const Simulation& sim);
+
+// Writes one line per ensemble member: how and when it stopped, the bodies
+// involved, the relative energy error and the member's softening
+bool writeEnsembleCsv(const std::string& path, const EnsembleSet& set, const std::vector<EnsembleResult>& results);
@@ -0,0 +1,410 @@
+#include "Ensemble.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const float MIN_DISTANCE_SQ = 1e-6f; // Same cutoff as the direct sum
+const size_t BLOCK_MEMBERS = 1024;   // Members per generator stream in buildEnsemble
+const size_t BATCHES_PER_TASK = 64;
+
+// One float per member, as wide as the vector unit. Only what the leapfrog
+// step needs; masks have one bit per lane.
+#if defined(__AVX512F__)
+
+const int LANES = 16;
+struct Lanes { __m512 v; };
+inline Lanes load(const float* p) { return { _mm512_load_ps(p) }; }
+inline void store(float* p, Lanes a) { _mm512_store_ps(p, a.v); }
+inline Lanes broadcast(float f) { return { _mm512_set1_ps(f) }; }
+inline Lanes operator+(Lanes a, Lanes b) { return { _mm512_add_ps(a.v, b.v) }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { _mm512_sub_ps(a.v, b.v) }; }
+inline Lanes operator*(Lanes a, Lanes b) { return { _mm512_mul_ps(a.v, b.v) }; }
+inline Lanes operator/(Lanes a, Lanes b) { return { _mm512_div_ps(a.v, b.v) }; }
+inline Lanes multiplyAdd(Lanes a, Lanes b, Lanes c) { return { _mm512_fmadd_ps(a.v, b.v, c.v) }; }
+inline Lanes squareRoot(Lanes a) { return { _mm512_sqrt_ps(a.v) }; }
+inline unsigned lessMask(Lanes a, Lanes b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+inline Lanes zeroUnless(unsigned mask, Lanes a) { return { _mm512_maskz_mov_ps((__mmask16)mask, a.v) }; }
+
+#elif defined(__AVX2__)
+
+const int LANES = 8;
+struct Lanes { __m256 v; };
+inline Lanes load(const float* p) { return { _mm256_load_ps(p) }; }
+inline void store(float* p, Lanes a) { _mm256_store_ps(p, a.v); }
+inline Lanes broadcast(float f) { return { _mm256_set1_ps(f) }; }
+inline Lanes operator+(Lanes a, Lanes b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline Lanes operator*(Lanes a, Lanes b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline Lanes operator/(Lanes a, Lanes b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline Lanes multiplyAdd(Lanes a, Lanes b, Lanes c) {
+#if defined(__FMA__)
+    return { _mm256_fmadd_ps(a.v, b.v, c.v) };
+#else
+    return { _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v) };
+#endif
+}
+inline Lanes squareRoot(Lanes a) { return { _mm256_sqrt_ps(a.v) }; }
+inline unsigned lessMask(Lanes a, Lanes b) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline Lanes zeroUnless(unsigned mask, Lanes a) {
+    __m256i bits = _mm256_and_si256(_mm256_set1_epi32((int)mask), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128));
+    __m256 keep = _mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, _mm256_setzero_si256()));
+    return { _mm256_andnot_ps(keep, a.v) };
+}
+
+#else
+
+const int LANES = 1;
+struct Lanes { float v; };
+inline Lanes load(const float* p) { return { *p }; }
+inline void store(float* p, Lanes a) { *p = a.v; }
+inline Lanes broadcast(float f) { return { f }; }
+inline Lanes operator+(Lanes a, Lanes b) { return { a.v + b.v }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { a.v - b.v }; }
+inline Lanes operator*(Lanes a, Lanes b) { return { a.v * b.v }; }
+inline Lanes operator/(Lanes a, Lanes b) { return { a.v / b.v }; }
+inline Lanes multiplyAdd(Lanes a, Lanes b, Lanes c) { return { a.v * b.v + c.v }; }
+inline Lanes squareRoot(Lanes a) { return { std::sqrt(a.v) }; }
+inline unsigned lessMask(Lanes a, Lanes b) { return a.v < b.v ? 1u : 0u; }
+inline Lanes zeroUnless(unsigned mask, Lanes a) { return { mask ? a.v : 0.0f }; }
+
+#endif
+
+// One member per lane. Idle lanes hold massless bodies a unit apart, which
+// exert and feel no force.
+struct alignas(64) Batch {
+    float x[ENSEMBLE_MAX_BODIES][LANES], y[ENSEMBLE_MAX_BODIES][LANES], z[ENSEMBLE_MAX_BODIES][LANES];
+    float vx[ENSEMBLE_MAX_BODIES][LANES], vy[ENSEMBLE_MAX_BODIES][LANES], vz[ENSEMBLE_MAX_BODIES][LANES];
+    float ax[ENSEMBLE_MAX_BODIES][LANES], ay[ENSEMBLE_MAX_BODIES][LANES], az[ENSEMBLE_MAX_BODIES][LANES];
+    float mass[ENSEMBLE_MAX_BODIES][LANES], radius[ENSEMBLE_MAX_BODIES][LANES];
+    float softening[LANES];
+    float inverseMass[LANES];      // Of the whole member, 0 when idle
+    size_t member[LANES];
+    uint32_t startStep[LANES];
+    double initialEnergy[LANES];
+};
+
+// Softened potential energy matching the force, as in computeTotalEnergy
+double memberEnergy(const Batch& b, int lane, size_t n, float gravityConstant) {
+    double kinetic = 0.0, potential = 0.0;
+    double soft = b.softening[lane];
+    double rootSoft = std::sqrt(soft);
+    const double halfPi = 2.0 * std::atan(1.0);
+    for(size_t i = 0; i < n; i++) {
+        double vx = b.vx[i][lane], vy = b.vy[i][lane], vz = b.vz[i][lane];
+        kinetic += 0.5 * b.mass[i][lane] * (vx * vx + vy * vy + vz * vz);
+        for(size_t j = i + 1; j < n; j++) {
+            double dx = b.x[j][lane] - b.x[i][lane], dy = b.y[j][lane] - b.y[i][lane], dz = b.z[j][lane] - b.z[i][lane];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if(r2 < MIN_DISTANCE_SQ) continue;
+            double mm = (double)b.mass[i][lane] * b.mass[j][lane];
+            potential += soft > 0.0 ? mm * (halfPi - std::atan(std::sqrt(r2) / rootSoft)) / rootSoft
+                                    : mm / std::sqrt(r2);
+        }
+    }
+    return kinetic - gravityConstant * potential;
+}
+
+void loadMember(Batch& b, int lane, const EnsembleSet& set, size_t member, uint32_t step, float gravityConstant) {
+    size_t n = set.bodiesPerMember;
+    double total = 0.0;
+    for(size_t i = 0; i < n; i++) {
+        size_t k = member * n + i;
+        b.x[i][lane] = set.x[k]; b.y[i][lane] = set.y[k]; b.z[i][lane] = set.z[k];
+        b.vx[i][lane] = set.vx[k]; b.vy[i][lane] = set.vy[k]; b.vz[i][lane] = set.vz[k];
+        b.mass[i][lane] = set.mass[k];
+        b.radius[i][lane] = set.radius[k];
+        total += set.mass[k];
+    }
+    b.softening[lane] = set.softening[member];
+    b.inverseMass[lane] = total > 0.0 ? (float)(1.0 / total) : 0.0f;
+    b.member[lane] = member;
+    b.startStep[lane] = step;
+    b.initialEnergy[lane] = memberEnergy(b, lane, n, gravityConstant);
+}
+
+void clearLane(Batch& b, int lane, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        b.x[i][lane] = (float)i; b.y[i][lane] = 0.0f; b.z[i][lane] = 0.0f;
+        b.vx[i][lane] = 0.0f; b.vy[i][lane] = 0.0f; b.vz[i][lane] = 0.0f;
+        b.mass[i][lane] = 0.0f;
+        b.radius[i][lane] = 0.0f;
+    }
+    b.softening[lane] = 1.0f;
+    b.inverseMass[lane] = 0.0f;
+}
+
+// Accelerations of every lane at the current positions. Returns the lanes
+// where some pair of spheres touches when collisions are checked.
+unsigned computeAccelerations(Batch& b, size_t n, float gravityConstant, bool checkCollisions) {
+    const Lanes zero = broadcast(0.0f);
+    const Lanes minDist2 = broadcast(MIN_DISTANCE_SQ);
+    const Lanes g = broadcast(gravityConstant);
+    const Lanes soft = load(b.softening);
+    unsigned touching = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        store(b.ax[i], zero); store(b.ay[i], zero); store(b.az[i], zero);
+    }
+    for(size_t i = 0; i < n; i++) {
+        Lanes xi = load(b.x[i]), yi = load(b.y[i]), zi = load(b.z[i]);
+        Lanes gmi = g * load(b.mass[i]);
+        Lanes axi = load(b.ax[i]), ayi = load(b.ay[i]), azi = load(b.az[i]);
+        for(size_t j = i + 1; j < n; j++) {
+            Lanes dx = load(b.x[j]) - xi, dy = load(b.y[j]) - yi, dz = load(b.z[j]) - zi;
+            Lanes dist2 = multiplyAdd(dx, dx, multiplyAdd(dy, dy, dz * dz));
+            unsigned tooClose = lessMask(dist2, minDist2);
+            Lanes s = zeroUnless(~tooClose, broadcast(1.0f) / (squareRoot(dist2) * (dist2 + soft)));
+            if(checkCollisions) {
+                Lanes reach = load(b.radius[i]) + load(b.radius[j]);
+                touching |= lessMask(dist2, reach * reach);
+            }
+
+            Lanes sj = g * load(b.mass[j]) * s;
+            axi = multiplyAdd(dx, sj, axi); ayi = multiplyAdd(dy, sj, ayi); azi = multiplyAdd(dz, sj, azi);
+            Lanes si = gmi * s;
+            store(b.ax[j], load(b.ax[j]) - dx * si);
+            store(b.ay[j], load(b.ay[j]) - dy * si);
+            store(b.az[j], load(b.az[j]) - dz * si);
+        }
+        store(b.ax[i], axi); store(b.ay[i], ayi); store(b.az[i], azi);
+    }
+    return touching;
+}
+
+void kick(Batch& b, size_t n, float dt) {
+    Lanes h = broadcast(dt);
+    for(size_t i = 0; i < n; i++) {
+        store(b.vx[i], multiplyAdd(load(b.ax[i]), h, load(b.vx[i])));
+        store(b.vy[i], multiplyAdd(load(b.ay[i]), h, load(b.vy[i])));
+        store(b.vz[i], multiplyAdd(load(b.az[i]), h, load(b.vz[i])));
+    }
+}
+
+void drift(Batch& b, size_t n, float dt) {
+    Lanes h = broadcast(dt);
+    for(size_t i = 0; i < n; i++) {
+        store(b.x[i], multiplyAdd(load(b.vx[i]), h, load(b.x[i])));
+        store(b.y[i], multiplyAdd(load(b.vy[i]), h, load(b.y[i])));
+        store(b.z[i], multiplyAdd(load(b.vz[i]), h, load(b.z[i])));
+    }
+}
+
+// Lanes with a body further than radius from the member's center of mass
+unsigned findEjections(const Batch& b, size_t n, float radius) {
+    Lanes cx = broadcast(0.0f), cy = cx, cz = cx;
+    for(size_t i = 0; i < n; i++) {
+        Lanes m = load(b.mass[i]);
+        cx = multiplyAdd(m, load(b.x[i]), cx);
+        cy = multiplyAdd(m, load(b.y[i]), cy);
+        cz = multiplyAdd(m, load(b.z[i]), cz);
+    }
+    Lanes inverse = load(b.inverseMass);
+    cx = cx * inverse; cy = cy * inverse; cz = cz * inverse;
+
+    Lanes limit = broadcast(radius * radius);
+    unsigned ejected = 0;
+    for(size_t i = 0; i < n; i++) {
+        Lanes dx = load(b.x[i]) - cx, dy = load(b.y[i]) - cy, dz = load(b.z[i]) - cz;
+        ejected |= lessMask(limit, multiplyAdd(dx, dx, multiplyAdd(dy, dy, dz * dz)));
+    }
+    return ejected;
+}
+
+// The first touching pair of a lane, in pair order
+void findCollision(const Batch& b, int lane, size_t n, int& first, int& second) {
+    for(size_t i = 0; i < n; i++) {
+        for(size_t j = i + 1; j < n; j++) {
+            float dx = b.x[j][lane] - b.x[i][lane], dy = b.y[j][lane] - b.y[i][lane], dz = b.z[j][lane] - b.z[i][lane];
+            float reach = b.radius[i][lane] + b.radius[j][lane];
+            if(dx * dx + dy * dy + dz * dz < reach * reach) {
+                first = (int)i;
+                second = (int)j;
+                return;
+            }
+        }
+    }
+}
+
+// The body furthest from a lane's center of mass
+int findEjectedBody(const Batch& b, int lane, size_t n) {
+    double cx = 0.0, cy = 0.0, cz = 0.0, total = 0.0;
+    for(size_t i = 0; i < n; i++) {
+        cx += b.mass[i][lane] * b.x[i][lane]; cy += b.mass[i][lane] * b.y[i][lane]; cz += b.mass[i][lane] * b.z[i][lane];
+        total += b.mass[i][lane];
+    }
+    cx /= total; cy /= total; cz /= total;
+    int furthest = 0;
+    double best = -1.0;
+    for(size_t i = 0; i < n; i++) {
+        double dx = b.x[i][lane] - cx, dy = b.y[i][lane] - cy, dz = b.z[i][lane] - cz;
+        double d2 = dx * dx + dy * dy + dz * dz;
+        if(d2 > best) {
+            best = d2;
+            furthest = (int)i;
+        }
+    }
+    return furthest;
+}
+
+// Step at which the first active lane reaches the time limit
+uint32_t nextDeadline(const Batch& b, unsigned active, uint32_t maxSteps) {
+    uint32_t deadline = ~0u;
+    for(int l = 0; l < LANES; l++) {
+        if(active >> l & 1) deadline = std::min(deadline, b.startStep[l] + maxSteps);
+    }
+    return deadline;
+}
+
+// Runs members [begin, end) through one batch, refilling lanes as members stop
+void runBatch(const EnsembleSet& set, const EnsembleParams& params, size_t begin, size_t end,
+              std::vector<EnsembleResult>& results) {
+    Batch b;
+    size_t n = set.bodiesPerMember;
+    float dt = params.timeStep;
+    uint32_t maxSteps = (uint32_t)std::max(1.0, std::ceil((double)params.maxTime / dt - 1e-3));
+    bool checkEjections = params.ejectionRadius > 0.0f;
+
+    uint32_t step = 0;
+    size_t next = begin;
+    unsigned active = 0;
+    for(int l = 0; l < LANES; l++) {
+        if(next < end) {
+            loadMember(b, l, set, next++, step, params.gravityConstant);
+            active |= 1u << l;
+        }
+        else {
+            clearLane(b, l, n);
+        }
+    }
+    computeAccelerations(b, n, params.gravityConstant, false);
+    uint32_t deadline = nextDeadline(b, active, maxSteps);
+
+    while(active) {
+        kick(b, n, 0.5f * dt);
+        drift(b, n, dt);
+        unsigned touching = computeAccelerations(b, n, params.gravityConstant, params.stopOnCollision);
+        kick(b, n, 0.5f * dt);
+        step++;
+
+        unsigned ejected = checkEjections ? findEjections(b, n, params.ejectionRadius) : 0;
+        if(!((touching | ejected) & active) && step < deadline) continue;
+
+        bool refilled = false;
+        for(int l = 0; l < LANES; l++) {
+            if(!(active >> l & 1)) continue;
+            EnsembleResult result;
+            if(touching >> l & 1) {
+                result.outcome = ENSEMBLE_COLLISION;
+                findCollision(b, l, n, result.body, result.otherBody);
+            }
+            else if(ejected >> l & 1) {
+                result.outcome = ENSEMBLE_EJECTION;
+                result.body = findEjectedBody(b, l, n);
+            }
+            else if(step - b.startStep[l] < maxSteps) {
+                continue;
+            }
+            result.steps = step - b.startStep[l];
+            result.time = (float)(result.steps * (double)dt);
+            double energy = memberEnergy(b, l, n, params.gravityConstant);
+            double initial = b.initialEnergy[l];
+            result.energyError = initial != 0.0 ? std::fabs((energy - initial) / initial) : 0.0;
+            results[b.member[l]] = result;
+
+            if(next < end) {
+                loadMember(b, l, set, next++, step, params.gravityConstant);
+                refilled = true;
+            }
+            else {
+                clearLane(b, l, n);
+                active &= ~(1u << l);
+            }
+        }
+        // Positions of the other lanes are unchanged, so their accelerations are too
+        if(refilled) computeAccelerations(b, n, params.gravityConstant, false);
+        deadline = nextDeadline(b, active, maxSteps);
+    }
+}
+
+}
+
+const char* ensembleOutcomeName(int outcome) {
+    switch(outcome) {
+        case ENSEMBLE_TIME_LIMIT: return "time-limit";
+        case ENSEMBLE_EJECTION: return "ejection";
+        case ENSEMBLE_COLLISION: return "collision";
+    }
+    return "unknown";
+}
+
+bool buildEnsemble(const BodyState& base, const std::vector<float>& radius, const EnsembleSweep& sweep,
+                   ThreadPool& pool, EnsembleSet& set) {
+    size_t n = base.size();
+    if(n == 0 || n > ENSEMBLE_MAX_BODIES || radius.size() != n) return false;
+
+    size_t members = sweep.members;
+    set.bodiesPerMember = n;
+    for(std::vector<float>* a : { &set.x, &set.y, &set.z, &set.vx, &set.vy, &set.vz, &set.mass, &set.radius }) {
+        a->resize(members * n);
+    }
+    set.softening.resize(members);
+
+    size_t blocks = (members + BLOCK_MEMBERS - 1) / BLOCK_MEMBERS;
+    pool.run(blocks, [&](size_t block) {
+        std::seed_seq sequence{ (unsigned int)sweep.seed, (unsigned int)block };
+        std::mt19937 gen(sequence);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        size_t last = std::min(members, (block + 1) * BLOCK_MEMBERS);
+        for(size_t m = block * BLOCK_MEMBERS; m < last; m++) {
+            float along = members > 1 ? (float)m / (members - 1) : 0.0f;
+            set.softening[m] = sweep.softeningMin + (sweep.softeningMax - sweep.softeningMin) * along;
+            for(size_t i = 0; i < n; i++) {
+                size_t k = m * n + i;
+                float speed = glm::length(base.velocity(i));
+                set.x[k] = base.x[i] + sweep.positionJitter * unit(gen);
+                set.y[k] = base.y[i] + sweep.positionJitter * unit(gen);
+                set.z[k] = base.z[i] + sweep.positionJitter * unit(gen);
+                set.vx[k] = base.vx[i] + sweep.velocityJitter * speed * unit(gen);
+                set.vy[k] = base.vy[i] + sweep.velocityJitter * speed * unit(gen);
+                set.vz[k] = base.vz[i] + sweep.velocityJitter * speed * unit(gen);
+                set.mass[k] = base.mass[i];
+                set.radius[k] = radius[i];
+            }
+        }
+    });
+    return true;
+}
+
+void runEnsemble(const EnsembleSet& set, const EnsembleParams& params, ThreadPool& pool,
+                 std::vector<EnsembleResult>& results) {
+    size_t members = set.size();
+    results.assign(members, EnsembleResult());
+    if(members == 0 || set.bodiesPerMember == 0 || set.bodiesPerMember > ENSEMBLE_MAX_BODIES) return;
+
+    // Each task keeps one batch of lanes busy over its own run of members;
+    // small ensembles get shorter runs so every thread has some
+    size_t batches = (members + LANES - 1) / LANES;
+    size_t perTask = LANES * std::max<size_t>(1, std::min(BATCHES_PER_TASK, batches / (4 * pool.threadCount())));
+    size_t tasks = (members + perTask - 1) / perTask;
+    pool.run(tasks, [&](size_t t) {
+        runBatch(set, params, t * perTask, std::min(members, (t + 1) * perTask), results);
+    });
+}
+
+const char* ensembleKernelName() {
+#if defined(__AVX512F__)
+    return "AVX-512, 16 lanes";
+#elif defined(__AVX2__)
+    return "AVX2, 8 lanes";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "BodyState.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Ensembles: many small, independent systems with the same body count,
+// integrated side by side for parameter studies. Each SIMD lane carries one
+// member, batches of lanes run as thread pool tasks, and members stop on
+// their own when a stop condition is met, with the lane taken over by the
+// next member. Members use the same softened force as the physics core and
+// kick-drift-kick leapfrog at a fixed step.
+
+const size_t ENSEMBLE_MAX_BODIES = 16;
+
+enum EnsembleOutcome { ENSEMBLE_TIME_LIMIT = 0, ENSEMBLE_EJECTION, ENSEMBLE_COLLISION, ENSEMBLE_OUTCOME_COUNT };
+
+const char* ensembleOutcomeName(int outcome);
+
+// Initial conditions of every member, member-major: body b of member m is
+// at m * bodiesPerMember + b
+struct EnsembleSet {
+    size_t bodiesPerMember = 0;
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> mass, radius;
+    std::vector<float> softening; // Per member
+
+    size_t size() const { return softening.size(); }
+};
+
+struct EnsembleParams {
+    float gravityConstant = 1000.0f;
+    float timeStep = 0.016f;
+    float maxTime = 16.0f;
+    float ejectionRadius = 0.0f; // Distance from the member's center of mass; 0 is off
+    bool stopOnCollision = true; // Spheres touching
+};
+
+struct EnsembleResult {
+    int outcome = ENSEMBLE_TIME_LIMIT;
+    int body = -1;               // Ejected body, or the first of the colliding pair
+    int otherBody = -1;          // Second of the colliding pair
+    uint32_t steps = 0;
+    float time = 0.0f;
+    double energyError = 0.0;    // Relative, at the last step
+};
+
+// How buildEnsemble varies a base system across members
+struct EnsembleSweep {
+    size_t members = 10000;
+    float positionJitter = 0.0f; // Absolute, uniform per component
+    float velocityJitter = 0.0f; // Relative to each body's speed, uniform per component
+    float softeningMin = 1.0f;   // Softening goes linearly from min to max across members
+    float softeningMax = 1.0f;
+    int seed = 1;                // Each member draws from its own stream, seeded from this
+};
+
+// Copies the base system into every member and applies the sweep. Returns
+// false when the base has no bodies or more than ENSEMBLE_MAX_BODIES.
+bool buildEnsemble(const BodyState& base, const std::vector<float>& radius, const EnsembleSweep& sweep,
+                   ThreadPool& pool, EnsembleSet& set);
+
+// Integrates every member until it stops. Results are per member and do not
+// depend on the thread count.
+void runEnsemble(const EnsembleSet& set, const EnsembleParams& params, ThreadPool& pool,
+                 std::vector<EnsembleResult>& results);
+
+// Name of the lane width the runner was compiled for
+const char* ensembleKernelName();
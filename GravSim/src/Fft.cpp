@@ -0,0 +1,113 @@
+#include "Fft.h"
+
+#include <cmath>
+#include <utility>
+
+void Fft::resize(size_t size) {
+    n = size;
+    twiddles.resize(n / 2);
+    reversed.resize(n);
+    if(n == 0) return;
+
+    // Twiddles in double so long transforms don't accumulate angle error
+    const double pi = std::acos(-1.0);
+    for(size_t k = 0; k < n / 2; k++) {
+        double angle = -2.0 * pi * (double)k / (double)n;
+        twiddles[k] = Complex((float)std::cos(angle), (float)std::sin(angle));
+    }
+
+    unsigned int bits = 0;
+    while(((size_t)1 << bits) < n) bits++;
+    for(size_t i = 0; i < n; i++) {
+        unsigned int r = 0;
+        for(unsigned int b = 0; b < bits; b++) {
+            if(i & ((size_t)1 << b)) r |= 1u << (bits - 1 - b);
+        }
+        reversed[i] = r;
+    }
+}
+
+size_t Fft::nextPowerOfTwo(size_t n) {
+    size_t p = 1;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+void Fft::transform(Complex* data, bool inverse) const {
+    for(size_t i = 0; i < n; i++) {
+        if(i < reversed[i]) std::swap(data[i], data[reversed[i]]);
+    }
+
+    for(size_t half = 1; half < n; half <<= 1) {
+        size_t twiddleStep = n / (2 * half);
+        for(size_t block = 0; block < n; block += 2 * half) {
+            Complex* a = data + block;
+            Complex* b = a + half;
+            for(size_t k = 0; k < half; k++) {
+                Complex w = twiddles[k * twiddleStep];
+                if(inverse) w = std::conj(w);
+                // Written out so it stays a plain multiply-add; std::complex
+                // operator* carries NaN/inf recovery code
+                float tr = b[k].real() * w.real() - b[k].imag() * w.imag();
+                float ti = b[k].real() * w.imag() + b[k].imag() * w.real();
+                Complex t(tr, ti);
+                b[k] = a[k] - t;
+                a[k] += t;
+            }
+        }
+    }
+}
+
+void RealFft::resize(size_t size) {
+    n = size;
+    half.resize(n / 2);
+    twiddles.resize(n / 2 + 1);
+    const double pi = std::acos(-1.0);
+    for(size_t k = 0; k <= n / 2 && n > 0; k++) {
+        double angle = -2.0 * pi * (double)k / (double)n;
+        twiddles[k] = Complex((float)std::cos(angle), (float)std::sin(angle));
+    }
+}
+
+// Even samples go in the real part and odd samples in the imaginary part;
+// their spectra E and O are separated from the packed transform Z with
+// E[k] = (Z[k] + conj(Z[m - k])) / 2 and O[k] = (Z[k] - conj(Z[m - k])) / 2i,
+// then X[k] = E[k] + w^k O[k]
+void RealFft::forward(const float* input, Complex* spectrum, Complex* scratch) const {
+    size_t m = n / 2;
+    for(size_t k = 0; k < m; k++) scratch[k] = Complex(input[2 * k], input[2 * k + 1]);
+    half.forward(scratch);
+
+    for(size_t k = 0; k <= m; k++) {
+        Complex z = scratch[k == m ? 0 : k];
+        Complex zm = std::conj(scratch[k == 0 ? 0 : m - k]);
+        Complex even = 0.5f * (z + zm);
+        Complex diff = 0.5f * (z - zm);
+        Complex odd(diff.imag(), -diff.real()); // diff / i
+        const Complex& w = twiddles[k];
+        spectrum[k] = Complex(even.real() + w.real() * odd.real() - w.imag() * odd.imag(),
+                              even.imag() + w.real() * odd.imag() + w.imag() * odd.real());
+    }
+}
+
+// Reverses forward(): rebuilds Z[k] = E[k] + i O[k] from the spectrum
+// (scaled by 2 so the result matches an unnormalized n-point inverse)
+void RealFft::inverse(const Complex* spectrum, float* output, Complex* scratch) const {
+    size_t m = n / 2;
+    for(size_t k = 0; k < m; k++) {
+        Complex x = spectrum[k];
+        Complex xm = std::conj(spectrum[m - k]);
+        Complex even = x + xm;
+        Complex diff = x - xm;
+        const Complex& w = twiddles[k];
+        // odd = diff * conj(w)
+        Complex odd(diff.real() * w.real() + diff.imag() * w.imag(),
+                    diff.imag() * w.real() - diff.real() * w.imag());
+        scratch[k] = Complex(even.real() - odd.imag(), even.imag() + odd.real());
+    }
+    half.inverse(scratch);
+    for(size_t k = 0; k < m; k++) {
+        output[2 * k] = scratch[k].real();
+        output[2 * k + 1] = scratch[k].imag();
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+// Iterative radix-2 complex FFT for one power-of-two length. Twiddles and
+// the bit-reversal permutation are computed once, so a plan can be reused
+// for every row and column of a multi-dimensional transform. A plan is only
+// read while transforming and can be shared between threads.
+class Fft {
+public:
+    using Complex = std::complex<float>;
+
+    explicit Fft(size_t n = 0) { resize(n); }
+
+    // n must be a power of two
+    void resize(size_t n);
+    size_t size() const { return n; }
+
+    // In place. inverse() is unnormalized: inverse(forward(x)) == n * x.
+    void forward(Complex* data) const { transform(data, false); }
+    void inverse(Complex* data) const { transform(data, true); }
+
+    static size_t nextPowerOfTwo(size_t n);
+
+private:
+    void transform(Complex* data, bool inverse) const;
+
+    size_t n = 0;
+    std::vector<Complex> twiddles;      // exp(-2*pi*i*k/n) for k < n/2
+    std::vector<unsigned int> reversed; // Bit-reversed index of each element
+};
+
+// FFT of real input of even length n through one complex FFT of n / 2.
+// The spectrum is Hermitian, so only bins 0..n/2 are stored.
+class RealFft {
+public:
+    using Complex = Fft::Complex;
+
+    explicit RealFft(size_t n = 0) { resize(n); }
+
+    void resize(size_t n);
+    size_t size() const { return n; }
+    size_t spectrumSize() const { return n / 2 + 1; }
+
+    // `spectrum` holds spectrumSize() bins. `scratch` needs n / 2 elements;
+    // passing it in keeps the plan shareable between threads.
+    void forward(const float* input, Complex* spectrum, Complex* scratch) const;
+    // Unnormalized like Fft::inverse: inverse(forward(x)) == n * x
+    void inverse(const Complex* spectrum, float* output, Complex* scratch) const;
+
+private:
+    size_t n = 0;
+    Fft half;
+    std::vector<Complex> twiddles; // exp(-2*pi*i*k/n) for k <= n/2
+};
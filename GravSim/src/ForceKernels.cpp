@@ -0,0 +1,499 @@
+#include "ForceKernels.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const float MIN_DISTANCE_SQ = 1e-6f; // 0.001 squared
+
+}
+
+void accumulateDirectForcesScalar(const BodyState& state, size_t iBegin, size_t iEnd,
+                                  float* fx, float* fy, float* fz,
+                                  float gravityConstant, float softening) {
+    const size_t n = state.size();
+    const float* x = state.x.data();
+    const float* y = state.y.data();
+    const float* z = state.z.data();
+    const float* m = state.mass.data();
+
+    for(size_t i = iBegin; i < iEnd; i++) {
+        float xi = x[i], yi = y[i], zi = z[i];
+        float gmi = gravityConstant * m[i];
+        float fxi = 0.0f, fyi = 0.0f, fzi = 0.0f;
+
+        for(size_t j = i + 1; j < n; j++) {
+            float dx = x[j] - xi;
+            float dy = y[j] - yi;
+            float dz = z[j] - zi;
+            float dist2 = dx * dx + dy * dy + dz * dz;
+            if(dist2 < MIN_DISTANCE_SQ) continue;
+
+            // |F| / r, so that multiplying by the offset both scales and normalizes
+            float s = gmi * m[j] / (std::sqrt(dist2) * (dist2 + softening));
+            fxi += dx * s; fyi += dy * s; fzi += dz * s;
+            fx[j] -= dx * s; fy[j] -= dy * s; fz[j] -= dz * s;
+        }
+
+        fx[i] += fxi; fy[i] += fyi; fz[i] += fzi;
+    }
+}
+
+#if defined(__AVX512F__)
+
+void accumulateDirectForces(const BodyState& state, size_t iBegin, size_t iEnd,
+                            float* fx, float* fy, float* fz,
+                            float gravityConstant, float softening) {
+    const size_t n = state.size();
+    const float* x = state.x.data();
+    const float* y = state.y.data();
+    const float* z = state.z.data();
+    const float* m = state.mass.data();
+
+    const __m512 minDist2 = _mm512_set1_ps(MIN_DISTANCE_SQ);
+    const __m512 soft = _mm512_set1_ps(softening);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+
+    for(size_t i = iBegin; i < iEnd; i++) {
+        const __m512 xi = _mm512_set1_ps(x[i]);
+        const __m512 yi = _mm512_set1_ps(y[i]);
+        const __m512 zi = _mm512_set1_ps(z[i]);
+        const __m512 gmi = _mm512_set1_ps(gravityConstant * m[i]);
+        __m512 fxi = _mm512_setzero_ps(), fyi = _mm512_setzero_ps(), fzi = _mm512_setzero_ps();
+
+        size_t j = i + 1;
+        for(; j + 16 <= n; j += 16) {
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(z + j), zi);
+            __m512 dist2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+            __mmask16 valid = _mm512_cmp_ps_mask(dist2, minDist2, _CMP_GE_OQ);
+
+            // rsqrt14 refined by one Newton-Raphson step to full float precision
+            __m512 invR = _mm512_rsqrt14_ps(dist2);
+            invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, dist2),
+                                                        _mm512_mul_ps(invR, invR), threeHalves));
+            __m512 s = _mm512_div_ps(_mm512_mul_ps(gmi, _mm512_loadu_ps(m + j)),
+                                     _mm512_add_ps(dist2, soft));
+            s = _mm512_maskz_mul_ps(valid, s, invR);
+
+            __m512 px = _mm512_mul_ps(dx, s);
+            __m512 py = _mm512_mul_ps(dy, s);
+            __m512 pz = _mm512_mul_ps(dz, s);
+            fxi = _mm512_add_ps(fxi, px);
+            fyi = _mm512_add_ps(fyi, py);
+            fzi = _mm512_add_ps(fzi, pz);
+            _mm512_storeu_ps(fx + j, _mm512_sub_ps(_mm512_loadu_ps(fx + j), px));
+            _mm512_storeu_ps(fy + j, _mm512_sub_ps(_mm512_loadu_ps(fy + j), py));
+            _mm512_storeu_ps(fz + j, _mm512_sub_ps(_mm512_loadu_ps(fz + j), pz));
+        }
+
+        float fxs = _mm512_reduce_add_ps(fxi);
+        float fys = _mm512_reduce_add_ps(fyi);
+        float fzs = _mm512_reduce_add_ps(fzi);
+        float gmis = gravityConstant * m[i];
+        for(; j < n; j++) {
+            float dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+            float dist2 = dx * dx + dy * dy + dz * dz;
+            if(dist2 < MIN_DISTANCE_SQ) continue;
+            float s = gmis * m[j] / (std::sqrt(dist2) * (dist2 + softening));
+            fxs += dx * s; fys += dy * s; fzs += dz * s;
+            fx[j] -= dx * s; fy[j] -= dy * s; fz[j] -= dz * s;
+        }
+        fx[i] += fxs; fy[i] += fys; fz[i] += fzs;
+    }
+}
+
+const char* directKernelName() { return "AVX-512"; }
+
+#elif defined(__AVX2__)
+
+namespace {
+
+inline __m256 multiplyAdd(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+inline float horizontalSum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+}
+
+void accumulateDirectForces(const BodyState& state, size_t iBegin, size_t iEnd,
+                            float* fx, float* fy, float* fz,
+                            float gravityConstant, float softening) {
+    const size_t n = state.size();
+    const float* x = state.x.data();
+    const float* y = state.y.data();
+    const float* z = state.z.data();
+    const float* m = state.mass.data();
+
+    const __m256 minDist2 = _mm256_set1_ps(MIN_DISTANCE_SQ);
+    const __m256 soft = _mm256_set1_ps(softening);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+
+    for(size_t i = iBegin; i < iEnd; i++) {
+        const __m256 xi = _mm256_set1_ps(x[i]);
+        const __m256 yi = _mm256_set1_ps(y[i]);
+        const __m256 zi = _mm256_set1_ps(z[i]);
+        const __m256 gmi = _mm256_set1_ps(gravityConstant * m[i]);
+        __m256 fxi = _mm256_setzero_ps(), fyi = _mm256_setzero_ps(), fzi = _mm256_setzero_ps();
+
+        size_t j = i + 1;
+        for(; j + 8 <= n; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + j), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + j), zi);
+            __m256 dist2 = multiplyAdd(dx, dx, multiplyAdd(dy, dy, _mm256_mul_ps(dz, dz)));
+            __m256 valid = _mm256_cmp_ps(dist2, minDist2, _CMP_GE_OQ);
+
+            // 12-bit rsqrt estimate refined by one Newton-Raphson step
+            __m256 invR = _mm256_rsqrt_ps(dist2);
+            invR = _mm256_mul_ps(invR, _mm256_sub_ps(threeHalves,
+                                 _mm256_mul_ps(_mm256_mul_ps(half, dist2), _mm256_mul_ps(invR, invR))));
+            __m256 s = _mm256_div_ps(_mm256_mul_ps(gmi, _mm256_loadu_ps(m + j)),
+                                     _mm256_add_ps(dist2, soft));
+            s = _mm256_and_ps(_mm256_mul_ps(s, invR), valid);
+
+            __m256 px = _mm256_mul_ps(dx, s);
+            __m256 py = _mm256_mul_ps(dy, s);
+            __m256 pz = _mm256_mul_ps(dz, s);
+            fxi = _mm256_add_ps(fxi, px);
+            fyi = _mm256_add_ps(fyi, py);
+            fzi = _mm256_add_ps(fzi, pz);
+            _mm256_storeu_ps(fx + j, _mm256_sub_ps(_mm256_loadu_ps(fx + j), px));
+            _mm256_storeu_ps(fy + j, _mm256_sub_ps(_mm256_loadu_ps(fy + j), py));
+            _mm256_storeu_ps(fz + j, _mm256_sub_ps(_mm256_loadu_ps(fz + j), pz));
+        }
+
+        float fxs = horizontalSum(fxi);
+        float fys = horizontalSum(fyi);
+        float fzs = horizontalSum(fzi);
+        float gmis = gravityConstant * m[i];
+        for(; j < n; j++) {
+            float dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+            float dist2 = dx * dx + dy * dy + dz * dz;
+            if(dist2 < MIN_DISTANCE_SQ) continue;
+            float s = gmis * m[j] / (std::sqrt(dist2) * (dist2 + softening));
+            fxs += dx * s; fys += dy * s; fzs += dz * s;
+            fx[j] -= dx * s; fy[j] -= dy * s; fz[j] -= dz * s;
+        }
+        fx[i] += fxs; fy[i] += fys; fz[i] += fzs;
+    }
+}
+
+const char* directKernelName() { return "AVX2"; }
+
+#else
+
+void accumulateDirectForces(const BodyState& state, size_t iBegin, size_t iEnd,
+                            float* fx, float* fy, float* fz,
+                            float gravityConstant, float softening) {
+    accumulateDirectForcesScalar(state, iBegin, iEnd, fx, fy, fz, gravityConstant, softening);
+}
+
+const char* directKernelName() { return "Scalar"; }
+
+#endif
+
+void computeDirectForces(BodyState& state, float gravityConstant, float softening) {
+    std::fill(state.fx.begin(), state.fx.end(), 0.0f);
+    std::fill(state.fy.begin(), state.fy.end(), 0.0f);
+    std::fill(state.fz.begin(), state.fz.end(), 0.0f);
+    accumulateDirectForces(state, 0, state.size(),
+                           state.fx.data(), state.fy.data(), state.fz.data(),
+                           gravityConstant, softening);
+}
+
+void computeDirectForcesParallel(BodyState& state, float gravityConstant, float softening,
+                                 ThreadPool& pool, DirectForceScratch& scratch) {
+    const size_t n = state.size();
+    size_t taskCount = std::min<size_t>(pool.threadCount() * 4, n / 16);
+    if(taskCount <= 1) {
+        computeDirectForces(state, gravityConstant, softening);
+        return;
+    }
+
+    // Row i owns n - 1 - i pairs, so equal-work splits follow a square root:
+    // the rows from i to n hold a fraction (1 - i/n)^2 of all pairs.
+    scratch.rowBegin.resize(taskCount + 1);
+    for(size_t t = 0; t <= taskCount; t++) {
+        double remaining = 1.0 - (double)t / taskCount;
+        size_t row = (size_t)(n * (1.0 - std::sqrt(remaining)));
+        scratch.rowBegin[t] = std::min(n, row);
+    }
+    scratch.rowBegin[taskCount] = n;
+
+    scratch.fx.resize(taskCount * n);
+    scratch.fy.resize(taskCount * n);
+    scratch.fz.resize(taskCount * n);
+
+    // A task covering rows [b, e) only writes indices >= b
+    pool.run(taskCount, [&](size_t t) {
+        size_t b = scratch.rowBegin[t];
+        size_t e = scratch.rowBegin[t + 1];
+        float* px = scratch.fx.data() + t * n;
+        float* py = scratch.fy.data() + t * n;
+        float* pz = scratch.fz.data() + t * n;
+        std::fill(px + b, px + n, 0.0f);
+        std::fill(py + b, py + n, 0.0f);
+        std::fill(pz + b, pz + n, 0.0f);
+        accumulateDirectForces(state, b, e, px, py, pz, gravityConstant, softening);
+    });
+
+    pool.parallelFor(0, n, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+            for(size_t t = 0; t < taskCount && scratch.rowBegin[t] <= i; t++) {
+                sx += scratch.fx[t * n + i];
+                sy += scratch.fy[t * n + i];
+                sz += scratch.fz[t * n + i];
+            }
+            state.fx[i] = sx;
+            state.fy[i] = sy;
+            state.fz[i] = sz;
+        }
+    });
+}
+
+namespace {
+
+#if defined(__AVX512F__)
+
+// AVX-512F brings FMA only for 512-bit vectors; the 256-bit forms need __FMA__
+inline __m256 multiplyAdd256(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+inline __m256 negativeMultiplyAdd256(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__)
+    return _mm256_fnmadd_ps(a, b, c);
+#else
+    return _mm256_sub_ps(c, _mm256_mul_ps(a, b));
+#endif
+}
+
+// Pairs (i, j) for j from `j` in blocks of 8, adding body i's share to
+// fxi/fyi/fzi. Returns the first j left for the scalar tail.
+// Mixed: offsets in double, pair terms in float, sums in double.
+size_t accumulatePreciseRow(MixedPrecision, const PreciseState& state, size_t i, size_t j,
+                            double* fx, double* fy, double* fz, double& fxi, double& fyi, double& fzi,
+                            float gravityConstant, float softening) {
+    const size_t n = state.size();
+    const double* x = state.x.data();
+    const double* y = state.y.data();
+    const double* z = state.z.data();
+    const float* m = state.mass.data();
+
+    const __m512d xi = _mm512_set1_pd(x[i]);
+    const __m512d yi = _mm512_set1_pd(y[i]);
+    const __m512d zi = _mm512_set1_pd(z[i]);
+    const __m256 gmi = _mm256_set1_ps(gravityConstant * m[i]);
+    const __m256 minDist2 = _mm256_set1_ps(MIN_DISTANCE_SQ);
+    const __m256 soft = _mm256_set1_ps(softening);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    __m512d sx = _mm512_setzero_pd(), sy = _mm512_setzero_pd(), sz = _mm512_setzero_pd();
+
+    for(; j + 8 <= n; j += 8) {
+        __m256 dx = _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_loadu_pd(x + j), xi));
+        __m256 dy = _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_loadu_pd(y + j), yi));
+        __m256 dz = _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_loadu_pd(z + j), zi));
+        __m256 dist2 = multiplyAdd256(dx, dx, multiplyAdd256(dy, dy, _mm256_mul_ps(dz, dz)));
+        __m256 valid = _mm256_cmp_ps(dist2, minDist2, _CMP_GE_OQ);
+
+        // rsqrt refined by one Newton-Raphson step, as in the float kernel
+        __m256 invR = _mm256_rsqrt_ps(dist2);
+        invR = _mm256_mul_ps(invR, negativeMultiplyAdd256(_mm256_mul_ps(half, dist2),
+                                                          _mm256_mul_ps(invR, invR), threeHalves));
+        __m256 s = _mm256_div_ps(_mm256_mul_ps(gmi, _mm256_loadu_ps(m + j)), _mm256_add_ps(dist2, soft));
+        s = _mm256_and_ps(valid, _mm256_mul_ps(s, invR));
+
+        __m512d px = _mm512_cvtps_pd(_mm256_mul_ps(dx, s));
+        __m512d py = _mm512_cvtps_pd(_mm256_mul_ps(dy, s));
+        __m512d pz = _mm512_cvtps_pd(_mm256_mul_ps(dz, s));
+        sx = _mm512_add_pd(sx, px);
+        sy = _mm512_add_pd(sy, py);
+        sz = _mm512_add_pd(sz, pz);
+        _mm512_storeu_pd(fx + j, _mm512_sub_pd(_mm512_loadu_pd(fx + j), px));
+        _mm512_storeu_pd(fy + j, _mm512_sub_pd(_mm512_loadu_pd(fy + j), py));
+        _mm512_storeu_pd(fz + j, _mm512_sub_pd(_mm512_loadu_pd(fz + j), pz));
+    }
+
+    fxi += _mm512_reduce_add_pd(sx);
+    fyi += _mm512_reduce_add_pd(sy);
+    fzi += _mm512_reduce_add_pd(sz);
+    return j;
+}
+
+// Double: everything in double, with a true square root and division
+size_t accumulatePreciseRow(DoublePrecision, const PreciseState& state, size_t i, size_t j,
+                            double* fx, double* fy, double* fz, double& fxi, double& fyi, double& fzi,
+                            float gravityConstant, float softening) {
+    const size_t n = state.size();
+    const double* x = state.x.data();
+    const double* y = state.y.data();
+    const double* z = state.z.data();
+    const float* m = state.mass.data();
+
+    const __m512d xi = _mm512_set1_pd(x[i]);
+    const __m512d yi = _mm512_set1_pd(y[i]);
+    const __m512d zi = _mm512_set1_pd(z[i]);
+    const __m512d gmi = _mm512_set1_pd((double)gravityConstant * m[i]);
+    const __m512d minDist2 = _mm512_set1_pd(MIN_DISTANCE_SQ);
+    const __m512d soft = _mm512_set1_pd(softening);
+    __m512d sx = _mm512_setzero_pd(), sy = _mm512_setzero_pd(), sz = _mm512_setzero_pd();
+
+    for(; j + 8 <= n; j += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), xi);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), yi);
+        __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z + j), zi);
+        __m512d dist2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+        __mmask8 valid = _mm512_cmp_pd_mask(dist2, minDist2, _CMP_GE_OQ);
+
+        __m512d mj = _mm512_cvtps_pd(_mm256_loadu_ps(m + j));
+        __m512d s = _mm512_div_pd(_mm512_mul_pd(gmi, mj),
+                                  _mm512_mul_pd(_mm512_sqrt_pd(dist2), _mm512_add_pd(dist2, soft)));
+        s = _mm512_maskz_mov_pd(valid, s);
+
+        __m512d px = _mm512_mul_pd(dx, s);
+        __m512d py = _mm512_mul_pd(dy, s);
+        __m512d pz = _mm512_mul_pd(dz, s);
+        sx = _mm512_add_pd(sx, px);
+        sy = _mm512_add_pd(sy, py);
+        sz = _mm512_add_pd(sz, pz);
+        _mm512_storeu_pd(fx + j, _mm512_sub_pd(_mm512_loadu_pd(fx + j), px));
+        _mm512_storeu_pd(fy + j, _mm512_sub_pd(_mm512_loadu_pd(fy + j), py));
+        _mm512_storeu_pd(fz + j, _mm512_sub_pd(_mm512_loadu_pd(fz + j), pz));
+    }
+
+    fxi += _mm512_reduce_add_pd(sx);
+    fyi += _mm512_reduce_add_pd(sy);
+    fzi += _mm512_reduce_add_pd(sz);
+    return j;
+}
+
+#endif
+
+// Same pairs and law as accumulateDirectForcesScalar, with the types of the
+// policy. Uses the AVX-512 rows above when available; the scalar loop then
+// only covers the last few bodies of each row.
+template<typename Policy>
+void accumulatePreciseForces(const PreciseState& state, size_t iBegin, size_t iEnd,
+                             double* fx, double* fy, double* fz,
+                             float gravityConstant, float softening) {
+    using Real = typename Policy::Real;
+    using Accum = typename Policy::Accum;
+    const size_t n = state.size();
+    const double* x = state.x.data();
+    const double* y = state.y.data();
+    const double* z = state.z.data();
+    const float* m = state.mass.data();
+
+    for(size_t i = iBegin; i < iEnd; i++) {
+        double xi = x[i], yi = y[i], zi = z[i];
+        Real gmi = (Real)gravityConstant * (Real)m[i];
+        Accum fxi = 0, fyi = 0, fzi = 0;
+
+        size_t j = i + 1;
+#if defined(__AVX512F__)
+        j = accumulatePreciseRow(Policy(), state, i, j, fx, fy, fz, fxi, fyi, fzi, gravityConstant, softening);
+#endif
+        for(; j < n; j++) {
+            // Offsets between nearby bodies keep their digits in double
+            // before any rounding to Real
+            Real dx = (Real)(x[j] - xi);
+            Real dy = (Real)(y[j] - yi);
+            Real dz = (Real)(z[j] - zi);
+            Real dist2 = dx * dx + dy * dy + dz * dz;
+            if(dist2 < (Real)MIN_DISTANCE_SQ) continue;
+            Real s = gmi * (Real)m[j] / (std::sqrt(dist2) * (dist2 + (Real)softening));
+            Accum px = (Accum)(dx * s), py = (Accum)(dy * s), pz = (Accum)(dz * s);
+            fxi += px; fyi += py; fzi += pz;
+            fx[j] -= px; fy[j] -= py; fz[j] -= pz;
+        }
+
+        fx[i] += fxi; fy[i] += fyi; fz[i] += fzi;
+    }
+}
+
+}
+
+template<typename Policy>
+void computePreciseDirectForces(PreciseState& state, float gravityConstant, float softening,
+                                ThreadPool* pool, PreciseForceScratch& scratch) {
+    const size_t n = state.size();
+    size_t taskCount = pool ? std::min<size_t>(pool->threadCount() * 4, n / 16) : 0;
+    if(taskCount <= 1) {
+        std::fill(state.fx.begin(), state.fx.end(), 0.0);
+        std::fill(state.fy.begin(), state.fy.end(), 0.0);
+        std::fill(state.fz.begin(), state.fz.end(), 0.0);
+        accumulatePreciseForces<Policy>(state, 0, n, state.fx.data(), state.fy.data(), state.fz.data(),
+                                        gravityConstant, softening);
+        return;
+    }
+
+    // Equal-pair row split, as in computeDirectForcesParallel
+    scratch.rowBegin.resize(taskCount + 1);
+    for(size_t t = 0; t <= taskCount; t++) {
+        double remaining = 1.0 - (double)t / taskCount;
+        size_t row = (size_t)(n * (1.0 - std::sqrt(remaining)));
+        scratch.rowBegin[t] = std::min(n, row);
+    }
+    scratch.rowBegin[taskCount] = n;
+
+    scratch.fx.resize(taskCount * n);
+    scratch.fy.resize(taskCount * n);
+    scratch.fz.resize(taskCount * n);
+
+    pool->run(taskCount, [&](size_t t) {
+        size_t b = scratch.rowBegin[t];
+        size_t e = scratch.rowBegin[t + 1];
+        double* px = scratch.fx.data() + t * n;
+        double* py = scratch.fy.data() + t * n;
+        double* pz = scratch.fz.data() + t * n;
+        std::fill(px + b, px + n, 0.0);
+        std::fill(py + b, py + n, 0.0);
+        std::fill(pz + b, pz + n, 0.0);
+        accumulatePreciseForces<Policy>(state, b, e, px, py, pz, gravityConstant, softening);
+    });
+
+    pool->parallelFor(0, n, 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            double sx = 0.0, sy = 0.0, sz = 0.0;
+            for(size_t t = 0; t < taskCount && scratch.rowBegin[t] <= i; t++) {
+                sx += scratch.fx[t * n + i];
+                sy += scratch.fy[t * n + i];
+                sz += scratch.fz[t * n + i];
+            }
+            state.fx[i] = sx;
+            state.fy[i] = sy;
+            state.fz[i] = sz;
+        }
+    });
+}
+
+template void computePreciseDirectForces<MixedPrecision>(PreciseState&, float, float, ThreadPool*, PreciseForceScratch&);
+template void computePreciseDirectForces<DoublePrecision>(PreciseState&, float, float, ThreadPool*, PreciseForceScratch&);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "BodyState.h"
+#include "Precision.h"
+
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+// Pairwise direct-sum kernels over SoA body state. Each unordered pair (i, j)
+// is evaluated once and applied to both bodies (Newton's third law), using the
+// same softened law as the rest of the simulation:
+//   F = G * mi * mj / (r^2 + softening), pairs closer than 0.001 are skipped.
+
+// Accumulates forces for every pair (i, j) with iBegin <= i < iEnd and j > i
+// into fx/fy/fz. The caller zeroes the outputs; passing separate output arrays
+// lets several ranges be evaluated independently and summed afterwards.
+void accumulateDirectForces(const BodyState& state, size_t iBegin, size_t iEnd,
+                            float* fx, float* fy, float* fz,
+                            float gravityConstant, float softening);
+
+// Portable reference version of accumulateDirectForces
+void accumulateDirectForcesScalar(const BodyState& state, size_t iBegin, size_t iEnd,
+                                  float* fx, float* fy, float* fz,
+                                  float gravityConstant, float softening);
+
+// Overwrites state.fx/fy/fz with the full direct-sum forces
+void computeDirectForces(BodyState& state, float gravityConstant, float softening);
+
+// Per-task partial force buffers reused by computeDirectForcesParallel
+struct DirectForceScratch {
+    FloatArray fx, fy, fz;
+    std::vector<size_t> rowBegin;
+};
+
+// Parallel version of computeDirectForces. Rows are split into tasks of equal
+// pair count; each task accumulates into its own partial buffer, and the
+// partials are summed in task order, so results are bit-identical from run to
+// run for a given thread count.
+void computeDirectForcesParallel(BodyState& state, float gravityConstant, float softening,
+                                 ThreadPool& pool, DirectForceScratch& scratch);
+
+// Per-task partial force buffers reused by computePreciseDirectForces
+struct PreciseForceScratch {
+    DoubleArray fx, fy, fz;
+    std::vector<size_t> rowBegin;
+};
+
+// Direct sum on a PreciseState under a precision policy: offsets are taken
+// between the double positions, each pair term is computed in Policy::Real
+// and summed in Policy::Accum. Overwrites state.fx/fy/fz. Split into tasks
+// and reduced in task order like computeDirectForcesParallel; runs on the
+// calling thread when pool is null. Instantiated for MixedPrecision and
+// DoublePrecision.
+template<typename Policy>
+void computePreciseDirectForces(PreciseState& state, float gravityConstant, float softening,
+                                ThreadPool* pool, PreciseForceScratch& scratch);
+
+// Name of the instruction set the SIMD kernel was compiled for
+const char* directKernelName();
@@ -0,0 +1,67 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <new>
+
+namespace {
+
+const size_t ALIGNMENT = 64;
+
+}
+
+FrameArena::FrameArena(size_t blockBytes) : blockBytes(blockBytes) {}
+
+FrameArena::~FrameArena() {
+    for(const Block& block : blocks) ::operator delete(block.data, std::align_val_t(ALIGNMENT));
+}
+
+void* FrameArena::allocateBytes(size_t bytes) {
+    bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    while(current < blocks.size()) {
+        if(offset + bytes <= blocks[current].size) {
+            void* p = blocks[current].data + offset;
+            offset += bytes;
+            highWater = std::max(highWater, usedBytes());
+            return p;
+        }
+        // Later blocks were kept from earlier frames
+        if(current + 1 < blocks.size() && blocks[current + 1].size >= bytes) {
+            current++;
+            offset = 0;
+            continue;
+        }
+        break;
+    }
+
+    // Only while the arena is still growing
+    size_t size = std::max(blockBytes, bytes);
+    Block block = { static_cast<char*>(::operator new(size, std::align_val_t(ALIGNMENT))), size };
+    size_t position = blocks.empty() ? 0 : current + 1;
+    blocks.insert(blocks.begin() + position, block);
+    current = position;
+    offset = bytes;
+    highWater = std::max(highWater, usedBytes());
+    return block.data;
+}
+
+void FrameArena::rewind(const Marker& marker) {
+    current = marker.block;
+    offset = marker.offset;
+}
+
+size_t FrameArena::usedBytes() const {
+    size_t used = offset;
+    for(size_t b = 0; b < current && b < blocks.size(); b++) used += blocks[b].size;
+    return used;
+}
+
+size_t FrameArena::capacityBytes() const {
+    size_t capacity = 0;
+    for(const Block& block : blocks) capacity += block.size;
+    return capacity;
+}
+
+FrameArena& threadArena() {
+    thread_local FrameArena arena;
+    return arena;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for scratch that lives for one frame, one step or one task.
+// Memory comes from a chain of blocks that are kept when the arena is reset,
+// so once the blocks have grown to cover the largest frame, allocating from
+// the arena never touches the heap. Only for trivially destructible types;
+// nothing is constructed or destroyed.
+//
+// Not thread safe. Each thread has its own arena through threadArena(), for
+// scratch inside thread pool tasks:
+//
+//   ArenaScope scope;
+//   float* row = scope.allocate<float>(n);
+//
+// gives back everything the scope allocated when it ends.
+class FrameArena {
+public:
+    struct Marker {
+        size_t block;
+        size_t offset;
+    };
+
+    explicit FrameArena(size_t blockBytes = 1 << 20);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Uninitialized, aligned to a cache line
+    template<typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destroyed");
+        return static_cast<T*>(allocateBytes(count * sizeof(T)));
+    }
+    void* allocateBytes(size_t bytes);
+
+    Marker mark() const { return { current, offset }; }
+    // Frees everything allocated after the marker
+    void rewind(const Marker& marker);
+    void reset() { rewind({ 0, 0 }); }
+
+    size_t usedBytes() const;
+    size_t capacityBytes() const;
+    size_t highWaterBytes() const { return highWater; }
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0;  // Block being bumped
+    size_t offset = 0;   // Bytes used in it
+    size_t blockBytes;
+    size_t highWater = 0;
+};
+
+// The calling thread's arena
+FrameArena& threadArena();
+
+// Allocates from an arena and rewinds it to where it was on destruction
+class ArenaScope {
+public:
+    explicit ArenaScope(FrameArena& arena = threadArena()) : arena(arena), marker(arena.mark()) {}
+    ~ArenaScope() { arena.rewind(marker); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    template<typename T>
+    T* allocate(size_t count) { return arena.allocate<T>(count); }
+
+private:
+    FrameArena& arena;
+    FrameArena::Marker marker;
+};
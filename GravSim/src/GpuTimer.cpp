@@ -0,0 +1,98 @@
+#include "GpuTimer.h"
+
+#if GRAVSIM_PROFILER
+
+namespace {
+
+// GL and steady_clock drift apart slowly; re-measure the offset this often
+const uint64_t CALIBRATION_INTERVAL = 2000000000ull;
+// Passes waiting on the GPU beyond this are dropped unread
+const size_t MAX_PENDING = 256;
+
+}
+
+void GpuTimer::init(const char* trackName) {
+    track = createProfileTrack(trackName);
+    pending.assign(MAX_PENDING, Pass{ nullptr, 0, 0 });
+    pendingFirst = 0;
+    pendingCount = 0;
+    calibrate();
+}
+
+void GpuTimer::release() {
+    end();
+    for(size_t k = 0; k < pendingCount; k++) {
+        const Pass& pass = pending[(pendingFirst + k) % pending.size()];
+        idleQueries.push_back(pass.startQuery);
+        idleQueries.push_back(pass.endQuery);
+    }
+    pendingCount = 0;
+    if(!idleQueries.empty()) glDeleteQueries((GLsizei)idleQueries.size(), idleQueries.data());
+    idleQueries.clear();
+}
+
+// glGetInteger64v(GL_TIMESTAMP) waits for commands issued so far to reach
+// the GPU, not to finish, so the offset is off by at most that latency
+void GpuTimer::calibrate() {
+    GLint64 glTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &glTime);
+    lastCalibration = profileNow();
+    clockOffset = (int64_t)lastCalibration - (int64_t)glTime;
+}
+
+GLuint GpuTimer::takeQuery() {
+    if(idleQueries.empty()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        return query;
+    }
+    GLuint query = idleQueries.back();
+    idleQueries.pop_back();
+    return query;
+}
+
+void GpuTimer::begin(const char* name) {
+    end();
+    open.name = name;
+    open.startQuery = takeQuery();
+    open.endQuery = takeQuery();
+    glQueryCounter(open.startQuery, GL_TIMESTAMP);
+}
+
+void GpuTimer::end() {
+    if(!open.name) return;
+    glQueryCounter(open.endQuery, GL_TIMESTAMP);
+    if(pendingCount == pending.size()) {
+        idleQueries.push_back(pending[pendingFirst].startQuery);
+        idleQueries.push_back(pending[pendingFirst].endQuery);
+        pendingFirst = (pendingFirst + 1) % pending.size();
+        pendingCount--;
+    }
+    pending[(pendingFirst + pendingCount) % pending.size()] = open;
+    pendingCount++;
+    open.name = nullptr;
+}
+
+void GpuTimer::collect() {
+    // Queries complete in submission order, so stop at the first unfinished one
+    while(pendingCount > 0) {
+        const Pass& pass = pending[pendingFirst];
+        GLint available = 0;
+        glGetQueryObjectiv(pass.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) break;
+        GLuint64 start = 0, finish = 0;
+        glGetQueryObjectui64v(pass.startQuery, GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(pass.endQuery, GL_QUERY_RESULT, &finish);
+        int64_t shifted = (int64_t)start + clockOffset;
+        if(shifted >= 0 && finish >= start) {
+            recordProfileEvent(track, pass.name, (uint64_t)shifted, finish - start, 0);
+        }
+        idleQueries.push_back(pass.startQuery);
+        idleQueries.push_back(pass.endQuery);
+        pendingFirst = (pendingFirst + 1) % pending.size();
+        pendingCount--;
+    }
+    if(profileNow() - lastCalibration > CALIBRATION_INTERVAL) calibrate();
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <glad/glad.h>
+
+#include <vector>
+
+// Times draw passes on the GPU with GL timestamp queries. Queries are read
+// back a few frames later, once the GPU has reached them, so the CPU never
+// waits. Finished passes land on their own profiler track, moved onto the
+// profiler's clock. With GRAVSIM_PROFILER=0 every call is empty.
+class GpuTimer {
+public:
+#if GRAVSIM_PROFILER
+    // Needs a current GL context
+    void init(const char* trackName);
+    void release();
+
+    // Passes don't nest; begin() while a pass is open ends it first
+    void begin(const char* name);
+    void end();
+    // Records every pass the GPU has finished; call once a frame
+    void collect();
+#else
+    void init(const char*) {}
+    void release() {}
+    void begin(const char*) {}
+    void end() {}
+    void collect() {}
+#endif
+
+private:
+    struct Pass {
+        const char* name;
+        GLuint startQuery, endQuery;
+    };
+
+    void calibrate();
+    GLuint takeQuery();
+
+    uint32_t track = 0;
+    int64_t clockOffset = 0;     // Profiler time minus GL time, in nanoseconds
+    uint64_t lastCalibration = 0;
+    std::vector<GLuint> idleQueries;
+    std::vector<Pass> pending;   // Ring of passes waiting on the GPU, oldest at pendingFirst
+    size_t pendingFirst = 0;
+    size_t pendingCount = 0;
+    Pass open = { nullptr, 0, 0 };
+};
@@ -0,0 +1,126 @@
+#include "GridRenderer.h"
+#include "RenderState.h"
+#include "Shader.h"
+
+namespace {
+
+const char* gridVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec2 aXZ;
+layout (location = 1) in float aDepth;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+uniform float depthScale;
+
+void main() {
+    gl_Position = projection * view * vec4(aXZ.x, -depthScale * aDepth, aXZ.y, 1.0);
+}
+)";
+
+const char* gridFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+uniform vec3 lineColor;
+
+void main() {
+    FragColor = vec4(lineColor, 1.0);
+}
+)";
+
+const GLuint RESTART_INDEX = 0xFFFFFFFFu;
+
+}
+
+void GridRenderer::init(RenderState& renderState) {
+    state = &renderState;
+    program = createShaderProgram(gridVertexShaderSource, gridFragmentShaderSource);
+    state->attachCamera(program);
+    depthScaleLocation = glGetUniformLocation(program, "depthScale");
+    colorLocation = glGetUniformLocation(program, "lineColor");
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &positionBuffer);
+    glGenBuffers(1, &depthBuffer);
+    glGenBuffers(1, &indexBuffer);
+
+    state->bindVertexArray(vao);
+    state->bindArrayBuffer(positionBuffer);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    state->bindArrayBuffer(depthBuffer);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    state->bindVertexArray(0);
+    glPrimitiveRestartIndex(RESTART_INDEX);
+}
+
+void GridRenderer::release() {
+    GLuint buffers[] = { positionBuffer, depthBuffer, indexBuffer };
+    glDeleteBuffers(3, buffers);
+    if(vao) glDeleteVertexArrays(1, &vao);
+    if(program) glDeleteProgram(program);
+    positionBuffer = depthBuffer = indexBuffer = vao = program = 0;
+    gridResolution = 0;
+}
+
+void GridRenderer::setResolution(int resolution, float size) {
+    if(resolution == gridResolution) return;
+    gridResolution = resolution;
+    int side = resolution + 1;
+    float step = size / resolution;
+
+    std::vector<float> positions;
+    positions.reserve((size_t)side * side * 2);
+    for(int i = 0; i < side; i++) {
+        for(int j = 0; j < side; j++) {
+            positions.push_back(-size / 2 + i * step);
+            positions.push_back(-size / 2 + j * step);
+        }
+    }
+
+    // One strip per row and per column of vertices
+    std::vector<GLuint> indices;
+    indices.reserve((size_t)2 * side * (side + 1));
+    for(int i = 0; i < side; i++) {
+        for(int j = 0; j < side; j++) indices.push_back(i * side + j);
+        indices.push_back(RESTART_INDEX);
+    }
+    for(int j = 0; j < side; j++) {
+        for(int i = 0; i < side; i++) indices.push_back(i * side + j);
+        indices.push_back(RESTART_INDEX);
+    }
+    indexCount = (GLsizei)indices.size();
+
+    state->bindVertexArray(vao);
+    state->bindArrayBuffer(positionBuffer);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), positions.data(), GL_STATIC_DRAW);
+    state->bindArrayBuffer(depthBuffer);
+    std::vector<float> flat((size_t)side * side, 0.0f);
+    glBufferData(GL_ARRAY_BUFFER, flat.size() * sizeof(float), flat.data(), GL_DYNAMIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    state->bindVertexArray(0);
+}
+
+void GridRenderer::updateDepth(const std::vector<float>& depth) {
+    size_t side = (size_t)gridResolution + 1;
+    if(depth.size() != side * side) return;
+    state->bindArrayBuffer(depthBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, depth.size() * sizeof(float), depth.data());
+}
+
+void GridRenderer::draw(float depthScale, const glm::vec3& color) {
+    if(gridResolution == 0) return;
+    state->useProgram(program);
+    state->setUniform(depthScaleLocation, depthScale);
+    state->setUniform(colorLocation, color);
+    state->bindVertexArray(vao);
+    // Left on; no other index buffer uses the restart index
+    state->setEnabled(GL_PRIMITIVE_RESTART, true);
+    glDrawElements(GL_LINE_STRIP, indexCount, GL_UNSIGNED_INT, 0);
+    state->countDraw();
+}
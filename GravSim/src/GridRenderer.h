@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class RenderState;
+
+// Line mesh for the space-time grid. The XZ positions and the row and column
+// line strips (split by primitive restart) are built once per resolution;
+// per update only the depth of each vertex is uploaded, and the dip is
+// scaled in the vertex shader so changing its strength costs nothing.
+class GridRenderer {
+public:
+    // Both need a current GL context
+    void init(RenderState& renderState);
+    void release();
+
+    // Vertices per side are resolution + 1 over a size x size square
+    void setResolution(int resolution, float size);
+    int resolution() const { return gridResolution; }
+
+    // Depth per vertex in SpaceTimeGrid::depth() order
+    void updateDepth(const std::vector<float>& depth);
+
+    // Vertex height is -depthScale * depth; the view comes from the camera block
+    void draw(float depthScale, const glm::vec3& color);
+
+private:
+    RenderState* state = nullptr;
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint positionBuffer = 0;
+    GLuint depthBuffer = 0;
+    GLuint indexBuffer = 0;
+    GLsizei indexCount = 0;
+    int gridResolution = 0;
+
+    GLint depthScaleLocation = -1;
+    GLint colorLocation = -1;
+};
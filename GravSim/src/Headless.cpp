@@ -0,0 +1,467 @@
+#include "AllocationTracker.h"
+#include "CsvIO.h"
+#include "Ensemble.h"
+#include "Profiler.h"
+#include "Scenario.h"
+#include "Simulation.h"
+#include "SnapshotFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// gravsim-headless: runs the physics core without a window, for compute
+// nodes and CI. Prints the step rate and conservation errors at the end and
+// optionally writes the bodies to CSV every few steps or records the run to
+// a binary .gsnap file. With --ensemble it instead runs many perturbed
+// copies of a small system side by side and writes a summary per copy.
+
+namespace {
+
+struct Options {
+    int preset = 0;
+    int bodyCount = 15;
+    int seed = -1;
+    int generator = -1;
+    std::string input;
+    std::string resume;
+    long long steps = 1000;
+    long long snapshotInterval = 0;
+    std::string outputDir = ".";
+    int reportInterval = 0;
+    std::string recordPath;
+    long long recordInterval = 1;
+    int recordBuffers = 4;
+    bool recordQuantized = false;
+    std::string tracePath;
+    int threads = (int)ThreadPool::hardwareThreads();
+    SimulationParams params;
+    size_t ensembleMembers = 0;
+    float maxTime = -1.0f;   // Ensemble time limit, steps * dt when negative
+    float ejectionRadius = 0.0f;
+    bool collisionStop = true;
+    float positionJitter = 0.0f;
+    float velocityJitter = 0.0f;
+    float softeningMax = -1.0f; // No sweep when negative
+    std::string ensembleOutput = "ensemble.csv";
+};
+
+void printUsage(const char* program) {
+    std::printf(
+        "Usage: %s [options]\n"
+        "  --preset N          0 Earth-Sun, 1 Binary, 2 Three Body, 3 Asteroid Field (default 0)\n"
+        "  --bodies N          Body count for the Asteroid Field preset or a generator (default 15)\n"
+        "  --seed N            Random seed for the Asteroid Field preset or a generator (default: random)\n"
+        "  --generate NAME     plummer | disk | galaxies instead of a preset\n"
+        "  --input FILE        Load bodies from a CSV file, or the first frame of a .gsnap\n"
+        "  --resume FILE       Continue from the last frame of a .gsnap recording\n"
+        "  --steps N           Fixed steps to run (default 1000)\n"
+        "  --dt SECONDS        Fixed step size (default 0.016)\n"
+        "  --substeps N        Substeps per fixed step (default 1)\n"
+        "  --solver NAME       direct | barnes-hut | pm (default direct)\n"
+        "  --theta X           Barnes-Hut opening angle (default 0.5)\n"
+        "  --mesh N            Particle-mesh FFT size, power of two up to 256 (default 128)\n"
+        "  --no-p3m            Particle-mesh without the short-range correction\n"
+        "  --integrator NAME   euler | leapfrog | yoshida | hermite (default euler)\n"
+        "  --block-timesteps   Per-body block timesteps for Hermite\n"
+        "  --precision NAME    float | mixed | double (default float)\n"
+        "  --order NAME        none | morton | hilbert: keep bodies sorted along a\n"
+        "                      space-filling curve (default none)\n"
+        "  --collisions NAME   none | merge | bounce | absorb (default none)\n"
+        "  --gravity X         Gravity constant (default 1000)\n"
+        "  --softening X       Softening factor (default 1)\n"
+        "  --threads N         Physics threads (default: all hardware threads)\n"
+        "  --snapshot-every N  Write bodies to CSV every N steps (default 0, off)\n"
+        "  --output DIR        Directory for snapshots (default .)\n"
+        "  --report-every N    Print progress every N steps (default 0, off)\n"
+        "  --record FILE       Record the run to a binary .gsnap file\n"
+        "  --record-every N    Steps between recorded frames (default 1)\n"
+        "  --record-buffers N  Frames queued for the background writer, 0 to write\n"
+        "                      synchronously (default 4)\n"
+        "  --quantize          Record 16-bit quantized frames, half the size\n"
+        "  --trace FILE        Write the timed phases of the run as Chrome trace JSON\n"
+        "Ensembles (leapfrog, the preset, input or generated system as the base):\n"
+        "  --ensemble N        Run N perturbed copies of a system of up to 16 bodies\n"
+        "  --max-time T        Simulated time limit per copy (default: steps * dt)\n"
+        "  --eject-radius R    Stop a copy when a body is this far from its center of\n"
+        "                      mass (default 0, off)\n"
+        "  --no-collision-stop Keep integrating copies whose bodies touch\n"
+        "  --jitter-position X Uniform offset of up to X per position component\n"
+        "  --jitter-velocity X Uniform offset of up to X times each body's speed per\n"
+        "                      velocity component\n"
+        "  --softening-max X   Sweep the softening from --softening to X across copies\n"
+        "  --ensemble-out FILE Summary CSV, one line per copy (default ensemble.csv)\n",
+        program);
+}
+
+int parseIndex(const char* name, const char* const* names, int count) {
+    for(int i = 0; i < count; i++) {
+        if(std::strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    const char* solverNames[] = { "direct", "barnes-hut", "pm" };
+    const char* integratorNames[] = { "euler", "leapfrog", "yoshida", "hermite" };
+    const char* precisionNames[] = { "float", "mixed", "double" };
+    const char* orderingNames[] = { "none", "morton", "hilbert" };
+    const char* collisionNames[] = { "none", "merge", "bounce", "absorb" };
+    const char* generatorNames[] = { "plummer", "disk", "galaxies" };
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            std::exit(0);
+        }
+        if(arg == "--block-timesteps") {
+            options.params.blockTimesteps = true;
+            continue;
+        }
+        if(arg == "--no-p3m") {
+            options.params.shortRangeCorrection = false;
+            continue;
+        }
+        if(arg == "--quantize") {
+            options.recordQuantized = true;
+            continue;
+        }
+        if(arg == "--no-collision-stop") {
+            options.collisionStop = false;
+            continue;
+        }
+        if(i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        if(arg == "--preset") options.preset = std::atoi(value);
+        else if(arg == "--bodies") options.bodyCount = std::atoi(value);
+        else if(arg == "--seed") options.seed = std::atoi(value);
+        else if(arg == "--input") options.input = value;
+        else if(arg == "--resume") options.resume = value;
+        else if(arg == "--steps") options.steps = std::atoll(value);
+        else if(arg == "--dt") options.params.timeStep = (float)std::atof(value);
+        else if(arg == "--substeps") options.params.substeps = std::atoi(value);
+        else if(arg == "--theta") options.params.barnesHutTheta = (float)std::atof(value);
+        else if(arg == "--mesh") options.params.meshSize = std::atoi(value);
+        else if(arg == "--gravity") options.params.gravityConstant = (float)std::atof(value);
+        else if(arg == "--softening") options.params.softeningFactor = (float)std::atof(value);
+        else if(arg == "--threads") options.threads = std::atoi(value);
+        else if(arg == "--snapshot-every") options.snapshotInterval = std::atoll(value);
+        else if(arg == "--output") options.outputDir = value;
+        else if(arg == "--report-every") options.reportInterval = std::atoi(value);
+        else if(arg == "--record") options.recordPath = value;
+        else if(arg == "--record-every") options.recordInterval = std::atoll(value);
+        else if(arg == "--record-buffers") options.recordBuffers = std::atoi(value);
+        else if(arg == "--trace") options.tracePath = value;
+        else if(arg == "--ensemble") options.ensembleMembers = (size_t)std::max(0LL, std::atoll(value));
+        else if(arg == "--max-time") options.maxTime = (float)std::atof(value);
+        else if(arg == "--eject-radius") options.ejectionRadius = (float)std::atof(value);
+        else if(arg == "--jitter-position") options.positionJitter = (float)std::atof(value);
+        else if(arg == "--jitter-velocity") options.velocityJitter = (float)std::atof(value);
+        else if(arg == "--softening-max") options.softeningMax = (float)std::atof(value);
+        else if(arg == "--ensemble-out") options.ensembleOutput = value;
+        else if(arg == "--solver") {
+            options.params.forceSolver = parseIndex(value, solverNames, SOLVER_COUNT);
+            if(options.params.forceSolver < 0) {
+                std::cerr << "Unknown solver: " << value << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--integrator") {
+            options.params.integrator = parseIndex(value, integratorNames, INTEGRATOR_COUNT);
+            if(options.params.integrator < 0) {
+                std::cerr << "Unknown integrator: " << value << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--precision") {
+            options.params.precision = parseIndex(value, precisionNames, PRECISION_COUNT);
+            if(options.params.precision < 0) {
+                std::cerr << "Unknown precision: " << value << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--order") {
+            options.params.bodyOrdering = parseIndex(value, orderingNames, ORDERING_COUNT);
+            if(options.params.bodyOrdering < 0) {
+                std::cerr << "Unknown body order: " << value << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--generate") {
+            options.generator = parseIndex(value, generatorNames, GENERATOR_COUNT);
+            if(options.generator < 0) {
+                std::cerr << "Unknown generator: " << value << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--collisions") {
+            options.params.collisionMode = parseIndex(value, collisionNames, COLLISION_MODE_COUNT);
+            if(options.params.collisionMode < 0) {
+                std::cerr << "Unknown collision mode: " << value << std::endl;
+                return false;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if(options.steps < 0 || options.threads < 1 || options.params.substeps < 1 || options.params.timeStep <= 0.0f ||
+       options.recordInterval < 1) {
+        std::cerr << "Steps, threads, substeps, dt and the record interval must be positive" << std::endl;
+        return false;
+    }
+    if(options.recordBuffers < 0) {
+        std::cerr << "Record buffers must not be negative" << std::endl;
+        return false;
+    }
+    if(options.ensembleMembers > 0 && options.params.softeningFactor < 0.0f) {
+        std::cerr << "Softening must not be negative" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Runs the ensemble built from the loaded system and prints what stopped it
+int runEnsembleMode(const Options& options, Simulation& sim) {
+    std::vector<float> radius(sim.bodies.size());
+    for(size_t i = 0; i < radius.size(); i++) radius[i] = sim.bodies[i].radius;
+
+    EnsembleSweep sweep;
+    sweep.members = options.ensembleMembers;
+    sweep.positionJitter = options.positionJitter;
+    sweep.velocityJitter = options.velocityJitter;
+    sweep.softeningMin = options.params.softeningFactor;
+    sweep.softeningMax = options.softeningMax >= 0.0f ? options.softeningMax : options.params.softeningFactor;
+    sweep.seed = options.seed >= 0 ? options.seed : 1;
+    EnsembleSet set;
+    if(!buildEnsemble(sim.state, radius, sweep, sim.threadPool, set)) {
+        std::cerr << "Ensembles need 1 to " << ENSEMBLE_MAX_BODIES << " bodies, the system has "
+                  << sim.state.size() << std::endl;
+        return -1;
+    }
+
+    EnsembleParams params;
+    params.gravityConstant = options.params.gravityConstant;
+    params.timeStep = options.params.timeStep;
+    params.maxTime = options.maxTime >= 0.0f ? options.maxTime : options.steps * options.params.timeStep;
+    params.ejectionRadius = options.ejectionRadius;
+    params.stopOnCollision = options.collisionStop;
+    std::printf("Ensemble: %zu copies of %zu bodies, time limit %.3f, kernel: %s, threads: %u\n",
+                set.size(), set.bodiesPerMember, params.maxTime, ensembleKernelName(), sim.threadPool.threadCount());
+
+    std::vector<EnsembleResult> results;
+    auto start = std::chrono::steady_clock::now();
+    {
+        PROFILE_SCOPE("Ensemble");
+        runEnsemble(set, params, sim.threadPool, results);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t outcomes[ENSEMBLE_OUTCOME_COUNT] = {};
+    double totalSteps = 0.0, worstEnergyError = 0.0;
+    for(const EnsembleResult& r : results) {
+        outcomes[r.outcome]++;
+        totalSteps += r.steps;
+        worstEnergyError = std::max(worstEnergyError, r.energyError);
+    }
+    std::printf("Ran in %.3f s: %.0f copies/s (%.2f million per minute), %.3g member steps/s\n", seconds,
+                results.size() / seconds, results.size() / seconds * 60.0 / 1e6, totalSteps / seconds);
+    for(int o = 0; o < ENSEMBLE_OUTCOME_COUNT; o++) {
+        std::printf("  %-10s %zu\n", ensembleOutcomeName(o), outcomes[o]);
+    }
+    std::printf("Worst energy error: %.3e\n", worstEnergyError);
+
+    if(!options.ensembleOutput.empty()) {
+        if(!writeEnsembleCsv(options.ensembleOutput, set, results)) {
+            std::cerr << "Failed to write " << options.ensembleOutput << std::endl;
+            return -1;
+        }
+        std::printf("Summary: %s\n", options.ensembleOutput.c_str());
+    }
+    return 0;
+}
+
+bool writeSnapshot(const Options& options, const Simulation& sim) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "/snapshot_%08llu.csv", sim.stepCount);
+    std::string path = options.outputDir + name;
+    if(!writeBodiesCsv(path, sim)) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if(!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return -1;
+    }
+    setProfileThreadName("Main");
+
+    Simulation sim(options.threads);
+    sim.params = options.params;
+    sim.params.running = true;
+    if(!options.resume.empty()) {
+        // Continues with the recorded step, time and parameters
+        SnapshotReader reader;
+        SnapshotFrame frame;
+        std::string error;
+        if(!reader.open(options.resume, error)) {
+            std::cerr << "Failed to open recording: " << error << std::endl;
+            return -1;
+        }
+        if(reader.frameCount() == 0 || !reader.frame(reader.frameCount() - 1, frame)) {
+            std::cerr << "No readable frame in " << options.resume << std::endl;
+            return -1;
+        }
+        restoreSnapshotFrame(frame, sim);
+    }
+    else if(!options.input.empty()) {
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        if(!loadScenario(options.input, sim, error)) {
+            std::cerr << "Failed to load bodies: " << error << std::endl;
+            return -1;
+        }
+        std::printf("Loaded %zu bodies in %.3f s\n", sim.state.size(),
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    else if(options.generator >= 0) {
+        GeneratorParams generator;
+        generator.generator = options.generator;
+        generator.bodyCount = (size_t)std::max(options.bodyCount, 1);
+        generator.seed = options.seed;
+        auto start = std::chrono::steady_clock::now();
+        generateScenario(generator, sim);
+        std::printf("Generated %zu bodies in %.3f s\n", sim.state.size(),
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    else {
+        sim.initializePreset(options.preset, options.bodyCount, options.seed);
+    }
+
+    if(options.ensembleMembers > 0) return runEnsembleMode(options, sim);
+
+    const char* solverLabels[] = { "direct", "Barnes-Hut", "particle-mesh" };
+    std::printf("Bodies: %zu, solver: %s, integrator: %s, precision: %s, threads: %u, direct kernel: %s\n",
+                sim.state.size(), solverLabels[sim.params.forceSolver], integratorName(sim.params.integrator),
+                precisionName(sim.params.precision), sim.threadPool.threadCount(), directKernelName());
+
+    if(options.snapshotInterval > 0 && !writeSnapshot(options, sim)) return -1;
+
+    SnapshotWriter recorder;
+    std::string recordError;
+    if(!options.recordPath.empty()) {
+        int encoding = options.recordQuantized ? SNAPSHOT_QUANTIZED : SNAPSHOT_RAW;
+        if(!recorder.open(options.recordPath, sim, encoding, recordError, (size_t)options.recordBuffers) ||
+           !recorder.writeFrame(sim, recordError)) {
+            std::cerr << "Failed to record: " << recordError << std::endl;
+            return -1;
+        }
+    }
+
+    // Snapshot and recording writes are excluded from the step rate; the time
+    // recording takes on this thread is reported separately
+    using Clock = std::chrono::steady_clock;
+    double stepSeconds = 0.0, recordSeconds = 0.0;
+    // Heap allocations by every thread during the steps; the first step
+    // sizes the scratch buffers and is counted on its own
+    AllocationCounts firstStepAllocations, laterStepAllocations;
+    uint64_t maxStepAllocations = 0;
+    for(long long i = 0; i < options.steps; i++) {
+        AllocationCounts allocationsBefore = allocationCounts();
+        Clock::time_point start = Clock::now();
+        sim.step(sim.params.timeStep);
+        stepSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+        AllocationCounts stepAllocations = allocationCounts() - allocationsBefore;
+        if(i == 0) {
+            firstStepAllocations = stepAllocations;
+        } else {
+            laterStepAllocations.allocations += stepAllocations.allocations;
+            laterStepAllocations.bytes += stepAllocations.bytes;
+            maxStepAllocations = std::max(maxStepAllocations, stepAllocations.allocations);
+        }
+
+        if(options.snapshotInterval > 0 && sim.stepCount % options.snapshotInterval == 0) {
+            if(!writeSnapshot(options, sim)) return -1;
+        }
+        if(recorder.isOpen() && sim.stepCount % options.recordInterval == 0) {
+            PROFILE_SCOPE("Record");
+            Clock::time_point recordStart = Clock::now();
+            if(!recorder.writeFrame(sim, recordError)) {
+                std::cerr << "Failed to record: " << recordError << std::endl;
+                return -1;
+            }
+            recordSeconds += std::chrono::duration<double>(Clock::now() - recordStart).count();
+        }
+        if(options.reportInterval > 0 && sim.stepCount % options.reportInterval == 0) {
+            std::printf("step %llu, t = %.3f, %.1f steps/s\n", sim.stepCount, sim.simulationTime,
+                        sim.stepCount / stepSeconds);
+        }
+    }
+
+    // Final measurement, independent of the periodic one
+    if(sim.conservation.valid) sim.measureConservation();
+
+    std::printf("Steps: %lld in %.3f s, %.2f steps/s\n", options.steps, stepSeconds,
+                stepSeconds > 0.0 ? options.steps / stepSeconds : 0.0);
+    std::printf("Simulated time: %.3f\n", sim.simulationTime);
+    if(options.steps > 1) {
+        double laterSteps = (double)(options.steps - 1);
+        std::printf("Allocations: %llu (%.1f KB) in the first step, then %.2f (%.0f bytes) per step, at most %llu\n",
+                    (unsigned long long)firstStepAllocations.allocations, firstStepAllocations.bytes / 1e3,
+                    laterStepAllocations.allocations / laterSteps, laterStepAllocations.bytes / laterSteps,
+                    (unsigned long long)maxStepAllocations);
+    }
+    if(recorder.isOpen()) {
+        size_t frameCount = recorder.frameCount();
+        if(!recorder.close()) {
+            std::cerr << "Failed to finish " << options.recordPath << std::endl;
+            return -1;
+        }
+        SnapshotWriterStats stats = recorder.stats();
+        std::printf("Recorded %zu frames, %.1f MB to %s, %.1f MB/s\n", frameCount, stats.bytesWritten / 1e6,
+                    options.recordPath.c_str(), stats.bytesPerSecond / 1e6);
+        std::printf("Recording: %.3f s on the step loop, %.3f s stalled in %zu waits, max queue %zu, %zu writes\n",
+                    recordSeconds, stats.stallSeconds, stats.stalls, stats.maxQueueDepth, stats.writeCalls);
+    }
+    if(sim.params.bodyOrdering != ORDERING_NONE) {
+        std::printf("Reorders: %llu (%s), last took %.2f ms\n", sim.reorderCount,
+                    bodyOrderingName(sim.params.bodyOrdering), sim.lastReorderSeconds * 1000.0);
+    }
+    if(sim.params.collisionMode != COLLISION_NONE) {
+        std::printf("Collisions: %llu merges, %llu bounces, %zu bodies left\n",
+                    sim.totalMerges, sim.totalBounces, sim.state.size());
+    }
+    if(sim.conservation.valid) {
+        std::printf("Energy error: %.3e, momentum error: %.3e, force evaluations: %.1f\n",
+                    sim.conservation.relativeEnergyError, sim.conservation.momentumError,
+                    sim.conservation.forceEvaluations);
+    }
+    if(!options.tracePath.empty()) {
+        std::vector<ProfileEvent> events;
+        collectProfileEvents(0, events);
+        std::string error;
+        if(!writeChromeTrace(options.tracePath, events, error)) {
+            std::cerr << "Failed to write trace: " << error << std::endl;
+            return -1;
+        }
+        std::printf("Trace: %zu events to %s\n", events.size(), options.tracePath.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,572 @@
+#include "Integrators.h"
+#include "ForceKernels.h"
+#include "FrameArena.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float MIN_DISTANCE_SQ = 1e-6f;
+
+void parallelOver(ThreadPool* pool, size_t n, size_t grain, FunctionRef<void(size_t, size_t)> body) {
+    if(pool) pool->parallelFor(0, n, grain, body);
+    else body(0, n);
+}
+
+// v += F/m * dt, on a BodyState or a PreciseState
+template<typename State>
+void kick(State& s, double dt, ThreadPool* pool) {
+    using T = typename std::decay<decltype(s.x[0])>::type;
+    T h = (T)dt;
+    parallelOver(pool, s.size(), 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            T k = h / s.mass[i];
+            s.vx[i] += s.fx[i] * k;
+            s.vy[i] += s.fy[i] * k;
+            s.vz[i] += s.fz[i] * k;
+        }
+    });
+}
+
+// x += v * dt
+template<typename State>
+void drift(State& s, double dt, ThreadPool* pool) {
+    using T = typename std::decay<decltype(s.x[0])>::type;
+    T h = (T)dt;
+    parallelOver(pool, s.size(), 4096, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            s.x[i] += s.vx[i] * h;
+            s.y[i] += s.vy[i] * h;
+            s.z[i] += s.vz[i] * h;
+        }
+    });
+}
+
+// The bodies an integrator advances under a precision policy. With float
+// accumulators that is the BodyState itself. Otherwise it is a PreciseState
+// loaded from the BodyState on the first step and after reset, and rounded
+// back into it at the end of every step.
+template<typename Policy, bool Precise = keepsDoubleState<Policy>()>
+class IntegrationState;
+
+template<typename Policy>
+class IntegrationState<Policy, false> {
+public:
+    BodyState& begin(BodyState& state) { return state; }
+    void computeForces(BodyState& state, const IntegratorContext& context) { context.computeForces(state); }
+    void end(BodyState&) {}
+    void reset() {}
+    void reorder(const std::vector<unsigned int>&) {}
+    const PreciseState* precise() const { return nullptr; }
+    size_t memoryBytes() const { return 0; }
+};
+
+template<typename Policy>
+class IntegrationState<Policy, true> {
+public:
+    PreciseState& begin(BodyState& state) {
+        if(!loaded || bodies.size() != state.size()) {
+            bodies.load(state);
+            loaded = true;
+        }
+        return bodies;
+    }
+
+    // Direct summation runs on the double positions under the policy. Other
+    // solvers only work in float, so they get the rounded positions and
+    // their forces are widened.
+    void computeForces(BodyState& state, const IntegratorContext& context) {
+        if(context.directForces) {
+            PROFILE_SCOPE("Forces");
+            computePreciseDirectForces<Policy>(bodies, context.gravityConstant, context.softening,
+                                               context.pool, scratch);
+            return;
+        }
+        bodies.storePositions(state);
+        context.computeForces(state);
+        bodies.loadForces(state);
+    }
+
+    void end(BodyState& state) { bodies.store(state); }
+    void reset() { loaded = false; }
+
+    void reorder(const std::vector<unsigned int>& order) {
+        if(!loaded) return;
+        if(order.size() != bodies.size()) {
+            loaded = false;
+            return;
+        }
+        bodies.permute(order, permuteScratch, massScratch);
+    }
+    const PreciseState* precise() const { return loaded ? &bodies : nullptr; }
+
+    size_t memoryBytes() const {
+        return bodies.memoryBytes() + 3 * scratch.fx.capacity() * sizeof(double) +
+               scratch.rowBegin.capacity() * sizeof(size_t);
+    }
+
+private:
+    PreciseState bodies;
+    PreciseForceScratch scratch;
+    DoubleArray permuteScratch;
+    FloatArray massScratch;
+    bool loaded = false;
+};
+
+template<typename Policy>
+class EulerIntegrator : public Integrator {
+public:
+    void step(BodyState& state, double dt, const IntegratorContext& context) override {
+        auto& s = bodies.begin(state);
+        bodies.computeForces(state, context);
+        evaluations += 1.0;
+        kick(s, dt, context.pool);
+        drift(s, dt, context.pool);
+        bodies.end(state);
+    }
+
+    void reset() override { bodies.reset(); }
+    void reorder(const std::vector<unsigned int>& order) override { bodies.reorder(order); }
+    const PreciseState* preciseState() const override { return bodies.precise(); }
+    size_t memoryBytes() const override { return bodies.memoryBytes(); }
+
+private:
+    IntegrationState<Policy> bodies;
+};
+
+template<typename Policy>
+class LeapfrogIntegrator : public Integrator {
+public:
+    void step(BodyState& state, double dt, const IntegratorContext& context) override {
+        auto& s = bodies.begin(state);
+        // Forces from the end of the previous step are still valid unless something changed
+        if(!forcesValid || cachedSize != state.size()) {
+            bodies.computeForces(state, context);
+            evaluations += 1.0;
+        }
+        kick(s, 0.5 * dt, context.pool);
+        drift(s, dt, context.pool);
+        bodies.computeForces(state, context);
+        evaluations += 1.0;
+        kick(s, 0.5 * dt, context.pool);
+        bodies.end(state);
+        forcesValid = true;
+        cachedSize = state.size();
+    }
+
+    void reset() override {
+        forcesValid = false;
+        bodies.reset();
+    }
+    // Forces move with the bodies, in state and in the double copy
+    void reorder(const std::vector<unsigned int>& order) override { bodies.reorder(order); }
+    const PreciseState* preciseState() const override { return bodies.precise(); }
+    size_t memoryBytes() const override { return bodies.memoryBytes(); }
+
+private:
+    IntegrationState<Policy> bodies;
+    bool forcesValid = false;
+    size_t cachedSize = 0;
+};
+
+template<typename Policy>
+class Yoshida4Integrator : public Integrator {
+public:
+    void step(BodyState& state, double dt, const IntegratorContext& context) override {
+        // Three leapfrog steps of w1, w0, w1 (Yoshida 1990) in kick-drift-kick
+        // form. Adjacent half kicks merge, and the forces at the end carry
+        // over to the next step, leaving three evaluations per step.
+        const double cbrt2 = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+        const double drifts[3] = { w1, w0, w1 };
+        const double kicks[4] = { 0.5 * w1, 0.5 * (w1 + w0), 0.5 * (w0 + w1), 0.5 * w1 };
+
+        auto& s = bodies.begin(state);
+        if(!forcesValid || cachedSize != state.size()) {
+            bodies.computeForces(state, context);
+            evaluations += 1.0;
+        }
+        for(int k = 0; k < 3; k++) {
+            kick(s, kicks[k] * dt, context.pool);
+            drift(s, drifts[k] * dt, context.pool);
+            bodies.computeForces(state, context);
+            evaluations += 1.0;
+        }
+        kick(s, kicks[3] * dt, context.pool);
+        bodies.end(state);
+        forcesValid = true;
+        cachedSize = state.size();
+    }
+
+    void reset() override {
+        forcesValid = false;
+        bodies.reset();
+    }
+    // Forces move with the bodies, in state and in the double copy
+    void reorder(const std::vector<unsigned int>& order) override { bodies.reorder(order); }
+    const PreciseState* preciseState() const override { return bodies.precise(); }
+    size_t memoryBytes() const override { return bodies.memoryBytes(); }
+
+private:
+    IntegrationState<Policy> bodies;
+    bool forcesValid = false;
+    size_t cachedSize = 0;
+};
+
+// Pair terms in Policy::Real and the integrated quantities in Policy::Accum;
+// per-body sums of acceleration and jerk are double in every mode
+template<typename Policy>
+class HermiteIntegrator : public Integrator {
+public:
+    HermiteIntegrator(bool blockTimesteps, float eta) : blockTimesteps(blockTimesteps), eta(eta) {}
+
+    void reset() override {
+        initialized = false;
+        bodies.reset();
+    }
+
+    // Between steps every body is at block time zero, so only the
+    // derivatives and block steps need to move with the bodies
+    void reorder(const std::vector<unsigned int>& order) override {
+        bodies.reorder(order);
+        if(!initialized) return;
+        if(order.size() != bodyStep.size()) {
+            initialized = false;
+            return;
+        }
+        for(AccumArray* a : { &ax, &ay, &az, &jx, &jy, &jz }) permuteArray(*a, order, permuteScratch);
+        permuteArray(bodyStep, order, stepScratch);
+    }
+
+    const PreciseState* preciseState() const override { return bodies.precise(); }
+
+    size_t memoryBytes() const override {
+        return 18 * ax.capacity() * sizeof(Accum) + bodies.memoryBytes() +
+               (bodyTime.capacity() + bodyStep.capacity() + active.capacity()) * sizeof(unsigned int);
+    }
+
+    void step(BodyState& state, double dt, const IntegratorContext& context) override {
+        size_t n = state.size();
+        if(n == 0) return;
+        auto& s = bodies.begin(state);
+        if(!initialized || bodyTime.size() != n) initialize(s, dt, context);
+
+        // Block times are integer ticks of dt / STEP_TICKS so that
+        // synchronization is exact
+        const double tick = dt / STEP_TICKS;
+        unsigned int now = 0;
+        while(now < STEP_TICKS) {
+            // Next block time and the bodies due at it
+            unsigned int next = STEP_TICKS;
+            for(size_t i = 0; i < n; i++) next = std::min(next, bodyTime[i] + bodyStep[i]);
+            active.clear();
+            for(size_t i = 0; i < n; i++) {
+                if(bodyTime[i] + bodyStep[i] == next) active.push_back((unsigned int)i);
+            }
+
+            predict(s, next, tick, context.pool);
+            evaluate(s, active, context);
+            evaluations += (double)active.size() / n;
+            correct(s, next, tick, context.pool);
+            now = next;
+        }
+
+        // Everybody is synchronized at the end of the step; restart block time from zero
+        for(size_t i = 0; i < n; i++) {
+            bodyTime[i] = 0;
+            s.fx[i] = s.mass[i] * ax[i];
+            s.fy[i] = s.mass[i] * ay[i];
+            s.fz[i] = s.mass[i] * az[i];
+        }
+        bodies.end(state);
+    }
+
+private:
+    using Real = typename Policy::Real;
+    using Accum = typename Policy::Accum;
+    using AccumArray = std::vector<Accum, AlignedAllocator<Accum>>;
+    using State = typename std::conditional<keepsDoubleState<Policy>(), PreciseState, BodyState>::type;
+
+    void resizeArrays(size_t n) {
+        for(AccumArray* a : { &ax, &ay, &az, &jx, &jy, &jz, &px, &py, &pz, &pvx, &pvy, &pvz,
+                              &newAx, &newAy, &newAz, &newJx, &newJy, &newJz }) {
+            a->assign(n, (Accum)0);
+        }
+        bodyTime.assign(n, 0);
+        bodyStep.assign(n, STEP_TICKS);
+    }
+
+    void initialize(State& state, double dt, const IntegratorContext& context) {
+        size_t n = state.size();
+        resizeArrays(n);
+        for(size_t i = 0; i < n; i++) {
+            px[i] = state.x[i]; py[i] = state.y[i]; pz[i] = state.z[i];
+            pvx[i] = state.vx[i]; pvy[i] = state.vy[i]; pvz[i] = state.vz[i];
+        }
+        active.resize(n);
+        for(size_t i = 0; i < n; i++) active[i] = (unsigned int)i;
+        evaluate(state, active, context);
+        evaluations += 1.0;
+
+        for(size_t i = 0; i < n; i++) {
+            ax[i] = newAx[i]; ay[i] = newAy[i]; az[i] = newAz[i];
+            jx[i] = newJx[i]; jy[i] = newJy[i]; jz[i] = newJz[i];
+            // Conservative start: a fraction of the acceleration / jerk time scale
+            double a = std::sqrt((double)ax[i] * ax[i] + (double)ay[i] * ay[i] + (double)az[i] * az[i]);
+            double j = std::sqrt((double)jx[i] * jx[i] + (double)jy[i] * jy[i] + (double)jz[i] * jz[i]);
+            if(blockTimesteps && j > 0.0) bodyStep[i] = quantize(0.01 * a / j / dt, 0, STEP_TICKS);
+        }
+        initialized = true;
+    }
+
+    // Largest power-of-two tick count not above `wanted` (in units of the
+    // frame step) that keeps `time` on a multiple of the step and grows by
+    // at most 2x
+    unsigned int quantize(double wanted, unsigned int time, unsigned int previous) {
+        double limit = std::min(wanted * STEP_TICKS, 2.0 * previous);
+        unsigned int stepTicks = STEP_TICKS;
+        while(stepTicks > 1 && stepTicks > limit) stepTicks >>= 1;
+        while(stepTicks > 1 && time % stepTicks != 0) stepTicks >>= 1;
+        return stepTicks;
+    }
+
+    // Taylor-predicts every body to block time t
+    void predict(const State& s, unsigned int t, double tick, ThreadPool* pool) {
+        parallelOver(pool, s.size(), 2048, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                Accum h = (Accum)((t - bodyTime[i]) * tick);
+                Accum h2 = h * h * (Accum)0.5, h3 = h * h * h / (Accum)6;
+                px[i] = s.x[i] + s.vx[i] * h + ax[i] * h2 + jx[i] * h3;
+                py[i] = s.y[i] + s.vy[i] * h + ay[i] * h2 + jy[i] * h3;
+                pz[i] = s.z[i] + s.vz[i] * h + az[i] * h2 + jz[i] * h3;
+                pvx[i] = s.vx[i] + ax[i] * h + jx[i] * h2;
+                pvy[i] = s.vy[i] + ay[i] * h + jy[i] * h2;
+                pvz[i] = s.vz[i] + az[i] * h + jz[i] * h2;
+            }
+        });
+    }
+
+    // Acceleration and jerk on the listed bodies from all predicted bodies.
+    // With a = G m d f(r^2), f = 1 / (r (r^2 + s)):
+    //   jerk = G m (dv f - d f (1/r^2 + 2/(r^2 + s)) (d . dv))
+    void evaluate(const State& s, const std::vector<unsigned int>& list, const IntegratorContext& context) {
+        size_t n = s.size();
+        double G = context.gravityConstant;
+        Real soft = (Real)context.softening;
+        parallelOver(context.pool, list.size(), 64, [&](size_t begin, size_t end) {
+            for(size_t k = begin; k < end; k++) {
+                unsigned int i = list[k];
+                double sax = 0.0, say = 0.0, saz = 0.0, sjx = 0.0, sjy = 0.0, sjz = 0.0;
+                for(size_t j = 0; j < n; j++) {
+                    if(j == i) continue;
+                    Real dx = (Real)(px[j] - px[i]), dy = (Real)(py[j] - py[i]), dz = (Real)(pz[j] - pz[i]);
+                    Real r2 = dx * dx + dy * dy + dz * dz;
+                    if(r2 < (Real)MIN_DISTANCE_SQ) continue;
+                    Real dvx = (Real)(pvx[j] - pvx[i]), dvy = (Real)(pvy[j] - pvy[i]), dvz = (Real)(pvz[j] - pvz[i]);
+                    Real q = r2 + soft;
+                    Real f = (Real)s.mass[j] / (std::sqrt(r2) * q);
+                    Real rv = (dx * dvx + dy * dvy + dz * dvz) * f * ((Real)1 / r2 + (Real)2 / q);
+                    sax += dx * f; say += dy * f; saz += dz * f;
+                    sjx += dvx * f - dx * rv;
+                    sjy += dvy * f - dy * rv;
+                    sjz += dvz * f - dz * rv;
+                }
+                newAx[i] = (Accum)(G * sax); newAy[i] = (Accum)(G * say); newAz[i] = (Accum)(G * saz);
+                newJx[i] = (Accum)(G * sjx); newJy[i] = (Accum)(G * sjy); newJz[i] = (Accum)(G * sjz);
+            }
+        });
+    }
+
+    void correctAxis(Accum& x, Accum& v, Accum& a0, Accum& j0, Accum a1, Accum j1,
+                     Accum predictedX, Accum predictedV, Accum h, Accum& snap, Accum& crackle) {
+        Accum h2 = h * h, h3 = h2 * h;
+        snap = (-6 * (a0 - a1) - h * (4 * j0 + 2 * j1)) / h2;
+        crackle = (12 * (a0 - a1) + 6 * h * (j0 + j1)) / h3;
+        x = predictedX + snap * h2 * h2 / 24 + crackle * h3 * h2 / 120;
+        v = predictedV + snap * h3 / 6 + crackle * h2 * h2 / 24;
+        a0 = a1;
+        j0 = j1;
+    }
+
+    void correct(State& s, unsigned int t, double tick, ThreadPool* pool) {
+        parallelOver(pool, active.size(), 256, [&](size_t begin, size_t end) {
+            for(size_t k = begin; k < end; k++) {
+                unsigned int i = active[k];
+                Accum h = (Accum)((t - bodyTime[i]) * tick);
+                Accum sx, sy, sz, cx, cy, cz;
+                correctAxis(s.x[i], s.vx[i], ax[i], jx[i], newAx[i], newJx[i], px[i], pvx[i], h, sx, cx);
+                correctAxis(s.y[i], s.vy[i], ay[i], jy[i], newAy[i], newJy[i], py[i], pvy[i], h, sy, cy);
+                correctAxis(s.z[i], s.vz[i], az[i], jz[i], newAz[i], newJz[i], pz[i], pvz[i], h, sz, cz);
+                bodyTime[i] = t;
+
+                if(!blockTimesteps) continue;
+                // Aarseth criterion with the snap carried to the end of the step
+                double a = std::sqrt((double)ax[i] * ax[i] + (double)ay[i] * ay[i] + (double)az[i] * az[i]);
+                double j = std::sqrt((double)jx[i] * jx[i] + (double)jy[i] * jy[i] + (double)jz[i] * jz[i]);
+                double s2x = sx + cx * h, s2y = sy + cy * h, s2z = sz + cz * h;
+                double sn = std::sqrt(s2x * s2x + s2y * s2y + s2z * s2z);
+                double cr = std::sqrt((double)cx * cx + (double)cy * cy + (double)cz * cz);
+                double denominator = j * cr + sn * sn;
+                double wanted = denominator > 0.0 ? std::sqrt(eta * (a * sn + j * j) / denominator) : 1e30;
+                bodyStep[i] = quantize(wanted / (tick * STEP_TICKS), t, bodyStep[i]);
+            }
+        });
+    }
+
+    static constexpr unsigned int STEP_TICKS = 1u << 16;    // Finest block level is dt / 2^16
+
+    bool blockTimesteps;
+    float eta;
+    bool initialized = false;
+
+    IntegrationState<Policy> bodies;
+    AccumArray ax, ay, az, jx, jy, jz;          // Acceleration and jerk at each body's own time
+    AccumArray px, py, pz, pvx, pvy, pvz;       // Predicted state at the current block time
+    AccumArray newAx, newAy, newAz, newJx, newJy, newJz;
+    std::vector<unsigned int> bodyTime;         // Ticks into the current frame step
+    std::vector<unsigned int> bodyStep;
+    std::vector<unsigned int> active;
+    AccumArray permuteScratch;
+    std::vector<unsigned int> stepScratch;
+};
+
+}
+
+const char* integratorName(int type) {
+    switch(type) {
+        case INTEGRATOR_EULER: return "Semi-implicit Euler";
+        case INTEGRATOR_LEAPFROG: return "Leapfrog (KDK)";
+        case INTEGRATOR_YOSHIDA4: return "Yoshida 4th Order";
+        case INTEGRATOR_HERMITE: return "Hermite 4th Order";
+    }
+    return "Unknown";
+}
+
+const char* precisionName(int mode) {
+    switch(mode) {
+        case PRECISION_FLOAT: return "Float";
+        case PRECISION_MIXED: return "Mixed (double sums)";
+        case PRECISION_DOUBLE: return "Double";
+    }
+    return "Unknown";
+}
+
+namespace {
+
+template<typename Policy>
+std::unique_ptr<Integrator> createWithPolicy(int type, bool blockTimesteps, float eta) {
+    switch(type) {
+        case INTEGRATOR_LEAPFROG: return std::make_unique<LeapfrogIntegrator<Policy>>();
+        case INTEGRATOR_YOSHIDA4: return std::make_unique<Yoshida4Integrator<Policy>>();
+        case INTEGRATOR_HERMITE: return std::make_unique<HermiteIntegrator<Policy>>(blockTimesteps, eta);
+        default: return std::make_unique<EulerIntegrator<Policy>>();
+    }
+}
+
+template<typename State>
+double totalEnergy(const State& s, float gravityConstant, float softening, ThreadPool* pool) {
+    size_t n = s.size();
+    double kinetic = 0.0;
+    for(size_t i = 0; i < n; i++) {
+        double v2 = (double)s.vx[i] * s.vx[i] + (double)s.vy[i] * s.vy[i] + (double)s.vz[i] * s.vz[i];
+        kinetic += 0.5 * s.mass[i] * v2;
+    }
+
+    // Pair potential in fixed-size row chunks, summed in chunk order so the
+    // result does not depend on scheduling
+    const double rootSoft = std::sqrt((double)softening);
+    const double halfPi = 2.0 * std::atan(1.0);
+    const size_t chunk = 64;
+    size_t chunks = (n + chunk - 1) / chunk;
+    ArenaScope scope;
+    double* partial = scope.allocate<double>(chunks);
+    auto rows = [&](size_t c) {
+        double sum = 0.0;
+        for(size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); i++) {
+            for(size_t j = i + 1; j < n; j++) {
+                double dx = s.x[j] - s.x[i], dy = s.y[j] - s.y[i], dz = s.z[j] - s.z[i];
+                double r2 = dx * dx + dy * dy + dz * dz;
+                if(r2 < MIN_DISTANCE_SQ) continue;
+                sum += (double)s.mass[i] * s.mass[j] * (halfPi - std::atan(std::sqrt(r2) / rootSoft));
+            }
+        }
+        partial[c] = sum;
+    };
+    if(pool) pool->run(chunks, rows);
+    else for(size_t c = 0; c < chunks; c++) rows(c);
+
+    double potential = 0.0;
+    for(size_t c = 0; c < chunks; c++) potential += partial[c];
+    return kinetic - gravityConstant * potential / rootSoft;
+}
+
+template<typename State>
+glm::dvec3 totalMomentum(const State& s) {
+    glm::dvec3 p(0.0);
+    for(size_t i = 0; i < s.size(); i++) {
+        p += glm::dvec3(s.vx[i], s.vy[i], s.vz[i]) * (double)s.mass[i];
+    }
+    return p;
+}
+
+}
+
+std::unique_ptr<Integrator> createIntegrator(int type, bool blockTimesteps, int precision, float eta) {
+    switch(precision) {
+        case PRECISION_MIXED: return createWithPolicy<MixedPrecision>(type, blockTimesteps, eta);
+        case PRECISION_DOUBLE: return createWithPolicy<DoublePrecision>(type, blockTimesteps, eta);
+        default: return createWithPolicy<FloatPrecision>(type, blockTimesteps, eta);
+    }
+}
+
+double computeTotalEnergy(const BodyState& state, float gravityConstant, float softening, ThreadPool* pool) {
+    return totalEnergy(state, gravityConstant, softening, pool);
+}
+
+double computeTotalEnergy(const PreciseState& state, float gravityConstant, float softening, ThreadPool* pool) {
+    return totalEnergy(state, gravityConstant, softening, pool);
+}
+
+glm::dvec3 computeTotalMomentum(const BodyState& state) { return totalMomentum(state); }
+
+glm::dvec3 computeTotalMomentum(const PreciseState& state) { return totalMomentum(state); }
+
+void ConservationStats::begin(const BodyState& state, float gravityConstant, float softening, ThreadPool* pool,
+                              double evaluationsSoFar) {
+    initialEnergy = computeTotalEnergy(state, gravityConstant, softening, pool);
+    energy = initialEnergy;
+    relativeEnergyError = 0.0;
+    initialMomentum = computeTotalMomentum(state);
+    momentumError = 0.0;
+    momentumScale = 0.0;
+    for(size_t i = 0; i < state.size(); i++) {
+        momentumScale += state.mass[i] * glm::length(state.velocity(i));
+    }
+    if(momentumScale <= 0.0) momentumScale = 1.0;
+    baselineEvaluations = evaluationsSoFar;
+    forceEvaluations = 0.0;
+    valid = true;
+}
+
+template<typename State>
+void ConservationStats::measureState(const State& state, float gravityConstant, float softening, ThreadPool* pool,
+                                double evaluationsSoFar) {
+    energy = computeTotalEnergy(state, gravityConstant, softening, pool);
+    relativeEnergyError = initialEnergy != 0.0 ? std::fabs((energy - initialEnergy) / initialEnergy) : 0.0;
+    momentumError = glm::length(computeTotalMomentum(state) - initialMomentum) / momentumScale;
+    forceEvaluations = evaluationsSoFar - baselineEvaluations;
+}
+
+void ConservationStats::measure(const BodyState& state, float gravityConstant, float softening, ThreadPool* pool,
+                                double evaluationsSoFar) {
+    measureState(state, gravityConstant, softening, pool, evaluationsSoFar);
+}
+
+void ConservationStats::measure(const PreciseState& state, float gravityConstant, float softening, ThreadPool* pool,
+                                double evaluationsSoFar) {
+    measureState(state, gravityConstant, softening, pool, evaluationsSoFar);
+}
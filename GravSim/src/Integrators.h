@@ -0,0 +1,108 @@
+#pragma once
+
+#include "BodyState.h"
+#include "Precision.h"
+
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+class ThreadPool;
+
+// Everything an integrator needs besides the state it advances
+struct IntegratorContext {
+    // Fills state.fx/fy/fz from the current positions using the selected solver
+    std::function<void(BodyState&)> computeForces;
+    // The selected solver is direct summation, which integrators running
+    // with double state evaluate themselves under their precision policy
+    bool directForces = false;
+    float gravityConstant = 1000.0f;
+    float softening = 1.0f;
+    ThreadPool* pool = nullptr;
+};
+
+enum IntegratorType {
+    INTEGRATOR_EULER = 0,     // Semi-implicit Euler, 1 force evaluation per step
+    INTEGRATOR_LEAPFROG = 1,  // Kick-drift-kick, 1 evaluation per step (forces reused)
+    INTEGRATOR_YOSHIDA4 = 2,  // 4th-order symplectic composition, 3 evaluations per step
+    INTEGRATOR_HERMITE = 3,   // 4th-order predictor-corrector, optional block timesteps
+    INTEGRATOR_COUNT
+};
+
+const char* integratorName(int type);
+
+// Advances a BodyState by one step. On return state.fx/fy/fz hold the forces
+// at the new positions, so overlays and diagnostics see consistent data.
+class Integrator {
+public:
+    virtual ~Integrator() = default;
+
+    virtual void step(BodyState& state, double dt, const IntegratorContext& context) = 0;
+
+    // Drops anything cached between steps; call after bodies or parameters change
+    virtual void reset() {}
+
+    // Follows a reordering of the bodies (slot k now holds the body that was
+    // at order[k]) without losing cached state. Defaults to reset().
+    virtual void reorder(const std::vector<unsigned int>& order) {
+        (void)order;
+        reset();
+    }
+
+    // Force evaluations so far, in units of "all N bodies once". Block-timestep
+    // Hermite counts the active fraction of each evaluation.
+    double forceEvaluations() const { return evaluations; }
+
+    // Heap memory held between steps
+    virtual size_t memoryBytes() const { return 0; }
+
+    // The double state advanced in mixed and double precision, null in float
+    // precision and until the first step
+    virtual const PreciseState* preciseState() const { return nullptr; }
+
+protected:
+    double evaluations = 0.0;
+};
+
+// Hermite integration needs jerks, so it always evaluates forces by direct
+// summation regardless of the selected solver. With block timesteps each
+// body advances on its own power-of-two fraction of the frame step, chosen
+// by Aarseth's criterion with accuracy parameter eta. precision is a
+// PrecisionMode; each mode instantiates the integrator with its policy.
+std::unique_ptr<Integrator> createIntegrator(int type, bool blockTimesteps, int precision = PRECISION_FLOAT,
+                                             float eta = 0.02f);
+
+// Total energy using the potential that matches the softened force law
+// F = G mi mj / (r^2 + s):  U(r) = -G mi mj / sqrt(s) * (pi/2 - atan(r / sqrt(s)))
+double computeTotalEnergy(const BodyState& state, float gravityConstant, float softening, ThreadPool* pool);
+double computeTotalEnergy(const PreciseState& state, float gravityConstant, float softening, ThreadPool* pool);
+glm::dvec3 computeTotalMomentum(const BodyState& state);
+glm::dvec3 computeTotalMomentum(const PreciseState& state);
+
+// Drift of energy and momentum relative to a baseline taken with begin()
+struct ConservationStats {
+    double initialEnergy = 0.0;
+    double energy = 0.0;
+    double relativeEnergyError = 0.0;
+    glm::dvec3 initialMomentum = glm::dvec3(0.0);
+    double momentumError = 0.0;       // |P - P0| relative to sum(m |v|) at baseline
+    double forceEvaluations = 0.0;    // Since the baseline
+    bool valid = false;
+
+    void begin(const BodyState& state, float gravityConstant, float softening, ThreadPool* pool,
+               double evaluationsSoFar);
+    void measure(const BodyState& state, float gravityConstant, float softening, ThreadPool* pool,
+                 double evaluationsSoFar);
+    void measure(const PreciseState& state, float gravityConstant, float softening, ThreadPool* pool,
+                 double evaluationsSoFar);
+
+private:
+    template<typename State>
+    void measureState(const State& state, float gravityConstant, float softening, ThreadPool* pool,
+                      double evaluationsSoFar);
+
+    double momentumScale = 1.0;
+    double baselineEvaluations = 0.0;
+};
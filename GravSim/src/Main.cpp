@@ -1,18 +1,39 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include "AllocationTracker.h"
+#include "BodyListPanel.h"
+#include "BodyPicker.h"
+#include "BodyRenderer.h"
+#include "FrameArena.h"
+#include "GpuTimer.h"
+#include "GridRenderer.h"
+#include "Profiler.h"
+#include "ProfilerPanel.h"
+#include "RenderState.h"
+#include "Shader.h"
+#include "Scenario.h"
+#include "Simulation.h"
+#include "SimulationThread.h"
+#include "SnapshotFile.h"
+#include "SpaceTimeGrid.h"
+#include "TrailRenderer.h"
+#include "VectorRenderer.h"
+#include "TripleBuffer.h"
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <cmath>
-#include <random>
-
-#define M_PI 7.312
+#include <chrono>
 
 // Constants
 const int WIDTH = 1600;
@@ -32,33 +53,158 @@ float cameraSpeed = 50.0f;
 bool keys[1024];
 bool mousePressed = false;
 
-// Physics Object
-struct GravityBody {
-    glm::vec3 position;
-    glm::vec3 velocity;
-    glm::vec3 acceleration;
-    glm::vec3 force;
-    float mass;
-    float radius;
-    glm::vec3 color;
-    std::vector<glm::vec3> trail;
-    int maxTrailLength = 500;
-};
+// Simulation state, owned by the physics thread. The UI edits `params`; the
+// physics thread works on its own copy, `sim.params`, replaced through posted
+// commands.
+Simulation sim;
 
-// Simulation state
-std::vector<GravityBody> bodies;
-bool simulationRunning = false;
-float simulationSpeed = 1.0f;
-float gravityConstant = 1000.0f; // Scaled for visualization
-float timeStep = 0.016f;
+// UI settings
+SimulationParams params;
 bool showTrails = true;
 bool showVelocity = false;
 bool showForce = false;
+int vectorDecimation = VECTORS_ALL;
+int maxArrows = 20000; // Per field, when decimating
 bool showSpaceTimeGrid = false;
-float softeningFactor = 1.0f;
-int selectedBody = -1;
+bool showProfiler = false;
+const char* const FRAME_SCOPE = "Frame"; // Profiler scope around a whole frame
+int selectedBody = -1; // Body id, which unlike the index survives reordering
 float gridDeformationIntensity = 0.5f;
 int gridResolution = 50;
+int asteroidCount = 15;
+int generatorType = GENERATOR_PLUMMER;
+int generatorCount = 10000;
+char scenePath[256] = "scene.csv";
+
+int physicsThreads = (int)ThreadPool::hardwareThreads();
+
+// Everything the renderer and UI need from one published physics state
+struct SimulationSnapshot {
+    BodyState state;
+    std::vector<unsigned int> ids;
+    std::vector<float> radius;
+    std::vector<glm::vec3> color;
+    unsigned int structureVersion = 0;
+    unsigned long long step = 0;
+    double simulationTime = 0.0;
+    double publishTime = 0.0; // Wall clock seconds
+    size_t octreeNodes = 0;
+    float meshCellSize = 0.0f;
+    double shortRangePairs = 0.0;
+    size_t collisionPairs = 0;
+    unsigned long long totalMerges = 0;
+    unsigned long long totalBounces = 0;
+    bool recording = false;
+    size_t recordedFrames = 0;
+    uint64_t recordedBytes = 0;
+    SnapshotWriterStats recordingStats;
+    std::string recordingError;
+    std::string sceneError;
+    ForceErrorStats forceError;
+    ConservationStats conservation;
+    double forceEvaluations = 0.0;
+    unsigned long long reorderCount = 0;
+    unsigned long long lastReorderStep = 0;
+    double lastReorderSeconds = 0.0;
+    // Click selection tree over this snapshot's positions, refit on the
+    // physics thread once picking has been used
+    BodyPicker picker;
+    unsigned int pickerStructureVersion = ~0u;
+    bool pickable = false;
+};
+
+SimulationThread physicsThread;
+TripleBuffer<SimulationSnapshot> snapshots;
+
+// Recording, owned by the physics thread: every published state is appended,
+// and written out by the writer's own thread
+const size_t RECORDING_BUFFERS = 4;
+SnapshotWriter recordingWriter;
+std::string recordingError;
+unsigned long long lastRecordedStep = 0;
+std::string sceneError; // Last failed scene load, physics thread
+
+// Playback of a recording, render thread only. Raw frames are drawn straight
+// from the mapped file.
+SnapshotReader playback;
+SnapshotFrame playbackView;
+bool playbackActive = false;
+bool playbackPlaying = false;
+int playbackFrame = 0;
+int shownPlaybackFrame = -1;
+float playbackFramesPerSecond = 30.0f;
+double playbackClock = 0.0;
+std::vector<unsigned int> playbackIds;
+std::vector<glm::vec3> playbackColors;
+bool attributesStale = false; // Body attributes on the GPU came from playback
+char recordingPath[256] = "recording.gsnap";
+bool recordQuantized = false;
+std::string playbackPath;
+std::string playbackError;
+
+// Click selection trees are kept up to date off the render thread, from the
+// first click on: live ones in publishSnapshot, playback ones by a posted
+// command that reads the recording through its own mapping, as Resume From
+// Frame does, and hands the tree back through a triple buffer
+struct PlaybackPickTree {
+    BodyPicker picker;
+    FloatArray x, y, z;
+    std::vector<float> radius;
+    std::vector<unsigned int> ids;
+    std::string path;
+    int frame = -1;
+    uint64_t bodyTable = 0;
+    bool valid = false;
+};
+bool maintainPickTrees = false;                // Physics thread
+SnapshotReader pickReader;                     // Physics thread
+std::string pickReaderPath;
+TripleBuffer<PlaybackPickTree> playbackPickTrees;
+std::atomic<bool> playbackPickPosted{false};   // A playback tree update is queued
+
+// Render-side state derived from snapshots
+bool interpolateMotion = true;
+FloatArray previousX, previousY, previousZ;
+double previousPublishTime = 0.0;
+unsigned int previousStructureVersion = ~0u;
+FloatArray interpolatedX, interpolatedY, interpolatedZ;
+const float* drawX = nullptr;
+const float* drawY = nullptr;
+const float* drawZ = nullptr;
+BodyListPanel bodyListPanel;
+std::vector<BodyEdit> pendingEdits;       // Body list edits, posted once per frame
+
+// Click selection, render thread only
+const float PICK_TOLERANCE_PIXELS = 4.0f; // Bodies smaller than this are hit within this many pixels
+bool pickTreesRequested = false;        // The physics thread was asked to keep pick trees
+bool pickRequested = false;             // Left click in the 3D view, handled once a tree is ready
+double pickX = 0.0, pickY = 0.0;        // Cursor position of the click
+double lastPickSeconds = 0.0;           // Ray query of the last click
+double lastPickTreeSeconds = 0.0;       // Last update of the tree it used
+size_t lastPickNodes = 0;
+unsigned long long lastPickRebuilds = 0;
+bool scrollToSelection = false;         // Open and show the selected body in the list
+int selectedIndex = -1;                 // Index of selectedBody in the drawn bodies
+int selectedIndexBody = -1;
+uint64_t selectedIndexTable = ~0ull;
+const size_t maxTrailLength = 500;
+TrailRenderer trailRenderer(maxTrailLength);
+VectorRenderer vectorRenderer;
+RenderState renderState;
+
+// Heap traffic of the last whole frame; steady state should be zero
+AllocationCounts frameAllocations;      // All threads
+AllocationCounts renderAllocations;     // Render thread only
+size_t frameArenaBytes = 0;             // Render thread arena used by the last frame
+BodyRenderer bodyRenderer;
+SpaceTimeGrid spaceTimeGrid;
+GridRenderer gridRenderer;
+ThreadPool gridThreadPool(ThreadPool::hardwareThreads());
+unsigned long long lastTrailStep = 0;
+
+double wallSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 // Sphere data
 std::vector<float> sphereVertices;
@@ -68,13 +214,14 @@ void generateSphere(float radius, int sectors, int stacks) {
     sphereVertices.clear();
     sphereIndices.clear();
     
+    const float pi = glm::pi<float>();
     for(int i = 0; i <= stacks; ++i) {
-        float stackAngle = M_PI / 2 - i * M_PI / stacks;
+        float stackAngle = pi / 2 - i * pi / stacks;
         float xy = radius * cosf(stackAngle);
         float z = radius * sinf(stackAngle);
         
         for(int j = 0; j <= sectors; ++j) {
-            float sectorAngle = j * 2 * M_PI / sectors;
+            float sectorAngle = j * 2 * pi / sectors;
             float x = xy * cosf(sectorAngle);
             float y = xy * sinf(sectorAngle);
             
@@ -110,204 +257,177 @@ void generateSphere(float radius, int sectors, int stacks) {
     }
 }
 
-const char* vertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-
-out vec3 FragPos;
-out vec3 Normal;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
-}
-)";
-
-const char* fragmentShaderSource = R"(
-#version 330 core
-out vec4 FragColor;
-
-in vec3 FragPos;
-in vec3 Normal;
-
-uniform vec3 objectColor;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-
-void main() {
-    float ambientStrength = 0.3;
-    vec3 ambient = ambientStrength * vec3(1.0);
-    
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * vec3(1.0);
-    
-    float specularStrength = 0.5;
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-    vec3 specular = specularStrength * spec * vec3(1.0);
-    
-    vec3 result = (ambient + diffuse + specular) * objectColor;
-    FragColor = vec4(result, 1.0);
-}
-)";
-
-const char* lineVertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
-
-uniform mat4 view;
-uniform mat4 projection;
-
-void main() {
-    gl_Position = projection * view * vec4(aPos, 1.0);
-}
-)";
-
-const char* lineFragmentShaderSource = R"(
-#version 330 core
-out vec4 FragColor;
-
-uniform vec3 lineColor;
-
-void main() {
-    FragColor = vec4(lineColor, 1.0);
+// Copies the physics state into the free snapshot slot and hands it to the renderer
+void publishSnapshot() {
+    SimulationSnapshot& snap = snapshots.writeBuffer();
+    snap.state = sim.state;
+    snap.ids.resize(sim.bodies.size());
+    snap.radius.resize(sim.bodies.size());
+    snap.color.resize(sim.bodies.size());
+    for(size_t i = 0; i < sim.bodies.size(); i++) {
+        snap.ids[i] = sim.bodies[i].id;
+        snap.radius[i] = sim.bodies[i].radius;
+        snap.color[i] = sim.bodies[i].color;
+    }
+    snap.structureVersion = sim.structureVersion;
+    snap.pickable = maintainPickTrees;
+    if(maintainPickTrees) {
+        PROFILE_SCOPE("Pick Tree");
+        snap.picker.update(snap.state.x.data(), snap.state.y.data(), snap.state.z.data(), snap.radius.data(),
+                           snap.state.size(), snap.pickerStructureVersion != sim.structureVersion, sim.threadPool);
+        snap.pickerStructureVersion = sim.structureVersion;
+    }
+    snap.step = sim.stepCount;
+    snap.simulationTime = sim.simulationTime;
+    snap.publishTime = wallSeconds();
+    snap.octreeNodes = sim.params.forceSolver == SOLVER_BARNES_HUT ? sim.octree.nodeCount() : 0;
+    snap.meshCellSize = sim.particleMesh.cellSize();
+    snap.shortRangePairs = sim.particleMesh.shortRangePairs();
+    snap.collisionPairs = sim.collisionPairs;
+    snap.totalMerges = sim.totalMerges;
+    snap.totalBounces = sim.totalBounces;
+    // Publishes without a step (edits, parameter changes) don't add frames
+    bool newStep = recordingWriter.frameCount() == 0 || sim.stepCount != lastRecordedStep;
+    if(recordingWriter.isOpen() && newStep) {
+        PROFILE_SCOPE("Record");
+        if(!recordingWriter.writeFrame(sim, recordingError)) {
+            std::cerr << "Recording stopped: " << recordingError << std::endl;
+        }
+        lastRecordedStep = sim.stepCount;
+    }
+    snap.recording = recordingWriter.isOpen();
+    snap.recordedFrames = recordingWriter.frameCount();
+    snap.recordedBytes = recordingWriter.bytesWritten();
+    snap.recordingStats = recordingWriter.stats();
+    snap.recordingError = recordingError;
+    snap.sceneError = sceneError;
+    snap.forceError = sim.forceError;
+    snap.conservation = sim.conservation;
+    snap.forceEvaluations = sim.forceEvaluations();
+    snap.reorderCount = sim.reorderCount;
+    snap.lastReorderStep = sim.lastReorderStep;
+    snap.lastReorderSeconds = sim.lastReorderSeconds;
+    snapshots.publish();
 }
-)";
 
-GLuint compileShader(const char* source, GLenum type) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
-    
-    int success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if(!success) {
-        char infoLog[512];
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        std::cerr << "Shader compilation error: " << infoLog << std::endl;
+// Physics thread: fits a playback pick tree to one frame of the recording
+void updatePlaybackPickTree(const std::string& path, int frame) {
+    PlaybackPickTree& tree = playbackPickTrees.writeBuffer();
+    if(pickReaderPath != path) {
+        std::string error;
+        pickReader.close();
+        pickReaderPath = pickReader.open(path, error) ? path : std::string();
+    }
+    SnapshotFrame view;
+    tree.valid = !pickReaderPath.empty() && pickReader.frame((size_t)frame, view);
+    if(tree.valid) {
+        PROFILE_SCOPE("Pick Tree");
+        bool rebuild = tree.path != path || tree.bodyTable != view.bodyTableOffset;
+        tree.x.assign(view.x, view.x + view.count);
+        tree.y.assign(view.y, view.y + view.count);
+        tree.z.assign(view.z, view.z + view.count);
+        tree.radius.assign(view.radius, view.radius + view.count);
+        tree.ids.assign(view.ids, view.ids + view.count);
+        tree.picker.update(tree.x.data(), tree.y.data(), tree.z.data(), tree.radius.data(), view.count,
+                           rebuild, sim.threadPool);
+        tree.bodyTable = view.bodyTableOffset;
     }
-    return shader;
+    tree.path = path;
+    tree.frame = frame;
+    playbackPickTrees.publish();
+    playbackPickPosted = false;
 }
 
-GLuint createShaderProgram(const char* vertexSrc, const char* fragmentSrc) {
-    GLuint vertexShader = compileShader(vertexSrc, GL_VERTEX_SHADER);
-    GLuint fragmentShader = compileShader(fragmentSrc, GL_FRAGMENT_SHADER);
+// Picks up the newest snapshot, if any, and chooses the positions drawn this
+// frame. With interpolation on, bodies are drawn between the previous and the
+// current snapshot, one physics batch behind, so motion stays smooth at any
+// physics rate. Returns true when a new snapshot was picked up.
+bool updateRenderState(double now) {
+    PROFILE_SCOPE("Sync Snapshot");
+    bool updated = snapshots.hasUpdate();
+    if(updated) {
+        const SimulationSnapshot& old = snapshots.readBuffer();
+        previousX = old.state.x;
+        previousY = old.state.y;
+        previousZ = old.state.z;
+        previousPublishTime = old.publishTime;
+        previousStructureVersion = old.structureVersion;
+        
+        snapshots.update();
+        const SimulationSnapshot& snap = snapshots.readBuffer();
+        if(!playbackActive) {
+            PROFILE_SCOPE("Trail Append");
+            trailRenderer.sync(snap.ids, snap.color);
+            if(showTrails && snap.step != lastTrailStep) {
+                trailRenderer.append(snap.state.x.data(), snap.state.y.data(), snap.state.z.data(), snap.state.size());
+            }
+        }
+        lastTrailStep = snap.step;
+    }
     
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
+    const SimulationSnapshot& snap = snapshots.readBuffer();
+    size_t n = snap.state.size();
+    drawX = snap.state.x.data();
+    drawY = snap.state.y.data();
+    drawZ = snap.state.z.data();
     
-    int success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if(!success) {
-        char infoLog[512];
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        std::cerr << "Program linking error: " << infoLog << std::endl;
+    double interval = snap.publishTime - previousPublishTime;
+    if(!interpolateMotion || previousStructureVersion != snap.structureVersion ||
+       previousX.size() != n || interval <= 0.0) {
+        return updated;
     }
     
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    return program;
+    PROFILE_SCOPE("Interpolate");
+    float alpha = (float)glm::clamp((now - snap.publishTime) / interval, 0.0, 1.0);
+    interpolatedX.resize(n);
+    interpolatedY.resize(n);
+    interpolatedZ.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        interpolatedX[i] = previousX[i] + (snap.state.x[i] - previousX[i]) * alpha;
+        interpolatedY[i] = previousY[i] + (snap.state.y[i] - previousY[i]) * alpha;
+        interpolatedZ[i] = previousZ[i] + (snap.state.z[i] - previousZ[i]) * alpha;
+    }
+    drawX = interpolatedX.data();
+    drawY = interpolatedY.data();
+    drawZ = interpolatedZ.data();
+    return updated;
 }
 
-void addBody(glm::vec3 pos, glm::vec3 vel, float mass, float radius, glm::vec3 color) {
-    GravityBody body;
-    body.position = pos;
-    body.velocity = vel;
-    body.acceleration = glm::vec3(0.0f);
-    body.force = glm::vec3(0.0f);
-    body.mass = mass;
-    body.radius = radius;
-    body.color = color;
-    bodies.push_back(body);
-}
+// Advances the playback clock and loads the frame to show. Returns true when
+// the frame's body table differs from the one shown before.
+bool updatePlaybackState(float deltaTime) {
+    PROFILE_SCOPE("Playback");
+    int frameCount = (int)playback.frameCount();
+    if(playbackPlaying && frameCount > 0) {
+        playbackClock += deltaTime * playbackFramesPerSecond;
+        int advance = (int)playbackClock;
+        playbackClock -= advance;
+        playbackFrame = std::min(playbackFrame + advance, frameCount - 1);
+        if(playbackFrame == frameCount - 1) playbackPlaying = false;
+    }
+    if(playbackFrame == shownPlaybackFrame) return false;
 
-void initializePreset(int preset) {
-    bodies.clear();
-    
-    switch(preset) {
-        case 0: // Earth-Sun
-            addBody(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 1000.0f, 5.0f, glm::vec3(1.0f, 0.8f, 0.0f));
-            addBody(glm::vec3(50, 0, 0), glm::vec3(0, 0, 45), 10.0f, 2.0f, glm::vec3(0.2f, 0.5f, 1.0f));
-            break;
-        case 1: // Binary System
-            addBody(glm::vec3(-30, 0, 0), glm::vec3(0, 0, 30), 500.0f, 4.0f, glm::vec3(1.0f, 0.3f, 0.3f));
-            addBody(glm::vec3(30, 0, 0), glm::vec3(0, 0, -30), 500.0f, 4.0f, glm::vec3(0.3f, 0.3f, 1.0f));
-            break;
-        case 2: // Three Body
-            addBody(glm::vec3(0, 0, 0), glm::vec3(0, 0, 20), 300.0f, 3.5f, glm::vec3(1.0f, 0.5f, 0.0f));
-            addBody(glm::vec3(40, 0, 0), glm::vec3(0, 0, -10), 300.0f, 3.5f, glm::vec3(0.0f, 1.0f, 0.5f));
-            addBody(glm::vec3(20, 35, 0), glm::vec3(-15, 0, 0), 300.0f, 3.5f, glm::vec3(0.5f, 0.0f, 1.0f));
-            break;
-        case 3: // Asteroid Field
-            {
-                std::random_device rd;
-                std::mt19937 gen(rd());
-                std::uniform_real_distribution<> posDist(-80.0, 80.0);
-                std::uniform_real_distribution<> velDist(-20.0, 20.0);
-                std::uniform_real_distribution<> massDist(5.0, 30.0);
-                std::uniform_real_distribution<> colorDist(0.3, 1.0);
-                
-                for(int i = 0; i < 15; i++) {
-                    glm::vec3 pos(posDist(gen), posDist(gen), posDist(gen));
-                    glm::vec3 vel(velDist(gen), velDist(gen), velDist(gen));
-                    float mass = massDist(gen);
-                    glm::vec3 color(colorDist(gen), colorDist(gen), colorDist(gen));
-                    addBody(pos, vel, mass, mass / 10.0f, color);
-                }
-            }
-            break;
+    uint64_t previousTable = shownPlaybackFrame < 0 ? 0 : playbackView.bodyTableOffset;
+    bool consecutive = playbackFrame == shownPlaybackFrame + 1;
+    if(!playback.frame(playbackFrame, playbackView)) {
+        playbackError = "Frame " + std::to_string(playbackFrame) + " is damaged";
+        playbackView = SnapshotFrame();
     }
-}
+    shownPlaybackFrame = playbackFrame;
+    if(playbackFrame + 1 < frameCount) playback.prefetch(playbackFrame + 1);
 
-void updatePhysics(float dt) {
-    if(!simulationRunning) return;
-    
-    dt *= simulationSpeed;
-    
-    // Calculate forces
-    for(size_t i = 0; i < bodies.size(); i++) {
-        bodies[i].force = glm::vec3(0.0f);
-        
-        for(size_t j = 0; j < bodies.size(); j++) {
-            if(i == j) continue;
-            
-            glm::vec3 direction = bodies[j].position - bodies[i].position;
-            float distance = glm::length(direction);
-            
-            if(distance < 0.001f) continue;
-            
-            float forceMagnitude = (gravityConstant * bodies[i].mass * bodies[j].mass) / 
-                                  (distance * distance + softeningFactor);
-            
-            glm::vec3 force = glm::normalize(direction) * forceMagnitude;
-            bodies[i].force += force;
-        }
+    bool tableChanged = playbackView.bodyTableOffset != previousTable;
+    if(tableChanged) {
+        playbackIds.assign(playbackView.ids, playbackView.ids + playbackView.count);
+        playbackColors.assign(playbackView.color, playbackView.color + playbackView.count);
+        trailRenderer.sync(playbackIds, playbackColors);
     }
-    
-    // Update velocities and positions
-    for(auto& body : bodies) {
-        body.acceleration = body.force / body.mass;
-        body.velocity += body.acceleration * dt;
-        body.position += body.velocity * dt;
-        
-        if(showTrails) {
-            body.trail.push_back(body.position);
-            if(body.trail.size() > body.maxTrailLength) {
-                body.trail.erase(body.trail.begin());
-            }
-        }
+    if(showTrails) {
+        // After a jump the trail would draw a line across it
+        if(!consecutive) trailRenderer.clear();
+        trailRenderer.append(playbackView.x, playbackView.y, playbackView.z, playbackView.count);
     }
+    return tableChanged;
 }
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -320,6 +440,10 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
         if(action == GLFW_PRESS) mousePressed = true;
         else if(action == GLFW_RELEASE) mousePressed = false;
     }
+    if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !ImGui::GetIO().WantCaptureMouse) {
+        glfwGetCursorPos(window, &pickX, &pickY);
+        pickRequested = true;
+    }
 }
 
 void cursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
@@ -408,231 +532,496 @@ int main() {
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330");
     
-    GLuint shaderProgram = createShaderProgram(vertexShaderSource, fragmentShaderSource);
-    GLuint lineShaderProgram = createShaderProgram(lineVertexShaderSource, lineFragmentShaderSource);
-    
-    generateSphere(1.0f, 36, 18);
+    renderState.init();
     
-    GLuint VAO, VBO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), &sphereVertices[0], GL_STATIC_DRAW);
-    
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), &sphereIndices[0], GL_STATIC_DRAW);
+    // Sphere LODs from most to least detailed, each used down to the given
+    // projected radius in pixels; smaller bodies become point sprites. An
+    // outline of s sectors is off by r * (1 - cos(pi / s)), about r * pi^2 / 2s^2,
+    // so the next coarser LOD takes over once that is under half a pixel
+    const int lodSectors[] = { 64, 32, 16, 8 };
+    const float lodMinPixels[] = { 104.0f, 26.0f, 6.5f, 4.0f };
+    std::vector<SphereLod> sphereLods;
+    for(int i = 0; i < 4; i++) {
+        generateSphere(1.0f, lodSectors[i], lodSectors[i] / 2);
+        sphereLods.push_back({ sphereVertices, sphereIndices, lodMinPixels[i] });
+    }
+    bodyRenderer.init(renderState, sphereLods);
     
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    trailRenderer.init(renderState);
+    vectorRenderer.init(renderState);
+    gridRenderer.init(renderState);
     
-    GLuint lineVAO, lineVBO;
-    glGenVertexArrays(1, &lineVAO);
-    glGenBuffers(1, &lineVBO);
+    setProfileThreadName("Render");
+    GpuTimer gpuTimer;
+    gpuTimer.init("GPU");
+    ProfilerPanel profilerPanel(FRAME_SCOPE);
     
-    initializePreset(0);
+    // Physics runs on its own thread from here on; everything below talks to
+    // it through posted commands and reads state from published snapshots.
+    SimulationParams postedParams = params;
+    physicsThread.post([postedParams] {
+        sim.params = postedParams;
+        sim.initializePreset(0);
+    });
+    physicsThread.start([](double dt) { sim.step(dt); }, publishSnapshot);
     
     float lastFrame = 0.0f;
     
     while(!glfwWindowShouldClose(window)) {
+        PROFILE_SCOPE(FRAME_SCOPE);
+        // The render thread's arena is the frame arena: scratch lives until here
+        frameArenaBytes = threadArena().usedBytes();
+        threadArena().reset();
+        AllocationCounts frameStart = allocationCounts();
+        AllocationCounts renderStart = threadAllocationCounts();
+        gpuTimer.collect();
+        renderState.beginFrame();
         float currentFrame = glfwGetTime();
         float deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         
+        PROFILE_BEGIN("Input");
         processInput(window, deltaTime);
-        updatePhysics(timeStep);
+        
+        physicsThread.setTiming(params.timeStep, params.simulationSpeed, !params.running);
+        if(params != postedParams) {
+            postedParams = params;
+            physicsThread.post([postedParams] { sim.params = postedParams; });
+        }
+        PROFILE_END();
+        
+        bool newSnapshot = updateRenderState(wallSeconds());
+        const SimulationSnapshot& snap = snapshots.readBuffer();
+        const BodyState& snapState = snap.state;
+        
+        // Draw the live simulation, or the current frame of the recording
+        size_t drawCount = snapState.size();
+        const float* drawMass = snapState.mass.data();
+        const float* drawVX = snapState.vx.data();
+        const float* drawVY = snapState.vy.data();
+        const float* drawVZ = snapState.vz.data();
+        PROFILE_BEGIN("Upload");
+        if(playbackActive) {
+            if(updatePlaybackState(deltaTime) || !attributesStale) {
+                bodyRenderer.updateAttributes(playbackView.radius, playbackView.color, playbackView.count);
+                attributesStale = true;
+            }
+            drawCount = playbackView.count;
+            drawX = playbackView.x;
+            drawY = playbackView.y;
+            drawZ = playbackView.z;
+            drawMass = playbackView.mass;
+            drawVX = playbackView.vx;
+            drawVY = playbackView.vy;
+            drawVZ = playbackView.vz;
+        }
+        else if(newSnapshot || attributesStale) {
+            bodyRenderer.updateAttributes(snap.radius.data(), snap.color.data(), snapState.size());
+            attributesStale = false;
+        }
+        bodyRenderer.updatePositions(drawX, drawY, drawZ, drawCount);
+        PROFILE_END();
         
         glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WIDTH / HEIGHT, 0.1f, 1000.0f);
         glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        renderState.setCamera(view, projection, cameraPos);
         
-        // Draw space-time grid
-        if(showSpaceTimeGrid) {
-            glUseProgram(lineShaderProgram);
-            glUniformMatrix4fv(glGetUniformLocation(lineShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-            glUniformMatrix4fv(glGetUniformLocation(lineShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-            glUniform3f(glGetUniformLocation(lineShaderProgram, "lineColor"), 0.3f, 0.3f, 0.4f);
+        // Click selection. The trees are fit off the render thread, so a click
+        // only runs the ray query, against the positions its tree was fit to:
+        // the newest snapshot, not the interpolated positions drawn between
+        // it and the one before, or the newest playback frame the physics
+        // thread has caught up with. Live and playback body tables are told
+        // apart by the top bit.
+        uint64_t bodyTable = playbackActive ? (playbackView.bodyTableOffset | 1ull << 63) : snap.structureVersion;
+        const unsigned int* drawIds = playbackActive ? playbackIds.data() : snap.ids.data();
+        if(pickRequested && !pickTreesRequested) {
+            physicsThread.post([] { maintainPickTrees = true; });
+            pickTreesRequested = true;
+        }
+        if(pickTreesRequested && playbackActive) {
+            playbackPickTrees.update();
+            const PlaybackPickTree& tree = playbackPickTrees.readBuffer();
+            bool behind = tree.frame != shownPlaybackFrame || tree.path != playbackPath;
+            if(behind && !playbackPickPosted.exchange(true)) {
+                std::string path = playbackPath;
+                int frame = shownPlaybackFrame;
+                physicsThread.post([path, frame] { updatePlaybackPickTree(path, frame); });
+            }
+        }
+        const BodyPicker* picker = nullptr;
+        const float *pickPositionX = nullptr, *pickPositionY = nullptr, *pickPositionZ = nullptr;
+        const float* pickRadius = nullptr;
+        const unsigned int* pickIds = nullptr;
+        size_t pickCount = 0;
+        if(playbackActive) {
+            const PlaybackPickTree& tree = playbackPickTrees.readBuffer();
+            if(tree.valid && tree.path == playbackPath) {
+                picker = &tree.picker;
+                pickPositionX = tree.x.data();
+                pickPositionY = tree.y.data();
+                pickPositionZ = tree.z.data();
+                pickRadius = tree.radius.data();
+                pickIds = tree.ids.data();
+                pickCount = tree.ids.size();
+            }
+        }
+        else if(snap.pickable) {
+            picker = &snap.picker;
+            pickPositionX = snapState.x.data();
+            pickPositionY = snapState.y.data();
+            pickPositionZ = snapState.z.data();
+            pickRadius = snap.radius.data();
+            pickIds = snap.ids.data();
+            pickCount = snapState.size();
+        }
+        if(pickRequested && picker) {
+            PROFILE_SCOPE("Pick");
+            pickRequested = false;
             
-            std::vector<float> gridVertices;
-            float gridSize = 200.0f;
-            float step = gridSize / gridResolution;
+            int windowWidth, windowHeight;
+            glfwGetWindowSize(window, &windowWidth, &windowHeight);
+            float ndcX = 2.0f * (float)pickX / windowWidth - 1.0f;
+            float ndcY = 1.0f - 2.0f * (float)pickY / windowHeight;
+            glm::mat4 unproject = glm::inverse(projection * view);
+            glm::vec4 nearPoint = unproject * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+            glm::vec4 farPoint = unproject * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+            glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+            glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+            float slope = PICK_TOLERANCE_PIXELS / (projection[1][1] * HEIGHT * 0.5f);
             
-            for(int i = 0; i <= gridResolution; i++) {
-                for(int j = 0; j <= gridResolution; j++) {
-                    float x = -gridSize / 2 + i * step;
-                    float z = -gridSize / 2 + j * step;
-                    float y = 0.0f;
-                    
-                    // Calculate deformation
-                    for(const auto& body : bodies) {
-                        float dist = glm::length(glm::vec2(x - body.position.x, z - body.position.z));
-                        float deform = (body.mass / 100.0f) * gridDeformationIntensity / (1.0f + dist / 10.0f);
-                        y -= deform;
-                    }
-                    
-                    gridVertices.push_back(x);
-                    gridVertices.push_back(y);
-                    gridVertices.push_back(z);
+            double queryStart = wallSeconds();
+            int hit = picker->pick(origin, direction, slope, pickPositionX, pickPositionY, pickPositionZ,
+                                   pickRadius, pickCount);
+            lastPickSeconds = wallSeconds() - queryStart;
+            lastPickTreeSeconds = picker->lastUpdateSeconds();
+            lastPickNodes = picker->nodeCount();
+            lastPickRebuilds = picker->rebuildCount();
+            selectedBody = hit >= 0 ? (int)pickIds[hit] : -1;
+            scrollToSelection = hit >= 0;
+        }
+        if(selectedBody != selectedIndexBody || bodyTable != selectedIndexTable) {
+            selectedIndex = -1;
+            for(size_t i = 0; i < drawCount && selectedBody >= 0; i++) {
+                if(drawIds[i] == (unsigned int)selectedBody) {
+                    selectedIndex = (int)i;
+                    break;
                 }
             }
-            
-            glBindVertexArray(lineVAO);
-            glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-            glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), &gridVertices[0], GL_DYNAMIC_DRAW);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-            glEnableVertexAttribArray(0);
-            
-            for(int i = 0; i < gridResolution; i++) {
-                glDrawArrays(GL_LINE_STRIP, i * (gridResolution + 1), gridResolution + 1);
+            selectedIndexBody = selectedBody;
+            selectedIndexTable = bodyTable;
+        }
+        bodyRenderer.setHighlight(selectedIndex);
+        
+        // Draw space-time grid
+        if(showSpaceTimeGrid) {
+            PROFILE_SCOPE("Grid");
+            if(spaceTimeGrid.resolution() != gridResolution) {
+                spaceTimeGrid.setResolution(gridResolution);
+                gridRenderer.setResolution(gridResolution, spaceTimeGrid.size());
             }
-            for(int j = 0; j <= gridResolution; j++) {
-                std::vector<unsigned int> indices;
-                for(int i = 0; i <= gridResolution; i++) {
-                    indices.push_back(i * (gridResolution + 1) + j);
+            {
+                PROFILE_SCOPE("Grid Deform");
+                if(spaceTimeGrid.update(drawX, drawZ, drawMass, drawCount, gridThreadPool)) {
+                    gridRenderer.updateDepth(spaceTimeGrid.depth());
                 }
-                glDrawElements(GL_LINE_STRIP, indices.size(), GL_UNSIGNED_INT, indices.data());
             }
+            gpuTimer.begin("Grid");
+            gridRenderer.draw(gridDeformationIntensity / 100.0f, glm::vec3(0.3f, 0.3f, 0.4f));
+            gpuTimer.end();
         }
         
         // Draw bodies
-        glUseProgram(shaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, glm::value_ptr(glm::vec3(100, 100, 100)));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(cameraPos));
-        
-        glBindVertexArray(VAO);
-        for(const auto& body : bodies) {
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, body.position);
-            model = glm::scale(model, glm::vec3(body.radius));
-            glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-            glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1, glm::value_ptr(body.color));
-            glDrawElements(GL_TRIANGLES, sphereIndices.size(), GL_UNSIGNED_INT, 0);
-        }
+        PROFILE_BEGIN("Bodies");
+        gpuTimer.begin("Bodies");
+        bodyRenderer.draw(view, projection, (float)HEIGHT, glm::vec3(100, 100, 100));
+        gpuTimer.end();
+        PROFILE_END();
         
         // Draw trails
         if(showTrails) {
-            glUseProgram(lineShaderProgram);
-            glUniformMatrix4fv(glGetUniformLocation(lineShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-            glUniformMatrix4fv(glGetUniformLocation(lineShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-            
-            glBindVertexArray(lineVAO);
-            for(const auto& body : bodies) {
-                if(body.trail.size() < 2) continue;
-                
-                std::vector<float> trailVerts;
-                for(const auto& pos : body.trail) {
-                    trailVerts.push_back(pos.x);
-                    trailVerts.push_back(pos.y);
-                    trailVerts.push_back(pos.z);
-                }
-                
-                glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-                glBufferData(GL_ARRAY_BUFFER, trailVerts.size() * sizeof(float), &trailVerts[0], GL_DYNAMIC_DRAW);
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-                glEnableVertexAttribArray(0);
-                
-                glUniform3fv(glGetUniformLocation(lineShaderProgram, "lineColor"), 1, glm::value_ptr(body.color * 0.7f));
-                glDrawArrays(GL_LINE_STRIP, 0, body.trail.size());
-            }
+            PROFILE_SCOPE("Trails");
+            gpuTimer.begin("Trails");
+            trailRenderer.draw();
+            gpuTimer.end();
         }
         
-        // Draw velocity vectors
-        if(showVelocity) {
-            glUseProgram(lineShaderProgram);
-            glBindVertexArray(lineVAO);
-            
-            for(const auto& body : bodies) {
-                float lineVerts[] = {
-                    body.position.x, body.position.y, body.position.z,
-                    body.position.x + body.velocity.x * 0.5f, 
-                    body.position.y + body.velocity.y * 0.5f, 
-                    body.position.z + body.velocity.z * 0.5f
-                };
-                
-                glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-                glBufferData(GL_ARRAY_BUFFER, sizeof(lineVerts), lineVerts, GL_DYNAMIC_DRAW);
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-                glEnableVertexAttribArray(0);
-                
-                glUniform3f(glGetUniformLocation(lineShaderProgram, "lineColor"), 0.0f, 1.0f, 0.0f);
-                glDrawArrays(GL_LINES, 0, 2);
+        // Draw velocity and force vectors; recordings don't store forces
+        bool drawForces = showForce && !playbackActive && snapState.size() == drawCount;
+        if(showVelocity || drawForces) {
+            PROFILE_SCOPE("Vectors");
+            gpuTimer.begin("Vectors");
+            VectorField fields[2];
+            size_t fieldCount = 0;
+            if(showVelocity) {
+                fields[fieldCount++] = { drawVX, drawVY, drawVZ, 0.5f, glm::vec3(0.0f, 1.0f, 0.0f) };
             }
-        }
-        
-        // Draw force vectors
-        if(showForce) {
-            glUseProgram(lineShaderProgram);
-            glBindVertexArray(lineVAO);
-            
-            for(const auto& body : bodies) {
-                glm::vec3 forceVis = body.force * 0.01f;
-                float lineVerts[] = {
-                    body.position.x, body.position.y, body.position.z,
-                    body.position.x + forceVis.x, 
-                    body.position.y + forceVis.y, 
-                    body.position.z + forceVis.z
-                };
-                
-                glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-                glBufferData(GL_ARRAY_BUFFER, sizeof(lineVerts), lineVerts, GL_DYNAMIC_DRAW);
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-                glEnableVertexAttribArray(0);
-                
-                glUniform3f(glGetUniformLocation(lineShaderProgram, "lineColor"), 1.0f, 0.0f, 0.0f);
-                glDrawArrays(GL_LINES, 0, 2);
+            if(drawForces) {
+                fields[fieldCount++] = { snapState.fx.data(), snapState.fy.data(), snapState.fz.data(),
+                                         0.01f, glm::vec3(1.0f, 0.0f, 0.0f) };
             }
+            vectorRenderer.draw(drawX, drawY, drawZ, drawCount, fields, fieldCount, vectorDecimation, (size_t)maxArrows);
+            gpuTimer.end();
         }
         
         // ImGui
+        PROFILE_BEGIN("UI");
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         
         ImGui::Begin("Gravity Simulation Control", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
         
-        if(ImGui::Button(simulationRunning ? "Pause" : "Start")) {
-            simulationRunning = !simulationRunning;
+        if(ImGui::Button(params.running ? "Pause" : "Start")) {
+            params.running = !params.running;
         }
         ImGui::SameLine();
         if(ImGui::Button("Reset")) {
-            for(auto& body : bodies) body.trail.clear();
+            trailRenderer.clear();
         }
         
         ImGui::Separator();
         ImGui::Text("Global Settings");
-        ImGui::SliderFloat("Gravity Constant", &gravityConstant, 100.0f, 5000.0f);
-        ImGui::SliderFloat("Simulation Speed", &simulationSpeed, 0.1f, 5.0f);
-        ImGui::SliderFloat("Time Step", &timeStep, 0.001f, 0.05f);
-        ImGui::SliderFloat("Softening Factor", &softeningFactor, 0.1f, 10.0f);
+        ImGui::SliderFloat("Gravity Constant", &params.gravityConstant, 100.0f, 5000.0f);
+        ImGui::SliderFloat("Simulation Speed", &params.simulationSpeed, 0.1f, 5.0f);
+        ImGui::SliderFloat("Time Step", &params.timeStep, 0.001f, 0.05f);
+        ImGui::SliderInt("Substeps", &params.substeps, 1, 16);
+        ImGui::SliderFloat("Softening Factor", &params.softeningFactor, 0.1f, 10.0f);
+        ImGui::Checkbox("Interpolate Motion", &interpolateMotion);
+        ImGui::Text("Physics: %.0f steps/s, t = %.2f", physicsThread.stepsPerSecond(), snap.simulationTime);
+        if(physicsThread.droppedSimTime() > 0.0) {
+            ImGui::Text("Falling behind: %.2f s of simulated time skipped", physicsThread.droppedSimTime());
+        }
+        
+        ImGui::Separator();
+        ImGui::Text("Force Solver");
+        const char* solverNames[] = { "Direct Sum", "Barnes-Hut", "Particle Mesh" };
+        ImGui::Combo("Solver", &params.forceSolver, solverNames, SOLVER_COUNT);
+        if(params.forceSolver == SOLVER_DIRECT) {
+            ImGui::Text("Direct Kernel: %s", directKernelName());
+        }
+        if(ImGui::SliderInt("Physics Threads", &physicsThreads, 1, (int)ThreadPool::hardwareThreads())) {
+            int threads = physicsThreads;
+            physicsThread.post([threads] { sim.threadPool.resize(threads); });
+        }
+        if(params.forceSolver == SOLVER_BARNES_HUT) {
+            ImGui::SliderFloat("Opening Angle", &params.barnesHutTheta, 0.0f, 1.5f);
+            if(ImGui::Button("Measure Force Error")) {
+                // Measured against the tree of the last step, so run at least one step first
+                physicsThread.post([] { sim.measureForceError(256); });
+            }
+            ImGui::Text("Octree Nodes: %zu", snap.octreeNodes);
+            ImGui::Text("Force Error: rms %.2e, max %.2e (%zu samples)",
+                        snap.forceError.rmsRelative, snap.forceError.maxRelative, snap.forceError.samples);
+        }
+        if(params.forceSolver == SOLVER_PARTICLE_MESH) {
+            const int meshSizes[] = { 32, 64, 128, 256 };
+            const char* meshNames[] = { "32^3", "64^3", "128^3", "256^3" };
+            int meshChoice = 0;
+            while(meshChoice < 3 && meshSizes[meshChoice] < params.meshSize) meshChoice++;
+            if(ImGui::Combo("FFT Size", &meshChoice, meshNames, 4)) params.meshSize = meshSizes[meshChoice];
+            ImGui::Checkbox("Short-Range Correction (P3M)", &params.shortRangeCorrection);
+            ImGui::Text("Cell Size: %.3f", snap.meshCellSize);
+            if(params.shortRangeCorrection) ImGui::Text("Short-Range Pairs: %.3g", snap.shortRangePairs);
+        }
+        
+        ImGui::Separator();
+        ImGui::Text("Integrator");
+        const char* integratorNames[INTEGRATOR_COUNT];
+        for(int i = 0; i < INTEGRATOR_COUNT; i++) integratorNames[i] = integratorName(i);
+        ImGui::Combo("Method", &params.integrator, integratorNames, INTEGRATOR_COUNT);
+        const char* precisionNames[PRECISION_COUNT];
+        for(int i = 0; i < PRECISION_COUNT; i++) precisionNames[i] = precisionName(i);
+        ImGui::Combo("Precision", &params.precision, precisionNames, PRECISION_COUNT);
+        if(params.integrator == INTEGRATOR_HERMITE) {
+            ImGui::Checkbox("Block Timesteps", &params.blockTimesteps);
+            ImGui::Text("Hermite always uses direct summation");
+        }
+        if(snap.conservation.valid) {
+            ImGui::Text("Energy Error: %.2e", snap.conservation.relativeEnergyError);
+            ImGui::Text("Momentum Error: %.2e", snap.conservation.momentumError);
+            ImGui::Text("Force Evaluations: %.1f", snap.conservation.forceEvaluations);
+        }
+        else {
+            ImGui::Text("Conservation tracking off above %zu bodies", Simulation::CONSERVATION_MAX_BODIES);
+        }
+        
+        ImGui::Separator();
+        ImGui::Text("Body Order");
+        const char* orderingNames[ORDERING_COUNT];
+        for(int i = 0; i < ORDERING_COUNT; i++) orderingNames[i] = bodyOrderingName(i);
+        ImGui::Combo("Memory Order", &params.bodyOrdering, orderingNames, ORDERING_COUNT);
+        if(params.bodyOrdering != ORDERING_NONE) {
+            ImGui::SliderFloat("Reorder Distance", &params.reorderDistance, 0.1f, 10.0f, "%.1f spacings");
+            ImGui::Text("Reorders: %llu, last %.2f ms, %llu steps ago", snap.reorderCount,
+                        snap.lastReorderSeconds * 1000.0, snap.step - snap.lastReorderStep);
+        }
+        
+        ImGui::Separator();
+        ImGui::Text("Collisions");
+        const char* collisionNames[COLLISION_MODE_COUNT];
+        for(int i = 0; i < COLLISION_MODE_COUNT; i++) collisionNames[i] = collisionModeName(i);
+        ImGui::Combo("Response", &params.collisionMode, collisionNames, COLLISION_MODE_COUNT);
+        if(params.collisionMode != COLLISION_NONE) {
+            ImGui::Text("Overlapping: %zu, merges: %llu, bounces: %llu",
+                        snap.collisionPairs, snap.totalMerges, snap.totalBounces);
+        }
         
         ImGui::Separator();
         ImGui::Text("Visualization");
         ImGui::Checkbox("Show Trails", &showTrails);
         ImGui::Checkbox("Show Velocity", &showVelocity);
         ImGui::Checkbox("Show Force", &showForce);
+        if(showVelocity || showForce) {
+            const char* decimationNames[VECTORS_DECIMATION_COUNT];
+            for(int i = 0; i < VECTORS_DECIMATION_COUNT; i++) decimationNames[i] = vectorDecimationName(i);
+            ImGui::Combo("Arrows", &vectorDecimation, decimationNames, VECTORS_DECIMATION_COUNT);
+            if(vectorDecimation != VECTORS_ALL) {
+                ImGui::SliderInt("Max Arrows", &maxArrows, 100, 100000, "%d", ImGuiSliderFlags_Logarithmic);
+            }
+            ImGui::Text("Arrows: %zu", vectorRenderer.arrowCount());
+        }
         ImGui::Checkbox("Space-Time Grid", &showSpaceTimeGrid);
+        ImGui::Checkbox("Profiler", &showProfiler);
         
         if(showSpaceTimeGrid) {
             ImGui::SliderFloat("Grid Deformation", &gridDeformationIntensity, 0.1f, 2.0f);
-            ImGui::SliderInt("Grid Resolution", &gridResolution, 20, 100);
+            ImGui::SliderInt("Grid Resolution", &gridResolution, 20, 256);
+            ImGui::Text("Grid: %zu far bodies", spaceTimeGrid.farBodyCount());
+        }
+        
+        const std::vector<size_t>& lodCounts = bodyRenderer.lodCounts();
+        ImGui::Text("Drawn: %zu / %zu / %zu / %zu spheres, %zu sprites, %zu culled",
+                    lodCounts[0], lodCounts[1], lodCounts[2], lodCounts[3], lodCounts[4],
+                    bodyRenderer.culledCount());
+        const RenderStats& renderStats = renderState.lastFrame();
+        ImGui::Text("GL: %zu draws, %zu state changes, %zu redundant skipped",
+                    renderStats.drawCalls, renderStats.stateChanges, renderStats.skippedChanges);
+        ImGui::Text("Heap: %llu allocations (%.1f KB) last frame, %llu on the render thread",
+                    (unsigned long long)frameAllocations.allocations, frameAllocations.bytes / 1024.0,
+                    (unsigned long long)renderAllocations.allocations);
+        ImGui::Text("Frame Arena: %.1f KB used, %.1f KB reserved",
+                    frameArenaBytes / 1024.0, threadArena().capacityBytes() / 1024.0);
+        
+        ImGui::Separator();
+        ImGui::Text("Recording");
+        ImGui::InputText("File", recordingPath, sizeof(recordingPath));
+        if(!snap.recording) {
+            ImGui::Checkbox("Quantized", &recordQuantized);
+            ImGui::SameLine();
+            if(ImGui::Button("Record")) {
+                std::string path = recordingPath;
+                int encoding = recordQuantized ? SNAPSHOT_QUANTIZED : SNAPSHOT_RAW;
+                physicsThread.post([path, encoding] {
+                    if(recordingWriter.open(path, sim, encoding, recordingError, RECORDING_BUFFERS)) recordingError.clear();
+                });
+            }
+        }
+        else {
+            if(ImGui::Button("Stop Recording")) physicsThread.post([] { recordingWriter.close(); });
+            ImGui::SameLine();
+            ImGui::Text("%zu frames, %.1f MB", snap.recordedFrames, snap.recordedBytes / 1e6);
+            const SnapshotWriterStats& stats = snap.recordingStats;
+            ImGui::Text("%.1f MB/s, queue %zu/%zu", stats.bytesPerSecond / 1e6, stats.queueDepth, RECORDING_BUFFERS);
+            ImGui::Text("Stalled %.1f ms in %zu waits", stats.stallSeconds * 1000.0, stats.stalls);
+        }
+        if(!snap.recordingError.empty()) ImGui::Text("%s", snap.recordingError.c_str());
+        
+        if(!playbackActive) {
+            if(ImGui::Button("Open Playback")) {
+                if(playback.open(recordingPath, playbackError)) {
+                    if(playback.frameCount() > 0) {
+                        playbackActive = true;
+                        playbackPlaying = false;
+                        playbackFrame = 0;
+                        shownPlaybackFrame = -1;
+                        playbackClock = 0.0;
+                        playbackPath = recordingPath;
+                        playbackError.clear();
+                        params.running = false;
+                        trailRenderer.clear();
+                    }
+                    else {
+                        playback.close();
+                        playbackError = "The recording has no frames";
+                    }
+                }
+            }
+        }
+        else {
+            ImGui::SliderInt("Frame", &playbackFrame, 0, (int)playback.frameCount() - 1);
+            ImGui::Checkbox("Play", &playbackPlaying);
+            ImGui::SameLine();
+            ImGui::SliderFloat("Frames/s", &playbackFramesPerSecond, 1.0f, 240.0f);
+            ImGui::Text("Step %llu, t = %.2f, %zu bodies", playbackView.step, playbackView.time, playbackView.count);
+            bool closePlayback = false;
+            if(ImGui::Button("Resume From Frame")) {
+                // The physics thread maps the file itself rather than share this mapping
+                std::string path = playbackPath;
+                size_t frame = (size_t)playbackFrame;
+                physicsThread.post([path, frame] {
+                    SnapshotReader reader;
+                    SnapshotFrame view;
+                    std::string error;
+                    if(reader.open(path, error) && reader.frame(frame, view)) restoreSnapshotFrame(view, sim);
+                });
+                params.gravityConstant = playbackView.gravityConstant;
+                params.softeningFactor = playbackView.softeningFactor;
+                params.timeStep = playbackView.timeStep;
+                closePlayback = true;
+            }
+            ImGui::SameLine();
+            if(ImGui::Button("Close Playback") || closePlayback) {
+                physicsThread.post([] {
+                    pickReader.close();
+                    pickReaderPath.clear();
+                });
+                playback.close();
+                playbackView = SnapshotFrame();
+                playbackActive = false;
+                trailRenderer.clear();
+            }
         }
+        if(!playbackError.empty()) ImGui::Text("%s", playbackError.c_str());
         
         ImGui::Separator();
         ImGui::Text("Presets");
-        if(ImGui::Button("Earth-Sun")) initializePreset(0);
+        int preset = -1;
+        if(ImGui::Button("Earth-Sun")) preset = 0;
         ImGui::SameLine();
-        if(ImGui::Button("Binary Stars")) initializePreset(1);
-        if(ImGui::Button("Three Body")) initializePreset(2);
+        if(ImGui::Button("Binary Stars")) preset = 1;
+        if(ImGui::Button("Three Body")) preset = 2;
         ImGui::SameLine();
-        if(ImGui::Button("Asteroid Field")) initializePreset(3);
+        if(ImGui::Button("Asteroid Field")) preset = 3;
+        if(preset >= 0) {
+            int fieldBodyCount = asteroidCount;
+            physicsThread.post([preset, fieldBodyCount] { sim.initializePreset(preset, fieldBodyCount); });
+        }
+        ImGui::SliderInt("Asteroid Count", &asteroidCount, 15, 100000, "%d", ImGuiSliderFlags_Logarithmic);
+
+        const char* generatorNames[GENERATOR_COUNT];
+        for(int i = 0; i < GENERATOR_COUNT; i++) generatorNames[i] = scenarioGeneratorName(i);
+        ImGui::Combo("Generator", &generatorType, generatorNames, GENERATOR_COUNT);
+        ImGui::SliderInt("Generated Bodies", &generatorCount, 100, 10000000, "%d", ImGuiSliderFlags_Logarithmic);
+        if(ImGui::Button("Generate")) {
+            GeneratorParams generator;
+            generator.generator = generatorType;
+            generator.bodyCount = (size_t)generatorCount;
+            physicsThread.post([generator] { generateScenario(generator, sim); });
+        }
+        ImGui::InputText("Scene", scenePath, sizeof(scenePath));
+        if(ImGui::Button("Load Scene")) {
+            // The panel's parameters stay in effect over any a recording carries
+            std::string path = scenePath;
+            SimulationParams panelParams = params;
+            physicsThread.post([path, panelParams] {
+                if(loadScenario(path, sim, sceneError)) sceneError.clear();
+                sim.params = panelParams;
+            });
+        }
+        if(!snap.sceneError.empty()) ImGui::Text("%s", snap.sceneError.c_str());
         
         ImGui::Separator();
         ImGui::Text("Object Editor");
@@ -650,41 +1039,38 @@ int main() {
         ImGui::ColorEdit3("Color", &newColorR);
         
         if(ImGui::Button("Add Body")) {
-            addBody(glm::vec3(newPosX, newPosY, newPosZ), 
-                   glm::vec3(newVelX, newVelY, newVelZ),
-                   newMass, newRadius, glm::vec3(newColorR, newColorG, newColorB));
+            glm::vec3 pos(newPosX, newPosY, newPosZ);
+            glm::vec3 vel(newVelX, newVelY, newVelZ);
+            glm::vec3 color(newColorR, newColorG, newColorB);
+            float mass = newMass, radius = newRadius;
+            physicsThread.post([pos, vel, mass, radius, color] { sim.addBody(pos, vel, mass, radius, color); });
         }
         
         if(ImGui::Button("Clear All")) {
-            bodies.clear();
+            physicsThread.post([] { sim.clearBodies(); });
         }
         
         ImGui::Separator();
-        ImGui::Text("Bodies: %zu", bodies.size());
-        
-        for(size_t i = 0; i < bodies.size(); i++) {
-            ImGui::PushID(i);
-            if(ImGui::TreeNode(("Body " + std::to_string(i)).c_str())) {
-                auto& b = bodies[i];
-                ImGui::Text("Position: (%.2f, %.2f, %.2f)", b.position.x, b.position.y, b.position.z);
-                ImGui::Text("Velocity: (%.2f, %.2f, %.2f)", b.velocity.x, b.velocity.y, b.velocity.z);
-                ImGui::Text("Speed: %.2f", glm::length(b.velocity));
-                ImGui::Text("Force: %.2f", glm::length(b.force));
-                
-                ImGui::DragFloat("Mass##edit", &b.mass, 1.0f, 1.0f, 10000.0f);
-                ImGui::DragFloat("Radius##edit", &b.radius, 0.1f, 0.5f, 20.0f);
-                ImGui::ColorEdit3("Color##edit", glm::value_ptr(b.color));
-                
-                if(ImGui::Button("Remove")) {
-                    bodies.erase(bodies.begin() + i);
-                    ImGui::TreePop();
-                    ImGui::PopID();
-                    break;
-                }
-                
-                ImGui::TreePop();
-            }
-            ImGui::PopID();
+        ImGui::Text("Bodies: %zu", snapState.size());
+        if(selectedBody >= 0) {
+            ImGui::SameLine();
+            ImGui::Text("Selected: Body %d", selectedBody);
+            ImGui::SameLine();
+            if(ImGui::SmallButton("Deselect")) selectedBody = -1;
+        }
+        if(lastPickNodes > 0) {
+            ImGui::Text("Last pick: ray %.3f ms; tree %.2f ms off the render thread, %zu nodes, %llu rebuilds",
+                        lastPickSeconds * 1000.0, lastPickTreeSeconds * 1000.0, lastPickNodes, lastPickRebuilds);
+        }
+        
+        // Edits are posted by id once per frame and show up in a later snapshot
+        BodyListView listView = { &snapState, snap.ids.data(), snap.radius.data(), snap.color.data(),
+                                  snap.structureVersion, cameraPos };
+        bodyListPanel.draw(listView, selectedBody, scrollToSelection, pendingEdits);
+        scrollToSelection = false;
+        if(!pendingEdits.empty()) {
+            physicsThread.post([edits = pendingEdits] { sim.applyEdits(edits); });
+            pendingEdits.clear();
         }
         
         ImGui::Separator();
@@ -693,25 +1079,39 @@ int main() {
         ImGui::Text("Speed: %.1f", cameraSpeed);
         ImGui::Text("Controls: WASD - Move, Space/Shift - Up/Down");
         ImGui::Text("Right Mouse - Look Around, Scroll - Speed");
+        ImGui::Text("Left Click - Select Body");
         
         ImGui::Text("FPS: %.1f", io.Framerate);
         
         ImGui::End();
         
+        if(showProfiler) profilerPanel.draw(&showProfiler);
+        PROFILE_END();
+        
+        PROFILE_BEGIN("UI Render");
+        gpuTimer.begin("UI");
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        gpuTimer.end();
+        PROFILE_END();
         
+        PROFILE_BEGIN("Swap");
         glfwSwapBuffers(window);
         glfwPollEvents();
+        PROFILE_END();
+        
+        frameAllocations = allocationCounts() - frameStart;
+        renderAllocations = threadAllocationCounts() - renderStart;
     }
     
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-    glDeleteVertexArrays(1, &lineVAO);
-    glDeleteBuffers(1, &lineVBO);
-    glDeleteProgram(shaderProgram);
-    glDeleteProgram(lineShaderProgram);
+    physicsThread.stop();
+    
+    gpuTimer.release();
+    renderState.release();
+    bodyRenderer.release();
+    gridRenderer.release();
+    trailRenderer.release();
+    vectorRenderer.release();
     
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
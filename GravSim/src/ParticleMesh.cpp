@@ -0,0 +1,363 @@
+#include "ParticleMesh.h"
+#include "FrameArena.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float SPLIT_CELLS = 1.25f;  // Gaussian split scale rs, in mesh cells
+const float CUTOFF_SPLITS = 4.5f; // Short-range cutoff, in units of rs
+const size_t MARGIN_CELLS = 3;    // Keeps CIC and the 4-point gradient inside the mesh
+const size_t TABLE_SIZE = 4096;
+const size_t LINE_BLOCK = 8;      // Lines transformed together to share cache lines
+const float MIN_DISTANCE_SQ = 1e-6f; // Same pair cutoff as the direct sum
+
+// Long-range force / r for unit masses and unit cell size at distance q:
+// the force from the Gaussian-smoothed potential -erf(q / 2rs) / q
+double longRangeOverR(double q) {
+    const double a = SPLIT_CELLS;
+    const double rootPi = std::sqrt(std::acos(-1.0));
+    if(q < 1e-3) return 1.0 / (6.0 * rootPi * a * a * a); // Series limit
+    double bracket = std::erf(q / (2.0 * a)) - q / (a * rootPi) * std::exp(-q * q / (4.0 * a * a));
+    return bracket / (q * q * q);
+}
+
+// Long-range potential for unit mass and unit cell size
+double longRangePotential(double q) {
+    const double a = SPLIT_CELLS;
+    if(q < 1e-6) return -1.0 / (a * std::sqrt(std::acos(-1.0)));
+    return -std::erf(q / (2.0 * a)) / q;
+}
+
+}
+
+void ParticleMeshSolver::resize(size_t fftSize) {
+    if(fftSize == fftSide) return;
+    fftSide = fftSize;
+    bins = fftSide / 2 + 1;
+    meshPoints = fftSide / 2;
+    rowFft.resize(fftSide);
+    lineFft.resize(fftSide);
+    work.assign(fftSide * fftSide * bins, Fft::Complex(0.0f, 0.0f));
+    mesh.assign(meshPoints * meshPoints * meshPoints, 0.0f);
+    gradientX.assign(mesh.size(), 0.0f);
+    gradientY.assign(mesh.size(), 0.0f);
+    gradientZ.assign(mesh.size(), 0.0f);
+    partialMeshes.clear();
+
+    // The kernel is sampled in cell units, so the spectrum only depends on
+    // the FFT size; the actual cell size scales the potential by 1 / h
+    ThreadPool serial(1);
+    long half = (long)fftSide / 2;
+    forward3d(fftSide, [&](size_t x, size_t y, float* row) {
+        long dx = (long)x < half ? (long)x : (long)x - (long)fftSide;
+        long dy = (long)y < half ? (long)y : (long)y - (long)fftSide;
+        for(size_t z = 0; z < fftSide; z++) {
+            long dz = (long)z < half ? (long)z : (long)z - (long)fftSide;
+            row[z] = (float)longRangePotential(std::sqrt((double)(dx * dx + dy * dy + dz * dz)));
+        }
+    }, serial);
+    float scale = 1.0f / ((float)fftSide * fftSide * fftSide);
+    kernelSpectrum.resize(work.size());
+    for(size_t i = 0; i < work.size(); i++) kernelSpectrum[i] = work[i].real() * scale;
+
+    float cutoffCells = SPLIT_CELLS * CUTOFF_SPLITS;
+    longRangeTable.resize(TABLE_SIZE + 1);
+    for(size_t i = 0; i <= TABLE_SIZE; i++) {
+        double q2 = (double)i / TABLE_SIZE * cutoffCells * cutoffCells;
+        longRangeTable[i] = (float)longRangeOverR(std::sqrt(q2));
+    }
+}
+
+size_t ParticleMeshSolver::memoryBytes() const {
+    size_t bytes = work.capacity() * sizeof(Fft::Complex) +
+                   (kernelSpectrum.capacity() + mesh.capacity() + gradientX.capacity() +
+                    gradientY.capacity() + gradientZ.capacity() + longRangeTable.capacity()) * sizeof(float) +
+                   (cellStart.capacity() + cellFill.capacity() + cellOfBody.capacity() + sortedIndex.capacity()) *
+                       sizeof(unsigned int) +
+                   cellPairs.capacity() * sizeof(double) +
+                   (sortedX.capacity() + sortedY.capacity() + sortedZ.capacity() + sortedMass.capacity()) * sizeof(float);
+    for(const std::vector<float>& partial : partialMeshes) bytes += partial.capacity() * sizeof(float);
+    return bytes;
+}
+
+// Complex FFTs along y (lineStride = bins) or x (lineStride = fftSide * bins)
+// for every plane and frequency column. Blocks of neighbouring frequency
+// columns are gathered together so each strided read pulls in a full cache
+// line that gets used.
+void ParticleMeshSolver::transformLines(size_t planeCount, size_t lineStride, size_t planeStride,
+                                        bool inverse, ThreadPool& pool) {
+    size_t blocksPerPlane = (bins + LINE_BLOCK - 1) / LINE_BLOCK;
+    pool.parallelFor(0, planeCount * blocksPerPlane, 4, [&](size_t begin, size_t end) {
+        ArenaScope scope;
+        Fft::Complex* lines = scope.allocate<Fft::Complex>(LINE_BLOCK * fftSide);
+        for(size_t task = begin; task < end; task++) {
+            size_t plane = task / blocksPerPlane;
+            size_t k0 = (task % blocksPerPlane) * LINE_BLOCK;
+            size_t width = std::min(LINE_BLOCK, bins - k0);
+            Fft::Complex* base = &work[plane * planeStride + k0];
+            for(size_t i = 0; i < fftSide; i++) {
+                for(size_t k = 0; k < width; k++) lines[k * fftSide + i] = base[i * lineStride + k];
+            }
+            for(size_t k = 0; k < width; k++) {
+                if(inverse) lineFft.inverse(&lines[k * fftSide]);
+                else lineFft.forward(&lines[k * fftSide]);
+            }
+            for(size_t i = 0; i < fftSide; i++) {
+                for(size_t k = 0; k < width; k++) base[i * lineStride + k] = lines[k * fftSide + i];
+            }
+        }
+    });
+}
+
+template<typename FillRow>
+void ParticleMeshSolver::forward3d(size_t activeSide, FillRow fillRow, ThreadPool& pool) {
+    // z rows: real FFTs of the filled rows, zero spectra elsewhere
+    pool.parallelFor(0, fftSide * fftSide, 64, [&](size_t begin, size_t end) {
+        ArenaScope scope;
+        float* row = scope.allocate<float>(fftSide);
+        Fft::Complex* scratch = scope.allocate<Fft::Complex>(fftSide / 2);
+        for(size_t r = begin; r < end; r++) {
+            size_t x = r / fftSide, y = r % fftSide;
+            Fft::Complex* out = &work[r * bins];
+            if(x >= activeSide || y >= activeSide) {
+                std::fill(out, out + bins, Fft::Complex(0.0f, 0.0f));
+                continue;
+            }
+            std::fill(row, row + fftSide, 0.0f);
+            fillRow(x, y, row);
+            rowFft.forward(row, out, scratch);
+        }
+    });
+    // y lines only in the x planes that hold data, then x lines everywhere
+    transformLines(activeSide, bins, fftSide * bins, false, pool);
+    transformLines(fftSide, fftSide * bins, bins, false, pool);
+}
+
+void ParticleMeshSolver::computeForces(BodyState& state, float gravityConstant, float softening,
+                                       int fftSize, bool shortRange, ThreadPool& pool) {
+    size_t n = state.size();
+    resize(Fft::nextPowerOfTwo((size_t)std::min(std::max(fftSize, 16), 256)));
+    std::fill(state.fx.begin(), state.fx.end(), 0.0f);
+    std::fill(state.fy.begin(), state.fy.end(), 0.0f);
+    std::fill(state.fz.begin(), state.fz.end(), 0.0f);
+    pairCount = 0.0;
+    if(n == 0) return;
+
+    // Fit the mesh to the bodies' bounding cube
+    float minX = state.x[0], maxX = minX, minY = state.y[0], maxY = minY, minZ = state.z[0], maxZ = minZ;
+    for(size_t i = 1; i < n; i++) {
+        minX = std::min(minX, state.x[i]); maxX = std::max(maxX, state.x[i]);
+        minY = std::min(minY, state.y[i]); maxY = std::max(maxY, state.y[i]);
+        minZ = std::min(minZ, state.z[i]); maxZ = std::max(maxZ, state.z[i]);
+    }
+    float extent = std::max(std::max(maxX - minX, maxY - minY), maxZ - minZ);
+    spacing = std::max(extent * 1.0001f, 1e-3f) / (float)(meshPoints - 1 - 2 * MARGIN_CELLS);
+    originX = minX - MARGIN_CELLS * spacing;
+    originY = minY - MARGIN_CELLS * spacing;
+    originZ = minZ - MARGIN_CELLS * spacing;
+
+    deposit(state, pool);
+    solvePotential(pool);
+    interpolate(state, gravityConstant, pool);
+    if(shortRange) addShortRange(state, gravityConstant, softening, pool);
+}
+
+// Each task deposits a fixed range of bodies into its own mesh; the meshes
+// are then summed in task order, so results don't depend on scheduling
+void ParticleMeshSolver::deposit(const BodyState& state, ThreadPool& pool) {
+    size_t n = state.size();
+    size_t tasks = std::min<size_t>(pool.threadCount(), std::max<size_t>(1, n / 4096));
+    partialMeshes.resize(tasks);
+    float inverseSpacing = 1.0f / spacing;
+    size_t side = meshPoints;
+
+    pool.run(tasks, [&](size_t task) {
+        std::vector<float>& target = task == 0 ? mesh : partialMeshes[task];
+        target.assign(side * side * side, 0.0f);
+        size_t begin = n * task / tasks, end = n * (task + 1) / tasks;
+        for(size_t i = begin; i < end; i++) {
+            float u = (state.x[i] - originX) * inverseSpacing;
+            float v = (state.y[i] - originY) * inverseSpacing;
+            float w = (state.z[i] - originZ) * inverseSpacing;
+            size_t iu = (size_t)u, iv = (size_t)v, iw = (size_t)w;
+            float fu = u - iu, fv = v - iv, fw = w - iw;
+            float m = state.mass[i];
+            float* cell = &target[(iu * side + iv) * side + iw];
+            for(int corner = 0; corner < 8; corner++) {
+                int a = corner >> 2, b = (corner >> 1) & 1, c = corner & 1;
+                float weight = (a ? fu : 1.0f - fu) * (b ? fv : 1.0f - fv) * (c ? fw : 1.0f - fw);
+                cell[(a * side + b) * side + c] += m * weight;
+            }
+        }
+    });
+
+    if(tasks > 1) {
+        pool.parallelFor(0, mesh.size(), 1 << 16, [&](size_t begin, size_t end) {
+            for(size_t t = 1; t < tasks; t++) {
+                const float* partial = partialMeshes[t].data();
+                for(size_t i = begin; i < end; i++) mesh[i] += partial[i];
+            }
+        });
+    }
+}
+
+// Zero-padded convolution of the mass mesh with the long-range kernel, then
+// the potential gradient by 4-point central differences
+void ParticleMeshSolver::solvePotential(ThreadPool& pool) {
+    size_t side = meshPoints;
+    forward3d(side, [&](size_t x, size_t y, float* row) {
+        std::copy(&mesh[(x * side + y) * side], &mesh[(x * side + y) * side] + side, row);
+    }, pool);
+
+    pool.parallelFor(0, work.size(), 1 << 16, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) work[i] *= kernelSpectrum[i];
+    });
+
+    // Back along x everywhere, along y only in the mesh's x planes, and along
+    // z only for the mesh's rows
+    transformLines(fftSide, fftSide * bins, bins, true, pool);
+    transformLines(side, bins, fftSide * bins, true, pool);
+    float inverseSpacing = 1.0f / spacing;
+    pool.parallelFor(0, side * side, 64, [&](size_t begin, size_t end) {
+        ArenaScope scope;
+        float* row = scope.allocate<float>(fftSide);
+        Fft::Complex* scratch = scope.allocate<Fft::Complex>(fftSide / 2);
+        for(size_t r = begin; r < end; r++) {
+            size_t x = r / side, y = r % side;
+            rowFft.inverse(&work[(x * fftSide + y) * bins], row, scratch);
+            float* out = &mesh[r * side];
+            for(size_t z = 0; z < side; z++) out[z] = row[z] * inverseSpacing;
+        }
+    });
+
+    float scale = 1.0f / (12.0f * spacing);
+    size_t sx = side * side, sy = side;
+    pool.parallelFor(MARGIN_CELLS - 1, side - MARGIN_CELLS + 1, 1, [&](size_t begin, size_t end) {
+        for(size_t x = begin; x < end; x++) {
+            for(size_t y = MARGIN_CELLS - 1; y < side - MARGIN_CELLS + 1; y++) {
+                for(size_t z = MARGIN_CELLS - 1; z < side - MARGIN_CELLS + 1; z++) {
+                    size_t i = x * sx + y * sy + z;
+                    const float* p = mesh.data();
+                    gradientX[i] = (8.0f * (p[i + sx] - p[i - sx]) - (p[i + 2 * sx] - p[i - 2 * sx])) * scale;
+                    gradientY[i] = (8.0f * (p[i + sy] - p[i - sy]) - (p[i + 2 * sy] - p[i - 2 * sy])) * scale;
+                    gradientZ[i] = (8.0f * (p[i + 1] - p[i - 1]) - (p[i + 2] - p[i - 2])) * scale;
+                }
+            }
+        }
+    });
+}
+
+void ParticleMeshSolver::interpolate(BodyState& state, float gravityConstant, ThreadPool& pool) {
+    size_t side = meshPoints;
+    float inverseSpacing = 1.0f / spacing;
+    pool.parallelFor(0, state.size(), 1024, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            float u = (state.x[i] - originX) * inverseSpacing;
+            float v = (state.y[i] - originY) * inverseSpacing;
+            float w = (state.z[i] - originZ) * inverseSpacing;
+            size_t iu = (size_t)u, iv = (size_t)v, iw = (size_t)w;
+            float fu = u - iu, fv = v - iv, fw = w - iw;
+            size_t base = (iu * side + iv) * side + iw;
+            float gx = 0.0f, gy = 0.0f, gz = 0.0f;
+            for(int corner = 0; corner < 8; corner++) {
+                int a = corner >> 2, b = (corner >> 1) & 1, c = corner & 1;
+                float weight = (a ? fu : 1.0f - fu) * (b ? fv : 1.0f - fv) * (c ? fw : 1.0f - fw);
+                size_t node = base + (a * side + b) * side + c;
+                gx += weight * gradientX[node];
+                gy += weight * gradientY[node];
+                gz += weight * gradientZ[node];
+            }
+            float s = -gravityConstant * state.mass[i];
+            state.fx[i] = s * gx;
+            state.fy[i] = s * gy;
+            state.fz[i] = s * gz;
+        }
+    });
+}
+
+// Pairs within the cutoff, found through a cell list with cells at least
+// one cutoff wide. Each body sums its own neighbours, so tasks never write
+// to the same body.
+void ParticleMeshSolver::addShortRange(BodyState& state, float gravityConstant, float softening, ThreadPool& pool) {
+    size_t n = state.size();
+    float cutoff = SPLIT_CELLS * CUTOFF_SPLITS * spacing;
+    float cutoff2 = cutoff * cutoff;
+    float boxSize = (meshPoints - 1) * spacing;
+    size_t cells = std::max<size_t>(1, std::min<size_t>((size_t)(boxSize / cutoff), 256));
+    float cellsPerUnit = cells / boxSize;
+
+    auto cellOf = [&](size_t i) {
+        size_t cx = std::min((size_t)((state.x[i] - originX) * cellsPerUnit), cells - 1);
+        size_t cy = std::min((size_t)((state.y[i] - originY) * cellsPerUnit), cells - 1);
+        size_t cz = std::min((size_t)((state.z[i] - originZ) * cellsPerUnit), cells - 1);
+        return (unsigned int)((cx * cells + cy) * cells + cz);
+    };
+
+    // Counting sort into cell order, with the hot data copied alongside
+    size_t cellCount = cells * cells * cells;
+    cellStart.assign(cellCount + 1, 0);
+    cellOfBody.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        cellOfBody[i] = cellOf(i);
+        cellStart[cellOfBody[i] + 1]++;
+    }
+    for(size_t c = 0; c < cellCount; c++) cellStart[c + 1] += cellStart[c];
+    sortedIndex.resize(n);
+    sortedX.resize(n); sortedY.resize(n); sortedZ.resize(n); sortedMass.resize(n);
+    cellFill.assign(cellStart.begin(), cellStart.end() - 1);
+    for(size_t i = 0; i < n; i++) {
+        unsigned int slot = cellFill[cellOfBody[i]]++;
+        sortedIndex[slot] = (unsigned int)i;
+        sortedX[slot] = state.x[i];
+        sortedY[slot] = state.y[i];
+        sortedZ[slot] = state.z[i];
+        sortedMass[slot] = state.mass[i];
+    }
+
+    float inverseCell2 = 1.0f / (spacing * spacing);
+    float tableScale = TABLE_SIZE / (SPLIT_CELLS * CUTOFF_SPLITS * SPLIT_CELLS * CUTOFF_SPLITS);
+    float longRangeScale = 1.0f / (spacing * spacing * spacing);
+    cellPairs.assign(cellCount, 0.0);
+    const float* table = longRangeTable.data();
+
+    pool.parallelFor(0, cellCount, 8, [&](size_t begin, size_t end) {
+        for(size_t c = begin; c < end; c++) {
+            size_t cx = c / (cells * cells), cy = (c / cells) % cells, cz = c % cells;
+            double pairs = 0.0;
+            for(unsigned int a = cellStart[c]; a < cellStart[c + 1]; a++) {
+                float xi = sortedX[a], yi = sortedY[a], zi = sortedZ[a];
+                float fxi = 0.0f, fyi = 0.0f, fzi = 0.0f;
+                for(size_t nx = cx ? cx - 1 : 0; nx <= std::min(cx + 1, cells - 1); nx++) {
+                    for(size_t ny = cy ? cy - 1 : 0; ny <= std::min(cy + 1, cells - 1); ny++) {
+                        size_t rowCell = (nx * cells + ny) * cells;
+                        size_t zBegin = cz ? cz - 1 : 0, zEnd = std::min(cz + 1, cells - 1);
+                        // Neighbouring z cells are contiguous in sorted order
+                        unsigned int jBegin = cellStart[rowCell + zBegin], jEnd = cellStart[rowCell + zEnd + 1];
+                        for(unsigned int j = jBegin; j < jEnd; j++) {
+                            float dx = sortedX[j] - xi, dy = sortedY[j] - yi, dz = sortedZ[j] - zi;
+                            float dist2 = dx * dx + dy * dy + dz * dz;
+                            if(dist2 >= cutoff2 || dist2 < MIN_DISTANCE_SQ) continue;
+                            float t = dist2 * inverseCell2 * tableScale;
+                            size_t k = std::min((size_t)t, TABLE_SIZE - 1);
+                            float frac = t - (float)k;
+                            float longRange = (table[k] + frac * (table[k + 1] - table[k])) * longRangeScale;
+                            float s = sortedMass[j] * (1.0f / (std::sqrt(dist2) * (dist2 + softening)) - longRange);
+                            fxi += dx * s; fyi += dy * s; fzi += dz * s;
+                            pairs += 1.0;
+                        }
+                    }
+                }
+                unsigned int i = sortedIndex[a];
+                float gm = gravityConstant * sortedMass[a];
+                state.fx[i] += gm * fxi;
+                state.fy[i] += gm * fyi;
+                state.fz[i] += gm * fzi;
+            }
+            cellPairs[c] = pairs;
+        }
+    });
+    for(double p : cellPairs) pairCount += p;
+}
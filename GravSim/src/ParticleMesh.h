@@ -0,0 +1,75 @@
+#pragma once
+
+#include "BodyState.h"
+#include "Fft.h"
+
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+// Particle-mesh (PM) gravity with an optional particle-particle short-range
+// term (P3M), for large and roughly uniform systems.
+//
+// Masses are deposited cloud-in-cell onto a mesh of fftSize / 2 points per
+// side that covers the bodies' bounding cube. The mesh is zero-padded to
+// fftSize^3 so the FFT convolution treats the system as isolated rather than
+// periodic. The potential comes from a real-to-complex FFT, and forces are
+// 4-point differences interpolated back with the same CIC weights.
+//
+// The mesh solves only the long-range part of gravity: the Newtonian
+// potential smoothed by a Gaussian of scale rs = 1.25 cells. With the
+// short-range term on, pairs closer than 4.5 rs add the softened direct
+// force G mi mj / (r^2 + softening) minus that long-range part, so close
+// encounters follow the same law as the direct sum. Without it, forces are
+// only resolved down to a few mesh cells.
+class ParticleMeshSolver {
+public:
+    // Overwrites state.fx/fy/fz. fftSize is a power of two from 16 to 256.
+    void computeForces(BodyState& state, float gravityConstant, float softening,
+                       int fftSize, bool shortRange, ThreadPool& pool);
+
+    size_t meshSide() const { return meshPoints; }
+    float cellSize() const { return spacing; }
+    double shortRangePairs() const { return pairCount; }
+    size_t memoryBytes() const;
+
+private:
+    void resize(size_t fftSize);
+    void deposit(const BodyState& state, ThreadPool& pool);
+    void solvePotential(ThreadPool& pool);
+    void interpolate(BodyState& state, float gravityConstant, ThreadPool& pool);
+    void addShortRange(BodyState& state, float gravityConstant, float softening, ThreadPool& pool);
+
+    // 3D forward transform of a cube whose first `activeSide` rows along each
+    // axis are filled by fillRow(x, y, row); everything else is zero
+    template<typename FillRow>
+    void forward3d(size_t activeSide, FillRow fillRow, ThreadPool& pool);
+    void transformLines(size_t planeCount, size_t lineStride, size_t planeStride,
+                        bool inverse, ThreadPool& pool);
+
+    size_t fftSide = 0;
+    size_t bins = 0;       // fftSide / 2 + 1 stored frequencies along z
+    size_t meshPoints = 0; // fftSide / 2
+    float spacing = 1.0f;
+    float originX = 0.0f, originY = 0.0f, originZ = 0.0f;
+
+    RealFft rowFft;
+    Fft lineFft;
+    std::vector<Fft::Complex> work;  // fftSide^2 * bins spectrum
+    std::vector<float> kernelSpectrum; // Real since the kernel is even, pre-scaled by 1 / fftSide^3
+
+    std::vector<float> mesh;          // Mass, then potential
+    std::vector<std::vector<float>> partialMeshes;
+    std::vector<float> gradientX, gradientY, gradientZ;
+
+    // Short-range pass: bodies sorted into cells at least one cutoff wide
+    std::vector<float> longRangeTable; // Long-range force / r^2 by (r / h)^2
+    std::vector<unsigned int> cellStart;
+    std::vector<unsigned int> cellFill;   // Next free slot per cell while sorting
+    std::vector<unsigned int> cellOfBody;
+    std::vector<unsigned int> sortedIndex;
+    std::vector<double> cellPairs;        // Pairs found per cell, summed in order
+    FloatArray sortedX, sortedY, sortedZ, sortedMass;
+    double pairCount = 0.0;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "BodyState.h"
+
+#include <cstddef>
+#include <type_traits>
+
+// Floating-point precision of the physics step. Float keeps everything in
+// the BodyState's floats and uses the SIMD kernels. Mixed keeps positions,
+// velocities and force sums in double but computes each pair term in float,
+// which removes most of the round-off that builds up in long runs for little
+// extra cost. Double does everything in double.
+enum PrecisionMode {
+    PRECISION_FLOAT = 0,
+    PRECISION_MIXED = 1,
+    PRECISION_DOUBLE = 2,
+    PRECISION_COUNT
+};
+
+const char* precisionName(int mode);
+
+// Compile-time policies selected by PrecisionMode. Real is the type pair
+// terms are computed in; Accum is the type of sums and of the integrated
+// positions and velocities.
+struct FloatPrecision {
+    using Real = float;
+    using Accum = float;
+};
+
+struct MixedPrecision {
+    using Real = float;
+    using Accum = double;
+};
+
+struct DoublePrecision {
+    using Real = double;
+    using Accum = double;
+};
+
+template<typename Policy>
+constexpr bool keepsDoubleState() { return std::is_same<typename Policy::Accum, double>::value; }
+
+using DoubleArray = std::vector<double, AlignedAllocator<double>>;
+
+// Double copy of the positions, velocities and forces of a BodyState, for
+// integrators running with double accumulators. Masses stay float, as they
+// are in the BodyState. The BodyState remains what the renderer, recorder,
+// collisions and the float-only solvers read, and gets the rounded values
+// after every step.
+struct PreciseState {
+    DoubleArray x, y, z;
+    DoubleArray vx, vy, vz;
+    DoubleArray fx, fy, fz;
+    FloatArray mass;
+
+    size_t size() const { return x.size(); }
+
+    size_t memoryBytes() const { return 9 * x.capacity() * sizeof(double) + mass.capacity() * sizeof(float); }
+
+    void load(const BodyState& s) {
+        x.assign(s.x.begin(), s.x.end()); y.assign(s.y.begin(), s.y.end()); z.assign(s.z.begin(), s.z.end());
+        vx.assign(s.vx.begin(), s.vx.end()); vy.assign(s.vy.begin(), s.vy.end()); vz.assign(s.vz.begin(), s.vz.end());
+        fx.assign(s.fx.begin(), s.fx.end()); fy.assign(s.fy.begin(), s.fy.end()); fz.assign(s.fz.begin(), s.fz.end());
+        mass = s.mass;
+    }
+
+    void permute(const std::vector<unsigned int>& order, DoubleArray& scratch, FloatArray& massScratch) {
+        for(DoubleArray* a : { &x, &y, &z, &vx, &vy, &vz, &fx, &fy, &fz }) permuteArray(*a, order, scratch);
+        permuteArray(mass, order, massScratch);
+    }
+
+    // Widens forces that a float solver wrote into s
+    void loadForces(const BodyState& s) {
+        for(size_t i = 0; i < size(); i++) {
+            fx[i] = s.fx[i]; fy[i] = s.fy[i]; fz[i] = s.fz[i];
+        }
+    }
+
+    void storePositions(BodyState& s) const {
+        for(size_t i = 0; i < size(); i++) {
+            s.x[i] = (float)x[i]; s.y[i] = (float)y[i]; s.z[i] = (float)z[i];
+        }
+    }
+
+    void store(BodyState& s) const {
+        storePositions(s);
+        for(size_t i = 0; i < size(); i++) {
+            s.vx[i] = (float)vx[i]; s.vy[i] = (float)vy[i]; s.vz[i] = (float)vz[i];
+            s.fx[i] = (float)fx[i]; s.fy[i] = (float)fy[i]; s.fz[i] = (float)fz[i];
+        }
+    }
+};
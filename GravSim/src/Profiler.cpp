@@ -0,0 +1,190 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+namespace {
+
+const size_t RING_EVENTS = 1 << 15; // Per track, about 1 MB
+const size_t MAX_TRACKS = 64;       // Threads past this go unrecorded
+const size_t MAX_OPEN = 32;         // Nested PROFILE_BEGINs per thread
+
+struct ProfileTrack {
+    uint32_t index;
+    std::string name;
+    std::vector<ProfileEvent> ring;
+    std::atomic<uint64_t> written{0}; // Events ever recorded; event i is in ring[i % RING_EVENTS]
+};
+
+// Tracks live for the rest of the process, so readers can hold on to them
+// without a lock
+std::array<std::atomic<ProfileTrack*>, MAX_TRACKS> trackSlots{};
+std::atomic<uint32_t> trackCount{0};
+std::mutex trackMutex; // Serializes adding tracks
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+thread_local ProfileTrack* threadTrack = nullptr;
+#if GRAVSIM_PROFILER
+// Only the macros' scopes and phases use these
+thread_local uint32_t threadDepth = 0;
+thread_local const char* openNames[MAX_OPEN];
+thread_local uint64_t openStarts[MAX_OPEN];
+thread_local uint32_t openDepths[MAX_OPEN];
+thread_local size_t openCount = 0;
+#endif
+
+ProfileTrack* addTrack(const std::string& name) {
+    std::lock_guard<std::mutex> lock(trackMutex);
+    uint32_t index = trackCount.load();
+    if(index == MAX_TRACKS) return nullptr;
+    ProfileTrack* track = new ProfileTrack();
+    track->index = index;
+    track->name = name;
+    track->ring.resize(RING_EVENTS);
+    trackSlots[index].store(track, std::memory_order_release);
+    trackCount.store(index + 1, std::memory_order_release);
+    return track;
+}
+
+ProfileTrack* currentThreadTrack() {
+    if(!threadTrack) threadTrack = addTrack("Thread " + std::to_string(trackCount.load()));
+    return threadTrack;
+}
+
+void push(ProfileTrack& track, const char* name, uint64_t start, uint64_t duration, uint32_t depth) {
+    uint64_t slot = track.written.load(std::memory_order_relaxed);
+    track.ring[slot % RING_EVENTS] = { name, start, duration, track.index, depth };
+    track.written.store(slot + 1, std::memory_order_release);
+}
+
+void writeJsonString(FILE* file, const char* text) {
+    std::fputc('"', file);
+    for(const char* c = text; *c; c++) {
+        if(*c == '"' || *c == '\\') std::fputc('\\', file);
+        if((unsigned char)*c >= 0x20) std::fputc(*c, file);
+    }
+    std::fputc('"', file);
+}
+
+}
+
+uint64_t profileNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void setProfileThreadName(const char* name) {
+    ProfileTrack* track = currentThreadTrack();
+    if(!track) return;
+    std::lock_guard<std::mutex> lock(trackMutex);
+    track->name = name;
+}
+
+uint32_t createProfileTrack(const char* name) {
+    ProfileTrack* track = addTrack(name);
+    return track ? track->index : (uint32_t)MAX_TRACKS;
+}
+
+void recordProfileEvent(uint32_t track, const char* name, uint64_t start, uint64_t duration, uint32_t depth) {
+    if(track >= trackCount.load(std::memory_order_acquire)) return;
+    push(*trackSlots[track].load(std::memory_order_acquire), name, start, duration, depth);
+}
+
+void profileTrackNames(std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(trackMutex);
+    names.resize(trackCount.load());
+    for(uint32_t t = 0; t < names.size(); t++) names[t] = trackSlots[t].load()->name;
+}
+
+void collectProfileEvents(uint64_t since, std::vector<ProfileEvent>& out) {
+    uint32_t count = trackCount.load(std::memory_order_acquire);
+    for(uint32_t t = 0; t < count; t++) {
+        const ProfileTrack& track = *trackSlots[t].load(std::memory_order_acquire);
+        uint64_t end = track.written.load(std::memory_order_acquire);
+        uint64_t begin = end > RING_EVENTS ? end - RING_EVENTS : 0;
+
+        // Newest first, back to the first event that ended before `since`
+        size_t first = out.size();
+        for(uint64_t i = end; i > begin; i--) {
+            const ProfileEvent& event = track.ring[(i - 1) % RING_EVENTS];
+            if(event.start + event.duration < since) break;
+            out.push_back(event);
+        }
+        // Drop the oldest copies if the writer came round to them meanwhile;
+        // the slot of the event being written counts as overwritten
+        uint64_t after = track.written.load(std::memory_order_acquire);
+        uint64_t oldestIntact = after + 1 > RING_EVENTS ? after + 1 - RING_EVENTS : 0;
+        size_t intact = end > oldestIntact ? (size_t)(end - oldestIntact) : 0;
+        if(out.size() - first > intact) out.resize(first + intact);
+        std::reverse(out.begin() + first, out.end());
+    }
+}
+
+#if GRAVSIM_PROFILER
+
+ProfileScope::ProfileScope(const char* name) : name(name), start(profileNow()) {
+    threadDepth++;
+}
+
+ProfileScope::~ProfileScope() {
+    uint64_t end = profileNow();
+    threadDepth--;
+    if(ProfileTrack* track = currentThreadTrack()) push(*track, name, start, end - start, threadDepth);
+}
+
+void profileBegin(const char* name) {
+    // Past the limit the phase goes unrecorded but still pairs with its end
+    if(openCount < MAX_OPEN) {
+        openNames[openCount] = name;
+        openStarts[openCount] = profileNow();
+        openDepths[openCount] = threadDepth++;
+    }
+    openCount++;
+}
+
+void profileEnd() {
+    if(openCount == 0) return;
+    openCount--;
+    if(openCount >= MAX_OPEN) return;
+    uint64_t end = profileNow();
+    threadDepth = openDepths[openCount];
+    if(ProfileTrack* track = currentThreadTrack()) {
+        push(*track, openNames[openCount], openStarts[openCount], end - openStarts[openCount], threadDepth);
+    }
+}
+
+#endif
+
+bool writeChromeTrace(const std::string& path, const std::vector<ProfileEvent>& events, std::string& error) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if(!file) {
+        error = "Cannot create " + path;
+        return false;
+    }
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GravSim\"}}");
+    std::vector<std::string> names;
+    profileTrackNames(names);
+    for(size_t t = 0; t < names.size(); t++) {
+        std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":", t);
+        writeJsonString(file, names[t].c_str());
+        std::fprintf(file, "}}");
+    }
+    // Complete events, in microseconds
+    for(const ProfileEvent& event : events) {
+        std::fprintf(file, ",\n{\"name\":");
+        writeJsonString(file, event.name);
+        std::fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                     event.track, event.start / 1000.0, event.duration / 1000.0);
+    }
+    std::fprintf(file, "\n]}\n");
+    if(std::fclose(file) != 0) {
+        error = "Cannot write " + path;
+        return false;
+    }
+    return true;
+}
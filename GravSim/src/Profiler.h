@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped phase timers for the frame loop and the physics step.
+//
+//   PROFILE_SCOPE("Forces");
+//
+// records the time from that line to the end of the enclosing block;
+// PROFILE_BEGIN and PROFILE_END bracket phases that aren't a block. Each
+// thread writes finished scopes into its own ring of events with no locking;
+// a reader copies them out and ignores any that were overwritten while it
+// was copying. Timestamps come from steady_clock, roughly 20 ns a call.
+// Building with GRAVSIM_PROFILER=0 turns the macros into nothing.
+//
+// Other sources of timings, such as GPU queries, get a track of their own
+// and record finished events into it from a single thread.
+
+#ifndef GRAVSIM_PROFILER
+#define GRAVSIM_PROFILER 1
+#endif
+
+struct ProfileEvent {
+    const char* name;  // String literal, compared by pointer
+    uint64_t start;    // Nanoseconds since the profiler's epoch
+    uint64_t duration;
+    uint32_t track;
+    uint32_t depth;    // Enclosing scopes on the same track
+};
+
+// Nanoseconds since the profiler's epoch
+uint64_t profileNow();
+
+// Names the calling thread's track, for the panel and the trace
+void setProfileThreadName(const char* name);
+// A track written by whoever calls recordProfileEvent on it
+uint32_t createProfileTrack(const char* name);
+void recordProfileEvent(uint32_t track, const char* name, uint64_t start, uint64_t duration, uint32_t depth);
+
+// Overwrites names, reusing its strings, so polling it every frame doesn't allocate
+void profileTrackNames(std::vector<std::string>& names);
+// Appends every retained event that ended at or after `since`, grouped by
+// track and in order of ending within a track
+void collectProfileEvents(uint64_t since, std::vector<ProfileEvent>& out);
+
+// Writes events in the Chrome trace event format (chrome://tracing, Perfetto)
+bool writeChromeTrace(const std::string& path, const std::vector<ProfileEvent>& events, std::string& error);
+
+#if GRAVSIM_PROFILER
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+#define GRAVSIM_PROFILE_JOIN2(a, b) a##b
+#define GRAVSIM_PROFILE_JOIN(a, b) GRAVSIM_PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope GRAVSIM_PROFILE_JOIN(profileScope, __LINE__)(name)
+
+// Every begin needs an end on the same thread, innermost first
+void profileBegin(const char* name);
+void profileEnd();
+
+#define PROFILE_BEGIN(name) profileBegin(name)
+#define PROFILE_END() profileEnd()
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END() ((void)0)
+
+#endif
@@ -0,0 +1,187 @@
+#include "ProfilerPanel.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const uint64_t STATS_WINDOW = 1000000000ull; // Nanoseconds of events kept for the table
+const size_t HISTORY_FRAMES = 240;
+
+bool sameName(const char* a, const char* b) {
+    return a == b || std::strcmp(a, b) == 0;
+}
+
+// A stable color per phase name
+ImU32 phaseColor(const char* name) {
+    static const ImU32 palette[] = {
+        IM_COL32(86, 140, 214, 255), IM_COL32(214, 132, 72, 255), IM_COL32(96, 178, 110, 255),
+        IM_COL32(196, 92, 110, 255), IM_COL32(150, 116, 204, 255), IM_COL32(200, 176, 80, 255),
+        IM_COL32(72, 176, 180, 255), IM_COL32(170, 140, 120, 255)
+    };
+    uint32_t hash = 2166136261u;
+    for(const char* c = name; *c; c++) hash = (hash ^ (unsigned char)*c) * 16777619u;
+    return palette[hash % (sizeof(palette) / sizeof(palette[0]))];
+}
+
+}
+
+void ProfilerPanel::refresh() {
+    uint64_t now = profileNow();
+    events.clear();
+    collectProfileEvents(now > STATS_WINDOW ? now - STATS_WINDOW : 0, events);
+    profileTrackNames(trackNames);
+    history.resize(HISTORY_FRAMES, 0.0f);
+
+    // Frames in the window; new ones also go into the history
+    const ProfileEvent* lastFrame = nullptr;
+    framesInWindow = 0;
+    for(const ProfileEvent& event : events) {
+        if(!sameName(event.name, frameScope)) continue;
+        framesInWindow++;
+        if(!lastFrame || event.start > lastFrame->start) lastFrame = &event;
+        if(event.start > lastHistoryFrame) {
+            history[historyNext] = event.duration / 1e6f;
+            historyNext = (historyNext + 1) % HISTORY_FRAMES;
+            lastHistoryFrame = event.start;
+        }
+    }
+
+    shown.clear();
+    if(lastFrame) {
+        shownStart = lastFrame->start;
+        shownEnd = lastFrame->start + lastFrame->duration;
+        for(const ProfileEvent& event : events) {
+            if(event.start < shownEnd && event.start + event.duration > shownStart) shown.push_back(event);
+        }
+    }
+
+    phases.clear();
+    for(const ProfileEvent& event : events) {
+        auto phase = std::find_if(phases.begin(), phases.end(), [&](const PhaseStats& p) {
+            return p.track == event.track && sameName(p.name, event.name);
+        });
+        if(phase == phases.end()) {
+            phases.push_back({ event.track, event.name, 0.0, 0.0, 0 });
+            phase = phases.end() - 1;
+        }
+        double ms = event.duration / 1e6;
+        phase->totalMs += ms;
+        phase->maxMs = std::max(phase->maxMs, ms);
+        phase->calls++;
+    }
+    std::sort(phases.begin(), phases.end(), [](const PhaseStats& a, const PhaseStats& b) {
+        return a.track != b.track ? a.track < b.track : a.totalMs > b.totalMs;
+    });
+}
+
+void ProfilerPanel::drawTimeline() {
+    if(shown.empty() || shownEnd <= shownStart) {
+        ImGui::Text("No complete frame recorded yet");
+        return;
+    }
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+    float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+    double scale = width / (double)(shownEnd - shownStart);
+
+    float y = origin.y;
+    for(uint32_t track = 0; track < trackNames.size(); track++) {
+        uint32_t maxDepth = 0;
+        bool any = false;
+        for(const ProfileEvent& event : shown) {
+            if(event.track != track) continue;
+            any = true;
+            maxDepth = std::max(maxDepth, event.depth);
+        }
+        if(!any) continue;
+
+        drawList->AddText(ImVec2(origin.x, y), IM_COL32(200, 200, 200, 255), trackNames[track].c_str());
+        y += rowHeight;
+        for(const ProfileEvent& event : shown) {
+            if(event.track != track) continue;
+            double begin = std::max(event.start, shownStart) - shownStart;
+            double end = std::min(event.start + event.duration, shownEnd) - shownStart;
+            ImVec2 a(origin.x + (float)(begin * scale), y + event.depth * rowHeight);
+            ImVec2 b(std::max(origin.x + (float)(end * scale), a.x + 1.0f), a.y + rowHeight - 1.0f);
+            drawList->AddRectFilled(a, b, phaseColor(event.name));
+            if(b.x - a.x > ImGui::CalcTextSize(event.name).x + 4.0f) {
+                drawList->AddText(ImVec2(a.x + 2.0f, a.y + 2.0f), IM_COL32(255, 255, 255, 255), event.name);
+            }
+            if(ImGui::IsMouseHoveringRect(a, b)) {
+                ImGui::SetTooltip("%s: %.3f ms", event.name, event.duration / 1e6);
+            }
+        }
+        y += (maxDepth + 1) * rowHeight + 4.0f;
+    }
+    ImGui::Dummy(ImVec2(width, y - origin.y));
+}
+
+void ProfilerPanel::drawPhaseTable() {
+    if(!ImGui::BeginTable("Phases", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+        return;
+    }
+    ImGui::TableSetupColumn("Track");
+    ImGui::TableSetupColumn("Phase");
+    ImGui::TableSetupColumn("ms/frame");
+    ImGui::TableSetupColumn("max ms");
+    ImGui::TableSetupColumn("calls");
+    ImGui::TableHeadersRow();
+    double frames = (double)std::max(framesInWindow, (size_t)1);
+    for(const PhaseStats& phase : phases) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s", phase.track < trackNames.size() ? trackNames[phase.track].c_str() : "?");
+        ImGui::TableNextColumn();
+        ImGui::Text("%s", phase.name);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", phase.totalMs / frames);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", phase.maxMs);
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", phase.calls);
+    }
+    ImGui::EndTable();
+}
+
+void ProfilerPanel::draw(bool* open) {
+    if(!ImGui::Begin("Profiler", open)) {
+        ImGui::End();
+        return;
+    }
+#if GRAVSIM_PROFILER
+    ImGui::Checkbox("Pause", &paused);
+    if(!paused) refresh();
+
+    if(!history.empty()) {
+        float worst = *std::max_element(history.begin(), history.end());
+        char overlay[32];
+        std::snprintf(overlay, sizeof(overlay), "worst %.2f ms", worst);
+        ImGui::PlotLines("Frame ms", history.data(), (int)history.size(), (int)historyNext, overlay,
+                         0.0f, std::max(worst * 1.2f, 1.0f), ImVec2(0.0f, 60.0f));
+    }
+
+    ImGui::Text("Last frame: %.3f ms", (shownEnd - shownStart) / 1e6);
+    drawTimeline();
+    ImGui::Text("Last second, %zu frames", framesInWindow);
+    drawPhaseTable();
+
+    ImGui::InputText("Trace File", tracePath, sizeof(tracePath));
+    if(ImGui::Button("Export Chrome Trace")) {
+        std::vector<ProfileEvent> all;
+        collectProfileEvents(0, all);
+        std::string error;
+        traceStatus = writeChromeTrace(tracePath, all, error)
+            ? "Wrote " + std::to_string(all.size()) + " events to " + tracePath
+            : error;
+    }
+    if(!traceStatus.empty()) ImGui::Text("%s", traceStatus.c_str());
+#else
+    ImGui::Text("Built with GRAVSIM_PROFILER=0");
+#endif
+    ImGui::End();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ImGui window over the profiler: a frame time graph, a timeline of the
+// last whole frame with a row per track and nesting level, per-phase times
+// over the last second, and Chrome trace export.
+class ProfilerPanel {
+public:
+    // frameScope is the name given to the PROFILE_SCOPE around a whole frame
+    explicit ProfilerPanel(const char* frameScope) : frameScope(frameScope) {}
+
+    void draw(bool* open);
+
+private:
+    struct PhaseStats {
+        uint32_t track;
+        const char* name;
+        double totalMs, maxMs;
+        size_t calls;
+    };
+
+    void refresh();
+    void drawTimeline();
+    void drawPhaseTable();
+
+    const char* frameScope;
+    bool paused = false;
+    std::vector<ProfileEvent> events; // The last second
+    std::vector<ProfileEvent> shown;  // Overlapping the last whole frame
+    uint64_t shownStart = 0, shownEnd = 0;
+    std::vector<std::string> trackNames;
+    std::vector<PhaseStats> phases;
+    size_t framesInWindow = 0;
+    std::vector<float> history;       // Frame times in ms, a ring
+    size_t historyNext = 0;
+    uint64_t lastHistoryFrame = 0;
+    char tracePath[256] = "trace.json";
+    std::string traceStatus;
+};
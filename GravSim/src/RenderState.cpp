@@ -0,0 +1,117 @@
+#include "RenderState.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+
+namespace {
+
+const GLuint UNKNOWN = ~0u;
+
+// std140 layout of the Camera block
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;
+};
+
+}
+
+void RenderState::init() {
+    glGenBuffers(1, &cameraBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, cameraBuffer);
+    program = vertexArray = arrayBuffer = UNKNOWN;
+}
+
+void RenderState::release() {
+    if(cameraBuffer) glDeleteBuffers(1, &cameraBuffer);
+    cameraBuffer = 0;
+    capabilities.clear();
+    uniforms.clear();
+}
+
+void RenderState::attachCamera(GLuint program) {
+    GLuint block = glGetUniformBlockIndex(program, "Camera");
+    if(block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, CAMERA_BLOCK_BINDING);
+    // A reused program name starts with fresh uniforms
+    uniforms.erase(std::remove_if(uniforms.begin(), uniforms.end(),
+                                  [&](const UniformValue& u) { return u.program == program; }),
+                   uniforms.end());
+}
+
+void RenderState::beginFrame() {
+    program = vertexArray = arrayBuffer = UNKNOWN;
+    for(Capability& capability : capabilities) capability.enabled = -1;
+    previous = current;
+    current = RenderStats();
+}
+
+void RenderState::setCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos) {
+    CameraBlock block = { view, projection, glm::vec4(viewPos, 1.0f) };
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+}
+
+bool RenderState::change(GLuint& tracked, GLuint value) {
+    if(tracked == value) {
+        current.skippedChanges++;
+        return false;
+    }
+    tracked = value;
+    current.stateChanges++;
+    return true;
+}
+
+void RenderState::useProgram(GLuint program) {
+    if(change(this->program, program)) glUseProgram(program);
+}
+
+void RenderState::bindVertexArray(GLuint vertexArray) {
+    if(change(this->vertexArray, vertexArray)) glBindVertexArray(vertexArray);
+}
+
+void RenderState::bindArrayBuffer(GLuint buffer) {
+    if(change(arrayBuffer, buffer)) glBindBuffer(GL_ARRAY_BUFFER, buffer);
+}
+
+void RenderState::setEnabled(GLenum capability, bool enabled) {
+    auto it = std::find_if(capabilities.begin(), capabilities.end(),
+                           [&](const Capability& c) { return c.name == capability; });
+    if(it == capabilities.end()) {
+        capabilities.push_back({ capability, -1 });
+        it = capabilities.end() - 1;
+    }
+    if(it->enabled == (int)enabled) {
+        current.skippedChanges++;
+        return;
+    }
+    it->enabled = enabled;
+    current.stateChanges++;
+    if(enabled) glEnable(capability);
+    else glDisable(capability);
+}
+
+bool RenderState::changeUniform(GLint location, const glm::vec4& value) {
+    if(location < 0) return false;
+    auto it = std::find_if(uniforms.begin(), uniforms.end(), [&](const UniformValue& u) {
+        return u.program == program && u.location == location;
+    });
+    if(it != uniforms.end() && it->value == value) {
+        current.skippedChanges++;
+        return false;
+    }
+    if(it == uniforms.end()) uniforms.push_back({ program, location, value });
+    else it->value = value;
+    current.stateChanges++;
+    return true;
+}
+
+void RenderState::setUniform(GLint location, float value) {
+    if(changeUniform(location, glm::vec4(value, 0.0f, 0.0f, 0.0f))) glUniform1f(location, value);
+}
+
+void RenderState::setUniform(GLint location, const glm::vec3& value) {
+    if(changeUniform(location, glm::vec4(value, 0.0f))) glUniform3fv(location, 1, glm::value_ptr(value));
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// Binding point of the Camera uniform block shared by every program
+const GLuint CAMERA_BLOCK_BINDING = 0;
+
+// GL calls made in a frame, and the redundant ones skipped
+struct RenderStats {
+    size_t drawCalls = 0;
+    size_t stateChanges = 0;   // Program, vertex array, buffer, capability and uniform changes
+    size_t skippedChanges = 0;
+};
+
+// The GL state the renderers share, tracked on the CPU so that binds and
+// toggles which would change nothing are never issued, and counted so the
+// effect can be seen per frame. The camera matrices go out once a frame in
+// a uniform buffer, which shaders declare as
+//
+//   layout(std140) uniform Camera { mat4 view; mat4 projection; vec4 viewPos; };
+//
+// Between beginFrame() calls, everything binding a program, vertex array or
+// GL_ARRAY_BUFFER has to go through here. ImGui's backend restores whatever
+// it changes.
+class RenderState {
+public:
+    // Both need a current GL context
+    void init();
+    void release();
+
+    // Points the program's Camera block, if it has one, at the shared buffer
+    void attachCamera(GLuint program);
+
+    // Forgets the tracked bindings, which code outside may have changed, and
+    // starts counting a new frame
+    void beginFrame();
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos);
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    void bindArrayBuffer(GLuint buffer);
+    void setEnabled(GLenum capability, bool enabled);
+
+    // Set on the current program; skipped when the program already holds the value
+    void setUniform(GLint location, float value);
+    void setUniform(GLint location, const glm::vec3& value);
+
+    void countDraw() { current.drawCalls++; }
+
+    // Counts for the last whole frame
+    const RenderStats& lastFrame() const { return previous; }
+
+private:
+    struct Capability {
+        GLenum name;
+        int enabled; // -1 until known
+    };
+    struct UniformValue {
+        GLuint program;
+        GLint location;
+        glm::vec4 value;
+    };
+
+    bool change(GLuint& tracked, GLuint value);
+    bool changeUniform(GLint location, const glm::vec4& value);
+
+    GLuint cameraBuffer = 0;
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    GLuint arrayBuffer = 0;
+    std::vector<Capability> capabilities;
+    std::vector<UniformValue> uniforms;
+    RenderStats current, previous;
+};
@@ -0,0 +1,210 @@
+#include "Scenario.h"
+#include "CsvIO.h"
+#include "Simulation.h"
+#include "SnapshotFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+const size_t BLOCK_BODIES = 16384; // Bodies per random stream
+const float CORE_FRACTION = 0.2f;  // Share of a disk's mass in its central body
+const float TWO_PI = 6.28318531f;
+
+struct DiskModel {
+    glm::vec3 center, velocity;
+    glm::mat3 orientation; // Disk plane (x, z) to world
+    float mass, scale;     // Whole disk, core included
+    size_t first, count;   // Bodies [first, first + count), the core first
+};
+
+// Runs generate(i, gen) for every body, each fixed block of bodies drawing
+// from its own generator
+template<typename Generate>
+void generateBlocks(ThreadPool& pool, size_t count, unsigned int seed, Generate generate) {
+    size_t blocks = (count + BLOCK_BODIES - 1) / BLOCK_BODIES;
+    pool.run(blocks, [&](size_t block) {
+        std::seed_seq sequence{ seed, (unsigned int)block };
+        std::mt19937 gen(sequence);
+        size_t end = std::min(count, (block + 1) * BLOCK_BODIES);
+        for(size_t i = block * BLOCK_BODIES; i < end; i++) generate(i, gen);
+    });
+}
+
+glm::vec3 randomDirection(std::mt19937& gen) {
+    std::uniform_real_distribution<float> cosine(-1.0f, 1.0f), angle(0.0f, TWO_PI);
+    float z = cosine(gen), phi = angle(gen);
+    float s = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    return glm::vec3(s * std::cos(phi), s * std::sin(phi), z);
+}
+
+void setBody(std::vector<GravityBody>& bodies, BodyState& state, size_t i,
+             glm::vec3 pos, glm::vec3 vel, float mass, glm::vec3 color) {
+    state.x[i] = pos.x; state.y[i] = pos.y; state.z[i] = pos.z;
+    state.vx[i] = vel.x; state.vy[i] = vel.y; state.vz[i] = vel.z;
+    state.mass[i] = mass;
+    bodies[i].radius = std::cbrt(mass) * 0.5f;
+    bodies[i].color = color;
+}
+
+// Radius and speed drawn as in Aarseth, Henon and Wielen (1974)
+void plummerBody(std::mt19937& gen, float gravityConstant, float mass, float scale, glm::vec3& pos, glm::vec3& vel) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    // Cut off the long tail; it holds under 0.1% of the mass
+    float r;
+    do {
+        r = scale / std::sqrt(std::pow(unit(gen), -2.0f / 3.0f) - 1.0f);
+    } while(!(r < 20.0f * scale));
+    // Speed as a fraction of escape speed, by rejection from q^2 (1 - q^2)^3.5
+    float q, g;
+    do {
+        q = unit(gen);
+        g = unit(gen) * 0.1f;
+    } while(g > q * q * std::pow(1.0f - q * q, 3.5f));
+    float escape = std::sqrt(2.0f * gravityConstant * mass / std::sqrt(r * r + scale * scale));
+    pos = r * randomDirection(gen);
+    vel = q * escape * randomDirection(gen);
+}
+
+void diskBody(const DiskModel& disk, size_t i, std::mt19937& gen, float gravityConstant, float softening,
+              glm::vec3& pos, glm::vec3& vel, float& mass, glm::vec3& color) {
+    float coreMass = disk.mass * CORE_FRACTION;
+    if(i == disk.first) {
+        pos = disk.center;
+        vel = disk.velocity;
+        mass = coreMass;
+        color = glm::vec3(1.0f, 0.95f, 0.8f);
+        return;
+    }
+    float starMass = disk.mass - coreMass;
+    mass = starMass / (float)(disk.count - 1);
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    // A Gamma(2) radius gives surface density falling as exp(-R / scale)
+    float radius;
+    do {
+        radius = -disk.scale * std::log(unit(gen) * unit(gen));
+    } while(!(radius < 10.0f * disk.scale));
+    float angle = unit(gen) * TWO_PI;
+    float x = radius / disk.scale;
+
+    // Circular speed from the core and the disk inside the orbit, both taken
+    // as point masses under the simulation's force law G M / (r^2 + softening)
+    float enclosed = coreMass + starMass * (1.0f - (1.0f + x) * std::exp(-x));
+    float speed = std::sqrt(gravityConstant * enclosed * radius / (radius * radius + softening));
+
+    glm::vec3 local(radius * std::cos(angle), 0.05f * disk.scale * normal(gen), radius * std::sin(angle));
+    glm::vec3 tangent(-std::sin(angle), 0.0f, std::cos(angle));
+    glm::vec3 dispersion(normal(gen), normal(gen), normal(gen));
+    pos = disk.center + disk.orientation * local;
+    vel = disk.velocity + disk.orientation * (speed * tangent + 0.05f * speed * dispersion);
+    color = glm::mix(glm::vec3(1.0f, 0.9f, 0.7f), glm::vec3(0.4f, 0.6f, 1.0f), std::min(x / 4.0f, 1.0f));
+}
+
+// Removes the net drift and offset sampling noise leaves behind
+void centerOfMassFrame(BodyState& state) {
+    double m = 0.0, px = 0.0, py = 0.0, pz = 0.0, vx = 0.0, vy = 0.0, vz = 0.0;
+    for(size_t i = 0; i < state.size(); i++) {
+        double mi = state.mass[i];
+        m += mi;
+        px += mi * state.x[i]; py += mi * state.y[i]; pz += mi * state.z[i];
+        vx += mi * state.vx[i]; vy += mi * state.vy[i]; vz += mi * state.vz[i];
+    }
+    if(m <= 0.0) return;
+    float cx = (float)(px / m), cy = (float)(py / m), cz = (float)(pz / m);
+    float cvx = (float)(vx / m), cvy = (float)(vy / m), cvz = (float)(vz / m);
+    for(size_t i = 0; i < state.size(); i++) {
+        state.x[i] -= cx; state.y[i] -= cy; state.z[i] -= cz;
+        state.vx[i] -= cvx; state.vy[i] -= cvy; state.vz[i] -= cvz;
+    }
+}
+
+}
+
+const char* scenarioGeneratorName(int generator) {
+    switch(generator) {
+        case GENERATOR_PLUMMER: return "Plummer Sphere";
+        case GENERATOR_DISK: return "Exponential Disk";
+        case GENERATOR_GALAXIES: return "Colliding Galaxies";
+        default: return "Unknown";
+    }
+}
+
+void generateScenario(const GeneratorParams& params, Simulation& sim) {
+    size_t minimum = params.generator == GENERATOR_GALAXIES ? 4 : params.generator == GENERATOR_DISK ? 2 : 1;
+    size_t n = std::max(params.bodyCount, minimum);
+    unsigned int seed = params.seed >= 0 ? (unsigned int)params.seed : std::random_device()();
+    float totalMass = params.totalMass > 0.0f ? params.totalMass : 10.0f * (float)n;
+    float scale = params.scale > 0.0f ? params.scale : 40.0f * (float)std::cbrt(n / 15.0);
+    float gravityConstant = sim.params.gravityConstant;
+    float softening = sim.params.softeningFactor;
+
+    std::vector<GravityBody> bodies(n);
+    BodyState state;
+    state.resize(n);
+
+    if(params.generator == GENERATOR_PLUMMER) {
+        float mass = totalMass / (float)n;
+        generateBlocks(sim.threadPool, n, seed, [&](size_t i, std::mt19937& gen) {
+            glm::vec3 pos, vel;
+            plummerBody(gen, gravityConstant, totalMass, scale, pos, vel);
+            float t = std::min(glm::length(pos) / (3.0f * scale), 1.0f);
+            setBody(bodies, state, i, pos, vel, mass, glm::mix(glm::vec3(1.0f, 0.85f, 0.6f), glm::vec3(0.5f, 0.7f, 1.0f), t));
+        });
+    }
+    else {
+        std::vector<DiskModel> disks;
+        if(params.generator == GENERATOR_DISK) {
+            disks.push_back({ glm::vec3(0.0f), glm::vec3(0.0f), glm::mat3(1.0f), totalMass, scale, 0, n });
+        }
+        else {
+            // Equal halves on a parabolic orbit, the second tilted 60 degrees
+            float separation = 10.0f * scale, offset = 3.0f * scale;
+            float distance = std::sqrt(separation * separation + offset * offset);
+            float speed = std::sqrt(2.0f * gravityConstant * totalMass / distance);
+            float c = std::cos(TWO_PI / 6.0f), s = std::sin(TWO_PI / 6.0f);
+            glm::mat3 tilt(glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, c, s), glm::vec3(0.0f, -s, c));
+            size_t half = n / 2;
+            disks.push_back({ glm::vec3(-separation / 2, 0.0f, -offset / 2), glm::vec3(speed / 2, 0.0f, 0.0f),
+                              glm::mat3(1.0f), totalMass / 2, scale, 0, half });
+            disks.push_back({ glm::vec3(separation / 2, 0.0f, offset / 2), glm::vec3(-speed / 2, 0.0f, 0.0f),
+                              tilt, totalMass / 2, scale, half, n - half });
+        }
+        generateBlocks(sim.threadPool, n, seed, [&](size_t i, std::mt19937& gen) {
+            const DiskModel& disk = i < disks[0].count ? disks[0] : disks[1];
+            glm::vec3 pos, vel, color;
+            float mass;
+            diskBody(disk, i, gen, gravityConstant, softening, pos, vel, mass, color);
+            setBody(bodies, state, i, pos, vel, mass, color);
+        });
+    }
+
+    centerOfMassFrame(state);
+    sim.replaceBodies(bodies, state);
+}
+
+bool loadScenario(const std::string& path, Simulation& sim, std::string& error) {
+    const std::string extension = ".gsnap";
+    bool recording = path.size() >= extension.size() &&
+                     path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+    if(!recording) return loadBodiesCsv(path, sim, error);
+
+    SnapshotReader reader;
+    SnapshotFrame frame;
+    if(!reader.open(path, error)) return false;
+    if(reader.frameCount() == 0 || !reader.frame(0, frame)) {
+        error = path + " has no readable frames";
+        return false;
+    }
+    // Only the bodies and parameters; the clock carries on as for a CSV load
+    unsigned long long stepCount = sim.stepCount;
+    double simulationTime = sim.simulationTime;
+    restoreSnapshotFrame(frame, sim);
+    sim.stepCount = stepCount;
+    sim.simulationTime = simulationTime;
+    return true;
+}
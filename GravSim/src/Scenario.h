@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct Simulation;
+
+// Initial conditions beyond the built-in presets: large scenes loaded from
+// disk and procedurally generated systems.
+
+enum ScenarioGenerator { GENERATOR_PLUMMER = 0, GENERATOR_DISK, GENERATOR_GALAXIES, GENERATOR_COUNT };
+
+const char* scenarioGeneratorName(int generator);
+
+struct GeneratorParams {
+    int generator = GENERATOR_PLUMMER;
+    size_t bodyCount = 10000;
+    int seed = -1;          // Negative draws one from std::random_device
+    float totalMass = 0.0f; // 0 gives 10 per body
+    float scale = 0.0f;     // Plummer radius or disk scale length; 0 grows it with the body count
+};
+
+// Replaces the bodies with a system set up for equilibrium under the
+// simulation's gravity constant and softening:
+//   GENERATOR_PLUMMER   Plummer sphere, velocities from its distribution function
+//   GENERATOR_DISK      exponential disk on circular orbits around a heavy core
+//   GENERATOR_GALAXIES  two such disks, one tilted, falling toward each other
+// Bodies are generated in parallel in fixed blocks, each with its own random
+// stream, so a seed gives the same system for any thread count.
+void generateScenario(const GeneratorParams& params, Simulation& sim);
+
+// Replaces the bodies with those in a CSV file (see CsvIO.h) or, for a .gsnap
+// recording, its first frame together with the parameters it was recorded
+// with. On failure the simulation is left untouched.
+bool loadScenario(const std::string& path, Simulation& sim, std::string& error);
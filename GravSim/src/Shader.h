@@ -0,0 +1,8 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Compile errors are printed to stderr; the returned object is still valid
+// so callers can carry on with a broken shader during development.
+GLuint compileShader(const char* source, GLenum type);
+GLuint createShaderProgram(const char* vertexSrc, const char* fragmentSrc);
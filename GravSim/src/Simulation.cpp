@@ -0,0 +1,394 @@
+#include "Simulation.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+namespace {
+
+// Kept ids index arrays sized by the largest id, so a damaged file must not
+// pick that size
+const unsigned int MAX_KEPT_ID = 1u << 24;
+
+// True when the ids are distinct and small enough to keep
+bool keepableIds(const std::vector<GravityBody>& bodies) {
+    unsigned int idEnd = 0;
+    for(const GravityBody& body : bodies) {
+        if(body.id >= MAX_KEPT_ID) return false;
+        idEnd = std::max(idEnd, body.id + 1);
+    }
+    std::vector<unsigned char> seen(idEnd, 0);
+    for(const GravityBody& body : bodies) {
+        if(seen[body.id]) return false;
+        seen[body.id] = 1;
+    }
+    return true;
+}
+
+}
+
+void Simulation::addBody(glm::vec3 pos, glm::vec3 vel, float mass, float radius, glm::vec3 color) {
+    GravityBody body;
+    body.id = nextBodyId++;
+    body.radius = radius;
+    body.color = color;
+    bodies.push_back(body);
+    state.push(pos, vel, mass);
+    structureVersion++;
+    editVersion++;
+}
+
+bool Simulation::compactBodies(const std::vector<unsigned char>& removed) {
+    size_t kept = 0;
+    for(size_t i = 0; i < bodies.size(); i++) {
+        if(!removed[i]) bodies[kept++] = bodies[i];
+    }
+    if(kept == bodies.size()) return false;
+    bodies.resize(kept);
+    state.compact(removed);
+    octreeBodyCount = 0;
+    structureVersion++;
+    return true;
+}
+
+void Simulation::applyEdits(const std::vector<BodyEdit>& edits) {
+    // Indices stay valid until the compaction at the end
+    removedScratch.assign(bodies.size(), 0);
+    bool edited = false, removed = false;
+    for(const BodyEdit& edit : edits) {
+        int b = findBody(edit.id);
+        if(b < 0) continue;
+        if(edit.fields & EDIT_REMOVE) {
+            removedScratch[b] = 1;
+            removed = true;
+            continue;
+        }
+        if(edit.fields & EDIT_MASS) {
+            state.mass[b] = edit.mass;
+            edited = true;
+        }
+        if(edit.fields & EDIT_RADIUS) bodies[b].radius = edit.radius;
+        if(edit.fields & EDIT_COLOR) bodies[b].color = edit.color;
+    }
+    if(removed) compactBodies(removedScratch);
+    if(edited || removed) editVersion++;
+}
+
+void Simulation::clearBodies() {
+    bodies.clear();
+    state.clear();
+    structureVersion++;
+    editVersion++;
+}
+
+void Simulation::replaceBodies(std::vector<GravityBody>& newBodies, BodyState& newState, bool keepIds) {
+    bodies.swap(newBodies);
+    std::swap(state, newState);
+    // Duplicate or out-of-range ids get fresh ones
+    if(keepIds) keepIds = keepableIds(bodies);
+    for(GravityBody& body : bodies) {
+        if(keepIds) nextBodyId = std::max(nextBodyId, body.id + 1);
+        else body.id = nextBodyId++;
+    }
+    octreeBodyCount = 0;
+    structureVersion++;
+    editVersion++;
+}
+
+int Simulation::findBody(unsigned int id) const {
+    if(indexedStructureVersion != structureVersion) {
+        // Ids only grow, so the live ones span [smallest, nextBodyId)
+        idBase = nextBodyId;
+        for(const GravityBody& body : bodies) idBase = std::min(idBase, body.id);
+        indexOfId.assign(nextBodyId - idBase, -1);
+        for(size_t i = 0; i < bodies.size(); i++) indexOfId[bodies[i].id - idBase] = (int)i;
+        indexedStructureVersion = structureVersion;
+    }
+    if(id < idBase || id - idBase >= indexOfId.size()) return -1;
+    return indexOfId[id - idBase];
+}
+
+void Simulation::reorderBodies(const std::vector<unsigned int>& order) {
+    permuteArray(bodies, order, bodyScratch);
+    state.permute(order, permuteScratch);
+    if(integrator) integrator->reorder(order);
+    // The tree's indices refer to the old order
+    octreeBodyCount = 0;
+    structureVersion++;
+}
+
+void Simulation::initializePreset(int preset, int fieldBodyCount, int seed) {
+    clearBodies();
+    
+    switch(preset) {
+        case 0: // Earth-Sun
+            addBody(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 1000.0f, 5.0f, glm::vec3(1.0f, 0.8f, 0.0f));
+            addBody(glm::vec3(50, 0, 0), glm::vec3(0, 0, 45), 10.0f, 2.0f, glm::vec3(0.2f, 0.5f, 1.0f));
+            break;
+        case 1: // Binary System
+            addBody(glm::vec3(-30, 0, 0), glm::vec3(0, 0, 30), 500.0f, 4.0f, glm::vec3(1.0f, 0.3f, 0.3f));
+            addBody(glm::vec3(30, 0, 0), glm::vec3(0, 0, -30), 500.0f, 4.0f, glm::vec3(0.3f, 0.3f, 1.0f));
+            break;
+        case 2: // Three Body
+            addBody(glm::vec3(0, 0, 0), glm::vec3(0, 0, 20), 300.0f, 3.5f, glm::vec3(1.0f, 0.5f, 0.0f));
+            addBody(glm::vec3(40, 0, 0), glm::vec3(0, 0, -10), 300.0f, 3.5f, glm::vec3(0.0f, 1.0f, 0.5f));
+            addBody(glm::vec3(20, 35, 0), glm::vec3(-15, 0, 0), 300.0f, 3.5f, glm::vec3(0.5f, 0.0f, 1.0f));
+            break;
+        case 3: // Asteroid Field
+            {
+                std::mt19937 gen(seed >= 0 ? (unsigned int)seed : std::random_device()());
+                // Keep the field's density constant as the body count grows
+                double extent = 80.0 * std::cbrt(fieldBodyCount / 15.0);
+                std::uniform_real_distribution<> posDist(-extent, extent);
+                std::uniform_real_distribution<> velDist(-20.0, 20.0);
+                std::uniform_real_distribution<> massDist(5.0, 30.0);
+                std::uniform_real_distribution<> colorDist(0.3, 1.0);
+                
+                bodies.reserve(fieldBodyCount);
+                state.reserve(fieldBodyCount);
+                for(int i = 0; i < fieldBodyCount; i++) {
+                    glm::vec3 pos(posDist(gen), posDist(gen), posDist(gen));
+                    glm::vec3 vel(velDist(gen), velDist(gen), velDist(gen));
+                    float mass = massDist(gen);
+                    glm::vec3 color(colorDist(gen), colorDist(gen), colorDist(gen));
+                    addBody(pos, vel, mass, mass / 10.0f, color);
+                }
+            }
+            break;
+    }
+}
+
+void Simulation::computeForces(BodyState& target) {
+    PROFILE_SCOPE("Forces");
+    size_t n = target.size();
+    if(params.forceSolver == SOLVER_BARNES_HUT) {
+        {
+            PROFILE_SCOPE("Octree Build");
+            octree.build(target);
+        }
+        octreeBodyCount = n;
+        threadPool.parallelFor(0, n, 256, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                glm::vec3 f = octree.computeForce(i, params.gravityConstant, params.softeningFactor,
+                                                 params.barnesHutTheta);
+                target.fx[i] = f.x;
+                target.fy[i] = f.y;
+                target.fz[i] = f.z;
+            }
+        });
+    }
+    else if(params.forceSolver == SOLVER_PARTICLE_MESH) {
+        particleMesh.computeForces(target, params.gravityConstant, params.softeningFactor,
+                                   params.meshSize, params.shortRangeCorrection, threadPool);
+    }
+    else if(threadPool.threadCount() > 1) {
+        computeDirectForcesParallel(target, params.gravityConstant, params.softeningFactor,
+                                    threadPool, directScratch);
+    }
+    else {
+        computeDirectForces(target, params.gravityConstant, params.softeningFactor);
+    }
+}
+
+// Recreates the integrator when its settings change and drops its cached
+// state after edits or force setting changes. Either way the conservation
+// baseline starts over.
+void Simulation::prepareIntegrator() {
+    bool rebuild = !integrator || integratorType != params.integrator ||
+                   integratorBlockSteps != params.blockTimesteps || integratorPrecision != params.precision;
+    if(rebuild) {
+        integrator = createIntegrator(params.integrator, params.blockTimesteps, params.precision);
+        integratorType = params.integrator;
+        integratorBlockSteps = params.blockTimesteps;
+        integratorPrecision = params.precision;
+    }
+    bool stale = integratorEditVersion != editVersion || !integratorParams.sameForces(params);
+    if(!rebuild && stale) {
+        integrator->reset();
+    }
+    if(rebuild || stale) {
+        integratorEditVersion = editVersion;
+        integratorParams = params;
+        conservation = ConservationStats();
+        if(state.size() <= CONSERVATION_MAX_BODIES) {
+            conservation.begin(state, params.gravityConstant, params.softeningFactor, &threadPool,
+                               integrator->forceEvaluations());
+        }
+    }
+}
+
+bool Simulation::handleCollisions() {
+    PROFILE_SCOPE("Collisions");
+    size_t n = state.size();
+    collisionRadius.resize(n);
+    for(size_t i = 0; i < n; i++) collisionRadius[i] = bodies[i].radius;
+    collisionDetector.detect(state, collisionRadius, threadPool);
+    collisionPairs = collisionDetector.pairs().size();
+    if(collisionPairs == 0) return false;
+
+    // Pairs are resolved in order against the current values, so a body that
+    // already grew in an earlier merge is re-tested; pairs whose other body
+    // was merged away wait for the next step
+    removedScratch.assign(n, 0);
+    bool changed = false;
+    for(const auto& pair : collisionDetector.pairs()) {
+        unsigned int a = pair.first, b = pair.second;
+        if(removedScratch[a] || removedScratch[b]) continue;
+        glm::vec3 delta = state.position(b) - state.position(a);
+        float reach = collisionRadius[a] + collisionRadius[b];
+        float dist2 = glm::dot(delta, delta);
+        if(dist2 >= reach * reach) continue;
+        float ma = state.mass[a], mb = state.mass[b];
+        if(ma + mb <= 0.0f) continue;
+
+        if(params.collisionMode == COLLISION_BOUNCE) {
+            float dist = std::sqrt(dist2);
+            glm::vec3 normal = dist > 0.0f ? delta / dist : glm::vec3(1.0f, 0.0f, 0.0f);
+            // Push apart in inverse proportion to mass so they don't stay stuck
+            glm::vec3 separation = normal * (reach - dist) / (ma + mb);
+            glm::vec3 pa = state.position(a) - separation * mb;
+            glm::vec3 pb = state.position(b) + separation * ma;
+            state.x[a] = pa.x; state.y[a] = pa.y; state.z[a] = pa.z;
+            state.x[b] = pb.x; state.y[b] = pb.y; state.z[b] = pb.z;
+
+            // Elastic impulse along the normal, only while approaching
+            float approach = glm::dot(state.velocity(b) - state.velocity(a), normal);
+            if(approach < 0.0f) {
+                glm::vec3 impulse = normal * (2.0f * approach * ma * mb / (ma + mb));
+                glm::vec3 va = state.velocity(a) + impulse / ma;
+                glm::vec3 vb = state.velocity(b) - impulse / mb;
+                state.vx[a] = va.x; state.vy[a] = va.y; state.vz[a] = va.z;
+                state.vx[b] = vb.x; state.vy[b] = vb.y; state.vz[b] = vb.z;
+                totalBounces++;
+            }
+            changed = true;
+            continue;
+        }
+
+        // Merge or absorb: the heavier body survives with the combined mass
+        // and momentum; merge also moves it to the pair's center of mass
+        unsigned int keep = mb > ma ? b : a, lost = keep == a ? b : a;
+        float total = ma + mb;
+        float mk = state.mass[keep], ml = state.mass[lost];
+        glm::vec3 velocity = (state.velocity(keep) * mk + state.velocity(lost) * ml) / total;
+        state.vx[keep] = velocity.x; state.vy[keep] = velocity.y; state.vz[keep] = velocity.z;
+        if(params.collisionMode == COLLISION_MERGE) {
+            glm::vec3 position = (state.position(keep) * mk + state.position(lost) * ml) / total;
+            state.x[keep] = position.x; state.y[keep] = position.y; state.z[keep] = position.z;
+            bodies[keep].color = (bodies[keep].color * mk + bodies[lost].color * ml) / total;
+        }
+        state.mass[keep] = total;
+        // Volumes add
+        float rk = collisionRadius[keep], rl = collisionRadius[lost];
+        collisionRadius[keep] = std::cbrt(rk * rk * rk + rl * rl * rl);
+        bodies[keep].radius = collisionRadius[keep];
+        removedScratch[lost] = 1;
+        totalMerges++;
+        changed = true;
+    }
+
+    // One compaction for all of this step's merges
+    compactBodies(removedScratch);
+    return changed;
+}
+
+void Simulation::updateBodyOrder(float dt) {
+    size_t n = state.size();
+    if(params.bodyOrdering == ORDERING_NONE || n < 2) {
+        orderedBy = ORDERING_NONE;
+        return;
+    }
+
+    // Mean speed from a fixed sample of at most 4096 bodies
+    size_t stride = std::max<size_t>(1, n / 4096);
+    double speed = 0.0;
+    size_t samples = 0;
+    for(size_t i = 0; i < n; i += stride) {
+        speed += std::sqrt((double)state.vx[i] * state.vx[i] + (double)state.vy[i] * state.vy[i] +
+                           (double)state.vz[i] * state.vz[i]);
+        samples++;
+    }
+    reorderDrift += (float)(speed / samples * dt);
+
+    bool stale = orderedBy != params.bodyOrdering || orderedEditVersion != editVersion ||
+                 reorderDrift > params.reorderDistance * spatialSorter.spacing();
+    if(!stale) return;
+
+    PROFILE_SCOPE("Reorder");
+    auto start = std::chrono::steady_clock::now();
+    spatialSorter.sort(state, params.bodyOrdering, threadPool, reorderScratch);
+    reorderBodies(reorderScratch);
+    lastReorderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    lastReorderStep = stepCount;
+    reorderCount++;
+    reorderDrift = 0.0f;
+    orderedBy = params.bodyOrdering;
+    orderedEditVersion = editVersion;
+}
+
+void Simulation::updatePhysics(float dt) {
+    prepareIntegrator();
+    
+    IntegratorContext context;
+    context.computeForces = [this](BodyState& target) { computeForces(target); };
+    context.directForces = params.forceSolver == SOLVER_DIRECT;
+    context.gravityConstant = params.gravityConstant;
+    context.softening = params.softeningFactor;
+    context.pool = &threadPool;
+    {
+        PROFILE_SCOPE("Integrate");
+        integrator->step(state, dt, context);
+    }
+
+    // Collision responses edit the state directly. The integrator's cached
+    // forces are stale afterwards, but the conservation baseline is kept so
+    // momentum drift stays meaningful across merges and bounces.
+    if(params.collisionMode != COLLISION_NONE && handleCollisions()) integrator->reset();
+    updateBodyOrder(dt);
+    
+    stepCount++;
+    simulationTime += dt;
+    
+    if(conservation.valid && conservationInterval > 0 && stepCount % conservationInterval == 0) {
+        PROFILE_SCOPE("Conservation");
+        measureConservation();
+    }
+}
+
+void Simulation::measureConservation() {
+    // In mixed and double precision the integrator's own state is measured,
+    // so the drift shown isn't the float rounding of the copy in `state`
+    const PreciseState* precise = integrator ? integrator->preciseState() : nullptr;
+    double evaluations = forceEvaluations();
+    if(precise && precise->size() == state.size()) {
+        conservation.measure(*precise, params.gravityConstant, params.softeningFactor, &threadPool, evaluations);
+    }
+    else {
+        conservation.measure(state, params.gravityConstant, params.softeningFactor, &threadPool, evaluations);
+    }
+}
+
+void Simulation::step(double dt) {
+    PROFILE_SCOPE("Step");
+    int substeps = params.substeps > 0 ? params.substeps : 1;
+    for(int s = 0; s < substeps; s++) {
+        updatePhysics((float)(dt / substeps));
+    }
+}
+
+void Simulation::measureForceError(size_t maxSamples) {
+    if(octree.nodeCount() > 0 && octreeBodyCount == state.size()) {
+        forceError = ::measureForceError(octree, params.gravityConstant, params.softeningFactor,
+                                         params.barnesHutTheta, maxSamples);
+    }
+}
+
+size_t Simulation::memoryBytes() const {
+    return state.memoryBytes() + bodies.capacity() * sizeof(GravityBody) + octree.memoryBytes() +
+           3 * directScratch.fx.capacity() * sizeof(float) + directScratch.rowBegin.capacity() * sizeof(size_t) +
+           particleMesh.memoryBytes() + collisionDetector.memoryBytes() +
+           collisionRadius.capacity() * sizeof(float) + spatialSorter.memoryBytes() +
+           (integrator ? integrator->memoryBytes() : 0);
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "BarnesHut.h"
+#include "BodyState.h"
+#include "Collisions.h"
+#include "ForceKernels.h"
+#include "Integrators.h"
+#include "ParticleMesh.h"
+#include "SpatialOrder.h"
+#include "ThreadPool.h"
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+
+// Per-body data the force loop never touches. Position, velocity, force and
+// mass live in the SoA `state`, at the same index as the body here. The id
+// stays with a body for its lifetime so render-side data such as trails can
+// follow it when other bodies are added or removed.
+struct GravityBody {
+    unsigned int id;
+    float radius;
+    glm::vec3 color;
+};
+
+// One body's changes from the UI, by id. fields says which of the values
+// to apply; a removal wins over the rest.
+enum BodyEditField { EDIT_MASS = 1, EDIT_RADIUS = 2, EDIT_COLOR = 4, EDIT_REMOVE = 8 };
+
+struct BodyEdit {
+    unsigned int id;
+    int fields;
+    float mass;
+    float radius;
+    glm::vec3 color;
+};
+
+enum ForceSolver { SOLVER_DIRECT = 0, SOLVER_BARNES_HUT = 1, SOLVER_PARTICLE_MESH = 2, SOLVER_COUNT };
+
+// Parameters read by the physics step
+struct SimulationParams {
+    bool running = false;
+    float simulationSpeed = 1.0f;
+    float gravityConstant = 1000.0f; // Scaled for visualization
+    float timeStep = 0.016f;
+    float softeningFactor = 1.0f;
+    int forceSolver = 0;
+    float barnesHutTheta = 0.5f;
+    int meshSize = 128;              // Particle mesh FFT points per side, power of two up to 256
+    bool shortRangeCorrection = true; // P3M: direct softened forces inside the mesh cutoff
+    int substeps = 1;
+    int integrator = 0;
+    bool blockTimesteps = false;
+    int precision = PRECISION_FLOAT;
+    int collisionMode = COLLISION_NONE;
+    int bodyOrdering = ORDERING_NONE;
+    float reorderDistance = 1.0f;    // Mean movement since the last reorder, in body spacings, that triggers the next
+
+    bool operator==(const SimulationParams& o) const {
+        return running == o.running && simulationSpeed == o.simulationSpeed &&
+               gravityConstant == o.gravityConstant && timeStep == o.timeStep &&
+               softeningFactor == o.softeningFactor && forceSolver == o.forceSolver &&
+               barnesHutTheta == o.barnesHutTheta && meshSize == o.meshSize &&
+               shortRangeCorrection == o.shortRangeCorrection && substeps == o.substeps &&
+               integrator == o.integrator && blockTimesteps == o.blockTimesteps &&
+               precision == o.precision && collisionMode == o.collisionMode &&
+               bodyOrdering == o.bodyOrdering && reorderDistance == o.reorderDistance;
+    }
+    bool operator!=(const SimulationParams& o) const { return !(*this == o); }
+    // Same force on every body: cached forces and the energy baseline still hold
+    bool sameForces(const SimulationParams& o) const {
+        return gravityConstant == o.gravityConstant && softeningFactor == o.softeningFactor &&
+               forceSolver == o.forceSolver && barnesHutTheta == o.barnesHutTheta &&
+               meshSize == o.meshSize && shortRangeCorrection == o.shortRangeCorrection;
+    }
+};
+
+// The physics core: bodies, solvers and integrator, with no window or GL
+// dependency. The GUI drives one from its physics thread; gravsim-headless
+// drives one directly. Not thread-safe; one thread owns it at a time.
+struct Simulation {
+    std::vector<GravityBody> bodies;
+    BodyState state;
+    SimulationParams params;
+    unsigned int nextBodyId = 0;
+    unsigned int structureVersion = 0; // Bumped whenever bodies are added, removed or reordered
+    unsigned int editVersion = 0;      // Bumped on any edit that invalidates integrator state
+    unsigned long long stepCount = 0;
+    double simulationTime = 0.0;
+
+    // Force solvers
+    BarnesHutTree octree;
+    ForceErrorStats forceError;
+    size_t octreeBodyCount = 0;      // Bodies the octree was built for; 0 once they are reordered or removed
+    ThreadPool threadPool;
+    DirectForceScratch directScratch;
+    ParticleMeshSolver particleMesh;
+
+    // Collisions
+    CollisionDetector collisionDetector;
+    size_t collisionPairs = 0;        // Overlapping pairs found in the last step
+    unsigned long long totalMerges = 0;
+    unsigned long long totalBounces = 0;
+
+    // Body ordering along a space-filling curve
+    SpatialSorter spatialSorter;
+    unsigned long long reorderCount = 0;
+    unsigned long long lastReorderStep = 0;
+    double lastReorderSeconds = 0.0;
+    float reorderDrift = 0.0f;        // Estimated mean movement since the last reorder
+
+    // Integration
+    std::unique_ptr<Integrator> integrator;
+    ConservationStats conservation;
+    static constexpr size_t CONSERVATION_MAX_BODIES = 20000; // Energy is O(N^2), skip it beyond this
+    int conservationInterval = 30;  // Steps between measurements, 0 to only take the baseline
+
+    explicit Simulation(unsigned int threads = ThreadPool::hardwareThreads()) : threadPool(threads) {}
+
+    void addBody(glm::vec3 pos, glm::vec3 vel, float mass, float radius, glm::vec3 color);
+    void clearBodies();
+    // Applies a frame's worth of edits at once. Bodies that are gone are
+    // skipped, and all removals go through one compaction.
+    void applyEdits(const std::vector<BodyEdit>& edits);
+    // Swaps in a body set that a loader or generator filled in place, leaving
+    // the previous one in the arguments. Bodies get fresh ids unless keepIds
+    // and their ids are distinct and in range.
+    void replaceBodies(std::vector<GravityBody>& newBodies, BodyState& newState, bool keepIds = false);
+    // Index of the body with this id, or -1. Ids survive reordering; indices
+    // don't, so anything that outlives a step should hold on to the id.
+    int findBody(unsigned int id) const;
+    // Moves the body at order[k] to index k, carrying the integrator's
+    // cached state along. Bumps structureVersion but not editVersion.
+    void reorderBodies(const std::vector<unsigned int>& order);
+
+    // Call after changing a body's position, velocity or mass in place
+    void markEdited() { editVersion++; }
+
+    // fieldBodyCount sets the size of the Asteroid Field preset. A negative
+    // seed draws one from std::random_device; benchmarks and batch runs pass
+    // a fixed seed so the field is reproducible.
+    void initializePreset(int preset, int fieldBodyCount = 15, int seed = -1);
+
+    // Fills target.fx/fy/fz using the selected force solver, in float
+    // whatever params.precision is
+    void computeForces(BodyState& target);
+
+    // Advances by one integrator step of dt
+    void updatePhysics(float dt);
+    // Advances by one fixed step, split into params.substeps
+    void step(double dt);
+
+    // Compares the last Barnes-Hut tree against the direct sum; no-op before
+    // the first Barnes-Hut step
+    void measureForceError(size_t maxSamples);
+
+    // Updates `conservation` from the current state; it must be valid
+    void measureConservation();
+
+    double forceEvaluations() const { return integrator ? integrator->forceEvaluations() : 0.0; }
+
+    // Heap memory held by the state, solvers and integrator
+    size_t memoryBytes() const;
+
+private:
+    void prepareIntegrator();
+    // Drops the flagged bodies and bumps structureVersion; false if none were flagged
+    bool compactBodies(const std::vector<unsigned char>& removed);
+    // Detects overlaps and applies params.collisionMode. Returns true when
+    // positions, velocities or the body set changed.
+    bool handleCollisions();
+    // Re-sorts the bodies along params.bodyOrdering when it was just turned
+    // on, after edits, or once they have moved far enough since the last sort
+    void updateBodyOrder(float dt);
+
+    int integratorType = -1;
+    bool integratorBlockSteps = false;
+    int integratorPrecision = PRECISION_FLOAT;
+    unsigned int integratorEditVersion = ~0u;
+    SimulationParams integratorParams; // Force settings the integrator's state was computed with
+
+    FloatArray collisionRadius;
+    std::vector<unsigned char> removedScratch;
+
+    int orderedBy = ORDERING_NONE;
+    unsigned int orderedEditVersion = ~0u;
+    std::vector<unsigned int> reorderScratch;
+    FloatArray permuteScratch;
+    std::vector<GravityBody> bodyScratch;
+
+    // id -> index, rebuilt on the first lookup after the bodies change
+    mutable std::vector<int> indexOfId;
+    mutable unsigned int idBase = 0;
+    mutable unsigned int indexedStructureVersion = ~0u;
+};
@@ -0,0 +1,133 @@
+#include "SimulationThread.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsBetween(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double>(b - a).count();
+}
+
+}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::start(StepFunction step, PublishFunction publish) {
+    stop();
+    stepFunction = std::move(step);
+    publishFunction = std::move(publish);
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        quit = false;
+    }
+    thread = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::stop() {
+    if(!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        quit = true;
+    }
+    commandCondition.notify_all();
+    thread.join();
+}
+
+void SimulationThread::post(std::function<void()> command) {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        pendingCommands.push_back(std::move(command));
+    }
+    commandCondition.notify_all();
+}
+
+void SimulationThread::setTiming(double newStepSize, double newTimeScale, bool newPaused) {
+    stepSize.store(std::max(newStepSize, 1e-6));
+    timeScale.store(std::max(newTimeScale, 0.0));
+    paused.store(newPaused);
+}
+
+bool SimulationThread::runCommands() {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        runningCommands.swap(pendingCommands);
+    }
+    if(runningCommands.empty()) return false;
+    PROFILE_SCOPE("Commands");
+    for(auto& command : runningCommands) command();
+    runningCommands.clear();
+    return true;
+}
+
+void SimulationThread::loop() {
+    setProfileThreadName("Physics");
+    Clock::time_point last = Clock::now();
+    Clock::time_point rateWindowStart = last;
+    unsigned long long stepsInWindow = 0;
+    double accumulator = 0.0;
+
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(commandMutex);
+            if(quit) break;
+        }
+        bool changed = runCommands();
+
+        Clock::time_point now = Clock::now();
+        double wall = secondsBetween(last, now);
+        last = now;
+
+        double dt = stepSize.load();
+        double scale = timeScale.load();
+        int steps = 0;
+
+        if(paused.load() || scale <= 0.0) {
+            accumulator = 0.0;
+        }
+        else {
+            accumulator += wall * scale;
+            int maxSteps = maxStepsPerBatch.load();
+            while(accumulator >= dt && steps < maxSteps) {
+                stepFunction(dt);
+                accumulator -= dt;
+                steps++;
+            }
+            // Falling behind: drop the backlog instead of spiralling
+            double maxLag = MAX_LAG_SECONDS * scale;
+            if(accumulator > maxLag) {
+                droppedTime.store(droppedTime.load() + accumulator - maxLag);
+                accumulator = maxLag;
+            }
+        }
+
+        if(steps > 0 || changed) {
+            PROFILE_SCOPE("Publish");
+            publishFunction();
+        }
+
+        stepsInWindow += steps;
+        double windowLength = secondsBetween(rateWindowStart, now);
+        if(windowLength >= 1.0) {
+            measuredStepRate.store(stepsInWindow / windowLength);
+            stepsInWindow = 0;
+            rateWindowStart = now;
+        }
+
+        // Sleep until the next step is due, waking early for new commands
+        double wait = 0.01;
+        if(!paused.load() && scale > 0.0) {
+            wait = std::min(wait, std::max(0.0, (dt - accumulator) / scale));
+        }
+        if(wait > 0.0) {
+            std::unique_lock<std::mutex> lock(commandMutex);
+            commandCondition.wait_for(lock, std::chrono::duration<double>(wait),
+                                      [this] { return quit || !pendingCommands.empty(); });
+        }
+    }
+}
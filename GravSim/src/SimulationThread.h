@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Drives the simulation at a fixed timestep on its own thread, independent of
+// the render loop. Wall-clock time scaled by the time scale is accumulated and
+// consumed in whole steps; after each batch of steps the publish callback is
+// invoked so the owner can hand a snapshot to the renderer.
+//
+// All access to simulation state from other threads goes through post(): the
+// command runs on the simulation thread between steps.
+class SimulationThread {
+public:
+    using StepFunction = std::function<void(double dt)>;
+    using PublishFunction = std::function<void()>;
+
+    ~SimulationThread();
+
+    void start(StepFunction step, PublishFunction publish);
+    void stop();
+    bool isRunning() const { return thread.joinable(); }
+
+    void post(std::function<void()> command);
+
+    // Safe to call every frame from any thread
+    void setTiming(double stepSize, double timeScale, bool paused);
+
+    // Upper bound on steps run before publishing; backlog beyond
+    // MAX_LAG_SECONDS of wall time is dropped and reported instead.
+    void setMaxStepsPerBatch(int steps) { maxStepsPerBatch.store(steps > 0 ? steps : 1); }
+
+    double stepsPerSecond() const { return measuredStepRate.load(); }
+    double droppedSimTime() const { return droppedTime.load(); }
+
+    static constexpr double MAX_LAG_SECONDS = 0.25;
+
+private:
+    void loop();
+    bool runCommands();
+
+    std::thread thread;
+    StepFunction stepFunction;
+    PublishFunction publishFunction;
+
+    std::mutex commandMutex;
+    std::condition_variable commandCondition;
+    std::vector<std::function<void()>> pendingCommands;
+    std::vector<std::function<void()>> runningCommands;
+    bool quit = false;
+
+    std::atomic<double> stepSize{0.016};
+    std::atomic<double> timeScale{1.0};
+    std::atomic<bool> paused{true};
+    std::atomic<int> maxStepsPerBatch{16};
+
+    std::atomic<double> measuredStepRate{0.0};
+    std::atomic<double> droppedTime{0.0};
+};
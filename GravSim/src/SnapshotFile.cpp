@@ -0,0 +1,669 @@
+#include "SnapshotFile.h"
+#include "FrameArena.h"
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define GRAVSIM_HAVE_MMAP 1
+#endif
+
+namespace {
+
+const char MAGIC[8] = { 'G', 'R', 'A', 'V', 'S', 'N', 'A', 'P' };
+const uint32_t VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint64_t ALIGNMENT = 64;
+const uint64_t CHUNK_BLOCK = 128; // Chunk header and fixed fields; arrays follow
+
+uint32_t makeTag(char a, char b, char c, char d) {
+    return (uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 | (uint32_t)d << 24;
+}
+
+const uint32_t TAG_BODIES = makeTag('B', 'O', 'D', 'Y');
+const uint32_t TAG_FRAME = makeTag('F', 'R', 'A', 'M');
+const uint32_t TAG_INDEX = makeTag('I', 'N', 'D', 'X');
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    float gravityConstant;
+    float softeningFactor;
+    float timeStep;
+    uint32_t encoding;
+    uint64_t indexOffset;   // 0 until the writer is closed
+    uint64_t frameCount;
+    uint8_t reserved[16];
+};
+
+struct ChunkHeader {
+    uint32_t tag;
+    uint32_t count;         // Bodies, or index entries
+    uint64_t size;          // Whole chunk including this header and padding
+};
+
+struct FrameInfo {
+    uint64_t step;
+    double time;
+    uint64_t bodyTableOffset;
+    uint32_t encoding;
+    float gravityConstant;
+    float softeningFactor;
+    float timeStep;
+    float origin[3];        // Quantized frames: position = origin + q * positionStep
+    float positionStep[3];
+    float velocityStep[3];  // velocity = q * velocityStep, q signed
+};
+
+static_assert(sizeof(FileHeader) == ALIGNMENT, "header must fill one aligned block");
+static_assert(sizeof(ChunkHeader) + sizeof(FrameInfo) <= CHUNK_BLOCK, "frame info must fit the chunk block");
+
+uint64_t alignUp(uint64_t value) {
+    return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Byte size of a chunk: the header block, then each array padded to 64 bytes
+uint64_t chunkSize(const std::vector<uint64_t>& arrayBytes) {
+    uint64_t total = CHUNK_BLOCK;
+    for(uint64_t bytes : arrayBytes) total += alignUp(bytes);
+    return total;
+}
+
+}
+
+void SnapshotWriter::append(Buffer& buffer, const void* data, size_t bytes) {
+    if(bytes == 0) return;
+    const unsigned char* source = static_cast<const unsigned char*>(data);
+    buffer.bytes.insert(buffer.bytes.end(), source, source + bytes);
+}
+
+void SnapshotWriter::align(Buffer& buffer) {
+    uint64_t end = buffer.offset + buffer.bytes.size();
+    buffer.bytes.resize(buffer.bytes.size() + (size_t)(alignUp(end) - end), 0);
+}
+
+// The chunk header and any fixed fields after it, zero-padded to CHUNK_BLOCK
+void SnapshotWriter::appendChunkBlock(Buffer& buffer, const void* fields, size_t bytes) {
+    unsigned char block[CHUNK_BLOCK] = {};
+    std::memcpy(block, fields, bytes);
+    append(buffer, block, sizeof(block));
+}
+
+bool SnapshotWriter::writeBuffers(Buffer* const* list, size_t count) {
+    if(count == 0) return true;
+#if defined(GRAVSIM_HAVE_MMAP)
+    ArenaScope scope;
+    iovec* parts = scope.allocate<iovec>(count);
+    size_t partCount = 0;
+    for(size_t b = 0; b < count; b++) {
+        if(!list[b]->bytes.empty()) parts[partCount++] = { list[b]->bytes.data(), list[b]->bytes.size() };
+    }
+    uint64_t position = list[0]->offset;
+    size_t first = 0;
+    while(first < partCount) {
+        int batch = (int)std::min(partCount - first, (size_t)IOV_MAX);
+        ssize_t written = pwritev(fd, parts + first, batch, (off_t)position);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return false;
+        position += (uint64_t)written;
+        // Step past whatever a short write covered
+        size_t left = (size_t)written;
+        while(first < partCount && left >= parts[first].iov_len) left -= parts[first++].iov_len;
+        if(left > 0) {
+            parts[first].iov_base = static_cast<unsigned char*>(parts[first].iov_base) + left;
+            parts[first].iov_len -= left;
+        }
+    }
+    return true;
+#else
+    if(std::fseek(file, (long)list[0]->offset, SEEK_SET) != 0) return false;
+    for(size_t b = 0; b < count; b++) {
+        const std::vector<unsigned char>& bytes = list[b]->bytes;
+        if(std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) return false;
+    }
+    return true;
+#endif
+}
+
+bool SnapshotWriter::open(const std::string& path, const Simulation& sim, int frameEncoding, std::string& error,
+                          size_t bufferCount) {
+    close();
+#if defined(GRAVSIM_HAVE_MMAP)
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    opened = fd >= 0;
+#else
+    file = std::fopen(path.c_str(), "wb");
+    opened = file != nullptr;
+#endif
+    if(!opened) {
+        error = "Cannot create " + path;
+        return false;
+    }
+    encoding = frameEncoding == SNAPSHOT_QUANTIZED ? SNAPSHOT_QUANTIZED : SNAPSHOT_RAW;
+    offset = 0;
+    bodyTableOffset = 0;
+    frames.clear();
+    tableIds.clear();
+    totals = SnapshotWriterStats();
+    openTime = std::chrono::steady_clock::now();
+
+    // The synchronous writer still encodes into one buffer
+    buffers.resize(std::max(bufferCount, (size_t)1));
+    for(auto& buffer : buffers) {
+        if(!buffer) buffer.reset(new Buffer());
+    }
+    idle.clear();
+    for(auto& buffer : buffers) idle.push_back(buffer.get());
+    pending.clear();
+    writing = 0;
+    stopping = false;
+    failed = false;
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.gravityConstant = sim.params.gravityConstant;
+    header.softeningFactor = sim.params.softeningFactor;
+    header.timeStep = sim.params.timeStep;
+    header.encoding = (uint32_t)encoding;
+    Buffer* buffer = buffers[0].get();
+    buffer->bytes.clear();
+    buffer->offset = 0;
+    append(*buffer, &header, sizeof(header));
+    if(!writeBuffers(&buffer, 1)) {
+        error = "Cannot write " + path;
+        abandon();
+        return false;
+    }
+    offset = buffer->bytes.size();
+    totals.bytesWritten = offset;
+
+    if(bufferCount > 0) writer = std::thread(&SnapshotWriter::writerLoop, this);
+    return true;
+}
+
+bool SnapshotWriter::bodyTableChanged(const Simulation& sim) const {
+    size_t n = sim.bodies.size();
+    if(bodyTableOffset == 0 || tableIds.size() != n) return true;
+    for(size_t i = 0; i < n; i++) {
+        const GravityBody& body = sim.bodies[i];
+        if(body.id != tableIds[i] || body.radius != tableRadius[i] || body.color != tableColor[i] ||
+           sim.state.mass[i] != tableMass[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SnapshotWriter::appendBodyTable(Buffer& buffer, const Simulation& sim) {
+    size_t n = sim.bodies.size();
+    tableIds.resize(n);
+    tableMass.assign(sim.state.mass.begin(), sim.state.mass.end());
+    tableRadius.resize(n);
+    tableColor.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        tableIds[i] = sim.bodies[i].id;
+        tableRadius[i] = sim.bodies[i].radius;
+        tableColor[i] = sim.bodies[i].color;
+    }
+
+    bodyTableOffset = buffer.offset + buffer.bytes.size();
+    ChunkHeader chunk = {};
+    chunk.tag = TAG_BODIES;
+    chunk.count = (uint32_t)n;
+    chunk.size = chunkSize({ n * sizeof(unsigned int), n * sizeof(float), n * sizeof(float), n * sizeof(glm::vec3) });
+    appendChunkBlock(buffer, &chunk, sizeof(chunk));
+    append(buffer, tableIds.data(), n * sizeof(unsigned int)); align(buffer);
+    append(buffer, tableMass.data(), n * sizeof(float)); align(buffer);
+    append(buffer, tableRadius.data(), n * sizeof(float)); align(buffer);
+    append(buffer, tableColor.data(), n * sizeof(glm::vec3)); align(buffer);
+}
+
+void SnapshotWriter::encodeFrame(Buffer& buffer, const Simulation& sim) {
+    const BodyState& state = sim.state;
+    size_t n = state.size();
+    if(bodyTableChanged(sim)) appendBodyTable(buffer, sim);
+
+    FrameInfo info = {};
+    info.step = sim.stepCount;
+    info.time = sim.simulationTime;
+    info.bodyTableOffset = bodyTableOffset;
+    info.encoding = (uint32_t)encoding;
+    info.gravityConstant = sim.params.gravityConstant;
+    info.softeningFactor = sim.params.softeningFactor;
+    info.timeStep = sim.params.timeStep;
+
+    const FloatArray* positions[3] = { &state.x, &state.y, &state.z };
+    const FloatArray* velocities[3] = { &state.vx, &state.vy, &state.vz };
+    size_t elementBytes = encoding == SNAPSHOT_QUANTIZED ? sizeof(uint16_t) : sizeof(float);
+    if(encoding == SNAPSHOT_QUANTIZED && n > 0) {
+        for(int axis = 0; axis < 3; axis++) {
+            const FloatArray& p = *positions[axis];
+            const FloatArray& v = *velocities[axis];
+            auto range = std::minmax_element(p.begin(), p.end());
+            info.origin[axis] = *range.first;
+            info.positionStep[axis] = std::max((*range.second - *range.first) / 65535.0f, 1e-30f);
+            float maxSpeed = 0.0f;
+            for(float value : v) maxSpeed = std::max(maxSpeed, std::fabs(value));
+            info.velocityStep[axis] = std::max(maxSpeed / 32767.0f, 1e-30f);
+        }
+    }
+
+    uint64_t frameOffset = buffer.offset + buffer.bytes.size();
+    ChunkHeader chunk = {};
+    chunk.tag = TAG_FRAME;
+    chunk.count = (uint32_t)n;
+    chunk.size = chunkSize(std::vector<uint64_t>(6, n * elementBytes));
+    unsigned char fields[sizeof(chunk) + sizeof(info)];
+    std::memcpy(fields, &chunk, sizeof(chunk));
+    std::memcpy(fields + sizeof(chunk), &info, sizeof(info));
+    appendChunkBlock(buffer, fields, sizeof(fields));
+
+    for(int array = 0; array < 6; array++) {
+        const FloatArray& values = array < 3 ? *positions[array] : *velocities[array - 3];
+        if(encoding == SNAPSHOT_RAW) {
+            append(buffer, values.data(), n * sizeof(float));
+            align(buffer);
+            continue;
+        }
+        // Quantized straight into the buffer
+        size_t start = buffer.bytes.size();
+        buffer.bytes.resize(start + n * sizeof(uint16_t));
+        uint16_t* quantized = reinterpret_cast<uint16_t*>(buffer.bytes.data() + start);
+        if(array < 3) {
+            float origin = info.origin[array], inverseStep = 1.0f / info.positionStep[array];
+            for(size_t i = 0; i < n; i++) {
+                long q = std::lround((values[i] - origin) * inverseStep);
+                quantized[i] = (uint16_t)std::max(std::min(q, 65535L), 0L);
+            }
+        }
+        else {
+            float inverseStep = 1.0f / info.velocityStep[array - 3];
+            for(size_t i = 0; i < n; i++) {
+                long q = std::max(std::min(std::lround(values[i] * inverseStep), 32767L), -32767L);
+                quantized[i] = (uint16_t)(int16_t)q;
+            }
+        }
+        align(buffer);
+    }
+    frames.push_back({ frameOffset, sim.stepCount, sim.simulationTime });
+}
+
+bool SnapshotWriter::writeFrame(const Simulation& sim, std::string& error) {
+    if(!opened) {
+        error = "Recording is not open";
+        return false;
+    }
+    bool async = writer.joinable();
+    Buffer* buffer = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(idle.empty() && !failed) {
+            // Backpressure: wait for the writer rather than drop the frame
+            auto start = std::chrono::steady_clock::now();
+            released.wait(lock, [this] { return !idle.empty() || failed; });
+            totals.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            totals.stalls++;
+        }
+        if(failed) {
+            error = "Write failed after " + std::to_string(totals.bytesWritten) + " bytes";
+        }
+        else {
+            buffer = idle.back();
+            idle.pop_back();
+        }
+    }
+    if(!buffer) {
+        abandon();
+        return false;
+    }
+
+    buffer->bytes.clear();
+    buffer->offset = offset;
+    encodeFrame(*buffer, sim);
+    offset += buffer->bytes.size();
+
+    if(async) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(buffer);
+        totals.maxQueueDepth = std::max(totals.maxQueueDepth, pending.size() + writing);
+        queued.notify_one();
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = writeBuffers(&buffer, 1);
+    totals.ioSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    totals.writeCalls++;
+    idle.push_back(buffer);
+    if(!ok) {
+        error = "Write failed after " + std::to_string(frames.size() - 1) + " frames";
+        abandon();
+        return false;
+    }
+    totals.bytesWritten += buffer->bytes.size();
+    return true;
+}
+
+void SnapshotWriter::writerLoop() {
+    std::vector<Buffer*> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        queued.wait(lock, [this] { return stopping || !pending.empty(); });
+        if(pending.empty()) break;
+        // Everything queued goes out in one call; buffers are in file order
+        // and back to back
+        batch.assign(pending.begin(), pending.end());
+        pending.clear();
+        writing = batch.size();
+        bool skip = failed;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = skip || writeBuffers(batch.data(), batch.size());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        if(!skip) {
+            totals.ioSeconds += seconds;
+            totals.writeCalls++;
+            if(ok) {
+                for(Buffer* buffer : batch) totals.bytesWritten += buffer->bytes.size();
+            }
+            else {
+                failed = true;
+            }
+        }
+        writing = 0;
+        idle.insert(idle.end(), batch.begin(), batch.end());
+        released.notify_all();
+    }
+}
+
+void SnapshotWriter::stopWriter() {
+    if(!writer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_one();
+    writer.join();
+}
+
+SnapshotWriterStats SnapshotWriter::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    SnapshotWriterStats result = totals;
+    if(!opened) return result; // As of close()
+    result.queueDepth = pending.size() + writing;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - openTime).count();
+    result.bytesPerSecond = elapsed > 0.0 ? result.bytesWritten / elapsed : 0.0;
+    return result;
+}
+
+// Closes the file as it stands, leaving no index
+void SnapshotWriter::abandon() {
+    stopWriter();
+#if defined(GRAVSIM_HAVE_MMAP)
+    if(fd >= 0) ::close(fd);
+    fd = -1;
+#else
+    if(file) std::fclose(file);
+    file = nullptr;
+#endif
+    opened = false;
+}
+
+bool SnapshotWriter::close() {
+    if(!opened) return true;
+    stopWriter();
+    bool ok = !failed;
+
+    Buffer* buffer = buffers[0].get();
+    buffer->bytes.clear();
+    buffer->offset = offset;
+    ChunkHeader chunk = {};
+    chunk.tag = TAG_INDEX;
+    chunk.count = (uint32_t)frames.size();
+    chunk.size = chunkSize({ frames.size() * sizeof(SnapshotIndexEntry) });
+    appendChunkBlock(*buffer, &chunk, sizeof(chunk));
+    append(*buffer, frames.data(), frames.size() * sizeof(SnapshotIndexEntry));
+    align(*buffer);
+    ok = ok && writeBuffers(&buffer, 1);
+    if(ok) totals.bytesWritten += buffer->bytes.size();
+
+    // Point the header at the index only once it's fully written
+    if(ok) {
+        uint64_t fields[2] = { offset, frames.size() };
+        buffer->bytes.clear();
+        buffer->offset = offsetof(FileHeader, indexOffset);
+        append(*buffer, fields, sizeof(fields));
+        ok = writeBuffers(&buffer, 1);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - openTime).count();
+    totals.bytesPerSecond = elapsed > 0.0 ? totals.bytesWritten / elapsed : 0.0;
+#if defined(GRAVSIM_HAVE_MMAP)
+    ok = ::close(fd) == 0 && ok;
+    fd = -1;
+#else
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+#endif
+    opened = false;
+    return ok;
+}
+
+bool SnapshotReader::open(const std::string& path, std::string& error) {
+    close();
+#if defined(GRAVSIM_HAVE_MMAP)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        error = "Cannot read " + path;
+        return false;
+    }
+    void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the file alive
+    if(mapping == MAP_FAILED) {
+        error = "Cannot map " + path;
+        return false;
+    }
+    data = static_cast<const unsigned char*>(mapping);
+    size = (uint64_t)info.st_size;
+    mapped = true;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if(!in) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if(fallback.empty()) {
+        error = "Cannot read " + path;
+        return false;
+    }
+    data = fallback.data();
+    size = fallback.size();
+#endif
+
+    FileHeader header;
+    if(size < sizeof(header)) {
+        error = path + " is too short to be a recording";
+        close();
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if(std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        error = path + " is not a GravSim recording";
+        close();
+        return false;
+    }
+    if(header.byteOrder != BYTE_ORDER_MARK || header.version != VERSION) {
+        error = path + " was written with another byte order or format version";
+        close();
+        return false;
+    }
+    fileEncoding = (int)header.encoding;
+
+    // Use the index when the recording was closed cleanly
+    ChunkHeader chunk;
+    // Bounds are compared as remaining space so a corrupt offset or count cannot wrap
+    if(header.indexOffset != 0 && header.indexOffset <= size && size - header.indexOffset >= CHUNK_BLOCK) {
+        std::memcpy(&chunk, data + header.indexOffset, sizeof(chunk));
+        uint64_t entries = header.indexOffset + CHUNK_BLOCK;
+        if(chunk.tag == TAG_INDEX && chunk.count == header.frameCount &&
+           chunk.count <= (size - entries) / sizeof(SnapshotIndexEntry)) {
+            frames.resize(chunk.count);
+            std::memcpy(frames.data(), data + entries, chunk.count * sizeof(SnapshotIndexEntry));
+        }
+    }
+    if(frames.empty()) {
+        for(uint64_t at = sizeof(FileHeader); at <= size && size - at >= sizeof(chunk);) {
+            std::memcpy(&chunk, data + at, sizeof(chunk));
+            if(chunk.size < CHUNK_BLOCK || chunk.size % ALIGNMENT != 0 || chunk.size > size - at) break;
+            if(chunk.tag == TAG_FRAME) {
+                FrameInfo info;
+                std::memcpy(&info, data + at + sizeof(chunk), sizeof(info));
+                frames.push_back({ at, info.step, info.time });
+            }
+            at += chunk.size;
+        }
+    }
+    return true;
+}
+
+void SnapshotReader::close() {
+#if defined(GRAVSIM_HAVE_MMAP)
+    if(mapped && data) munmap(const_cast<unsigned char*>(data), (size_t)size);
+#endif
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    fallback.clear();
+    frames.clear();
+}
+
+void SnapshotReader::prefetch(size_t index) const {
+#if defined(GRAVSIM_HAVE_MMAP)
+    if(!mapped || index >= frames.size()) return;
+    ChunkHeader chunk;
+    uint64_t at = frames[index].offset;
+    if(at > size || size - at < CHUNK_BLOCK) return;
+    std::memcpy(&chunk, data + at, sizeof(chunk));
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t begin = at / page * page;
+    uint64_t end = chunk.size < size - at ? at + chunk.size : size;
+    madvise(const_cast<unsigned char*>(data) + begin, (size_t)(end - begin), MADV_WILLNEED);
+#else
+    (void)index;
+#endif
+}
+
+bool SnapshotReader::readBodyTable(uint64_t tableOffset, SnapshotFrame& out) const {
+    ChunkHeader chunk;
+    if(tableOffset > size || size - tableOffset < CHUNK_BLOCK) return false;
+    std::memcpy(&chunk, data + tableOffset, sizeof(chunk));
+    size_t n = out.count;
+    if(chunk.tag != TAG_BODIES || chunk.count != n || chunk.size > size - tableOffset) return false;
+    if(CHUNK_BLOCK + 3 * alignUp(n * sizeof(float)) + alignUp(n * sizeof(glm::vec3)) > chunk.size) return false;
+
+    const unsigned char* at = data + tableOffset + CHUNK_BLOCK;
+    out.ids = reinterpret_cast<const unsigned int*>(at);
+    at += alignUp(n * sizeof(unsigned int));
+    out.mass = reinterpret_cast<const float*>(at);
+    at += alignUp(n * sizeof(float));
+    out.radius = reinterpret_cast<const float*>(at);
+    at += alignUp(n * sizeof(float));
+    out.color = reinterpret_cast<const glm::vec3*>(at);
+    out.bodyTableOffset = tableOffset;
+    return true;
+}
+
+bool SnapshotReader::frame(size_t index, SnapshotFrame& out) {
+    if(index >= frames.size()) return false;
+    uint64_t at = frames[index].offset;
+    // The index may come from a truncated or damaged file
+    if(at > size || size - at < CHUNK_BLOCK) return false;
+    ChunkHeader chunk;
+    FrameInfo info;
+    std::memcpy(&chunk, data + at, sizeof(chunk));
+    std::memcpy(&info, data + at + sizeof(chunk), sizeof(info));
+    size_t n = chunk.count;
+    size_t elementBytes = info.encoding == SNAPSHOT_QUANTIZED ? sizeof(uint16_t) : sizeof(float);
+    if(chunk.tag != TAG_FRAME || at + CHUNK_BLOCK + 6 * alignUp(n * elementBytes) > size) return false;
+
+    out.count = n;
+    out.step = info.step;
+    out.time = info.time;
+    out.gravityConstant = info.gravityConstant;
+    out.softeningFactor = info.softeningFactor;
+    out.timeStep = info.timeStep;
+    if(!readBodyTable(info.bodyTableOffset, out)) return false;
+
+    const unsigned char* arrays = data + at + CHUNK_BLOCK;
+    uint64_t stride = alignUp(n * elementBytes);
+    const float** targets[6] = { &out.x, &out.y, &out.z, &out.vx, &out.vy, &out.vz };
+    if(info.encoding != SNAPSHOT_QUANTIZED) {
+        // Straight out of the mapping
+        for(int array = 0; array < 6; array++) *targets[array] = reinterpret_cast<const float*>(arrays + array * stride);
+        return true;
+    }
+
+    FloatArray* decoded[6] = { &decodedX, &decodedY, &decodedZ, &decodedVX, &decodedVY, &decodedVZ };
+    for(int array = 0; array < 6; array++) {
+        const uint16_t* q = reinterpret_cast<const uint16_t*>(arrays + array * stride);
+        FloatArray& values = *decoded[array];
+        values.resize(n);
+        if(array < 3) {
+            float origin = info.origin[array], step = info.positionStep[array];
+            for(size_t i = 0; i < n; i++) values[i] = origin + q[i] * step;
+        }
+        else {
+            float step = info.velocityStep[array - 3];
+            for(size_t i = 0; i < n; i++) values[i] = (int16_t)q[i] * step;
+        }
+        *targets[array] = values.data();
+    }
+    return true;
+}
+
+void restoreSnapshotFrame(const SnapshotFrame& frame, Simulation& sim) {
+    size_t n = frame.count;
+    std::vector<GravityBody> bodies(n);
+    BodyState state;
+    state.resize(n);
+    std::copy(frame.x, frame.x + n, state.x.begin());
+    std::copy(frame.y, frame.y + n, state.y.begin());
+    std::copy(frame.z, frame.z + n, state.z.begin());
+    std::copy(frame.vx, frame.vx + n, state.vx.begin());
+    std::copy(frame.vy, frame.vy + n, state.vy.begin());
+    std::copy(frame.vz, frame.vz + n, state.vz.begin());
+    std::copy(frame.mass, frame.mass + n, state.mass.begin());
+    for(size_t i = 0; i < n; i++) {
+        bodies[i].id = frame.ids[i];
+        bodies[i].radius = frame.radius[i];
+        bodies[i].color = frame.color[i];
+    }
+    sim.replaceBodies(bodies, state, true);
+    sim.stepCount = frame.step;
+    sim.simulationTime = frame.time;
+    sim.params.gravityConstant = frame.gravityConstant;
+    sim.params.softeningFactor = frame.softeningFactor;
+    sim.params.timeStep = frame.timeStep;
+}
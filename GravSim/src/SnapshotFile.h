@@ -0,0 +1,196 @@
+#pragma once
+
+#include "BodyState.h"
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Simulation;
+
+// Binary recordings of a running simulation (.gsnap).
+//
+// The file is a 64-byte header followed by chunks. Every chunk starts on a
+// 64-byte boundary with a 128-byte block holding its tag, total size and
+// fixed fields, so a reader can walk the file without knowing every chunk
+// type:
+//   BODY  body table: ids, mass, radius and color, written whenever any of
+//         them changed since the previous table
+//   FRAM  one frame: step, time, the parameters in effect, the offset of its
+//         body table, and positions and velocities as separate arrays
+//   INDX  frame offsets, written on close; the header points to it
+// Arrays inside chunks also start on 64-byte boundaries. Because of that a
+// memory-mapped SNAPSHOT_RAW frame can be handed to the renderer as-is.
+// SNAPSHOT_QUANTIZED frames store positions as 16-bit steps across the
+// frame's bounding box and velocities as 16-bit steps of their largest
+// magnitude, half the size of raw frames, and are decoded on read.
+//
+// Files are written in host byte order; the header records it and readers
+// reject files from a machine with the other order.
+
+enum SnapshotEncoding { SNAPSHOT_RAW = 0, SNAPSHOT_QUANTIZED = 1, SNAPSHOT_ENCODING_COUNT };
+
+// One frame as seen by the reader. Pointers stay valid until the next
+// frame() call on the same reader or until it is closed.
+struct SnapshotFrame {
+    size_t count = 0;
+    unsigned long long step = 0;
+    double time = 0.0;
+    float gravityConstant = 0.0f;
+    float softeningFactor = 0.0f;
+    float timeStep = 0.0f;
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* z = nullptr;
+    const float* vx = nullptr;
+    const float* vy = nullptr;
+    const float* vz = nullptr;
+    const float* mass = nullptr;
+    const unsigned int* ids = nullptr;
+    const float* radius = nullptr;
+    const glm::vec3* color = nullptr;
+    uint64_t bodyTableOffset = 0; // Changes exactly when ids, mass, radius or color do
+};
+
+// Where a frame starts, plus enough to label it without reading it
+struct SnapshotIndexEntry {
+    uint64_t offset;
+    uint64_t step;
+    double time;
+};
+
+// Throughput and backpressure of a writer since it was opened
+struct SnapshotWriterStats {
+    uint64_t bytesWritten = 0;   // Reached the file
+    double bytesPerSecond = 0.0; // bytesWritten over the time since open
+    double ioSeconds = 0.0;      // Spent inside write calls
+    size_t writeCalls = 0;       // Each writes every frame that was queued
+    size_t queueDepth = 0;       // Frames encoded but not yet written
+    size_t maxQueueDepth = 0;
+    double stallSeconds = 0.0;   // writeFrame() waiting for a free buffer
+    size_t stalls = 0;
+};
+
+// Frames are encoded on the caller's thread into one of a fixed set of
+// buffers, which is the only time the simulation state is read. With
+// bufferCount > 0 a background thread writes the queued buffers in file
+// order, all that are ready in one pwritev(). When every buffer is queued,
+// writeFrame() waits for the oldest to reach the file: frames are never
+// dropped, and the wait is reported as stallSeconds. With bufferCount 0 each
+// frame is written before writeFrame() returns.
+class SnapshotWriter {
+public:
+    SnapshotWriter() = default;
+    ~SnapshotWriter() { close(); }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    bool open(const std::string& path, const Simulation& sim, int encoding, std::string& error, size_t bufferCount = 0);
+    // Appends the simulation's current state. On failure the file is closed
+    // without an index; readers recover the frames that were written.
+    bool writeFrame(const Simulation& sim, std::string& error);
+    // Waits for queued frames, then writes the frame index and finalizes the
+    // header
+    bool close();
+
+    bool isOpen() const { return opened; }
+    size_t frameCount() const { return frames.size(); }
+    // Including frames still queued
+    uint64_t bytesWritten() const { return offset; }
+    SnapshotWriterStats stats() const;
+
+private:
+    struct Buffer {
+        std::vector<unsigned char> bytes;
+        uint64_t offset = 0;
+    };
+
+    void append(Buffer& buffer, const void* data, size_t bytes);
+    void align(Buffer& buffer);
+    void appendChunkBlock(Buffer& buffer, const void* fields, size_t bytes);
+    bool bodyTableChanged(const Simulation& sim) const;
+    void appendBodyTable(Buffer& buffer, const Simulation& sim);
+    void encodeFrame(Buffer& buffer, const Simulation& sim);
+    // Writes buffers that are contiguous in the file
+    bool writeBuffers(Buffer* const* list, size_t count);
+    void writerLoop();
+    void stopWriter();
+    void abandon();
+
+    bool opened = false;
+    int fd = -1;          // Where pwritev() is available
+    FILE* file = nullptr; // Otherwise
+    int encoding = SNAPSHOT_RAW;
+    uint64_t offset = 0;  // End of the last encoded frame
+    uint64_t bodyTableOffset = 0;
+    std::vector<SnapshotIndexEntry> frames;
+
+    // Contents of the last body table, to tell when a new one is needed
+    std::vector<unsigned int> tableIds;
+    std::vector<float> tableMass;
+    std::vector<float> tableRadius;
+    std::vector<glm::vec3> tableColor;
+
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::thread writer;
+    mutable std::mutex mutex;
+    std::condition_variable queued, released;
+    std::vector<Buffer*> pending;
+    std::vector<Buffer*> idle;
+    size_t writing = 0; // Buffers in the writer thread's current call
+    bool stopping = false;
+    bool failed = false;
+    std::chrono::steady_clock::time_point openTime;
+    SnapshotWriterStats totals;
+};
+
+class SnapshotReader {
+public:
+    SnapshotReader() = default;
+    ~SnapshotReader() { close(); }
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    // Maps the file. Recordings that were never closed have no index; their
+    // frames are found by walking the chunks, and a truncated last chunk is
+    // ignored.
+    bool open(const std::string& path, std::string& error);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    size_t frameCount() const { return frames.size(); }
+    const SnapshotIndexEntry& frameEntry(size_t index) const { return frames[index]; }
+    int encoding() const { return fileEncoding; }
+    uint64_t fileSize() const { return size; }
+
+    bool frame(size_t index, SnapshotFrame& out);
+    // Asks the OS to start reading a frame in, ahead of frame(index)
+    void prefetch(size_t index) const;
+
+private:
+    bool readBodyTable(uint64_t tableOffset, SnapshotFrame& out) const;
+
+    const unsigned char* data = nullptr;
+    uint64_t size = 0;
+    bool mapped = false;                 // Otherwise `data` points into `fallback`
+    std::vector<unsigned char> fallback; // Whole file, where mmap isn't available
+    int fileEncoding = SNAPSHOT_RAW;
+    std::vector<SnapshotIndexEntry> frames;
+
+    FloatArray decodedX, decodedY, decodedZ, decodedVX, decodedVY, decodedVZ;
+};
+
+// Replaces the simulation's bodies, step count, time and the recorded
+// parameters with the frame's
+void restoreSnapshotFrame(const SnapshotFrame& frame, Simulation& sim);
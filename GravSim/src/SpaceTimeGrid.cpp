@@ -0,0 +1,364 @@
+#include "SpaceTimeGrid.h"
+#include "FrameArena.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Above this many changed mesh cells a full FFT solve is cheaper than
+// patching the lattice cell by cell
+const size_t INCREMENTAL_MAX_CELLS = 64;
+// Incremental updates accumulate rounding; re-solve from scratch now and then
+const int INCREMENTAL_MAX_UPDATES = 256;
+const float FAR_THETA = 0.5f;
+const int FAR_MAX_LEVELS = 9;
+
+// 2D transforms are stored as fftSide rows of spectrumSize() bins: rows go
+// through the real FFT, then each bin column through a complex FFT. Columns
+// are gathered into a contiguous buffer so the butterflies run on
+// consecutive memory.
+void fftColumns(const Fft& fft, Fft::Complex* data, size_t columns, bool inverse, ThreadPool& pool) {
+    size_t side = fft.size();
+    pool.parallelFor(0, columns, 16, [&](size_t begin, size_t end) {
+        ArenaScope scope;
+        Fft::Complex* column = scope.allocate<Fft::Complex>(side);
+        for(size_t c = begin; c < end; c++) {
+            for(size_t r = 0; r < side; r++) column[r] = data[r * columns + c];
+            if(inverse) fft.inverse(column);
+            else fft.forward(column);
+            for(size_t r = 0; r < side; r++) data[r * columns + c] = column[r];
+        }
+    });
+}
+
+// Forward transform of `rows` real rows of `width` values, zero-padded to the
+// FFT size. Rows past `rows` are zero.
+void forward2d(const RealFft& rowFft, const Fft& columnFft, const float* input, size_t rows, size_t width,
+               Fft::Complex* spectrum, ThreadPool& pool) {
+    size_t side = rowFft.size();
+    size_t bins = rowFft.spectrumSize();
+    pool.parallelFor(0, rows, 16, [&](size_t begin, size_t end) {
+        ArenaScope scope;
+        float* row = scope.allocate<float>(side);
+        Fft::Complex* scratch = scope.allocate<Fft::Complex>(side / 2);
+        std::fill(row, row + side, 0.0f);
+        for(size_t r = begin; r < end; r++) {
+            std::copy(input + r * width, input + (r + 1) * width, row);
+            rowFft.forward(row, spectrum + r * bins, scratch);
+        }
+    });
+    std::fill(spectrum + rows * bins, spectrum + side * bins, Fft::Complex(0.0f, 0.0f));
+    fftColumns(columnFft, spectrum, bins, false, pool);
+}
+
+float bilinear(const std::vector<float>& values, int side, float s, float t) {
+    int i = std::min((int)s, side - 2);
+    int j = std::min((int)t, side - 2);
+    float fs = s - i, ft = t - j;
+    const float* row0 = &values[(size_t)i * side + j];
+    const float* row1 = row0 + side;
+    return (row0[0] * (1.0f - ft) + row0[1] * ft) * (1.0f - fs) +
+           (row1[0] * (1.0f - ft) + row1[1] * ft) * fs;
+}
+
+}
+
+SpaceTimeGrid::SpaceTimeGrid(float size) : gridSize(size) {}
+
+void SpaceTimeGrid::setResolution(int resolution) {
+    resolution = std::max(resolution, 1);
+    if(resolution == gridResolution) return;
+    gridResolution = resolution;
+
+    latticeSide = std::min(resolution + 1, LATTICE_MAX);
+    marginCells = std::max(1, (latticeSide - 1) / 4);
+    meshSide = latticeSide + 2 * marginCells;
+    fftSide = Fft::nextPowerOfTwo((size_t)(latticeSide + meshSide - 1));
+    spacing = gridSize / (latticeSide - 1);
+    meshOrigin = -0.5f * gridSize - marginCells * spacing;
+    fft.resize(fftSide);
+    rowFft.resize(fftSide);
+
+    // Offsets between a mesh cell and a lattice point span +-kernelTableRadius
+    kernelTableRadius = latticeSide + marginCells - 1;
+    int tableSide = 2 * kernelTableRadius + 1;
+    kernelTable.resize((size_t)tableSide * tableSide);
+    for(int a = 0; a < tableSide; a++) {
+        for(int b = 0; b < tableSide; b++) {
+            float da = (float)(a - kernelTableRadius), db = (float)(b - kernelTableRadius);
+            kernelTable[(size_t)a * tableSide + b] = kernel(spacing * std::sqrt(da * da + db * db));
+        }
+    }
+
+    // Kernel laid out for circular convolution: offset t sits at t mod fftSide.
+    // fftSide leaves room for every offset, so nothing wraps onto the lattice.
+    std::vector<float> wrapped(fftSide * fftSide, 0.0f);
+    for(int a = -kernelTableRadius; a <= kernelTableRadius; a++) {
+        for(int b = -kernelTableRadius; b <= kernelTableRadius; b++) {
+            size_t row = (size_t)((a + (int)fftSide) % (int)fftSide);
+            size_t col = (size_t)((b + (int)fftSide) % (int)fftSide);
+            wrapped[row * fftSide + col] =
+                kernelTable[(size_t)(a + kernelTableRadius) * tableSide + (b + kernelTableRadius)];
+        }
+    }
+    kernelSpectrum.resize(fftSide * rowFft.spectrumSize());
+    ThreadPool serial(1);
+    forward2d(rowFft, fft, wrapped.data(), fftSide, fftSide, kernelSpectrum.data(), serial);
+    float scale = 1.0f / (float)(fftSide * fftSide);
+    for(Fft::Complex& c : kernelSpectrum) c *= scale;
+    work.resize(kernelSpectrum.size());
+
+    mesh.assign((size_t)meshSide * meshSide, 0.0f);
+    previousMesh.assign(mesh.size(), 0.0f);
+    nearLattice.assign((size_t)latticeSide * latticeSide, 0.0f);
+    farCoarse.assign(FAR_SIDE * FAR_SIDE, 0.0f);
+    field.assign((size_t)(resolution + 1) * (resolution + 1), 0.0f);
+    nearValid = false;
+    farValid = false;
+}
+
+bool SpaceTimeGrid::update(const float* x, const float* z, const float* mass, size_t n, ThreadPool& pool) {
+    if(gridResolution == 0) setResolution(50);
+
+    depositNear(x, z, mass, n);
+
+    changedCells.clear();
+    for(size_t c = 0; c < mesh.size(); c++) {
+        if(mesh[c] != previousMesh[c]) {
+            changedCells.push_back((int)c);
+            if(changedCells.size() > INCREMENTAL_MAX_CELLS) break;
+        }
+    }
+
+    bool nearChanged = !nearValid || !changedCells.empty();
+    bool full = false;
+    if(!nearValid || changedCells.size() > INCREMENTAL_MAX_CELLS || incrementalUpdates >= INCREMENTAL_MAX_UPDATES) {
+        solveNearFull(pool);
+        full = true;
+    } else if(!changedCells.empty()) {
+        solveNearIncremental();
+    }
+    mesh.swap(previousMesh);
+
+    bool farChanged = buildFarPyramid(x, z, mass);
+    if(farChanged) solveFar(pool);
+
+    if(!nearChanged && !farChanged) {
+        updateKind = UPDATE_UNCHANGED;
+        return false;
+    }
+    resample(pool);
+    updateKind = full ? UPDATE_FULL : UPDATE_INCREMENTAL;
+    return true;
+}
+
+// Cloud-in-cell: each body's mass is split over the four mesh points around
+// it. Bodies whose cell is not fully on the mesh are left to the far field.
+void SpaceTimeGrid::depositNear(const float* x, const float* z, const float* mass, size_t n) {
+    std::fill(mesh.begin(), mesh.end(), 0.0f);
+    // Every index is written and only far ones are kept, which avoids a
+    // branch per body in fields that are mostly far away
+    farIndex.resize(n);
+    size_t farCount = 0;
+    float inverseSpacing = 1.0f / spacing;
+    float limit = (float)(meshSide - 1);
+    for(size_t i = 0; i < n; i++) {
+        float u = (x[i] - meshOrigin) * inverseSpacing;
+        float v = (z[i] - meshOrigin) * inverseSpacing;
+        bool near = (u >= 0.0f) & (v >= 0.0f) & (u < limit) & (v < limit);
+        farIndex[farCount] = (unsigned int)i;
+        farCount += !near;
+        if(!near) continue;
+        int iu = (int)u, iv = (int)v;
+        float fu = u - iu, fv = v - iv;
+        float* cell = &mesh[(size_t)iu * meshSide + iv];
+        float m = mass[i];
+        cell[0] += m * (1.0f - fu) * (1.0f - fv);
+        cell[1] += m * (1.0f - fu) * fv;
+        cell[meshSide] += m * fu * (1.0f - fv);
+        cell[meshSide + 1] += m * fu * fv;
+    }
+    farIndex.resize(farCount);
+}
+
+// Zero-padded 2D convolution of the mesh with the kernel. Only the mesh rows
+// are transformed forward and only the lattice rows back; the rest are zero
+// or unused.
+void SpaceTimeGrid::solveNearFull(ThreadPool& pool) {
+    forward2d(rowFft, fft, mesh.data(), meshSide, meshSide, work.data(), pool);
+    for(size_t i = 0; i < work.size(); i++) {
+        const Fft::Complex& k = kernelSpectrum[i];
+        Fft::Complex& w = work[i];
+        w = Fft::Complex(w.real() * k.real() - w.imag() * k.imag(),
+                         w.real() * k.imag() + w.imag() * k.real());
+    }
+    size_t bins = rowFft.spectrumSize();
+    fftColumns(fft, work.data(), bins, true, pool);
+
+    pool.parallelFor(0, latticeSide, 16, [&](size_t begin, size_t end) {
+        ArenaScope scope;
+        float* row = scope.allocate<float>(fftSide);
+        Fft::Complex* scratch = scope.allocate<Fft::Complex>(fftSide / 2);
+        for(size_t a = begin; a < end; a++) {
+            rowFft.inverse(&work[(a + marginCells) * bins], row, scratch);
+            std::copy(row + marginCells, row + marginCells + latticeSide,
+                      nearLattice.begin() + a * latticeSide);
+        }
+    });
+    nearValid = true;
+    incrementalUpdates = 0;
+}
+
+// Adds each changed cell's mass difference times the kernel to every lattice point
+void SpaceTimeGrid::solveNearIncremental() {
+    int tableSide = 2 * kernelTableRadius + 1;
+    for(int c : changedCells) {
+        float delta = mesh[c] - previousMesh[c];
+        int ca = c / meshSide, cb = c % meshSide;
+        for(int a = 0; a < latticeSide; a++) {
+            const float* k = &kernelTable[(size_t)(a + marginCells - ca + kernelTableRadius) * tableSide +
+                                          (marginCells - cb + kernelTableRadius)];
+            float* out = &nearLattice[(size_t)a * latticeSide];
+            for(int b = 0; b < latticeSide; b++) out[b] += delta * k[b];
+        }
+    }
+    incrementalUpdates++;
+}
+
+// Sums the far bodies into a quadtree stored as full levels over their
+// bounding square. Leaves are small next to the distance from the grid, so
+// they keep only a monopole. Returns false when the leaves match the last
+// update exactly.
+bool SpaceTimeGrid::buildFarPyramid(const float* x, const float* z, const float* mass) {
+    if(farIndex.empty()) {
+        bool changed = !farValid || !previousLeaves.empty();
+        pyramid.clear();
+        previousLeaves.clear();
+        return changed;
+    }
+
+    float minX = x[farIndex[0]], maxX = minX;
+    float minZ = z[farIndex[0]], maxZ = minZ;
+    for(unsigned int i : farIndex) {
+        minX = std::min(minX, x[i]); maxX = std::max(maxX, x[i]);
+        minZ = std::min(minZ, z[i]); maxZ = std::max(maxZ, z[i]);
+    }
+    float extent = std::max(maxX - minX, maxZ - minZ) * 1.0001f + 1e-3f;
+
+    float leafTarget = marginCells * spacing;
+    int levels = 0;
+    while(levels < FAR_MAX_LEVELS && extent / (float)(1 << levels) > leafTarget) levels++;
+
+    int side = 1 << levels;
+    float cellsPerUnit = side / extent;
+    leafScratch.assign((size_t)side * side, Cell{ 0.0f, 0.0f, 0.0f });
+    for(unsigned int i : farIndex) {
+        int ix = std::min((int)((x[i] - minX) * cellsPerUnit), side - 1);
+        int iz = std::min((int)((z[i] - minZ) * cellsPerUnit), side - 1);
+        Cell& cell = leafScratch[(size_t)ix * side + iz];
+        cell.mass += mass[i];
+        cell.x += mass[i] * x[i];
+        cell.z += mass[i] * z[i];
+    }
+
+    bool changed = !farValid || minX != farMinX || minZ != farMinZ || extent != farExtent ||
+                   leafScratch.size() != previousLeaves.size() ||
+                   std::memcmp(leafScratch.data(), previousLeaves.data(), leafScratch.size() * sizeof(Cell)) != 0;
+    if(!changed) return false;
+    previousLeaves.swap(leafScratch);
+    farMinX = minX;
+    farMinZ = minZ;
+    farExtent = extent;
+
+    pyramid.resize(levels + 1);
+    for(int l = 0; l < levels; l++) pyramid[l].assign((size_t)1 << (2 * l), Cell{ 0.0f, 0.0f, 0.0f });
+    pyramid[levels] = previousLeaves;
+    for(int l = levels - 1; l >= 0; l--) {
+        int parentSide = 1 << l;
+        const std::vector<Cell>& children = pyramid[l + 1];
+        for(int a = 0; a < parentSide; a++) {
+            for(int b = 0; b < parentSide; b++) {
+                Cell& parent = pyramid[l][(size_t)a * parentSide + b];
+                for(int k = 0; k < 4; k++) {
+                    const Cell& child = children[(size_t)(2 * a + (k >> 1)) * (2 * parentSide) + 2 * b + (k & 1)];
+                    parent.mass += child.mass;
+                    parent.x += child.x;
+                    parent.z += child.z;
+                }
+            }
+        }
+    }
+    for(std::vector<Cell>& level : pyramid) {
+        for(Cell& cell : level) {
+            if(cell.mass > 0.0f) {
+                cell.x /= cell.mass;
+                cell.z /= cell.mass;
+            }
+        }
+    }
+    return true;
+}
+
+float SpaceTimeGrid::evaluateFar(float px, float pz) const {
+    struct Entry { int level, a, b; };
+    Entry stack[4 * FAR_MAX_LEVELS + 4];
+    int top = 0;
+    stack[top++] = { 0, 0, 0 };
+    int leafLevel = (int)pyramid.size() - 1;
+    float sum = 0.0f;
+    while(top > 0) {
+        Entry e = stack[--top];
+        const Cell& cell = pyramid[e.level][((size_t)e.a << e.level) + e.b];
+        if(cell.mass <= 0.0f) continue;
+        float dx = px - cell.x, dz = pz - cell.z;
+        float d = std::sqrt(dx * dx + dz * dz);
+        float cellSize = farExtent / (float)(1 << e.level);
+        if(e.level == leafLevel || cellSize < FAR_THETA * d) {
+            sum += cell.mass * kernel(d);
+            continue;
+        }
+        for(int k = 0; k < 4; k++) {
+            stack[top++] = { e.level + 1, 2 * e.a + (k >> 1), 2 * e.b + (k & 1) };
+        }
+    }
+    return sum;
+}
+
+void SpaceTimeGrid::solveFar(ThreadPool& pool) {
+    if(pyramid.empty()) {
+        std::fill(farCoarse.begin(), farCoarse.end(), 0.0f);
+    } else {
+        float step = gridSize / (FAR_SIDE - 1);
+        pool.parallelFor(0, FAR_SIDE, 1, [&](size_t begin, size_t end) {
+            for(size_t a = begin; a < end; a++) {
+                for(int b = 0; b < FAR_SIDE; b++) {
+                    farCoarse[a * FAR_SIDE + b] = evaluateFar(-0.5f * gridSize + a * step, -0.5f * gridSize + b * step);
+                }
+            }
+        });
+    }
+    farValid = true;
+}
+
+// Grid vertices sit between lattice points once the resolution exceeds the
+// lattice, so both the near lattice and the coarse far samples are
+// interpolated
+void SpaceTimeGrid::resample(ThreadPool& pool) {
+    int side = gridResolution + 1;
+    float nearScale = (float)(latticeSide - 1) / gridResolution;
+    float farScale = (float)(FAR_SIDE - 1) / gridResolution;
+    bool hasFar = !pyramid.empty();
+    pool.parallelFor(0, side, 16, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            float* out = &field[i * side];
+            for(int j = 0; j < side; j++) {
+                float value = bilinear(nearLattice, latticeSide, i * nearScale, j * nearScale);
+                if(hasFar) value += bilinear(farCoarse, FAR_SIDE, i * farScale, j * farScale);
+                out[j] = value;
+            }
+        }
+    });
+}
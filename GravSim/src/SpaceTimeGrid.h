@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Fft.h"
+
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+// Depth field for the space-time grid visualization: at every grid vertex,
+// the sum over bodies of mass / (1 + d / 10), with d the distance in the XZ
+// plane. The GUI scales it into the grid's dip.
+//
+// The field is solved on a lattice of at most LATTICE_MAX points per side
+// and bilinearly resampled to the grid vertices:
+//   - Bodies over the grid, or within a margin around it, are deposited onto
+//     a mass mesh (cloud-in-cell) and convolved with the kernel by FFT. When
+//     only a few mesh cells change since the last update, just those cells'
+//     contributions are added or removed instead.
+//   - Bodies beyond the margin are summed into a 2D mass pyramid and
+//     evaluated Barnes-Hut style on a coarse lattice. Their field is smooth
+//     over the grid, so the coarse lattice is interpolated.
+// Cost is O(N) for the deposit plus a fixed FFT size, independent of N.
+class SpaceTimeGrid {
+public:
+    enum UpdateKind { UPDATE_UNCHANGED, UPDATE_INCREMENTAL, UPDATE_FULL };
+
+    explicit SpaceTimeGrid(float size = 200.0f);
+
+    // Vertices per side are resolution + 1, centered on the origin
+    void setResolution(int resolution);
+    int resolution() const { return gridResolution; }
+    float size() const { return gridSize; }
+
+    // Recomputes the field. Returns false when nothing moved since the
+    // previous call, in which case depth() is untouched.
+    bool update(const float* x, const float* z, const float* mass, size_t n, ThreadPool& pool);
+
+    // Row-major, index i * (resolution + 1) + j with i along X and j along Z
+    const std::vector<float>& depth() const { return field; }
+
+    UpdateKind lastUpdate() const { return updateKind; }
+    size_t farBodyCount() const { return farIndex.size(); }
+
+    static float kernel(float distance) { return 1.0f / (1.0f + distance / 10.0f); }
+
+    static constexpr int LATTICE_MAX = 101;
+    static constexpr int FAR_SIDE = 17;
+
+private:
+    struct Cell {
+        float mass, x, z; // x, z are mass-weighted sums until finalized
+    };
+
+    void depositNear(const float* x, const float* z, const float* mass, size_t n);
+    void solveNearFull(ThreadPool& pool);
+    void solveNearIncremental();
+    bool buildFarPyramid(const float* x, const float* z, const float* mass);
+    float evaluateFar(float px, float pz) const;
+    void solveFar(ThreadPool& pool);
+    void resample(ThreadPool& pool);
+
+    float gridSize;
+    int gridResolution = 0;
+    int latticeSide = 0;   // G: lattice points per side over the grid
+    int marginCells = 0;   // Mesh extends this many lattice steps past the grid
+    int meshSide = 0;      // G + 2 * margin
+    size_t fftSide = 0;    // Padded so the circular convolution doesn't wrap
+    float spacing = 0.0f;  // Lattice step
+    float meshOrigin = 0.0f;
+
+    RealFft rowFft;
+    Fft fft;                                  // Columns of the row spectra
+    std::vector<Fft::Complex> kernelSpectrum; // Pre-scaled by 1 / fftSide^2
+    std::vector<Fft::Complex> work;
+    std::vector<float> kernelTable;  // Kernel by lattice offset, for incremental updates
+    int kernelTableRadius = 0;
+
+    std::vector<float> mesh;
+    std::vector<float> previousMesh;
+    std::vector<int> changedCells;
+    std::vector<float> nearLattice;
+    int incrementalUpdates = 0;
+    bool nearValid = false;
+
+    std::vector<unsigned int> farIndex;
+    std::vector<std::vector<Cell>> pyramid; // Level 0 is the root
+    std::vector<Cell> previousLeaves;
+    std::vector<Cell> leafScratch;
+    float farMinX = 0.0f, farMinZ = 0.0f, farExtent = 0.0f;
+    std::vector<float> farCoarse;  // FAR_SIDE^2 samples over the grid
+    bool farValid = false;
+
+    std::vector<float> field;
+    UpdateKind updateKind = UPDATE_UNCHANGED;
+};
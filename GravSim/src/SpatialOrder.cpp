@@ -0,0 +1,163 @@
+#include "SpatialOrder.h"
+#include "FrameArena.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int KEY_BITS = 21;          // Per axis, 63 in the key
+const size_t BODIES_PER_TASK = 16384;
+const int DIGIT_BITS = 8;
+const size_t DIGITS = 1 << DIGIT_BITS;
+
+// Spreads the low 21 bits of v to every third bit
+uint64_t spreadBits(uint32_t v) {
+    uint64_t x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+}
+
+const char* bodyOrderingName(int ordering) {
+    switch(ordering) {
+        case ORDERING_NONE: return "Creation Order";
+        case ORDERING_MORTON: return "Morton";
+        case ORDERING_HILBERT: return "Hilbert";
+    }
+    return "Unknown";
+}
+
+uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z) {
+    return spreadBits(x) << 2 | spreadBits(y) << 1 | spreadBits(z);
+}
+
+uint64_t hilbertKey(uint32_t x, uint32_t y, uint32_t z) {
+    // Skilling, "Programming the Hilbert curve" (2004): turns the axes into
+    // the transposed Hilbert index, whose bits interleave like a Morton key
+    uint32_t axes[3] = { x, y, z };
+    const uint32_t top = 1u << (KEY_BITS - 1);
+    for(uint32_t q = top; q > 1; q >>= 1) {
+        uint32_t p = q - 1;
+        for(int i = 0; i < 3; i++) {
+            if(axes[i] & q) {
+                axes[0] ^= p;
+            }
+            else {
+                uint32_t t = (axes[0] ^ axes[i]) & p;
+                axes[0] ^= t;
+                axes[i] ^= t;
+            }
+        }
+    }
+    // Gray encode
+    axes[1] ^= axes[0];
+    axes[2] ^= axes[1];
+    uint32_t t = 0;
+    for(uint32_t q = top; q > 1; q >>= 1) {
+        if(axes[2] & q) t ^= q - 1;
+    }
+    for(int i = 0; i < 3; i++) axes[i] ^= t;
+    return mortonKey(axes[0], axes[1], axes[2]);
+}
+
+void SpatialSorter::sort(const BodyState& state, int ordering, ThreadPool& pool, std::vector<unsigned int>& order) {
+    sort(state.x.data(), state.y.data(), state.z.data(), state.size(), ordering, pool, order);
+}
+
+void SpatialSorter::sort(const float* x, const float* y, const float* z, size_t n, int ordering, ThreadPool& pool,
+                         std::vector<unsigned int>& order) {
+    order.resize(n);
+    keys.resize(n);
+    if(n == 0) return;
+
+    size_t taskCount = std::max<size_t>(1, std::min<size_t>(pool.threadCount() * 4, n / BODIES_PER_TASK));
+    size_t perTask = (n + taskCount - 1) / taskCount;
+
+    // Bounding cube, per task then combined in task order
+    ArenaScope scope;
+    glm::vec3* taskMin = scope.allocate<glm::vec3>(taskCount);
+    glm::vec3* taskMax = scope.allocate<glm::vec3>(taskCount);
+    pool.run(taskCount, [&](size_t t) {
+        size_t begin = t * perTask, end = std::min(n, begin + perTask);
+        glm::vec3 lo(x[begin], y[begin], z[begin]), hi = lo;
+        for(size_t i = begin + 1; i < end; i++) {
+            glm::vec3 p(x[i], y[i], z[i]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        taskMin[t] = lo;
+        taskMax[t] = hi;
+    });
+    glm::vec3 lo = taskMin[0], hi = taskMax[0];
+    for(size_t t = 1; t < taskCount; t++) {
+        lo = glm::min(lo, taskMin[t]);
+        hi = glm::max(hi, taskMax[t]);
+    }
+    glm::vec3 extent = hi - lo;
+    float side = std::fmax(extent.x, std::fmax(extent.y, extent.z));
+    lastSpacing = side / std::cbrt((float)n);
+    // Just under 2^21 so the far faces still quantize inside the range
+    double scale = side > 0.0f ? ((1u << KEY_BITS) - 1) / (side * 1.0001) : 0.0;
+
+    keyScratch.resize(n);
+    indexScratch.resize(n);
+    pool.run(taskCount, [&](size_t t) {
+        size_t begin = t * perTask, end = std::min(n, begin + perTask);
+        for(size_t i = begin; i < end; i++) {
+            uint32_t qx = (uint32_t)((x[i] - lo.x) * scale);
+            uint32_t qy = (uint32_t)((y[i] - lo.y) * scale);
+            uint32_t qz = (uint32_t)((z[i] - lo.z) * scale);
+            keys[i] = ordering == ORDERING_HILBERT ? hilbertKey(qx, qy, qz) : mortonKey(qx, qy, qz);
+            order[i] = (unsigned int)i;
+        }
+    });
+
+    counts.resize(taskCount * DIGITS);
+    for(int shift = 0; shift < 3 * KEY_BITS; shift += DIGIT_BITS) {
+        pool.run(taskCount, [&](size_t t) {
+            size_t* c = counts.data() + t * DIGITS;
+            std::fill(c, c + DIGITS, 0);
+            size_t begin = t * perTask, end = std::min(n, begin + perTask);
+            for(size_t i = begin; i < end; i++) c[(keys[i] >> shift) & (DIGITS - 1)]++;
+        });
+
+        // Offsets by digit, then by task within a digit
+        size_t running = 0;
+        bool uniform = false;
+        for(size_t d = 0; d < DIGITS; d++) {
+            size_t digitTotal = 0;
+            for(size_t t = 0; t < taskCount; t++) {
+                size_t count = counts[t * DIGITS + d];
+                counts[t * DIGITS + d] = running + digitTotal;
+                digitTotal += count;
+            }
+            if(digitTotal == n) uniform = true;
+            running += digitTotal;
+        }
+        if(uniform) continue;
+
+        pool.run(taskCount, [&](size_t t) {
+            size_t* offset = counts.data() + t * DIGITS;
+            size_t begin = t * perTask, end = std::min(n, begin + perTask);
+            for(size_t i = begin; i < end; i++) {
+                size_t slot = offset[(keys[i] >> shift) & (DIGITS - 1)]++;
+                keyScratch[slot] = keys[i];
+                indexScratch[slot] = order[i];
+            }
+        });
+        keys.swap(keyScratch);
+        order.swap(indexScratch);
+    }
+}
+
+size_t SpatialSorter::memoryBytes() const {
+    return (keys.capacity() + keyScratch.capacity()) * sizeof(uint64_t) +
+           indexScratch.capacity() * sizeof(unsigned int) + counts.capacity() * sizeof(size_t);
+}
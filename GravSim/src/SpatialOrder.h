@@ -0,0 +1,53 @@
+#pragma once
+
+#include "BodyState.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+enum BodyOrdering { ORDERING_NONE = 0, ORDERING_MORTON, ORDERING_HILBERT, ORDERING_COUNT };
+
+const char* bodyOrderingName(int ordering);
+
+// Orders bodies along a space-filling curve, so that bodies close in space
+// are close in memory and the tree walks, hash scans and short-range passes
+// that go through bodies in index order touch fewer cache lines.
+//
+// Positions are quantized to 21 bits per axis inside their bounding cube
+// and turned into 63-bit Morton (Z-order) or Hilbert keys. The keys are
+// sorted by a parallel LSD radix sort with 8-bit digits: each task counts
+// the digits of its own slice, the counts are turned into per-task offsets
+// in task order, and each task scatters its slice, so the sort is stable
+// and gives the same order on any thread count. Digits that are the same
+// for every body are skipped.
+class SpatialSorter {
+public:
+    // Fills order so that order[k] is the index of the body that goes to
+    // slot k. ordering is a BodyOrdering other than ORDERING_NONE.
+    void sort(const BodyState& state, int ordering, ThreadPool& pool, std::vector<unsigned int>& order);
+    void sort(const float* x, const float* y, const float* z, size_t n, int ordering, ThreadPool& pool,
+              std::vector<unsigned int>& order);
+
+    // Keys of the last sort, in sorted order
+    const std::vector<uint64_t>& sortedKeys() const { return keys; }
+
+    // Mean spacing between bodies at the last sort if they filled their
+    // bounding cube evenly
+    float spacing() const { return lastSpacing; }
+
+    size_t memoryBytes() const;
+
+private:
+    std::vector<uint64_t> keys, keyScratch;
+    std::vector<unsigned int> indexScratch;
+    std::vector<size_t> counts; // 256 per task
+    float lastSpacing = 0.0f;
+};
+
+// Morton key of a point quantized to 21 bits per axis
+uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z);
+// Hilbert key of a point quantized to 21 bits per axis (Skilling's transform)
+uint64_t hilbertKey(uint32_t x, uint32_t y, uint32_t z);
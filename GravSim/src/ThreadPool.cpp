@@ -0,0 +1,149 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+
+// Pool whose tasks the current thread is executing, used to run nested batches inline
+thread_local const ThreadPool* activePool = nullptr;
+
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+    start(threadCount);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+unsigned int ThreadPool::hardwareThreads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void ThreadPool::resize(unsigned int threadCount) {
+    std::lock_guard<std::mutex> lock(runMutex);
+    stop();
+    start(threadCount);
+}
+
+void ThreadPool::start(unsigned int threadCount) {
+    threadCount = std::max(1u, threadCount);
+    stopping = false;
+    queues.clear();
+    for(unsigned int w = 0; w < threadCount; w++) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for(unsigned int w = 1; w < threadCount; w++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, w);
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for(auto& worker : workers) worker.join();
+    workers.clear();
+}
+
+void ThreadPool::run(size_t taskCount, FunctionRef<void(size_t)> task) {
+    if(taskCount == 0) return;
+    if(taskCount == 1 || activePool == this || queues.size() <= 1) {
+        for(size_t i = 0; i < taskCount; i++) task(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+
+    // Publish the task before dealing indices; workers read it after popping
+    // an index under the queue mutex, which orders the two.
+    currentTask = &task;
+    remaining.store(taskCount);
+    for(size_t i = 0; i < taskCount; i++) {
+        WorkQueue& queue = *queues[i % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        generation++;
+    }
+    wakeCondition.notify_all();
+
+    const ThreadPool* previous = activePool;
+    activePool = this;
+    drain(0);
+    activePool = previous;
+
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    doneCondition.wait(lock, [this] { return remaining.load() == 0; });
+    currentTask = nullptr;
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, FunctionRef<void(size_t, size_t)> body) {
+    if(end <= begin) return;
+    grain = std::max<size_t>(1, grain);
+    size_t chunks = (end - begin + grain - 1) / grain;
+    run(chunks, [&](size_t chunk) {
+        size_t chunkBegin = begin + chunk * grain;
+        body(chunkBegin, std::min(end, chunkBegin + grain));
+    });
+}
+
+void ThreadPool::workerLoop(unsigned int workerIndex) {
+    activePool = this;
+    unsigned long long seen = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait(lock, [&] { return stopping || generation != seen; });
+            if(stopping) return;
+            seen = generation;
+        }
+        drain(workerIndex);
+    }
+}
+
+void ThreadPool::drain(unsigned int workerIndex) {
+    size_t task;
+    while(popLocal(workerIndex, task) || steal(workerIndex, task)) {
+        (*currentTask)(task);
+        if(remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            doneCondition.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::popLocal(unsigned int workerIndex, size_t& task) {
+    WorkQueue& queue = *queues[workerIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.head == queue.tasks.size()) return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    if(queue.head == queue.tasks.size()) {
+        queue.tasks.clear();
+        queue.head = 0;
+    }
+    return true;
+}
+
+bool ThreadPool::steal(unsigned int workerIndex, size_t& task) {
+    size_t count = queues.size();
+    for(size_t k = 1; k < count; k++) {
+        WorkQueue& victim = *queues[(workerIndex + k) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(victim.head == victim.tasks.size()) continue;
+        task = victim.tasks[victim.head++];
+        if(victim.head == victim.tasks.size()) {
+            victim.tasks.clear();
+            victim.head = 0;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Non-owning reference to a callable. Unlike std::function it never copies
+// the callable, so passing a lambda with many captures doesn't allocate; the
+// callable has to outlive the call it is passed to.
+template<typename Signature> class FunctionRef;
+
+template<typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+public:
+    template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, FunctionRef>::value>>
+    FunctionRef(F&& f)
+        : object(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+          callback([](void* o, Args... args) -> R {
+              return (*static_cast<std::remove_reference_t<F>*>(o))(std::forward<Args>(args)...);
+          }) {}
+
+    R operator()(Args... args) const { return callback(object, std::forward<Args>(args)...); }
+
+private:
+    void* object;
+    R (*callback)(void*, Args...);
+};
+
+// Fork-join pool with per-worker task deques and work stealing. A batch of
+// tasks is dealt round-robin to the workers; each worker pops from the back
+// of its own deque and steals from the front of the others once it runs dry.
+// The calling thread takes part as worker 0, so a pool of N threads starts
+// N - 1 background threads.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threadCount = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Stops the workers and restarts with a new count (clamped to at least 1)
+    void resize(unsigned int threadCount);
+    unsigned int threadCount() const { return (unsigned int)queues.size(); }
+
+    // Runs task(i) for every i in [0, taskCount) and returns once all finished.
+    // Which thread runs a task is not deterministic, so tasks must only write
+    // to memory owned by their own index. Calls from inside a task run inline.
+    void run(size_t taskCount, FunctionRef<void(size_t)> task);
+
+    // Splits [begin, end) into chunks of at most `grain` items and runs
+    // body(chunkBegin, chunkEnd) for each chunk.
+    void parallelFor(size_t begin, size_t end, size_t grain, FunctionRef<void(size_t, size_t)> body);
+
+    static unsigned int hardwareThreads();
+
+private:
+    // Owner pops from the back, thieves take from head. Cleared once empty,
+    // keeping its capacity, so dealing a batch doesn't allocate.
+    struct WorkQueue {
+        std::mutex mutex;
+        std::vector<size_t> tasks;
+        size_t head = 0;
+    };
+
+    void start(unsigned int threadCount);
+    void stop();
+    void workerLoop(unsigned int workerIndex);
+    void drain(unsigned int workerIndex);
+    bool popLocal(unsigned int workerIndex, size_t& task);
+    bool steal(unsigned int workerIndex, size_t& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex runMutex;              // Serializes batches from different callers
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    const FunctionRef<void(size_t)>* currentTask = nullptr;
+    std::atomic<size_t> remaining{0};
+};
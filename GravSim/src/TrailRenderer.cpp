@@ -0,0 +1,259 @@
+#include "TrailRenderer.h"
+#include "RenderState.h"
+#include "Shader.h"
+
+#include <algorithm>
+
+namespace {
+
+const char* trailVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+uniform samplerBuffer trailColors;
+uniform int slotStride;
+
+out vec3 trailColor;
+
+void main() {
+    trailColor = texelFetch(trailColors, gl_VertexID / slotStride).rgb;
+    gl_Position = projection * view * vec4(aPos, 1.0);
+}
+)";
+
+const char* trailFragmentShaderSource = R"(
+#version 330 core
+in vec3 trailColor;
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(trailColor, 1.0);
+}
+)";
+
+const size_t MIN_SLOTS = 64;
+const float TRAIL_BRIGHTNESS = 0.7f;
+
+}
+
+TrailRenderer::TrailRenderer(size_t maxLength)
+    : maxLength(std::max<size_t>(maxLength, 2)), ringLength(this->maxLength + FENCED_COLUMNS), stride(ringLength + 1) {}
+
+void TrailRenderer::init(RenderState& renderState) {
+    state = &renderState;
+    program = createShaderProgram(trailVertexShaderSource, trailFragmentShaderSource);
+    state->attachCamera(program);
+    state->useProgram(program);
+    glUniform1i(glGetUniformLocation(program, "trailColors"), 0);
+    glUniform1i(glGetUniformLocation(program, "slotStride"), (GLint)stride);
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &colorBuffer);
+    glGenTextures(1, &colorTexture);
+    reserveSlots(MIN_SLOTS);
+}
+
+void TrailRenderer::release() {
+    deleteFences();
+    if(vbo) {
+        if(mapped) {
+            state->bindArrayBuffer(vbo);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        glDeleteBuffers(1, &vbo);
+    }
+    mapped = nullptr;
+    if(colorBuffer) glDeleteBuffers(1, &colorBuffer);
+    if(colorTexture) glDeleteTextures(1, &colorTexture);
+    if(vao) glDeleteVertexArrays(1, &vao);
+    if(program) glDeleteProgram(program);
+    vbo = colorBuffer = colorTexture = vao = program = 0;
+    capacity = 0;
+}
+
+void TrailRenderer::reserveSlots(size_t slots) {
+    if(slots <= capacity) return;
+    size_t newCapacity = std::max(std::max(slots, capacity * 2), MIN_SLOTS);
+    GLsizeiptr newSize = (GLsizeiptr)(newCapacity * stride * sizeof(glm::vec3));
+
+    GLuint newVbo;
+    glGenBuffers(1, &newVbo);
+    state->bindArrayBuffer(newVbo);
+    glm::vec3* newMapped = nullptr;
+    if(GLAD_GL_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, newSize, nullptr, flags);
+        newMapped = (glm::vec3*)glMapBufferRange(GL_ARRAY_BUFFER, 0, newSize, flags);
+    }
+    else {
+        glBufferData(GL_ARRAY_BUFFER, newSize, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    // Slots keep their index, so the old contents move over unchanged
+    if(vbo) {
+        glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0,
+                            (GLsizeiptr)(capacity * stride * sizeof(glm::vec3)));
+        if(mapped) glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glDeleteBuffers(1, &vbo);
+    }
+    vbo = newVbo;
+    mapped = newMapped;
+    if(mapped) {
+        // The copy has to land before the CPU writes through the new mapping;
+        // it follows every earlier draw, so the next append waits on it alone
+        deleteFences();
+        fences[fenceIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    state->bindVertexArray(vao);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    state->bindVertexArray(0);
+
+    for(size_t s = newCapacity; s > capacity; s--) freeSlots.push_back((unsigned int)(s - 1));
+    sampleCount.resize(newCapacity, 0);
+    slotColor.resize(newCapacity, glm::vec4(0.0f));
+    colorsDirty = true;
+    capacity = newCapacity;
+}
+
+void TrailRenderer::sync(const std::vector<unsigned int>& ids, const std::vector<glm::vec3>& colors) {
+    if(ids != syncedIds) {
+        usedSlots.assign(capacity, 0);
+        bodySlot.assign(ids.size(), ~0u);
+        size_t missing = 0;
+        for(size_t i = 0; i < ids.size(); i++) {
+            auto it = slotOfId.find(ids[i]);
+            if(it == slotOfId.end()) {
+                missing++;
+                continue;
+            }
+            bodySlot[i] = it->second;
+            usedSlots[it->second] = 1;
+        }
+        for(auto it = slotOfId.begin(); it != slotOfId.end();) {
+            if(!usedSlots[it->second]) {
+                sampleCount[it->second] = 0;
+                freeSlots.push_back(it->second);
+                it = slotOfId.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if(freeSlots.size() < missing) reserveSlots(slotOfId.size() + missing);
+        for(size_t i = 0; i < ids.size(); i++) {
+            if(bodySlot[i] != ~0u) continue;
+            unsigned int slot = freeSlots.back();
+            freeSlots.pop_back();
+            sampleCount[slot] = 0;
+            slotOfId[ids[i]] = slot;
+            bodySlot[i] = slot;
+        }
+        syncedIds = ids;
+    }
+
+    for(size_t i = 0; i < bodySlot.size() && i < colors.size(); i++) {
+        glm::vec4 color(colors[i] * TRAIL_BRIGHTNESS, 1.0f);
+        if(slotColor[bodySlot[i]] != color) {
+            slotColor[bodySlot[i]] = color;
+            colorsDirty = true;
+        }
+    }
+}
+
+void TrailRenderer::waitForGpu(GLsync& fence) {
+    if(!fence) return;
+    while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void TrailRenderer::deleteFences() {
+    for(GLsync& fence : fences) {
+        if(fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if(drawFence) glDeleteSync(drawFence);
+    drawFence = nullptr;
+}
+
+void TrailRenderer::writeVertex(size_t vertex, const glm::vec3& position) {
+    if(mapped) mapped[vertex] = position;
+    else glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(vertex * sizeof(glm::vec3)), sizeof(glm::vec3), &position);
+}
+
+void TrailRenderer::append(const float* x, const float* y, const float* z, size_t n) {
+    if(!vbo) return;
+    n = std::min(n, bodySlot.size());
+    // Draws since this fence was placed skip the column written here
+    waitForGpu(fences[fenceIndex]);
+    fences[fenceIndex] = drawFence;
+    drawFence = nullptr;
+    fenceIndex = (fenceIndex + 1) % FENCED_COLUMNS;
+    state->bindArrayBuffer(vbo);
+    for(size_t i = 0; i < n; i++) {
+        unsigned int slot = bodySlot[i];
+        glm::vec3 position(x[i], y[i], z[i]);
+        size_t base = slot * stride;
+        writeVertex(base + column, position);
+        if(column == 0) writeVertex(base + ringLength, position);
+        if(sampleCount[slot] < maxLength) sampleCount[slot]++;
+    }
+    column = (column + 1) % ringLength;
+}
+
+void TrailRenderer::clear() {
+    std::fill(sampleCount.begin(), sampleCount.end(), 0);
+}
+
+void TrailRenderer::draw() {
+    if(!vbo) return;
+
+    // Oldest to newest; a wrapped ring is two strips joined by the mirrored column 0
+    drawFirst.clear();
+    drawCount.clear();
+    for(unsigned int slot : bodySlot) {
+        size_t count = sampleCount[slot];
+        if(count < 2) continue;
+        size_t oldest = (column + ringLength - count) % ringLength;
+        GLint base = (GLint)(slot * stride);
+        if(oldest + count <= ringLength) {
+            drawFirst.push_back(base + (GLint)oldest);
+            drawCount.push_back((GLsizei)count);
+        }
+        else {
+            drawFirst.push_back(base + (GLint)oldest);
+            drawCount.push_back((GLsizei)(ringLength - oldest + 1));
+            drawFirst.push_back(base);
+            drawCount.push_back((GLsizei)column);
+        }
+    }
+    if(drawFirst.empty()) return;
+
+    if(colorsDirty) {
+        glBindBuffer(GL_TEXTURE_BUFFER, colorBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, slotColor.size() * sizeof(glm::vec4), slotColor.data(), GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, colorTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, colorBuffer);
+        colorsDirty = false;
+    }
+
+    state->useProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, colorTexture);
+    state->bindVertexArray(vao);
+    glMultiDrawArrays(GL_LINE_STRIP, drawFirst.data(), drawCount.data(), (GLsizei)drawFirst.size());
+    state->countDraw();
+
+    if(mapped) {
+        if(drawFence) glDeleteSync(drawFence);
+        drawFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
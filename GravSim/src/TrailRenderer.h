@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+class RenderState;
+
+// Orbit trails for every body, kept in one GPU vertex buffer.
+//
+// Each body owns a slot of ringLength + 1 vertices used as a ring buffer. All
+// trails append at the same ring column, so a new sample costs one vertex
+// write per body and nothing is ever shifted. Column 0 is mirrored into the
+// extra vertex at the end of the slot, which lets a wrapped ring be drawn as
+// two line strips that meet without a gap. All strips go out in one
+// glMultiDrawArrays call; the vertex shader finds each vertex's slot from
+// gl_VertexID and looks up the trail color in a buffer texture.
+//
+// With GL 4.4 the buffer is persistently mapped and samples are written in
+// place. The ring holds FENCED_COLUMNS more columns than are drawn, so a
+// draw never reads the next few columns to be written; each of those has its
+// own fence, and an append waits only for the draws that last read the
+// column it overwrites, FENCED_COLUMNS appends back, instead of the last
+// frame. Older contexts fall back to one glBufferSubData per sample.
+class TrailRenderer {
+public:
+    explicit TrailRenderer(size_t maxLength = 500);
+
+    TrailRenderer(const TrailRenderer&) = delete;
+    TrailRenderer& operator=(const TrailRenderer&) = delete;
+
+    // Both need a current GL context; GL objects are not freed by the destructor
+    void init(RenderState& renderState);
+    void release();
+
+    // Matches slots to the bodies in `ids` order: new ids get an empty
+    // trail, ids no longer present give their slot back
+    void sync(const std::vector<unsigned int>& ids, const std::vector<glm::vec3>& colors);
+
+    // Appends one sample per body, in the order of the last sync()
+    void append(const float* x, const float* y, const float* z, size_t n);
+
+    void clear();
+    // The view comes from the camera block
+    void draw();
+
+    bool persistentlyMapped() const { return mapped != nullptr; }
+    size_t slotCapacity() const { return capacity; }
+
+private:
+    void reserveSlots(size_t slots);
+    void waitForGpu(GLsync& fence);
+    void deleteFences();
+    void writeVertex(size_t vertex, const glm::vec3& position);
+
+    static const size_t FENCED_COLUMNS = 3;
+
+    size_t maxLength;                      // Samples drawn per trail
+    size_t ringLength;                     // Columns per slot, maxLength + FENCED_COLUMNS
+    size_t stride;                         // Vertices per slot, ringLength + 1
+    size_t capacity = 0;                   // Slots allocated on the GPU
+    size_t column = 0;                     // Next ring column written
+    std::vector<unsigned int> sampleCount; // Valid samples per slot
+    std::vector<unsigned int> freeSlots;
+    std::unordered_map<unsigned int, unsigned int> slotOfId;
+    std::vector<unsigned int> bodySlot;    // Body index (last sync order) -> slot
+    std::vector<unsigned int> syncedIds;
+    std::vector<char> usedSlots;           // Scratch for sync
+    std::vector<glm::vec4> slotColor;     // RGBA for the buffer texture
+    bool colorsDirty = false;
+
+    std::vector<GLint> drawFirst;
+    std::vector<GLsizei> drawCount;
+
+    RenderState* state = nullptr;
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint colorBuffer = 0;
+    GLuint colorTexture = 0;
+    glm::vec3* mapped = nullptr;
+    // fences[i] covers every draw before the append that placed it; the
+    // append FENCED_COLUMNS later waits on it
+    GLsync fences[FENCED_COLUMNS] = {};
+    size_t fenceIndex = 0;
+    GLsync drawFence = nullptr;            // After the last draw since the previous append
+};
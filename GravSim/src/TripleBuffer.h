@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+
+// Single-producer / single-consumer triple buffer. The writer fills
+// writeBuffer() and publishes it; the reader picks up the newest published
+// buffer with update(). Neither side ever waits on the other: each owns one
+// buffer and the third is swapped through an atomic index.
+template<typename T>
+class TripleBuffer {
+public:
+    // Writer side
+    T& writeBuffer() { return buffers[backIndex]; }
+
+    void publish() {
+        unsigned int previous = middle.exchange(backIndex | FRESH_BIT, std::memory_order_acq_rel);
+        backIndex = previous & INDEX_MASK;
+    }
+
+    // Reader side
+    bool hasUpdate() const {
+        return (middle.load(std::memory_order_acquire) & FRESH_BIT) != 0;
+    }
+
+    // Swaps in the newest published buffer; returns false if nothing new was published
+    bool update() {
+        if(!hasUpdate()) return false;
+        unsigned int previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX_MASK;
+        return true;
+    }
+
+    const T& readBuffer() const { return buffers[frontIndex]; }
+
+private:
+    static const unsigned int FRESH_BIT = 4;
+    static const unsigned int INDEX_MASK = 3;
+
+    T buffers[3];
+    std::atomic<unsigned int> middle{1};
+    unsigned int backIndex = 0;
+    unsigned int frontIndex = 2;
+};
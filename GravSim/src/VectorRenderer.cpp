@@ -0,0 +1,177 @@
+#include "VectorRenderer.h"
+#include "RenderState.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const char* vectorVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aColor;
+
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+out vec3 arrowColor;
+
+void main() {
+    arrowColor = aColor.rgb;
+    gl_Position = projection * view * vec4(aPos, 1.0);
+}
+)";
+
+const char* vectorFragmentShaderSource = R"(
+#version 330 core
+in vec3 arrowColor;
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(arrowColor, 1.0);
+}
+)";
+
+const size_t MIN_VERTICES = 1024;
+const int MAX_FIELD_SIDE = 64; // Cells per side for VECTORS_FIELD
+
+uint32_t packChannel(float value) {
+    return (uint32_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+uint32_t packColor(const glm::vec3& color) {
+    return packChannel(color.x) | packChannel(color.y) << 8 | packChannel(color.z) << 16 | 0xFF000000u;
+}
+
+}
+
+const char* vectorDecimationName(int decimation) {
+    switch(decimation) {
+        case VECTORS_ALL: return "All Bodies";
+        case VECTORS_SAMPLED: return "Sampled";
+        case VECTORS_FIELD: return "Averaged Field";
+        default: return "Unknown";
+    }
+}
+
+void VectorRenderer::init(RenderState& renderState) {
+    static_assert(sizeof(Vertex) == 16, "vertices are tightly packed");
+    state = &renderState;
+    program = createShaderProgram(vectorVertexShaderSource, vectorFragmentShaderSource);
+    state->attachCamera(program);
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    capacity = MIN_VERTICES;
+    state->bindVertexArray(vao);
+    state->bindArrayBuffer(vbo);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    state->bindVertexArray(0);
+}
+
+void VectorRenderer::release() {
+    if(vbo) glDeleteBuffers(1, &vbo);
+    if(vao) glDeleteVertexArrays(1, &vao);
+    if(program) glDeleteProgram(program);
+    vbo = vao = program = 0;
+    capacity = 0;
+}
+
+// Bins the bodies into a grid of at most maxArrows cells over their bounding
+// box and keeps the occupied cells, in order of first appearance
+void VectorRenderer::buildCells(const float* x, const float* y, const float* z, size_t n, size_t maxArrows) {
+    glm::vec3 lo(x[0], y[0], z[0]), hi = lo;
+    for(size_t i = 1; i < n; i++) {
+        glm::vec3 p(x[i], y[i], z[i]);
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    int side = std::max(1, std::min(MAX_FIELD_SIDE, (int)std::cbrt((double)maxArrows)));
+    glm::vec3 extent = glm::max(hi - lo, glm::vec3(1e-6f));
+    glm::vec3 toCell = glm::vec3((float)side) / extent;
+
+    cellIndex.assign((size_t)side * side * side, ~0u);
+    cellOfBody.resize(n);
+    cellPosition.clear();
+    cellCount.clear();
+    for(size_t i = 0; i < n; i++) {
+        glm::vec3 p(x[i], y[i], z[i]);
+        glm::ivec3 c = glm::min(glm::ivec3((p - lo) * toCell), glm::ivec3(side - 1));
+        uint32_t& slot = cellIndex[((size_t)c.x * side + c.y) * side + c.z];
+        if(slot == ~0u) {
+            slot = (uint32_t)cellPosition.size();
+            cellPosition.push_back(glm::vec3(0.0f));
+            cellCount.push_back(0);
+        }
+        cellOfBody[i] = slot;
+        cellPosition[slot] += p;
+        cellCount[slot]++;
+    }
+    for(size_t c = 0; c < cellPosition.size(); c++) cellPosition[c] /= (float)cellCount[c];
+}
+
+void VectorRenderer::draw(const float* x, const float* y, const float* z, size_t n,
+                          const VectorField* fields, size_t fieldCount, int decimation, size_t maxArrows) {
+    arrows = 0;
+    if(n == 0 || fieldCount == 0) return;
+    maxArrows = std::max<size_t>(maxArrows, 1);
+    if(n <= maxArrows) decimation = VECTORS_ALL;
+
+    size_t stride = decimation == VECTORS_SAMPLED ? (n + maxArrows - 1) / maxArrows : 1;
+    size_t perField;
+    if(decimation == VECTORS_FIELD) {
+        buildCells(x, y, z, n, maxArrows);
+        perField = cellPosition.size();
+    }
+    else {
+        perField = (n + stride - 1) / stride;
+    }
+    size_t vertexCount = 2 * perField * fieldCount;
+
+    // Invalidating on map orphans last frame's arrows, so it never waits on the GPU
+    state->bindArrayBuffer(vbo);
+    if(vertexCount > capacity) {
+        capacity = std::max(vertexCount, capacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    }
+    Vertex* out = (Vertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexCount * sizeof(Vertex),
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(!out) return;
+
+    for(size_t f = 0; f < fieldCount; f++) {
+        const VectorField& field = fields[f];
+        uint32_t color = packColor(field.color);
+        if(decimation == VECTORS_FIELD) {
+            cellSum.assign(cellPosition.size(), glm::vec3(0.0f));
+            for(size_t i = 0; i < n; i++) cellSum[cellOfBody[i]] += glm::vec3(field.dx[i], field.dy[i], field.dz[i]);
+            for(size_t c = 0; c < cellPosition.size(); c++) {
+                glm::vec3 from = cellPosition[c];
+                glm::vec3 to = from + cellSum[c] * (field.scale / (float)cellCount[c]);
+                *out++ = { from.x, from.y, from.z, color };
+                *out++ = { to.x, to.y, to.z, color };
+            }
+        }
+        else {
+            for(size_t i = 0; i < n; i += stride) {
+                *out++ = { x[i], y[i], z[i], color };
+                *out++ = { x[i] + field.dx[i] * field.scale, y[i] + field.dy[i] * field.scale,
+                           z[i] + field.dz[i] * field.scale, color };
+            }
+        }
+    }
+    if(!glUnmapBuffer(GL_ARRAY_BUFFER)) return; // Contents lost; try again next frame
+
+    state->useProgram(program);
+    state->bindVertexArray(vao);
+    glDrawArrays(GL_LINES, 0, (GLsizei)vertexCount);
+    state->countDraw();
+    arrows = vertexCount / 2;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class RenderState;
+
+enum VectorDecimation { VECTORS_ALL = 0, VECTORS_SAMPLED, VECTORS_FIELD, VECTORS_DECIMATION_COUNT };
+
+const char* vectorDecimationName(int decimation);
+
+// One per-body vector drawn as arrows: body position to position + scale * vector
+struct VectorField {
+    const float* dx;
+    const float* dy;
+    const float* dz;
+    float scale;
+    glm::vec3 color;
+};
+
+// Velocity and force overlays. Every arrow of every field is written
+// straight from the body arrays into one mapped, orphaned vertex buffer and
+// drawn with a single GL_LINES call. For large systems the arrows can be
+// decimated to at most maxArrows per field:
+//   VECTORS_SAMPLED  every k-th body, the same bodies from frame to frame
+//   VECTORS_FIELD    one arrow per occupied cell of a coarse grid over the
+//                    bodies, from their mean position along their mean vector
+class VectorRenderer {
+public:
+    // Both need a current GL context
+    void init(RenderState& renderState);
+    void release();
+
+    // The view comes from the camera block
+    void draw(const float* x, const float* y, const float* z, size_t n,
+              const VectorField* fields, size_t fieldCount, int decimation, size_t maxArrows);
+
+    // Arrows drawn by the last draw(), all fields together
+    size_t arrowCount() const { return arrows; }
+
+private:
+    struct Vertex {
+        float x, y, z;
+        uint32_t color; // RGBA8
+    };
+
+    void buildCells(const float* x, const float* y, const float* z, size_t n, size_t maxArrows);
+
+    RenderState* state = nullptr;
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    size_t capacity = 0; // Vertices
+    size_t arrows = 0;
+
+    // VECTORS_FIELD: body -> occupied cell, and each cell's mean position
+    std::vector<uint32_t> cellOfBody;
+    std::vector<uint32_t> cellIndex;
+    std::vector<glm::vec3> cellPosition;
+    std::vector<uint32_t> cellCount;
+    std::vector<glm::vec3> cellSum;
+};
@@ -0,0 +1,133 @@
+#include "CsvIO.h"
+#include "Simulation.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// loadBodiesCsv must read every number to the same float as strtof, including
+// decimals next to a point halfway between two floats, where rounding first
+// to double and then to float can land on the wrong side. Lines with a mass
+// that isn't positive or with any number that isn't finite are rejected.
+
+namespace {
+
+const char* CSV_PATH = "csvio_test.csv";
+
+bool sameFloat(float a, float b) {
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Decimals at, just below and just above the halfway point above f
+void addHalfwayCases(float f, std::vector<std::string>& cases) {
+    double half = 0.5 * ((double)f + (double)std::nextafter(f, INFINITY));
+    char text[64];
+    // 17 to 19 significant digits
+    std::snprintf(text, sizeof(text), "%.16e", half);
+    cases.push_back(text);
+    std::snprintf(text, sizeof(text), "%.17e", half);
+    cases.push_back(text);
+    std::snprintf(text, sizeof(text), "%.18e", half);
+    cases.push_back(text);
+    std::snprintf(text, sizeof(text), "%.18e", std::nextafter(half, 0.0));
+    cases.push_back(text);
+    std::snprintf(text, sizeof(text), "%.18e", std::nextafter(half, INFINITY));
+    cases.push_back(text);
+}
+
+// Loads a file whose second body is `line`; true if the loader rejected it
+bool rejects(const char* line) {
+    {
+        std::ofstream out(CSV_PATH);
+        out << "0,0,0,0,0,0,1\n" << line << "\n";
+    }
+    Simulation sim(1);
+    std::string error;
+    bool loaded = loadBodiesCsv(CSV_PATH, sim, error);
+    std::remove(CSV_PATH);
+    if(loaded) std::cerr << "Failed: loaded " << line << std::endl;
+    return !loaded;
+}
+
+}
+
+int main() {
+    bool rejected = true;
+    for(const char* line : { "0,0,0,0,0,0,0", "0,0,0,0,0,0,-1", "0,0,0,0,0,0,nan", "0,0,0,0,0,0,inf",
+                             "nan,0,0,0,0,0,1", "0,0,0,0,-inf,0,1", "0,0,0,0,0,0,1,1e39" }) {
+        rejected &= rejects(line);
+    }
+    if(!rejected) return -1;
+
+    std::vector<std::string> cases = {
+        "1.000000059604644776",  // Halfway above 1: strtof gives 1.00000012
+        "1.0000000596046447",
+        "0.5000000298023223877",
+        "-1.000000059604644776",
+        "16777217",
+        "3.4028235e38",
+        "1e-38",
+        "0",
+        "-0.0",
+        "12.345678",
+        "6.674e-11",
+        "1E10",
+    };
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> mantissaDist(1.0f, 2.0f);
+    std::uniform_int_distribution<int> exponentDist(-60, 60);
+    for(int i = 0; i < 2000; i++) {
+        float f = std::ldexp(mantissaDist(gen), exponentDist(gen));
+        addHalfwayCases(f, cases);
+        char text[64];
+        std::snprintf(text, sizeof(text), "%.9g", f);
+        cases.push_back(text);
+    }
+
+    // Six values per line in the position and velocity columns, mass 1
+    while(cases.size() % 6 != 0) cases.push_back("1");
+    {
+        std::ofstream out(CSV_PATH);
+        for(size_t i = 0; i < cases.size(); i += 6) {
+            for(size_t k = 0; k < 6; k++) out << cases[i + k] << ",";
+            out << "1\n";
+        }
+    }
+
+    Simulation sim(1);
+    std::string error;
+    bool loaded = loadBodiesCsv(CSV_PATH, sim, error);
+    std::remove(CSV_PATH);
+    if(!loaded) {
+        std::cerr << "Failed to load test CSV: " << error << std::endl;
+        return -1;
+    }
+    if(sim.state.size() * 6 != cases.size()) {
+        std::cerr << "Loaded " << sim.state.size() << " bodies, expected " << cases.size() / 6 << std::endl;
+        return -1;
+    }
+
+    const FloatArray* columns[6] = { &sim.state.x, &sim.state.y, &sim.state.z,
+                                     &sim.state.vx, &sim.state.vy, &sim.state.vz };
+    int failures = 0;
+    for(size_t i = 0; i < cases.size(); i++) {
+        float parsed = (*columns[i % 6])[i / 6];
+        float expected = std::strtof(cases[i].c_str(), nullptr);
+        if(!sameFloat(parsed, expected)) {
+            std::printf("%s: parsed %.9g, strtof gives %.9g\n", cases[i].c_str(), parsed, expected);
+            failures++;
+        }
+    }
+    if(failures > 0) {
+        std::cerr << failures << " of " << cases.size() << " numbers parsed differently from strtof" << std::endl;
+        return -1;
+    }
+    std::printf("%zu numbers parsed as strtof does\n", cases.size());
+    return 0;
+}
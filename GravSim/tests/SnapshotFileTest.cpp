@@ -0,0 +1,156 @@
+#include "SnapshotFile.h"
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// A .gsnap recording must read back what was written: raw frames exactly,
+// quantized frames to within one 16-bit step. A recording cut off in the
+// middle of a frame must open without its index and give back the frames
+// before the cut. Restored bodies must get usable ids even when the file's
+// are duplicate or out of range.
+
+namespace {
+
+const char* SNAPSHOT_PATH = "snapshot_test.gsnap";
+const char* TRUNCATED_PATH = "snapshot_test_truncated.gsnap";
+const int FRAMES = 5;
+
+bool check(bool ok, const char* what) {
+    if(!ok) std::cerr << "Failed: " << what << std::endl;
+    return ok;
+}
+
+struct RecordedFrame {
+    unsigned long long step;
+    BodyState state;
+    std::vector<unsigned int> ids;
+};
+
+// Largest extent of the positions or velocities over 65535, one 16-bit step
+float quantizationStep(const BodyState& state, bool velocities) {
+    const FloatArray* arrays[3] = { &state.x, &state.y, &state.z };
+    const FloatArray* velocityArrays[3] = { &state.vx, &state.vy, &state.vz };
+    float step = 0.0f;
+    for(int axis = 0; axis < 3; axis++) {
+        const FloatArray& values = velocities ? *velocityArrays[axis] : *arrays[axis];
+        auto range = std::minmax_element(values.begin(), values.end());
+        float extent = velocities ? 2.0f * std::max(std::fabs(*range.first), std::fabs(*range.second))
+                                  : *range.second - *range.first;
+        step = std::max(step, extent / 65535.0f);
+    }
+    return step;
+}
+
+bool matches(const SnapshotFrame& frame, const RecordedFrame& recorded, int encoding) {
+    const BodyState& state = recorded.state;
+    if(frame.count != state.size() || frame.step != recorded.step) return false;
+    float positionTolerance = encoding == SNAPSHOT_QUANTIZED ? quantizationStep(state, false) : 0.0f;
+    float velocityTolerance = encoding == SNAPSHOT_QUANTIZED ? quantizationStep(state, true) : 0.0f;
+    for(size_t i = 0; i < frame.count; i++) {
+        if(frame.ids[i] != recorded.ids[i] || frame.mass[i] != state.mass[i]) return false;
+        if(std::fabs(frame.x[i] - state.x[i]) > positionTolerance ||
+           std::fabs(frame.y[i] - state.y[i]) > positionTolerance ||
+           std::fabs(frame.z[i] - state.z[i]) > positionTolerance) return false;
+        if(std::fabs(frame.vx[i] - state.vx[i]) > velocityTolerance ||
+           std::fabs(frame.vy[i] - state.vy[i]) > velocityTolerance ||
+           std::fabs(frame.vz[i] - state.vz[i]) > velocityTolerance) return false;
+    }
+    return true;
+}
+
+bool roundTrip(int encoding) {
+    Simulation sim(1);
+    sim.initializePreset(3, 500, 7);
+    SnapshotWriter writer;
+    std::string error;
+    if(!writer.open(SNAPSHOT_PATH, sim, encoding, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    std::vector<RecordedFrame> recorded;
+    for(int f = 0; f < FRAMES; f++) {
+        sim.step(0.016);
+        if(!writer.writeFrame(sim, error)) {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        RecordedFrame frame = { sim.stepCount, sim.state, {} };
+        for(const GravityBody& body : sim.bodies) frame.ids.push_back(body.id);
+        recorded.push_back(frame);
+    }
+    writer.close();
+
+    bool ok = true;
+    SnapshotReader reader;
+    SnapshotFrame frame;
+    ok &= check(reader.open(SNAPSHOT_PATH, error), "could not open the recording");
+    ok &= check(reader.frameCount() == FRAMES, "wrong frame count");
+    for(size_t f = 0; ok && f < reader.frameCount(); f++) {
+        ok &= check(reader.frame(f, frame) && matches(frame, recorded[f], encoding), "frame read back differently");
+    }
+    if(!ok) return false;
+
+    // Cut the file in the middle of the last frame
+    uint64_t cut = reader.frameEntry(FRAMES - 1).offset + 100;
+    reader.close();
+    {
+        std::ifstream in(SNAPSHOT_PATH, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(TRUNCATED_PATH, std::ios::binary);
+        out.write(bytes.data(), (std::streamsize)std::min<uint64_t>(cut, bytes.size()));
+    }
+    ok &= check(reader.open(TRUNCATED_PATH, error), "could not open the truncated recording");
+    ok &= check(reader.frameCount() == FRAMES - 1, "truncated recording has the wrong frame count");
+    for(size_t f = 0; ok && f < reader.frameCount(); f++) {
+        ok &= check(reader.frame(f, frame) && matches(frame, recorded[f], encoding),
+                    "frame read back differently from the truncated recording");
+    }
+    reader.close();
+    std::remove(SNAPSHOT_PATH);
+    std::remove(TRUNCATED_PATH);
+    return ok;
+}
+
+// A frame whose ids a damaged file could hold
+bool restoreBadIds() {
+    const size_t n = 4;
+    float zero[n] = {}, position[n] = { 0.0f, 1.0f, 2.0f, 3.0f }, mass[n] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glm::vec3 color[n] = {};
+    unsigned int ids[n] = { 5, 5, 0xFFFFFFFFu, 7 };
+    SnapshotFrame frame;
+    frame.count = n;
+    frame.x = position;
+    frame.y = frame.z = frame.vx = frame.vy = frame.vz = zero;
+    frame.mass = mass;
+    frame.radius = mass;
+    frame.color = color;
+    frame.ids = ids;
+
+    Simulation sim(1);
+    restoreSnapshotFrame(frame, sim);
+    bool ok = true;
+    for(size_t i = 0; i < n; i++) {
+        ok &= check(sim.findBody(sim.bodies[i].id) == (int)i, "restored ids do not find their bodies");
+    }
+    ok &= check(sim.nextBodyId > 0 && sim.nextBodyId < 0xFFFFFFFFu, "restored ids wrapped the next id");
+    return ok;
+}
+
+}
+
+int main() {
+    bool ok = true;
+    ok &= check(roundTrip(SNAPSHOT_RAW), "raw round trip");
+    ok &= check(roundTrip(SNAPSHOT_QUANTIZED), "quantized round trip");
+    ok &= restoreBadIds();
+    if(!ok) return -1;
+    std::printf("Snapshot file checks passed\n");
+    return 0;
+}